@@ -0,0 +1,108 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#include "adc-filter.h"
+#include <string.h>
+
+enum {
+    ONE      = 1 << ADCFILTER_FRAC,
+    VAR_FRAC = 12   /*Fraction bits of the Kalman variances, the largest is (q + r) << 12*/
+};
+
+static int clamp( int val, int min, int max ) {
+    return val < min ? min : val > max ? max : val;
+}
+
+void adcfilter_init( struct adcfilter* self, struct adcfilter_params const* params ) {
+    memset( self, 0, sizeof(*self) );
+    self->params = *params;
+    /*An even window has no middle sample*/
+    self->params.median = clamp( params->median, 1, ADCFILTER_MAX_MEDIAN ) | 1;
+    self->params.mean = clamp( params->mean, 1, ADCFILTER_MAX_MEAN );
+}
+
+/*Keep the window sorted: take out the oldest sample and insert the new one*/
+static int16_t median( struct adcfilter* self, int16_t sample ) {
+    int const n = self->params.median;
+    int count = self->medCount;
+    if( count == n ) {
+        int16_t const oldest = self->medHist[self->medPos];
+        int i = 0;
+        while( self->medSorted[i] != oldest ) {
+            ++i;
+        }
+        for( ; i < count - 1; ++i ) {
+            self->medSorted[i] = self->medSorted[i + 1];
+        }
+        --count;
+    }
+    int i = count;
+    for( ; 0 < i && sample < self->medSorted[i - 1]; --i ) {
+        self->medSorted[i] = self->medSorted[i - 1];
+    }
+    self->medSorted[i] = sample;
+    self->medCount = count + 1;
+    self->medHist[self->medPos] = sample;
+    self->medPos = self->medPos + 1 < n ? self->medPos + 1 : 0;
+    return self->medSorted[self->medCount / 2];
+}
+
+static int32_t mean( struct adcfilter* self, int16_t sample ) {
+    int const n = self->params.mean;
+    if( self->meanCount < n ) {
+        ++self->meanCount;
+    }
+    else {
+        self->meanSum -= self->meanHist[self->meanPos];
+    }
+    self->meanHist[self->meanPos] = sample;
+    self->meanSum += sample;
+    self->meanPos = self->meanPos + 1 < n ? self->meanPos + 1 : 0;
+    return (int32_t)( ( (int64_t)self->meanSum << ADCFILTER_FRAC ) / self->meanCount );
+}
+
+/*y += alpha * ( x - y ), the difference is rounded down to 8 fraction bits first to
+stay in 32 bits*/
+static int32_t lowpass( struct adcfilter* self, int32_t value ) {
+    self->iirOut += ( ( value - self->iirOut + 128 ) >> 8 ) * self->params.iir;
+    return self->iirOut;
+}
+
+static int32_t kalman( struct adcfilter* self, int32_t value ) {
+    int32_t const r = (int32_t)self->params.r << VAR_FRAC;
+    int32_t const p = self->kp + ( (int32_t)self->params.q << VAR_FRAC );
+    int32_t const gain = (int32_t)( ( (int64_t)p << ADCFILTER_FRAC ) / ( p + r ) );
+    self->kx += (int32_t)( ( (int64_t)( value - self->kx ) * gain ) >> ADCFILTER_FRAC );
+    self->kp = (int32_t)( ( (int64_t)p * ( ONE - gain ) + ONE / 2 ) >> ADCFILTER_FRAC );
+    return self->kx;
+}
+
+int32_t adcfilter_put( struct adcfilter* self, int16_t sample ) {
+    if( 1 < self->params.median ) {
+        sample = median( self, sample );
+    }
+    int32_t value = 1 < self->params.mean ? mean( self, sample ) : (int32_t)sample << ADCFILTER_FRAC;
+    /*The first value starts the state of the low pass and the Kalman filter*/
+    if( !self->started ) {
+        self->started = true;
+        self->iirOut = value;
+        self->kx = value;
+        self->kp = (int32_t)self->params.r << VAR_FRAC;
+        return value;
+    }
+    if( self->params.iir ) {
+        value = lowpass( self, value );
+    }
+    if( self->params.r ) {
+        value = kalman( self, value );
+    }
+    return value;
+}
+
+int adcfilter_toCode( int32_t value ) {
+    return ( value + ONE / 2 ) >> ADCFILTER_FRAC;
+}
@@ -0,0 +1,68 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#ifndef __ADC_FILTER__
+#define __ADC_FILTER__
+
+#include <stdint.h>
+
+enum {
+    ADCFILTER_MAX_MEDIAN = 9,    /*Samples of the median*/
+    ADCFILTER_MAX_MEAN   = 64,   /*Samples of the running mean*/
+    ADCFILTER_FRAC       = 16    /*Fraction bits of the filtered values*/
+};
+
+/*Stages of the chain, in the order they run. Each one is skipped with the value
+given for "off".*/
+struct adcfilter_params {
+    uint8_t  median;  /*Samples of the median, odd, 1 is off*/
+    uint8_t  mean;    /*Samples of the running mean, 1 is off*/
+    uint8_t  iir;     /*Weight of a new sample in the first order low pass, in 1/256, 0 is off*/
+    uint16_t q;       /*Process noise of the Kalman filter, ADC codes squared*/
+    uint16_t r;       /*Measurement noise of the Kalman filter, ADC codes squared, 0 is off*/
+};
+
+/* Filter chain of the 4-20 mA channel: median against the spikes, then running mean,
+   first order low pass and a one dimension Kalman filter of a random walk. The values
+   after the median are fixed point with ADCFILTER_FRAC fraction bits. A sample costs
+   at most a sorted insert into the median window, one 64 bits division and a few
+   multiplications, there is no allocation.*/
+struct adcfilter {
+    struct adcfilter_params params;
+    int16_t  medHist[ADCFILTER_MAX_MEDIAN];   /*Window in arrival order*/
+    int16_t  medSorted[ADCFILTER_MAX_MEDIAN];
+    uint8_t  medCount;
+    uint8_t  medPos;
+    int16_t  meanHist[ADCFILTER_MAX_MEAN];
+    int32_t  meanSum;
+    uint8_t  meanCount;
+    uint8_t  meanPos;
+    bool     started;    /*The low pass and the Kalman state hold a value*/
+    int32_t  iirOut;
+    int32_t  kx;         /*Kalman estimate*/
+    int32_t  kp;         /*Kalman error variance, ADC codes squared with 12 fraction bits*/
+};
+
+/**
+ * @brief Initialize an empty filter chain.
+ * @param self, the filter
+ * @param params, the stages, out of range values are clamped */
+void adcfilter_init( struct adcfilter* self, struct adcfilter_params const* params );
+
+/**
+ * @brief Run a sample through the chain.
+ * @param self, the filter
+ * @param sample, ADC code
+ * @return filtered value, ADC code with ADCFILTER_FRAC fraction bits */
+int32_t adcfilter_put( struct adcfilter* self, int16_t sample );
+
+/**
+ * @brief Round a filtered value to an ADC code.
+ * @param value, filtered value */
+int adcfilter_toCode( int32_t value );
+
+#endif //__ADC_FILTER__
@@ -0,0 +1,203 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#include "adc-task.h"
+#include <Arduino.h>
+#include "esp_timer.h"
+#include "adc121.h"
+#include "adc-filter.h"
+#include "config-mng.h"
+
+enum {
+    ADC_TIMER         = 1,     /*Hardware timer, group 0 timer 1*/
+    ADC_TIMER_DIVIDER = 80,    /*1 MHz from the 80 MHz APB clock*/
+    ADC_WAIT          = 1000,  /*Longest wait for a tick before checking the configuration, ms*/
+    ADC_PEAK_PERIOD   = 1000000, /*Time between reads of the ADC121 lowest and highest conversions, us*/
+    ADC_CYCLE_RETRY   = 1000000, /*Time between attempts to set the conversion cycle, us*/
+    ADC_NO_LOW        = 0x0fff + 1,
+    ADC_NO_HIGH       = -1,
+    ADC_MAX_FAILS     = 16     /*Failed reads in a row to drop the value*/
+};
+
+static struct adcfilter filter;
+static hw_timer_t* timer = NULL;
+static TaskHandle_t task = NULL;
+static struct adc_stats stats;
+/*Last filtered value with ADCFILTER_FRAC fraction bits, -1 while there is none.
+A 32 bits word is read and written at once.*/
+static volatile int32_t latest = -1;
+/*Lowest and highest conversions since the last adc_takePeaks() of each reader*/
+static struct peaks {
+    int low;
+    int high;
+} peaks[ADC_PEAKS_READERS] = { { ADC_NO_LOW, ADC_NO_HIGH }, { ADC_NO_LOW, ADC_NO_HIGH } };
+static portMUX_TYPE peaksLock = portMUX_INITIALIZER_UNLOCKED;
+
+
+static void IRAM_ATTR onTick( void ) {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR( task, &woken );
+    if( woken ) {
+        portYIELD_FROM_ISR( );
+    }
+}
+
+static void filterStart( struct adc_config const* ac ) {
+    struct adcfilter_params const params = {
+        .median = ac->median,
+        .mean   = ac->window,
+        .iir    = ac->iir,
+        .q      = ac->kalmanq,
+        .r      = ac->kalmanr
+    };
+    adcfilter_init( &filter, &params );
+}
+
+/*Period of the configured rate in us*/
+static uint32_t getPeriod( uint16_t rate ) {
+    rate = rate < ADC_MIN_RATE ? ADC_MIN_RATE : rate > ADC_MAX_RATE ? ADC_MAX_RATE : rate;
+    return 1000000 / rate;
+}
+
+bool adc_getValue( int* value ) {
+    int32_t const val = latest;
+    if( val < 0 ) {
+        return false;
+    }
+    *value = adcfilter_toCode( val );
+    return true;
+}
+
+bool adc_getFiltered( int32_t* value ) {
+    int32_t const val = latest;
+    if( val < 0 ) {
+        return false;
+    }
+    *value = val;
+    return true;
+}
+
+bool adc_takePeaks( int reader, int* low, int* high ) {
+    if( reader < 0 || ADC_PEAKS_READERS <= reader ) {
+        return false;
+    }
+    portENTER_CRITICAL( &peaksLock );
+    struct peaks const taken = peaks[reader];
+    peaks[reader].low = ADC_NO_LOW;
+    peaks[reader].high = ADC_NO_HIGH;
+    portEXIT_CRITICAL( &peaksLock );
+    if( taken.high < taken.low ) {
+        return false;
+    }
+    *low = taken.low;
+    *high = taken.high;
+    return true;
+}
+
+void adc_getStats( struct adc_stats* dest ) {
+    *dest = stats;
+    dest->transactions = adc121_getTransactions( );
+}
+
+static void putPeaks( int low, int high ) {
+    portENTER_CRITICAL( &peaksLock );
+    for( int i = 0; i < ADC_PEAKS_READERS; ++i ) {
+        peaks[i].low = low < peaks[i].low ? low : peaks[i].low;
+        peaks[i].high = high > peaks[i].high ? high : peaks[i].high;
+    }
+    portEXIT_CRITICAL( &peaksLock );
+}
+
+void adc_task( void * parameter ) {
+
+    task = xTaskGetCurrentTaskHandle( );
+    adc121_init( );
+
+    struct adc_config applied;
+    memset( &applied, 0, sizeof(applied) );
+    uint32_t period = 0;
+    int64_t last = 0;
+    int64_t peaksAt = 0;
+    int64_t cycleAt = 0;
+    int fails = 0;
+
+    timer = timerBegin( ADC_TIMER, ADC_TIMER_DIVIDER, true );
+    timerAttachInterrupt( timer, onTick, true );
+
+    for(;;) {
+
+        /*The conversion cycle stays as it was until the ADC121 takes the new one*/
+        if( applied.cycle != cfg.adc.cycle && ADC_CYCLE_RETRY <= esp_timer_get_time( ) - cycleAt ) {
+            cycleAt = esp_timer_get_time( );
+            if( adc121_setCycle( cfg.adc.cycle ) ) {
+                ++stats.errors;
+            }
+            else {
+                applied.cycle = cfg.adc.cycle;
+            }
+        }
+
+        /*A new setting starts the filter again*/
+        struct adc_config wanted = cfg.adc;
+        wanted.cycle = applied.cycle;
+        if( memcmp( &applied, &wanted, sizeof(applied) ) ) {
+            applied = wanted;
+            period = getPeriod( applied.rate );
+            filterStart( &applied );
+            timerAlarmDisable( timer );
+            timerAlarmWrite( timer, period, true );
+            timerWrite( timer, 0 );
+            timerAlarmEnable( timer );
+            last = 0;
+            Serial.printf("ADC sampling at %u us, cycle %d\n", period, applied.cycle );
+        }
+
+        uint32_t const ticks = ulTaskNotifyTake( pdTRUE, pdMS_TO_TICKS( ADC_WAIT ) );
+        if( 0 == ticks ) {
+            continue;
+        }
+        stats.overruns += ticks - 1;
+
+        int64_t const now = esp_timer_get_time( );
+        if( last ) {
+            int64_t const delta = now - last - (int64_t)period * ticks;
+            uint32_t const jitter = delta < 0 ? -delta : delta;
+            stats.jitter = jitter > stats.jitter ? jitter : stats.jitter;
+        }
+        last = now;
+
+        int16_t raw;
+        if( adc121_getval( &raw ) ) {
+            ++stats.errors;
+            /*The value is dropped after too many failed reads in a row*/
+            if( ++fails >= ADC_MAX_FAILS ) {
+                latest = -1;
+                filterStart( &applied );
+            }
+            continue;
+        }
+        fails = 0;
+        ++stats.samples;
+        int32_t const value = adcfilter_put( &filter, raw );
+        /*A rounding below code 0 must not read as a missing value*/
+        latest = value < 0 ? 0 : value;
+        putPeaks( raw, raw );
+
+        /*The ADC121 only tracks the peaks in the automatic mode, they include the
+        conversions between two reads*/
+        if( applied.cycle && ADC_PEAK_PERIOD <= now - peaksAt ) {
+            int16_t low, high;
+            if( adc121_getPeaks( &low, &high ) ) {
+                ++stats.errors;
+            }
+            else if( low <= high ) {
+                putPeaks( low, high );
+            }
+            peaksAt = now;
+        }
+    }
+}
@@ -0,0 +1,68 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#ifndef __ADC_TASK__
+#define __ADC_TASK__
+
+#include <stdint.h>
+
+enum {
+    ADC_MIN_RATE   = 1,     /*Samples per second*/
+    ADC_MAX_RATE   = 1000
+};
+
+/*Readers of the lowest and highest conversions, each one has its own interval*/
+enum adc_peakreader {
+    ADC_PEAKS_MQTT,     /*Measurement payloads of ctrl_task*/
+    ADC_PEAKS_WEB,      /*The /sample request*/
+    ADC_PEAKS_READERS
+};
+
+/*4-20 mA channel acquisition counters*/
+struct adc_stats {
+    uint32_t samples;   /*Conversions read*/
+    uint32_t errors;    /*Failed I2C reads*/
+    uint32_t overruns;  /*Timer ticks lost because the task was late*/
+    uint32_t jitter;    /*Largest deviation of a read from its period, us*/
+    uint32_t transactions; /*I2C transactions with the ADC121*/
+};
+
+/**
+ * @brief Freertos task to sample the ADC121 at the configured rate. A hardware timer
+ * sets the pace and the samples go through the filter chain. In the automatic mode the
+ * ADC121 converts on its own and keeps the lowest and highest conversions, which the
+ * task collects once per second.
+ * @param parameter */
+void adc_task( void * parameter );
+
+/**
+ * @brief Get the last filtered value of the 4-20 mA channel, without waiting for the bus.
+ * @param value, destination of the value, in ADC codes.
+ * @return false if the ADC does not answer or has not been read yet. */
+bool adc_getValue( int* value );
+
+/**
+ * @brief Get the last filtered value of the 4-20 mA channel with its fraction bits.
+ * @param value, destination of the value, in ADC codes with ADCFILTER_FRAC fraction bits.
+ * @return false if the ADC does not answer or has not been read yet. */
+bool adc_getFiltered( int32_t* value );
+
+/**
+ * @brief Take the lowest and highest conversions since the previous call of the reader,
+ * and start a new interval.
+ * @param reader, enum adc_peakreader
+ * @param low, lowest conversion, in ADC codes.
+ * @param high, highest conversion.
+ * @return false if there were no conversions. */
+bool adc_takePeaks( int reader, int* low, int* high );
+
+/**
+ * @brief Get a snapshot of the acquisition counters.
+ * @param dest, destination of the counters. */
+void adc_getStats( struct adc_stats* dest );
+
+#endif //__ADC_TASK__
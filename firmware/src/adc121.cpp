@@ -1,4 +1,3 @@
-
 #include "Arduino.h"
 
 #include <Wire.h>
@@ -15,17 +14,39 @@ enum {
     REG_ADDR_CONVL    = 0x06,
     REG_ADDR_CONVH    = 0x07,
 
+    REG_ADDR_UNKNOWN  = 0xff,
+
     ADDR_ADC121       = 0x51,
 };
 
-int adc121_getval( int16_t* value ) {
-    int16_t adcval = 0;
+/*The address pointer keeps its value between reads, it is only written to change
+the register read*/
+static uint8_t pointer = REG_ADDR_UNKNOWN;
+static uint32_t transactions = 0;
+
+static int setPointer( uint8_t reg ) {
+    if( pointer == reg ) {
+        return 0;
+    }
+    ++transactions;
     Wire.beginTransmission( ADDR_ADC121 );        // transmit to device
-    Wire.write( REG_ADDR_RESULT );                // get reuslt
-    Wire.endTransmission();
+    Wire.write( reg );
+    if( Wire.endTransmission() ) {
+        pointer = REG_ADDR_UNKNOWN;
+        return -1;
+    }
+    pointer = reg;
+    return 0;
+}
+
+static int readReg( uint8_t reg, int16_t* value ) {
+    if( setPointer( reg ) ) {
+        return -1;
+    }
+    ++transactions;
     Wire.requestFrom( ADDR_ADC121, 2 );   
     if( Wire.available() == 2 ) {
-        adcval = (Wire.read()&0x0f)<<8;
+        int16_t adcval = (Wire.read()&0x0f)<<8;
         adcval |= Wire.read();
         *value = adcval;
         return 0;
@@ -33,14 +54,48 @@ int adc121_getval( int16_t* value ) {
     return -1;
 }
 
+/*The write leaves the pointer on the register written*/
+static int writeReg( uint8_t reg, uint8_t const* data, int len ) {
+    ++transactions;
+    Wire.beginTransmission( ADDR_ADC121 );
+    Wire.write( reg );
+    Wire.write( data, len );
+    int const err = Wire.endTransmission();
+    pointer = err ? REG_ADDR_UNKNOWN : reg;
+    return err ? -1 : 0;
+}
+
+int adc121_getval( int16_t* value ) {
+    return readReg( REG_ADDR_RESULT, value );
+}
+
+int adc121_setCycle( uint8_t cycle ) {
+    uint8_t const conf = ( cycle & 0x07 ) << 5;
+    return writeReg( REG_ADDR_CONFIG, &conf, 1 );
+}
+
+int adc121_getPeaks( int16_t* low, int16_t* high ) {
+    if( readReg( REG_ADDR_CONVL, low ) || readReg( REG_ADDR_CONVH, high ) ) {
+        return -1;
+    }
+    /*Any write clears them, the lowest to 0x0fff and the highest to 0*/
+    uint8_t const clear[2] = { 0, 0 };
+    if( writeReg( REG_ADDR_CONVL, clear, 2 ) || writeReg( REG_ADDR_CONVH, clear, 2 ) ) {
+        return -1;
+    }
+    return 0;
+}
+
+uint32_t adc121_getTransactions( void ) {
+    return transactions;
+}
+
 
 void adc121_init( void ) {
 
     Wire.begin();
-    Wire.beginTransmission( ADDR_ADC121 );        // transmit to device
-    Wire.write( REG_ADDR_CONFIG );                // Configuration Register
-    Wire.write( 0x02 );  //0x20  //0x10 works
-    Wire.endTransmission(); 
+    pointer = REG_ADDR_UNKNOWN;
+    adc121_setCycle( ADC121_CYCLE_OFF );
 
 }
 
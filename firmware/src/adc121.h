@@ -15,10 +15,48 @@ extern "C"{
 
 
 
+/*Conversion cycle time of the automatic mode, in conversion times. 
+The conversion time is 1 us, ADC121_CYCLE_2048 converts about 400 times per second.*/
+enum adc121_cycle {
+    ADC121_CYCLE_OFF  = 0,   /*Convert on each read of the result*/
+    ADC121_CYCLE_32   = 1,
+    ADC121_CYCLE_64   = 2,
+    ADC121_CYCLE_128  = 3,
+    ADC121_CYCLE_256  = 4,
+    ADC121_CYCLE_512  = 5,
+    ADC121_CYCLE_1024 = 6,
+    ADC121_CYCLE_2048 = 7
+};
+
+/**
+ * @brief Start the bus and set the normal mode, a conversion on each read. */
 void adc121_init( void );
 
+/**
+ * @brief Read the last conversion. The register pointer is only written if it was moved
+ * to another register, so consecutive reads are one bus transaction each.
+ * @param value, destination of the 12 bits result.
+ * @return 0 on success, -1 if the device does not answer. */
 int adc121_getval( int16_t* value );
 
+/**
+ * @brief Set the automatic conversion mode.
+ * @param cycle, enum adc121_cycle, ADC121_CYCLE_OFF for the normal mode.
+ * @return 0 on success. */
+int adc121_setCycle( uint8_t cycle );
+
+/**
+ * @brief Read and clear the lowest and highest conversions. The device only
+ * updates them in the automatic mode.
+ * @param low, lowest conversion since the last call, 0x0fff if none.
+ * @param high, highest conversion since the last call, 0 if none.
+ * @return 0 on success. */
+int adc121_getPeaks( int16_t* low, int16_t* high );
+
+/**
+ * @brief Get the number of bus transactions done, for the statistics. */
+uint32_t adc121_getTransactions( void );
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,89 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#include "calibration.h"
+#include <math.h>
+
+enum {
+    STEP_FRAC = CAL_FRAC + CALTABLE_SHIFT    /*Fraction bits of a code within a table step*/
+};
+
+int cal_sort( struct calpoint* points, int count ) {
+    /*Insertion sort, stable so the last of the same code is the last one given*/
+    for( int i = 1; i < count; ++i ) {
+        struct calpoint const p = points[i];
+        int j = i;
+        for( ; 0 < j && p.x < points[j - 1].x; --j ) {
+            points[j] = points[j - 1];
+        }
+        points[j] = p;
+    }
+    int n = 0;
+    for( int i = 0; i < count; ++i ) {
+        if( 0 < n && points[n - 1].x == points[i].x ) {
+            --n;
+        }
+        points[n++] = points[i];
+    }
+    return n;
+}
+
+bool cal_isValid( struct calpoint const* points, int count ) {
+    if( count < 2 || CAL_MAX_POINTS < count ) {
+        return false;
+    }
+    bool const rising = points[0].y < points[1].y;
+    for( int i = 1; i < count; ++i ) {
+        float const dy = points[i].y - points[i - 1].y;
+        if( points[i].x <= points[i - 1].x || !isfinite( points[i].y ) || 0 == dy || rising != ( 0 < dy ) ) {
+            return false;
+        }
+    }
+    return 0 <= points[0].x && points[count - 1].x <= CAL_MAX_CODE;
+}
+
+int cal_fromLegacy( struct calpoint* points, struct cal_legacy const* legacy ) {
+    for( int i = 0; i < 2; ++i ) {
+        double const y = legacy->val[i].y;
+        /*Out of the float range, or NaN, is left to cal_isValid()*/
+        points[i].x = legacy->val[i].x;
+        points[i].y = isfinite( y ) && fabs( y ) < 1e30 ? (float)y : NAN;
+    }
+    int const count = cal_sort( points, 2 );
+    return cal_isValid( points, count ) ? count : 0;
+}
+
+int cal_setNominal( struct calpoint* points ) {
+    points[0].x = 655;
+    points[0].y = 4.0f;
+    points[1].x = 3276;
+    points[1].y = 20.0f;
+    return 2;
+}
+
+void caltable_build( struct caltable* self, struct calpoint const* points, int count ) {
+    int seg = 0;
+    for( int i = 0; i < CALTABLE_SIZE; ++i ) {
+        int const code = i << CALTABLE_SHIFT;
+        /*Segment of the code, the end ones are extended*/
+        while( seg < count - 2 && points[seg + 1].x <= code ) {
+            ++seg;
+        }
+        struct calpoint const* a = &points[seg];
+        struct calpoint const* b = &points[seg + 1];
+        double const y = a->y + (double)( b->y - a->y ) * ( code - a->x ) / ( b->x - a->x );
+        self->y[i] = (int32_t)lround( y * ( 1 << CAL_FRAC ) );
+    }
+}
+
+int32_t caltable_get( struct caltable const* self, int32_t code ) {
+    code = code < 0 ? 0 : code > ( CAL_MAX_CODE << CAL_FRAC ) ? ( CAL_MAX_CODE << CAL_FRAC ) : code;
+    int const i = code >> STEP_FRAC;
+    int32_t const rem = code & ( ( 1 << STEP_FRAC ) - 1 );
+    int32_t const y0 = self->y[i];
+    return y0 + (int32_t)( ( (int64_t)( self->y[i + 1] - y0 ) * rem ) >> STEP_FRAC );
+}
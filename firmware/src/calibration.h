@@ -0,0 +1,87 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#ifndef __CALIBRATION__
+#define __CALIBRATION__
+
+#include <stdint.h>
+
+enum {
+    CAL_MAX_POINTS = 8,
+    CAL_MAX_CODE   = 4095,  /*12 bits ADC*/
+    CAL_FRAC       = 16,    /*Fraction bits of the codes and of the table values*/
+    CALTABLE_SHIFT = 0,     /*Codes between entries as a power of 2, an entry per code keeps the points exact*/
+    CALTABLE_SIZE  = ( ( CAL_MAX_CODE + 1 ) >> CALTABLE_SHIFT ) + 1
+};
+
+/*Calibration point, an ADC code and the value read on the reference meter*/
+struct calpoint {
+    float   y;
+    int16_t x;
+};
+
+/*Two point calibration stored by the firmware before CFG_VER 16*/
+struct cal_legacy {
+    struct {
+        double  y;
+        int16_t x;
+    } val[2];
+    char id_sens_1[16];
+    char id_sens_2[16];
+};
+
+/* Piecewise linear calibration sampled over the ADC code space. The entries are the
+   calibrated values with CAL_FRAC fraction bits, a conversion is one lookup and a linear
+   interpolation between two entries. Below the first point and above the last one the
+   end segments are extended.*/
+struct caltable {
+    int32_t y[CALTABLE_SIZE];
+};
+
+/**
+ * @brief Sort the points by code. Of the points with the same code the last one is kept.
+ * @param points, the points
+ * @param count, number of points
+ * @return number of points left. */
+int cal_sort( struct calpoint* points, int count );
+
+/**
+ * @brief Check that there are at least two sorted points and that the values grow,
+ * or fall, with the code.
+ * @param points, points sorted with cal_sort()
+ * @param count, number of points */
+bool cal_isValid( struct calpoint const* points, int count );
+
+/**
+ * @brief Convert a two point calibration of the firmware before CFG_VER 16.
+ * @param points, destination of the points, at least 2
+ * @param legacy, the calibration as read from the EEPROM, it may be any bytes
+ * @return number of points, 0 if the legacy calibration is not valid. */
+int cal_fromLegacy( struct calpoint* points, struct cal_legacy const* legacy );
+
+/**
+ * @brief Set the nominal line of a 4-20 mA input over 16% to 80% of the ADC range,
+ * used until the channel is calibrated.
+ * @param points, destination of the points, at least 2
+ * @return number of points. */
+int cal_setNominal( struct calpoint* points );
+
+/**
+ * @brief Fill the table of a calibration.
+ * @param self, the table
+ * @param points, points accepted by cal_isValid()
+ * @param count, number of points */
+void caltable_build( struct caltable* self, struct calpoint const* points, int count );
+
+/**
+ * @brief Convert an ADC code.
+ * @param self, the table
+ * @param code, ADC code with CAL_FRAC fraction bits
+ * @return calibrated value with CAL_FRAC fraction bits */
+int32_t caltable_get( struct caltable const* self, int32_t code );
+
+#endif //__CALIBRATION__
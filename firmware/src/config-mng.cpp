@@ -6,18 +6,23 @@
 */
 
 #include "config-mng.h"
+#include "payload-codec.h"
+#include "adc121.h"
 #include <Arduino.h>
 #include <EEPROM.h>
 
 
-#define CFG_VER 1
+#define CFG_VER 16
 
-#define EEPROM_SIZE 1024
+#define EEPROM_SIZE 2048
 
 struct config cfg;
 struct acq_cal cal;
 static int const cfgaddr = 0; 
-static int const caladdr = 900;
+static int const caladdr = 1024;
+
+/* Default calibration written by the firmware before CFG_VER 16, struct cal_legacy */
+static int const legacyaddr = 900;
 
 
 void static strgetname( char* name, char const* prefix ) {
@@ -48,6 +53,42 @@ static void setdefault( struct config* cfg ) {
     strcpy( cfg->wifi.mode, "dhcp" );
     strcpy( cfg->ntp.host, "pool.ntp.org");
 
+    cfg->udp.maxframes = 1;
+    cfg->udp.mtu = 1400;
+    cfg->udp.holdms = 100;
+    cfg->udp.deadband = 2;
+    cfg->udp.keyinterval = 50;
+    cfg->udp.spoolkb = 256;
+    cfg->udp.drainrate = 50;
+
+    cfg->radar.count = 1;
+    cfg->radar.adaptive = 0;
+    cfg->radar.threshold = 20;
+    cfg->radar.hysteresis = 5;
+    cfg->radar.activeperiod = 0;
+    cfg->radar.idleperiod = 1000;
+    cfg->radar.holdms = 2000;
+
+    cfg->presence.enabled = 0;
+    cfg->presence.raw = 1;
+    cfg->presence.window = 8;
+    cfg->presence.enter = 30;
+    cfg->presence.exit = 20;
+    cfg->presence.holdms = 5000;
+    cfg->presence.summary = 60;
+
+    cfg->aggregate.enabled = 0;
+    cfg->aggregate.raw = 1;
+    cfg->aggregate.window = 60;
+
+    cfg->adc.rate = 50;
+    cfg->adc.window = 16;
+    cfg->adc.cycle = ADC121_CYCLE_2048;
+    cfg->adc.median = 5;
+    cfg->adc.iir = 0;
+    cfg->adc.kalmanq = 1;
+    cfg->adc.kalmanr = 0;
+
     strgetclientid( cfg->service.client_id );
     strcpy( cfg->service.host_ip, "industrial.api.ubidots.com");
     cfg->service.port = 1883;
@@ -55,14 +96,23 @@ static void setdefault( struct config* cfg ) {
     sprintf(cfg->service.measures.topic, "%s/%s", "/v2.0/devices", cfg->service.client_id ) ;
     cfg->service.measures.period = 20;
     strcpy( cfg->service.measures.unit, "Second" );
+    cfg->service.measures.encoding = PAYLOAD_JSON;
+    cfg->service.measures.qos = 1;
+    cfg->service.batchsize = 1;
+    cfg->service.window = 4;
+    cfg->service.batchdelay = 60;
     
     sprintf(cfg->service.status.topic, "%s/%s", "/v2.0/devices", cfg->service.client_id ) ;
     cfg->service.status.period = 1;
     strcpy( cfg->service.status.unit, "Minute" );
+    cfg->service.status.encoding = PAYLOAD_JSON;
+    cfg->service.status.qos = 0;
 
     sprintf(cfg->service.info.topic, "%s/%s", "/v2.0/devices", cfg->service.client_id ) ;
     cfg->service.info.period = 0;
     strcpy( cfg->service.info.unit, "Second" );
+    cfg->service.info.encoding = PAYLOAD_JSON;
+    cfg->service.info.qos = 1;
 
     cfg->cal = cal;
 }
@@ -86,6 +136,35 @@ void config_overwritedefaultcal( struct acq_cal const* calibration ) {
     EEPROM.commit(); 
 }
 
+/* Load the default calibration. When there is none at caladdr, the two points of older
+versions are taken from legacyaddr if they are valid. The config version can not tell them
+apart: in the old layout it is read from inside the legacy calibration. */
+static void loadcal( void ) {
+    EEPROM.get( caladdr, cal );
+    if ( cal_isValid( cal.val, cal.count ) ) {
+        return;
+    }
+
+    struct acq_cal loaded;
+    memset( &loaded, 0, sizeof( loaded ) );
+    struct cal_legacy legacy;
+    EEPROM.get( legacyaddr, legacy );
+    loaded.count = cal_fromLegacy( loaded.val, &legacy );
+    if ( loaded.count ) {
+        Serial.println("Default calibration of two points migrated");
+        memcpy( loaded.id_sens_1, legacy.id_sens_1, sizeof( loaded.id_sens_1 ) );
+        memcpy( loaded.id_sens_2, legacy.id_sens_2, sizeof( loaded.id_sens_2 ) );
+        loaded.id_sens_1[sizeof( loaded.id_sens_1 ) - 1] = '\0';
+        loaded.id_sens_2[sizeof( loaded.id_sens_2 ) - 1] = '\0';
+    }
+    else {
+        Serial.println("No valid default calibration, using the nominal line");
+        loaded.count = cal_setNominal( loaded.val );
+    }
+    cal = loaded;
+    EEPROM.put( caladdr, cal );
+}
+
 void config_load( void ) {
     
     if ( !EEPROM.begin(EEPROM_SIZE) ) {
@@ -105,14 +184,13 @@ void config_load( void ) {
         vTaskDelay(pdMS_TO_TICKS(3000));
     }
 
-    EEPROM.get( caladdr, cal );
-    eeAdress += sizeof( struct acq_cal );
-    
-    if ( eeAdress > EEPROM_SIZE ) {
+    if ( caladdr + sizeof( struct acq_cal ) > EEPROM_SIZE ) {
         Serial.println("ERROR > EEPROM insufficient size for calibration");
         vTaskDelay(pdMS_TO_TICKS(3000));
     }
 
+    loadcal( );
+
     if ( cfgversion != CFG_VER ) {
         setdefault( &cfg );
         eeAdress = cfgaddr;
@@ -124,6 +202,10 @@ void config_load( void ) {
         eeAdress += sizeof( struct acq_cal );
         Serial.printf("LOAD DEFAULT\n");
     }
+    else if ( !cal_isValid( cfg.cal.val, cfg.cal.count ) ) {
+        cfg.cal = cal;
+        EEPROM.put( cfgaddr, cfg );
+    }
 
     EEPROM.commit(); 
 } 
@@ -143,6 +225,32 @@ void print_ntpCfg( struct ntp_config const* ntp ) {
 void print_udpCfg( struct udp_config const* udp ) {
     printIp("UDP IP: ", &udp->ip);
     Serial.printf("UDP PORT: %d\n", udp->port);
+    Serial.printf("UDP FORMAT: %d\n", udp->format);
+    Serial.printf("UDP BATCH: %d frames, %d bytes, %d ms\n", udp->maxframes, udp->mtu, udp->holdms);
+    Serial.printf("UDP DELTA: deadband %d, keyframe every %d records\n", udp->deadband, udp->keyinterval);
+    Serial.printf("UDP SPOOL: %d KB, drain %d datagrams/s\n", udp->spoolkb, udp->drainrate);
+}
+
+void print_radarCfg( struct radar_config const* radar ) {
+    Serial.printf("RADAR COUNT: %d\n", radar->count);
+    Serial.printf("RADAR ADAPTIVE: %d\n", radar->adaptive);
+    Serial.printf("RADAR THRESHOLD: %d, HYSTERESIS: %d\n", radar->threshold, radar->hysteresis);
+    Serial.printf("RADAR PERIOD ACTIVE: %d ms, IDLE: %d ms, HOLD: %d ms\n", radar->activeperiod, radar->idleperiod, radar->holdms);
+}
+
+void print_presenceCfg( struct presence_config const* presence ) {
+    Serial.printf("PRESENCE ENABLED: %d, RAW FRAMES: %d\n", presence->enabled, presence->raw);
+    Serial.printf("PRESENCE WINDOW: %d, ENTER: %d, EXIT: %d\n", presence->window, presence->enter, presence->exit);
+    Serial.printf("PRESENCE HOLD: %d ms, SUMMARY: %d s\n", presence->holdms, presence->summary);
+}
+
+void print_aggregateCfg( struct aggregate_config const* aggregate ) {
+    Serial.printf("AGGREGATE ENABLED: %d, RAW FRAMES: %d, WINDOW: %d s\n", aggregate->enabled, aggregate->raw, aggregate->window);
+}
+
+void print_adcCfg( struct adc_config const* adc ) {
+    Serial.printf("ADC RATE: %d samples/s, CYCLE: %d\n", adc->rate, adc->cycle);
+    Serial.printf("ADC FILTER: median %d, mean %d, iir %d/256, kalman q %d r %d\n", adc->median, adc->window, adc->iir, adc->kalmanq, adc->kalmanr);
 }
 
 void print_NetworkCfg( struct wifi_config const* ntwk ) {
@@ -169,9 +277,15 @@ void print_ServiceCfg( struct service_config const* srvc ) {
         Serial.printf("MQTT TEMP_TOPIC: %s\n", srvc->measures.topic);
         Serial.printf("MQTT TEMP_INTER: %d\n", srvc->measures.period);
         Serial.printf("MQTT TEMP_UND: %s\n", srvc->measures.unit);
+        Serial.printf("MQTT TEMP_ENC: %d\n", srvc->measures.encoding);
+        Serial.printf("MQTT TEMP_QOS: %d\n", srvc->measures.qos);
+        Serial.printf("MQTT TEMP_BATCH: %d samples, %d s\n", srvc->batchsize, srvc->batchdelay);
         Serial.printf("MQTT PING_TOPIC: %s\n", srvc->status.topic);
         Serial.printf("MQTT PING_INTER: %d\n", srvc->status.period);
         Serial.printf("MQTT PING_UND: %s\n", srvc->status.unit);
+        Serial.printf("MQTT PING_ENC: %d\n", srvc->status.encoding);
+        Serial.printf("MQTT PING_QOS: %d\n", srvc->status.qos);
+        Serial.printf("MQTT WINDOW: %d\n", srvc->window);
         Serial.printf("LOC LAT: %f\n", srvc->geo.lat );
         Serial.printf("LOC LON: %f\n", srvc->geo.lng );
 }
@@ -183,8 +297,9 @@ void print_apCfg( struct ap_config const* ap ) {
 }
 
 void print_Calibration( struct acq_cal const* cal ) {
-    Serial.printf("CAL [x0,y0]: [%d,%f]\n", cal->val[0].x, cal->val[0].y  );
-    Serial.printf("CAL [x1,y1]: [%d,%f]\n", cal->val[1].x, cal->val[1].y  );
+    for ( int i = 0; i < cal->count && i < CAL_MAX_POINTS; ++i ) {
+        Serial.printf("CAL [x%d,y%d]: [%d,%f]\n", i, i, cal->val[i].x, cal->val[i].y  );
+    }
     Serial.printf("SEN_1: %s\n", cal->id_sens_1 );
     Serial.printf("SEN_2: %s\n", cal->id_sens_2 );
 }
\ No newline at end of file
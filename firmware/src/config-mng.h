@@ -9,6 +9,7 @@
 #define _CONFIG_MNG_H_                   
 
 #include <stdint.h>
+#include "calibration.h"
 
 enum {
     SSID_SIZE = 32,
@@ -31,6 +32,8 @@ struct pub_topic {
     char topic[64];
     int32_t period; /* in seconds */
     char unit[16];
+    uint8_t encoding; /* enum payload_encoding */
+    uint8_t qos;      /* 0 or 1 */
 };
 
 
@@ -56,6 +59,50 @@ struct ntp_config {
 struct udp_config {
     struct ip ip;
     int port;
+    uint8_t format;    /* enum frame_format */
+    uint8_t maxframes; /* Maximum number of frames per datagram */
+    uint16_t mtu;      /* Maximum size of the datagram in bytes */
+    uint16_t holdms;   /* Maximum time a frame is held waiting for others */
+    uint8_t deadband;  /* Minimum change of a gate energy sent in a delta record */
+    uint16_t keyinterval; /* Delta records between keyframes */
+    uint16_t spoolkb;  /* Flash kept for the events not sent while offline, 0 disables it */
+    uint16_t drainrate; /* Spooled datagrams sent per second once online */
+};
+
+struct radar_config {
+    uint8_t  count;        /* Number of radars connected, applied on restart */
+    uint8_t  adaptive;     /* Reduce the reporting rate while the scene is idle */
+    uint8_t  threshold;    /* Target energy to report at the active rate */
+    uint8_t  hysteresis;   /* Energy below threshold to leave the active rate */
+    uint16_t activeperiod; /* Minimum time between frames while active in ms, 0 reports all */
+    uint16_t idleperiod;   /* Time between heartbeat frames while idle in ms */
+    uint16_t holdms;       /* Time below the exit level before going idle in ms */
+};
+
+struct presence_config {
+    uint8_t  enabled;      /* Run the presence detector on the radar frames */
+    uint8_t  raw;          /* Keep sending the raw frames along with the events */
+    uint8_t  window;       /* Frames averaged per gate */
+    uint8_t  enter;        /* Averaged gate energy to detect a target */
+    uint8_t  exit;         /* Averaged gate energy to keep detecting it */
+    uint16_t holdms;       /* Time without targets before going vacant in ms */
+    uint16_t summary;      /* Period of the summary events in seconds, 0 disables them */
+};
+
+struct aggregate_config {
+    uint8_t  enabled;      /* Send the per gate statistics of each window */
+    uint8_t  raw;          /* Keep sending the raw frames along with the statistics */
+    uint16_t window;       /* Length of the windows in seconds */
+};
+
+struct adc_config {
+    uint16_t rate;         /* ADC samples per second */
+    uint8_t  window;       /* Samples in the running mean */
+    uint8_t  cycle;        /* enum adc121_cycle, automatic conversion of the ADC121 */
+    uint8_t  median;       /* Samples of the median against spikes, 1 disables it */
+    uint8_t  iir;          /* Weight of a new sample in the low pass in 1/256, 0 disables it */
+    uint16_t kalmanq;      /* Process noise of the Kalman filter */
+    uint16_t kalmanr;      /* Measurement noise of the Kalman filter, 0 disables it */
 };
 
 struct service_config {
@@ -65,6 +112,9 @@ struct service_config {
     char username[64];
     char password[32];
     struct pub_topic measures;
+    uint8_t  batchsize;  /* Measurement samples published in one payload */
+    uint8_t  window;     /* QoS 1 publishes sent without their PUBACK */
+    uint16_t batchdelay; /* Longest time a sample waits to be published, in seconds */
     struct pub_topic status;
     struct pub_topic info;
     struct location{
@@ -82,10 +132,8 @@ struct ap_config {
 };
 
 struct acq_cal {
-    struct point {
-        double  y;
-        int16_t x;
-    } val[2];
+    struct calpoint val[CAL_MAX_POINTS];  /* Sorted by code */
+    uint8_t count;                        /* Points used, from 2 to CAL_MAX_POINTS */
 
     char id_sens_1[16];
     char id_sens_2[16];
@@ -98,6 +146,10 @@ struct config  {
     struct service_config  service;
     struct ntp_config ntp;
     struct udp_config udp;
+    struct radar_config radar;
+    struct presence_config presence;
+    struct aggregate_config aggregate;
+    struct adc_config adc;
     struct acq_cal cal;
 };
 
@@ -117,6 +169,14 @@ void print_ntpCfg( struct ntp_config const* ntp );
 
 void print_udpCfg( struct udp_config const* udp );
 
+void print_radarCfg( struct radar_config const* radar );
+
+void print_presenceCfg( struct presence_config const* presence );
+
+void print_aggregateCfg( struct aggregate_config const* aggregate );
+
+void print_adcCfg( struct adc_config const* adc );
+
 
 void print_NetworkCfg( struct wifi_config const* ntwk );
 
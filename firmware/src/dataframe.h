@@ -0,0 +1,36 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#ifndef __DATAFRAME__
+#define __DATAFRAME__
+
+#include <stdint.h>
+
+/*Same value as the ld2410 library, kept here so the frame can be used without it.*/
+#ifndef LD2410_MAX_GATES
+#define LD2410_MAX_GATES 9
+#endif
+
+/*Radars that can be connected to the bridge*/
+#define DATAFRAME_MAX_SENSORS 2
+
+/*Engineering frame reported by a radar*/
+struct dataframe {
+    uint64_t timestamp; /*Capture time in us, esp_timer time unless stated otherwise*/
+    uint32_t seq;       /*Sequence number of the reported frames of all the radars, a gap means lost frames*/
+    uint8_t  sensor;    /*Radar that captured the frame*/
+    uint16_t detectionDistance;
+    uint16_t stationaryTargetDistance;
+    uint8_t  stationaryTargetEnergy;
+    uint16_t movingTargetDistance;
+    uint8_t  movingTargetEnergy;
+    uint16_t engRataingData;
+    uint8_t  engMovingDistanceGateEnergy[LD2410_MAX_GATES];
+    uint8_t  engStaticDistanceGateEnergy[LD2410_MAX_GATES];
+};
+
+#endif //__DATAFRAME__
@@ -0,0 +1,584 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#include "frame-codec.h"
+#include <string.h>
+
+/*Write the decimal representation of val, return the position after the last digit*/
+static char* putuint( char* dest, uint32_t val ) {
+    char tmp[10];
+    int n = 0;
+    do {
+        tmp[n++] = '0' + val % 10;
+        val /= 10;
+    } while( val );
+
+    while( n ) {
+        *dest++ = tmp[--n];
+    }
+    return dest;
+}
+
+/*Same as putuint for 64 bits values, with a single 64 bits division*/
+static char* putuint64( char* dest, uint64_t val ) {
+    enum { DIGITS = 9 };
+    uint32_t const base = 1000000000;
+    if( val < base ) {
+        return putuint( dest, val );
+    }
+
+    dest = putuint( dest, val / base );
+    uint32_t low = val % base;
+    for( int n = DIGITS - 1; 0 <= n; --n ) {
+        dest[n] = '0' + low % 10;
+        low /= 10;
+    }
+    return dest + DIGITS;
+}
+
+static uint8_t* put16( uint8_t* dest, uint16_t val ) {
+    dest[0] = val;
+    dest[1] = val >> 8;
+    return dest + 2;
+}
+
+static uint8_t* put32( uint8_t* dest, uint32_t val ) {
+    dest = put16( dest, val );
+    return put16( dest, val >> 16 );
+}
+
+static uint8_t* put64( uint8_t* dest, uint64_t val ) {
+    dest = put32( dest, val );
+    return put32( dest, val >> 32 );
+}
+
+static uint16_t get16( uint8_t const* src ) {
+    return src[0] | ( src[1] << 8 );
+}
+
+static uint32_t get32( uint8_t const* src ) {
+    return get16( src ) | ( (uint32_t)get16( src + 2 ) << 16 );
+}
+
+static uint64_t get64( uint8_t const* src ) {
+    return get32( src ) | ( (uint64_t)get32( src + 4 ) << 32 );
+}
+
+size_t frame_toCsv( struct dataframe const* data, int64_t clockoffset, char* dest, size_t len ) {
+    if( len < FRAME_CSV_MAX ) {
+        return 0;
+    }
+
+    char* pos = dest;
+    pos = putuint( pos, data->sensor );
+    *pos++ = ',';
+    pos = putuint( pos, data->seq );
+    *pos++ = ',';
+    pos = putuint64( pos, data->timestamp + clockoffset );
+    *pos++ = ',';
+    pos = putuint( pos, data->stationaryTargetDistance );
+    *pos++ = ',';
+    pos = putuint( pos, data->stationaryTargetEnergy );
+    *pos++ = ',';
+    pos = putuint( pos, data->movingTargetDistance );
+    *pos++ = ',';
+    pos = putuint( pos, data->movingTargetEnergy );
+    *pos++ = ',';
+    pos = putuint( pos, data->detectionDistance );
+    *pos++ = ',';
+    pos = putuint( pos, data->engRataingData );
+
+    for( int x = 0; x < LD2410_MAX_GATES; ++x ) {
+        *pos++ = ',';
+        pos = putuint( pos, data->engMovingDistanceGateEnergy[x] );
+    }
+    for( int x = 0; x < LD2410_MAX_GATES; ++x ) {
+        *pos++ = ',';
+        pos = putuint( pos, data->engStaticDistanceGateEnergy[x] );
+    }
+    *pos = '\0';
+    return pos - dest;
+}
+
+size_t frame_binHeader( struct frame_header const* hdr, uint8_t* dest, size_t len ) {
+    if( len < FRAME_BIN_HEADER ) {
+        return 0;
+    }
+
+    uint8_t* pos = dest;
+    *pos++ = FRAME_BIN_MAGIC;
+    *pos++ = hdr->version;
+    *pos++ = hdr->count;
+    *pos++ = hdr->flags;
+    pos = put32( pos, hdr->device );
+    pos = put32( pos, hdr->seq );
+    pos = put32( pos, hdr->frameseq );
+    pos = put64( pos, hdr->timestamp );
+    return pos - dest;
+}
+
+/*Write the target fields of a frame, the ones placed before the gate energies*/
+static uint8_t* puttargets( uint8_t* pos, struct dataframe const* data ) {
+    pos = put16( pos, data->detectionDistance );
+    pos = put16( pos, data->stationaryTargetDistance );
+    *pos++ = data->stationaryTargetEnergy;
+    pos = put16( pos, data->movingTargetDistance );
+    *pos++ = data->movingTargetEnergy;
+    return put16( pos, data->engRataingData );
+}
+
+static uint8_t const* gettargets( uint8_t const* pos, struct dataframe* data ) {
+    data->detectionDistance        = get16( pos );
+    data->stationaryTargetDistance = get16( pos + 2 );
+    data->stationaryTargetEnergy   = pos[4];
+    data->movingTargetDistance     = get16( pos + 5 );
+    data->movingTargetEnergy       = pos[7];
+    data->engRataingData           = get16( pos + 8 );
+    return pos + 10;
+}
+
+/*Gate energies of a frame in the order of the records, moving first*/
+static void getgates( struct dataframe const* data, uint8_t* gates ) {
+    memcpy( gates, data->engMovingDistanceGateEnergy, LD2410_MAX_GATES );
+    memcpy( gates + LD2410_MAX_GATES, data->engStaticDistanceGateEnergy, LD2410_MAX_GATES );
+}
+
+static void setgates( struct dataframe* data, uint8_t const* gates ) {
+    memcpy( data->engMovingDistanceGateEnergy, gates, LD2410_MAX_GATES );
+    memcpy( data->engStaticDistanceGateEnergy, gates + LD2410_MAX_GATES, LD2410_MAX_GATES );
+}
+
+/*Write the capture time, sequence number and radar of a record*/
+static uint8_t* putstamp( uint8_t* pos, struct dataframe const* data, int32_t dt, uint8_t seqoff ) {
+    pos = put32( pos, (uint32_t)dt );
+    *pos++ = seqoff;
+    *pos++ = data->sensor;
+    return pos;
+}
+
+size_t frame_binRecord( struct dataframe const* data, int32_t dt, uint8_t seqoff, uint8_t* dest, size_t len ) {
+    if( len < FRAME_BIN_RECORD ) {
+        return 0;
+    }
+
+    uint8_t* pos = dest;
+    pos = putstamp( pos, data, dt, seqoff );
+    pos = puttargets( pos, data );
+    memcpy( pos, data->engMovingDistanceGateEnergy, LD2410_MAX_GATES );
+    pos += LD2410_MAX_GATES;
+    memcpy( pos, data->engStaticDistanceGateEnergy, LD2410_MAX_GATES );
+    pos += LD2410_MAX_GATES;
+    return pos - dest;
+}
+
+size_t frame_binParseHeader( uint8_t const* src, size_t len, struct frame_header* hdr ) {
+    if( len < FRAME_BIN_HEADER || src[0] != FRAME_BIN_MAGIC ) {
+        return 0;
+    }
+    if( src[1] != FRAME_BIN_VERSION && src[1] != FRAME_BIN_VERSION_DELTA ) {
+        return 0;
+    }
+
+    hdr->version   = src[1];
+    hdr->count     = src[2];
+    hdr->flags     = src[3];
+    hdr->device    = get32( src + 4 );
+    hdr->seq       = get32( src + 8 );
+    hdr->frameseq  = get32( src + 12 );
+    hdr->timestamp = get64( src + 16 );
+    return FRAME_BIN_HEADER;
+}
+
+/*Capture time and sequence number of a record, relative to the header, and its radar*/
+static uint8_t const* getstamp( struct frame_header const* hdr, uint8_t const* pos, struct dataframe* data ) {
+    data->timestamp = hdr->timestamp + (int32_t)get32( pos );
+    data->seq       = hdr->frameseq + pos[4];
+    data->sensor    = pos[5];
+    return pos + 6;
+}
+
+size_t frame_binParseRecord( struct frame_header const* hdr, uint8_t const* src, size_t len, struct dataframe* data ) {
+    if( len < FRAME_BIN_RECORD ) {
+        return 0;
+    }
+
+    uint8_t const* pos = getstamp( hdr, src, data );
+    pos = gettargets( pos, data );
+    memcpy( data->engMovingDistanceGateEnergy, pos, LD2410_MAX_GATES );
+    memcpy( data->engStaticDistanceGateEnergy, pos + LD2410_MAX_GATES, LD2410_MAX_GATES );
+    return FRAME_BIN_RECORD;
+}
+
+void framedelta_init( struct frame_delta* self, uint8_t deadband, uint16_t keyinterval ) {
+    self->deadband = deadband;
+    self->keyinterval = keyinterval;
+    framedelta_reset( self );
+}
+
+void framedelta_reset( struct frame_delta* self ) {
+    self->sincekey = 0;
+    self->valid = false;
+}
+
+size_t frame_deltaRecord( struct frame_delta* states, struct dataframe const* data, int32_t dt, uint8_t seqoff, uint8_t* dest, size_t len ) {
+    enum { GATES = 2 * LD2410_MAX_GATES };
+    if( DATAFRAME_MAX_SENSORS <= data->sensor ) {
+        return 0;
+    }
+    struct frame_delta* self = &states[data->sensor];
+    uint8_t gates[GATES];
+    getgates( data, gates );
+    /*Bit i set if the gate i moved past the deadband, computed without branches because
+    the gates of a live scene change at random*/
+    uint32_t bitmap = 0;
+    int changed = 0;
+    if( self->valid && self->sincekey < self->keyinterval ) {
+        for( int i = 0; i < GATES; ++i ) {
+            uint32_t const diff = (int)gates[i] - self->ref[i] + self->deadband;
+            uint32_t const bit = diff > 2u * self->deadband;
+            bitmap |= bit << i;
+            changed += bit;
+        }
+    }
+
+    /*A keyframe is sent instead of a delta that would not be smaller*/
+    bool const key = !self->valid || self->keyinterval <= self->sincekey || FRAME_DELTA_BITMAP + changed >= GATES;
+    size_t const size = 7 + 10 + ( key ? GATES : FRAME_DELTA_BITMAP + changed );
+    if( len < size ) {
+        return 0;
+    }
+
+    uint8_t* pos = dest;
+    pos = putstamp( pos, data, dt, seqoff );
+    *pos++ = key ? FRAME_DELTA_KEY : FRAME_DELTA_DIFF;
+    pos = puttargets( pos, data );
+    if( key ) {
+        memcpy( self->ref, gates, GATES );
+        memcpy( pos, gates, GATES );
+        pos += GATES;
+        self->sincekey = 0;
+        self->valid = true;
+    }
+    else {
+        for( int i = 0; i < FRAME_DELTA_BITMAP; ++i ) {
+            *pos++ = bitmap >> ( 8 * i );
+        }
+        for( uint32_t bits = bitmap; bits; bits &= bits - 1 ) {
+            int const i = __builtin_ctz( bits );
+            self->ref[i] = *pos++ = gates[i];
+        }
+        ++self->sincekey;
+    }
+    return pos - dest;
+}
+
+size_t frame_deltaParseRecord( struct frame_delta* states, struct frame_header const* hdr, uint8_t const* src, size_t len, struct dataframe* data ) {
+    enum { GATES = 2 * LD2410_MAX_GATES };
+    if( len < 7 + 10 ) {
+        return 0;
+    }
+
+    uint8_t const* pos = getstamp( hdr, src, data );
+    if( DATAFRAME_MAX_SENSORS <= data->sensor ) {
+        return 0;
+    }
+    struct frame_delta* self = &states[data->sensor];
+    uint8_t const kind = *pos++;
+    pos = gettargets( pos, data );
+    uint8_t const* const end = src + len;
+    if( FRAME_DELTA_KEY == kind ) {
+        if( end - pos < GATES ) {
+            return 0;
+        }
+        memcpy( self->ref, pos, GATES );
+        pos += GATES;
+        self->valid = true;
+    }
+    else if( FRAME_DELTA_DIFF == kind ) {
+        if( end - pos < FRAME_DELTA_BITMAP ) {
+            return 0;
+        }
+        uint8_t const* bitmap = pos;
+        pos += FRAME_DELTA_BITMAP;
+        for( int i = 0; i < GATES; ++i ) {
+            if( bitmap[i / 8] & ( 1u << ( i % 8 ) ) ) {
+                if( pos == end ) {
+                    return 0;
+                }
+                self->ref[i] = *pos++;
+            }
+        }
+    }
+    else {
+        return 0;
+    }
+
+    setgates( data, self->ref );
+    return pos - src;
+}
+
+/*Space needed to add one more frame to the batch*/
+static size_t nextsize( struct frame_batch const* self ) {
+    size_t const hlen = self->count ? 0 : FRAME_BIN_HEADER;
+    if( FRAME_FORMAT_BINARY == self->format ) {
+        return FRAME_BIN_RECORD + hlen;
+    }
+    if( FRAME_FORMAT_DELTA == self->format ) {
+        return FRAME_DELTA_RECORD + hlen;
+    }
+    return FRAME_CSV_MAX + 1;
+}
+
+void framebatch_init( struct frame_batch* self, uint8_t* buf, size_t cap, uint8_t format, uint8_t maxframes,
+                      struct frame_delta* delta, int64_t clockoffset ) {
+    self->buf = buf;
+    self->cap = cap;
+    self->len = 0;
+    self->format = format;
+    self->maxframes = maxframes ? maxframes : 1;
+    self->count = 0;
+    self->first = 0;
+    self->capture = 0;
+    self->frameseq = 0;
+    self->clockoffset = clockoffset;
+    self->delta = delta;
+    if( FRAME_FORMAT_DELTA == format && NULL == delta ) {
+        self->format = FRAME_FORMAT_BINARY;
+    }
+}
+
+size_t framebatch_minSize( uint8_t format ) {
+    struct frame_batch empty;
+    empty.format = format;
+    empty.count = 0;
+    return nextsize( &empty );
+}
+
+bool framebatch_add( struct frame_batch* self, struct frame_header const* hdr, struct dataframe const* data, uint32_t now ) {
+    if( framebatch_isFull( self ) ) {
+        return false;
+    }
+
+    if( 0 == self->count ) {
+        self->first = now;
+        self->capture = data->timestamp;
+        self->frameseq = data->seq;
+    }
+
+    /*A frame of the other radar may have been captured before the first one*/
+    int64_t const dt = (int64_t)( data->timestamp - self->capture );
+    uint32_t const seqoff = data->seq - self->frameseq;
+    if( DATAFRAME_MAX_SENSORS <= data->sensor ) {
+        return false;
+    }
+    if( FRAME_FORMAT_CSV != self->format && ( dt < INT32_MIN || INT32_MAX < dt || FRAME_BIN_MAXOFF < seqoff ) ) {
+        return false;
+    }
+
+    uint8_t* dest = self->buf + self->len;
+    size_t const len = self->cap - self->len;
+    if( FRAME_FORMAT_CSV != self->format ) {
+        bool const delta = FRAME_FORMAT_DELTA == self->format;
+        size_t hlen = 0;
+        if( 0 == self->count ) {
+            struct frame_header first = *hdr;
+            first.version = delta ? FRAME_BIN_VERSION_DELTA : FRAME_BIN_VERSION;
+            first.flags |= self->clockoffset ? FRAME_FLAG_WALLCLOCK : 0;
+            first.frameseq = data->seq;
+            first.timestamp = data->timestamp + self->clockoffset;
+            hlen = frame_binHeader( &first, dest, len );
+        }
+        self->len += hlen + ( delta ? frame_deltaRecord( self->delta, data, (int32_t)dt, seqoff, dest + hlen, len - hlen )
+                                    : frame_binRecord( data, (int32_t)dt, seqoff, dest + hlen, len - hlen ) );
+    }
+    else {
+        if( self->count ) {
+            *dest++ = '\n';
+            ++self->len;
+        }
+        self->len += frame_toCsv( data, self->clockoffset, (char*)dest, len - 1 );
+    }
+    ++self->count;
+    return true;
+}
+
+bool framebatch_isFull( struct frame_batch const* self ) {
+    return self->maxframes <= self->count || self->cap - self->len < nextsize( self );
+}
+
+int32_t framebatch_remaining( struct frame_batch const* self, uint32_t now, uint32_t holdms ) {
+    if( 0 == self->count ) {
+        return -1;
+    }
+    uint32_t const elapsed = now - self->first;
+    return elapsed < holdms ? holdms - elapsed : 0;
+}
+
+size_t framebatch_finish( struct frame_batch* self ) {
+    size_t const len = self->len;
+    if( FRAME_FORMAT_CSV != self->format && self->count ) {
+        self->buf[2] = self->count;
+    }
+    self->len = 0;
+    self->count = 0;
+    return len;
+}
+
+/*Name of the event fields in the csv lines*/
+static char* putname( char* dest, char const* name ) {
+    size_t const len = strlen( name );
+    memcpy( dest, name, len );
+    return dest + len;
+}
+
+size_t frame_eventToCsv( struct presence_event const* ev, int64_t clockoffset, char* dest, size_t len ) {
+    if( len < FRAME_EVENT_CSV_MAX ) {
+        return 0;
+    }
+
+    char* pos = dest;
+    pos = putname( pos, "event," );
+    pos = putuint( pos, ev->sensor );
+    *pos++ = ',';
+    pos = putuint64( pos, ev->timestamp + clockoffset );
+    *pos++ = ',';
+    pos = putname( pos, PRESENCE_CHANGE == ev->kind ? "change" : "summary" );
+    *pos++ = ',';
+    pos = putname( pos, presence_stateName( ev->state ) );
+    *pos++ = ',';
+    pos = putname( pos, presence_stateName( ev->previous ) );
+    *pos++ = ',';
+    pos = putuint( pos, ev->moving );
+    *pos++ = ',';
+    pos = putuint( pos, ev->stationary );
+    *pos++ = ',';
+    pos = putuint( pos, ev->gate );
+    *pos = '\0';
+    return pos - dest;
+}
+
+size_t frame_binEvent( struct frame_header const* hdr, struct presence_event const* ev, int64_t clockoffset, uint8_t* dest, size_t len ) {
+    if( len < FRAME_BIN_HEADER + FRAME_EVENT_RECORD ) {
+        return 0;
+    }
+
+    struct frame_header first = *hdr;
+    first.version = FRAME_BIN_VERSION;
+    first.count = 1;
+    first.flags |= FRAME_FLAG_EVENT | ( clockoffset ? FRAME_FLAG_WALLCLOCK : 0 );
+    first.frameseq = 0;
+    first.timestamp = ev->timestamp + clockoffset;
+    uint8_t* pos = dest + frame_binHeader( &first, dest, len );
+    *pos++ = ev->sensor;
+    *pos++ = ev->kind;
+    *pos++ = ev->state;
+    *pos++ = ev->previous;
+    *pos++ = ev->moving;
+    *pos++ = ev->stationary;
+    *pos++ = ev->gate;
+    return pos - dest;
+}
+
+size_t frame_binParseEvent( struct frame_header const* hdr, uint8_t const* src, size_t len, struct presence_event* ev ) {
+    if( len < FRAME_EVENT_RECORD ) {
+        return 0;
+    }
+
+    ev->timestamp  = hdr->timestamp;
+    ev->sensor     = src[0];
+    ev->kind       = src[1];
+    ev->state      = src[2];
+    ev->previous   = src[3];
+    ev->moving     = src[4];
+    ev->stationary = src[5];
+    ev->gate       = src[6];
+    return FRAME_EVENT_RECORD;
+}
+
+/*Write a value in hundredths with two decimals*/
+static char* putcenti( char* dest, uint16_t val ) {
+    dest = putuint( dest, val / 100 );
+    *dest++ = '.';
+    *dest++ = '0' + val / 10 % 10;
+    *dest++ = '0' + val % 10;
+    return dest;
+}
+
+size_t frame_aggregateToCsv( struct gate_aggregate const* agg, int64_t clockoffset, char* dest, size_t len ) {
+    if( len < FRAME_AGGREGATE_CSV_MAX ) {
+        return 0;
+    }
+
+    char* pos = dest;
+    pos = putname( pos, "aggregate," );
+    pos = putuint( pos, agg->sensor );
+    *pos++ = ',';
+    pos = putuint64( pos, agg->timestamp + clockoffset );
+    *pos++ = ',';
+    pos = putuint( pos, agg->duration );
+    *pos++ = ',';
+    pos = putuint( pos, agg->frames );
+    for( int i = 0; i < GATESTATS_GATES; ++i ) {
+        struct gate_summary const* g = &agg->gate[i];
+        *pos++ = ',';
+        pos = putuint( pos, g->min );
+        *pos++ = ',';
+        pos = putuint( pos, g->max );
+        *pos++ = ',';
+        pos = putcenti( pos, g->mean );
+        *pos++ = ',';
+        pos = putcenti( pos, g->stddev );
+    }
+    *pos = '\0';
+    return pos - dest;
+}
+
+size_t frame_binAggregate( struct frame_header const* hdr, struct gate_aggregate const* agg, int64_t clockoffset, uint8_t* dest, size_t len ) {
+    if( len < FRAME_BIN_HEADER + FRAME_AGGREGATE_RECORD ) {
+        return 0;
+    }
+
+    struct frame_header first = *hdr;
+    first.version = FRAME_BIN_VERSION;
+    first.count = 1;
+    first.flags |= FRAME_FLAG_AGGREGATE | ( clockoffset ? FRAME_FLAG_WALLCLOCK : 0 );
+    first.frameseq = 0;
+    first.timestamp = agg->timestamp + clockoffset;
+    uint8_t* pos = dest + frame_binHeader( &first, dest, len );
+    *pos++ = agg->sensor;
+    pos = put32( pos, agg->duration );
+    pos = put32( pos, agg->frames );
+    for( int i = 0; i < GATESTATS_GATES; ++i ) {
+        struct gate_summary const* g = &agg->gate[i];
+        *pos++ = g->min;
+        *pos++ = g->max;
+        pos = put16( pos, g->mean );
+        pos = put16( pos, g->stddev );
+    }
+    return pos - dest;
+}
+
+size_t frame_binParseAggregate( struct frame_header const* hdr, uint8_t const* src, size_t len, struct gate_aggregate* agg ) {
+    if( len < FRAME_AGGREGATE_RECORD ) {
+        return 0;
+    }
+
+    agg->timestamp = hdr->timestamp;
+    agg->sensor    = src[0];
+    agg->duration  = get32( src + 1 );
+    agg->frames    = get32( src + 5 );
+    uint8_t const* pos = src + 9;
+    for( int i = 0; i < GATESTATS_GATES; ++i ) {
+        struct gate_summary* g = &agg->gate[i];
+        g->min    = pos[0];
+        g->max    = pos[1];
+        g->mean   = get16( pos + 2 );
+        g->stddev = get16( pos + 4 );
+        pos += 6;
+    }
+    return FRAME_AGGREGATE_RECORD;
+}
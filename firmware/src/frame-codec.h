@@ -0,0 +1,291 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#ifndef __FRAME_CODEC__
+#define __FRAME_CODEC__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "dataframe.h"
+#include "presence.h"
+#include "gate-stats.h"
+
+/*Encodings of the radar frames sent to the UDP collector*/
+enum frame_format {
+    FRAME_FORMAT_CSV    = 0,
+    FRAME_FORMAT_BINARY = 1,
+    FRAME_FORMAT_DELTA  = 2
+};
+
+/* Binary datagram, all fields little endian:
+    header: magic(1) version(1) count(1) flags(1) device(4) seq(4) frameseq(4) timestamp(8)
+    record: dt(4) seqoff(1) sensor(1) detectionDistance(2) stationaryTargetDistance(2) stationaryTargetEnergy(1)
+            movingTargetDistance(2) movingTargetEnergy(1) engRataingData(2)
+            engMovingDistanceGateEnergy(LD2410_MAX_GATES) engStaticDistanceGateEnergy(LD2410_MAX_GATES)
+    The header is followed by count records. The capture time of a record is timestamp + dt in us,
+    dt is signed as the frames of two radars may be published out of capture order, and its
+    sequence number is frameseq + seqoff.
+
+   Version 6 datagrams carry delta records instead:
+    record: dt(4) seqoff(1) sensor(1) kind(1) <same fields as version 5 up to engRataingData>
+            kind FRAME_DELTA_KEY: all the gate energies, moving first.
+            kind FRAME_DELTA_DIFF: bitmap(FRAME_DELTA_BITMAP) with a bit set for each gate, moving
+            first and LSB first, followed by the energies of the gates with the bit set.
+            The reference energies are kept per sensor.
+
+   Presence events are sent in their own datagram, with FRAME_FLAG_EVENT set, the version of the
+   full frames, count 1 and the sequence number of the events in seq:
+    record: sensor(1) kind(1) state(1) previous(1) moving(1) stationary(1) gate(1)
+
+   Gate statistics are sent in the same way with FRAME_FLAG_AGGREGATE set, the start of the window
+   in timestamp and the sequence number of the events in seq:
+    record: sensor(1) duration(4) frames(4) and per gate, moving first: min(1) max(1) mean(2) stddev(2)
+            mean and stddev in hundredths */
+enum {
+    FRAME_BIN_MAGIC   = 0xA5,
+    FRAME_BIN_VERSION = 5,       /*Versions 1 to 4 had no sensor, 1 and 2 neither capture times nor frame sequence numbers*/
+    FRAME_BIN_VERSION_DELTA = 6,
+    FRAME_BIN_HEADER  = 24,
+    FRAME_BIN_RECORD  = 16 + 2 * LD2410_MAX_GATES,
+    FRAME_BIN_MAXOFF  = UINT8_MAX, /*Largest sequence number offset of a record*/
+    FRAME_CSV_MAX     = 4 + 11 + 21 + 6 * 6 + 2 * LD2410_MAX_GATES * 4 + 1,
+
+    FRAME_FLAG_WALLCLOCK = 1u << 0, /*The timestamp is unix time, otherwise time since boot*/
+    FRAME_FLAG_EVENT     = 1u << 1, /*The datagram holds a presence event*/
+    FRAME_EVENT_RECORD   = 7,
+    FRAME_EVENT_CSV_MAX  = 6 + 4 + 21 + 8 + 2 * 9 + 3 * 4 + 1,
+    FRAME_FLAG_AGGREGATE = 1u << 2, /*The datagram holds the statistics of a window*/
+    FRAME_AGGREGATE_RECORD  = 9 + 6 * GATESTATS_GATES,
+    FRAME_AGGREGATE_CSV_MAX = 10 + 4 + 21 + 2 * 11 + GATESTATS_GATES * ( 2 * 4 + 2 * 7 ) + 1,
+
+    FRAME_DELTA_KEY    = 0,
+    FRAME_DELTA_DIFF   = 1,
+    FRAME_DELTA_BITMAP = ( 2 * LD2410_MAX_GATES + 7 ) / 8,
+    FRAME_DELTA_RECORD = FRAME_BIN_RECORD + 1  /*Largest delta record*/
+};
+
+/*Gate energies shared by the encoder and the decoder of a delta stream*/
+struct frame_delta {
+    uint8_t  deadband;    /*Gates whose energy moved less than this are not sent*/
+    uint16_t keyinterval; /*Records between keyframes*/
+    uint16_t sincekey;
+    bool     valid;       /*ref holds the energies known by the other end*/
+    uint8_t  ref[2 * LD2410_MAX_GATES];
+};
+
+/*Stream information carried in the header of a binary datagram*/
+struct frame_header {
+    uint8_t  version;
+    uint8_t  count;     /*Number of records*/
+    uint8_t  flags;
+    uint32_t device;    /*Device identifier, lower bytes of the MAC*/
+    uint32_t seq;       /*Sequence number of the datagram*/
+    uint32_t frameseq;  /*Sequence number of the first record*/
+    uint64_t timestamp; /*Capture time of the first record in us*/
+};
+
+/*Several frames packed in one datagram. CSV frames are separated by new lines,
+binary frames are records behind a single header.*/
+struct frame_batch {
+    uint8_t* buf;
+    size_t   cap;       /*Maximum size of the datagram*/
+    size_t   len;
+    uint8_t  format;    /*enum frame_format*/
+    uint8_t  maxframes;
+    uint8_t  count;
+    uint32_t first;     /*Time of the first frame in ms*/
+    uint64_t capture;   /*Capture time of the first frame*/
+    uint32_t frameseq;  /*Sequence number of the first frame*/
+    int64_t  clockoffset;
+    struct frame_delta* delta; /*DATAFRAME_MAX_SENSORS states*/
+};
+
+/**
+ * @brief Initialize an empty batch.
+ * @param self, the batch
+ * @param buf, buffer where the datagram is built
+ * @param cap, maximum size of the datagram, it is also bounded by the MTU of the link.
+ * @param format, encoding of the frames: enum frame_format
+ * @param maxframes, maximum number of frames per datagram.
+ * @param delta, state of the stream of each sensor, DATAFRAME_MAX_SENSORS entries, only used with FRAME_FORMAT_DELTA.
+ * @param clockoffset, added to the capture times to get unix time in us, 0 to send the time since boot. */
+void framebatch_init( struct frame_batch* self, uint8_t* buf, size_t cap, uint8_t format, uint8_t maxframes,
+                      struct frame_delta* delta, int64_t clockoffset );
+
+/**
+ * @brief Get the size of the smallest datagram that holds one frame.
+ * @param format, encoding of the frames: enum frame_format */
+size_t framebatch_minSize( uint8_t format );
+
+/**
+ * @brief Append a frame to the batch.
+ * @param self, the batch
+ * @param hdr, device and sequence number used when the frame is the first of a binary batch.
+ * @param data, the frame
+ * @param now, current time in ms
+ * @return true if the frame has been added, false if it does not fit, or its capture time or sequence
+ * number are too far from the first frame, and the batch must be sent first. */
+bool framebatch_add( struct frame_batch* self, struct frame_header const* hdr, struct dataframe const* data, uint32_t now );
+
+/**
+ * @brief Check if no more frames can be added to the batch.
+ * @param self, the batch */
+bool framebatch_isFull( struct frame_batch const* self );
+
+/**
+ * @brief Get the time the batch can still be held before it exceeds the latency budget.
+ * @param self, the batch
+ * @param now, current time in ms
+ * @param holdms, maximum time in ms a frame can be held in the batch.
+ * @return remaining time in ms, 0 if the batch must be sent now or -1 if it is empty. */
+int32_t framebatch_remaining( struct frame_batch const* self, uint32_t now, uint32_t holdms );
+
+/**
+ * @brief Close the batch and get the datagram. The batch is empty afterwards.
+ * @param self, the batch
+ * @return size of the datagram in bytes, 0 if the batch was empty. */
+size_t framebatch_finish( struct frame_batch* self );
+
+/**
+ * @brief Encode a frame as a line of comma separated values, without line ending. The line starts
+ * with the sensor, the sequence number and the capture time of the frame.
+ * @param data, the frame
+ * @param clockoffset, added to the capture time
+ * @param dest, destination buffer
+ * @param len, size of the destination buffer, FRAME_CSV_MAX is always enough.
+ * @return number of characters written, 0 if the buffer is too small. */
+size_t frame_toCsv( struct dataframe const* data, int64_t clockoffset, char* dest, size_t len );
+
+/**
+ * @brief Encode the header of a binary datagram.
+ * @param hdr, stream information
+ * @param dest, destination buffer
+ * @param len, size of the destination buffer.
+ * @return number of bytes written, 0 if the buffer is too small. */
+size_t frame_binHeader( struct frame_header const* hdr, uint8_t* dest, size_t len );
+
+/**
+ * @brief Encode a frame as a record of a binary datagram.
+ * @param data, the frame
+ * @param dt, capture time in us from the timestamp of the header
+ * @param seqoff, sequence number from the one of the header
+ * @param dest, destination buffer
+ * @param len, size of the destination buffer.
+ * @return number of bytes written, 0 if the buffer is too small. */
+size_t frame_binRecord( struct dataframe const* data, int32_t dt, uint8_t seqoff, uint8_t* dest, size_t len );
+
+/**
+ * @brief Decode the header of a binary datagram.
+ * @param src, received datagram
+ * @param len, size of the datagram
+ * @param hdr, destination of the stream information.
+ * @return number of bytes read, 0 if it is not a binary datagram of a known version. */
+size_t frame_binParseHeader( uint8_t const* src, size_t len, struct frame_header* hdr );
+
+/**
+ * @brief Decode a record of a binary datagram.
+ * @param hdr, header of the datagram, the capture time and sequence number are relative to it.
+ * @param src, start of the record
+ * @param len, remaining size of the datagram
+ * @param data, destination of the frame.
+ * @return number of bytes read, 0 if the record is truncated. */
+size_t frame_binParseRecord( struct frame_header const* hdr, uint8_t const* src, size_t len, struct dataframe* data );
+
+/**
+ * @brief Initialize the state of a delta stream. The next record will be a keyframe.
+ * @param self, the delta state
+ * @param deadband, minimum change of a gate energy to be sent
+ * @param keyinterval, number of records between keyframes. */
+void framedelta_init( struct frame_delta* self, uint8_t deadband, uint16_t keyinterval );
+
+/**
+ * @brief Force a keyframe as the next record, used when the other end may have lost records.
+ * @param self, the delta state */
+void framedelta_reset( struct frame_delta* self );
+
+/**
+ * @brief Encode a frame as a record of a delta binary datagram.
+ * @param states, delta state of each sensor, DATAFRAME_MAX_SENSORS entries
+ * @param data, the frame
+ * @param dt, capture time in us from the timestamp of the header
+ * @param seqoff, sequence number from the one of the header
+ * @param dest, destination buffer
+ * @param len, size of the destination buffer.
+ * @return number of bytes written, 0 if the buffer is too small. */
+size_t frame_deltaRecord( struct frame_delta* states, struct dataframe const* data, int32_t dt, uint8_t seqoff, uint8_t* dest, size_t len );
+
+/**
+ * @brief Decode a record of a delta binary datagram. The decoded gate energies are within
+ * the deadband of the encoder. Delta records received without a previous keyframe can not be
+ * decoded, the valid field of the state of the sensor is false afterwards.
+ * @param states, delta state of each sensor, DATAFRAME_MAX_SENSORS entries
+ * @param hdr, header of the datagram, the capture time and sequence number are relative to it.
+ * @param src, start of the record
+ * @param len, remaining size of the datagram
+ * @param data, destination of the frame.
+ * @return number of bytes read, 0 if the record is malformed. */
+size_t frame_deltaParseRecord( struct frame_delta* states, struct frame_header const* hdr, uint8_t const* src, size_t len, struct dataframe* data );
+
+/**
+ * @brief Encode a presence event as a line of comma separated values, without line ending:
+ * event,sensor,timestamp,kind,state,previous,moving,stationary,gate
+ * @param ev, the event
+ * @param clockoffset, added to the capture time
+ * @param dest, destination buffer
+ * @param len, size of the destination buffer, FRAME_EVENT_CSV_MAX is always enough.
+ * @return number of characters written, 0 if the buffer is too small. */
+size_t frame_eventToCsv( struct presence_event const* ev, int64_t clockoffset, char* dest, size_t len );
+
+/**
+ * @brief Encode a presence event as a binary datagram.
+ * @param hdr, device and sequence number of the event
+ * @param ev, the event
+ * @param clockoffset, added to the capture time, 0 to send the time since boot
+ * @param dest, destination buffer
+ * @param len, size of the destination buffer.
+ * @return number of bytes written, 0 if the buffer is too small. */
+size_t frame_binEvent( struct frame_header const* hdr, struct presence_event const* ev, int64_t clockoffset, uint8_t* dest, size_t len );
+
+/**
+ * @brief Decode the record of a presence event datagram.
+ * @param hdr, header of the datagram
+ * @param src, start of the record
+ * @param len, remaining size of the datagram
+ * @param ev, destination of the event.
+ * @return number of bytes read, 0 if the record is truncated. */
+size_t frame_binParseEvent( struct frame_header const* hdr, uint8_t const* src, size_t len, struct presence_event* ev );
+
+/**
+ * @brief Encode the statistics of a window as a csv line, without line ending:
+ * aggregate,sensor,timestamp,duration,frames then min,max,mean,stddev of each gate, moving first.
+ * @param agg, the statistics
+ * @param clockoffset, added to the start of the window
+ * @param dest, destination buffer
+ * @param len, size of the destination buffer, FRAME_AGGREGATE_CSV_MAX is always enough.
+ * @return number of characters written, 0 if the buffer is too small. */
+size_t frame_aggregateToCsv( struct gate_aggregate const* agg, int64_t clockoffset, char* dest, size_t len );
+
+/**
+ * @brief Encode the statistics of a window as a binary datagram.
+ * @param hdr, device and sequence number of the datagram
+ * @param agg, the statistics
+ * @param clockoffset, added to the start of the window, 0 to send the time since boot
+ * @param dest, destination buffer
+ * @param len, size of the destination buffer.
+ * @return number of bytes written, 0 if the buffer is too small. */
+size_t frame_binAggregate( struct frame_header const* hdr, struct gate_aggregate const* agg, int64_t clockoffset, uint8_t* dest, size_t len );
+
+/**
+ * @brief Decode the record of a gate statistics datagram.
+ * @param hdr, header of the datagram
+ * @param src, start of the record
+ * @param len, remaining size of the datagram
+ * @param agg, destination of the statistics.
+ * @return number of bytes read, 0 if the record is truncated. */
+size_t frame_binParseAggregate( struct frame_header const* hdr, uint8_t const* src, size_t len, struct gate_aggregate* agg );
+
+#endif //__FRAME_CODEC__
@@ -0,0 +1,231 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#include "frame-history.h"
+#include "frame-codec.h"
+
+enum {
+    GATES     = 2 * LD2410_MAX_GATES,
+    GATE_MAX  = ( 1 << HISTORY_GATE_BITS ) - 1,
+    GATE_MASK = GATE_MAX
+};
+
+static void packGates( uint8_t* dest, struct dataframe const* data ) {
+    uint32_t acc = 0;
+    int bits = 0;
+    for( int i = 0; i < GATES; ++i ) {
+        uint8_t const val = i < LD2410_MAX_GATES ? data->engMovingDistanceGateEnergy[i]
+                                                 : data->engStaticDistanceGateEnergy[i - LD2410_MAX_GATES];
+        acc |= (uint32_t)( val < GATE_MAX ? val : (uint8_t)GATE_MAX ) << bits;
+        bits += HISTORY_GATE_BITS;
+        for( ; 8 <= bits; bits -= 8 ) {
+            *dest++ = acc;
+            acc >>= 8;
+        }
+    }
+    if( bits ) {
+        *dest = acc;
+    }
+}
+
+static void unpackGates( uint8_t const* src, struct dataframe* data ) {
+    uint32_t acc = 0;
+    int bits = 0;
+    for( int i = 0; i < GATES; ++i ) {
+        for( ; bits < HISTORY_GATE_BITS; bits += 8 ) {
+            acc |= (uint32_t)*src++ << bits;
+        }
+        uint8_t const val = acc & GATE_MASK;
+        acc >>= HISTORY_GATE_BITS;
+        bits -= HISTORY_GATE_BITS;
+        if( i < LD2410_MAX_GATES ) {
+            data->engMovingDistanceGateEnergy[i] = val;
+        }
+        else {
+            data->engStaticDistanceGateEnergy[i - LD2410_MAX_GATES] = val;
+        }
+    }
+}
+
+/*Capture time of a stored frame, from its lower bits and the newest frame*/
+static uint64_t timeAt( struct frame_history const* self, uint32_t n ) {
+    return self->lastTime + (int32_t)( self->time[n % self->cap] - (uint32_t)self->lastTime );
+}
+
+/*Take a column of n elements from the memory block*/
+template<typename T>
+static T* column( uint8_t** mem, uint32_t n, size_t width = 1 ) {
+    T* col = (T*)*mem;
+    *mem += sizeof(T) * n * width;
+    return col;
+}
+
+uint32_t history_init( struct frame_history* self, void* mem, size_t size ) {
+    size_t const rows = size / HISTORY_FRAME_BYTES;
+    uint32_t const cap = rows < (size_t)HISTORY_MAX_FRAMES ? rows : (size_t)HISTORY_MAX_FRAMES;
+    /*Widest columns first, so all of them are aligned*/
+    uint8_t* pos = (uint8_t*)mem;
+    self->cap                = cap;
+    self->total              = 0;
+    self->start              = 0;
+    self->lastSeq            = 0;
+    self->lastTime           = 0;
+    self->time               = column<uint32_t>( &pos, cap );
+    self->seq                = column<uint16_t>( &pos, cap );
+    self->detectionDistance  = column<uint16_t>( &pos, cap );
+    self->stationaryDistance = column<uint16_t>( &pos, cap );
+    self->movingDistance     = column<uint16_t>( &pos, cap );
+    self->retain             = column<uint16_t>( &pos, cap );
+    self->sensor             = column<uint8_t>( &pos, cap );
+    self->stationaryEnergy   = column<uint8_t>( &pos, cap );
+    self->movingEnergy       = column<uint8_t>( &pos, cap );
+    self->gates              = column<uint8_t>( &pos, cap, HISTORY_GATE_BYTES );
+    return cap;
+}
+
+void history_append( struct frame_history* self, struct dataframe const* data ) {
+    if( 0 == self->cap ) {
+        return;
+    }
+    /*Forget the frames too old to rebuild their time from the new one*/
+    uint64_t const ms = data->timestamp / 1000;
+    for( uint32_t n = history_first( self ); n < self->total; ++n ) {
+        int64_t const age = (int64_t)( ms - timeAt( self, n ) );
+        if( age < HISTORY_MAX_SPAN && -HISTORY_MAX_SPAN < age ) {
+            break;
+        }
+        self->start = n + 1;
+    }
+    uint32_t const row = self->total % self->cap;
+    self->time[row]               = (uint32_t)ms;
+    self->seq[row]                = data->seq;
+    self->sensor[row]             = data->sensor;
+    self->detectionDistance[row]  = data->detectionDistance;
+    self->stationaryDistance[row] = data->stationaryTargetDistance;
+    self->movingDistance[row]     = data->movingTargetDistance;
+    self->stationaryEnergy[row]   = data->stationaryTargetEnergy;
+    self->movingEnergy[row]       = data->movingTargetEnergy;
+    self->retain[row]             = data->engRataingData;
+    packGates( self->gates + row * HISTORY_GATE_BYTES, data );
+    self->lastSeq = data->seq;
+    self->lastTime = ms;
+    ++self->total;
+}
+
+uint32_t history_first( struct frame_history const* self ) {
+    uint32_t const first = self->total < self->cap ? 0 : self->total - self->cap;
+    return first < self->start ? self->start : first;
+}
+
+uint32_t history_find( struct frame_history const* self, uint64_t ms ) {
+    uint32_t lo = history_first( self );
+    uint32_t hi = self->total;
+    while( lo < hi ) {
+        uint32_t const mid = lo + ( hi - lo ) / 2;
+        if( timeAt( self, mid ) < ms ) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+bool history_get( struct frame_history const* self, uint32_t n, struct dataframe* data ) {
+    if( n < history_first( self ) || self->total <= n ) {
+        return false;
+    }
+    uint32_t const row = n % self->cap;
+    /*The stored frames are less than 2^16 apart, so is their sequence numbers unless
+    the history consumer lost that many frames*/
+    uint16_t const back = (uint16_t)self->lastSeq - self->seq[row];
+    data->timestamp                = timeAt( self, n ) * 1000;
+    data->seq                      = self->lastSeq - back;
+    data->sensor                   = self->sensor[row];
+    data->detectionDistance        = self->detectionDistance[row];
+    data->stationaryTargetDistance = self->stationaryDistance[row];
+    data->movingTargetDistance     = self->movingDistance[row];
+    data->stationaryTargetEnergy   = self->stationaryEnergy[row];
+    data->movingTargetEnergy       = self->movingEnergy[row];
+    data->engRataingData           = self->retain[row];
+    unpackGates( self->gates + row * HISTORY_GATE_BYTES, data );
+    return true;
+}
+
+/*Check if a frame and all the following ones were captured after the end of the range*/
+static bool isPast( struct history_cursor const* cursor, uint64_t ms ) {
+    return cursor->to < ms && HISTORY_DISORDER_MS < ms - cursor->to;
+}
+
+void history_seek( struct frame_history const* self, struct history_cursor* cursor, uint64_t from, uint64_t to,
+                   uint8_t format, int64_t clockoffset, uint32_t device ) {
+    cursor->next        = history_find( self, from < HISTORY_DISORDER_MS ? 0 : from - HISTORY_DISORDER_MS );
+    cursor->end         = self->total;
+    cursor->from        = from;
+    cursor->to          = to;
+    cursor->format      = FRAME_FORMAT_CSV == format ? FRAME_FORMAT_CSV : FRAME_FORMAT_BINARY;
+    cursor->clockoffset = clockoffset;
+    cursor->device      = device;
+    cursor->seq         = 0;
+}
+
+bool history_done( struct frame_history const* self, struct history_cursor const* cursor ) {
+    uint32_t const next = cursor->next < history_first( self ) ? history_first( self ) : cursor->next;
+    return cursor->end <= next || isPast( cursor, timeAt( self, next ) );
+}
+
+size_t history_read( struct frame_history const* self, struct history_cursor* cursor, uint8_t* dest, size_t len ) {
+    bool const csv = FRAME_FORMAT_CSV == cursor->format;
+    if( 0 == len || history_done( self, cursor ) ) {
+        return 0;
+    }
+
+    /*A CSV batch has no line ending after the last frame, one byte is kept for it*/
+    struct frame_batch batch;
+    framebatch_init( &batch, dest, csv ? len - 1 : len, cursor->format, UINT8_MAX, NULL, cursor->clockoffset );
+    struct frame_header const hdr = {
+        .version   = FRAME_BIN_VERSION,
+        .count     = 0,
+        .flags     = 0,
+        .device    = cursor->device,
+        .seq       = cursor->seq,
+        .frameseq  = 0,
+        .timestamp = 0
+    };
+
+    while( cursor->next < cursor->end ) {
+        struct dataframe data;
+        if( !history_get( self, cursor->next, &data ) ) {
+            /*Overwritten by the writer, continue with the oldest frame*/
+            cursor->next = history_first( self );
+            continue;
+        }
+        uint64_t const ms = data.timestamp / 1000;
+        if( isPast( cursor, ms ) ) {
+            cursor->end = cursor->next;
+            break;
+        }
+        if( ms < cursor->from || cursor->to < ms ) {
+            ++cursor->next;
+            continue;
+        }
+        if( !framebatch_add( &batch, &hdr, &data, 0 ) ) {
+            break;
+        }
+        ++cursor->next;
+    }
+
+    size_t size = framebatch_finish( &batch );
+    if( size ) {
+        ++cursor->seq;
+        if( csv ) {
+            dest[size++] = '\n';
+        }
+    }
+    return size;
+}
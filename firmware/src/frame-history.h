@@ -0,0 +1,126 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#ifndef __FRAME_HISTORY__
+#define __FRAME_HISTORY__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "dataframe.h"
+
+enum {
+    HISTORY_GATE_BITS   = 7,    /*Gate energies go from 0 to 100*/
+    HISTORY_GATE_BYTES  = ( 2 * LD2410_MAX_GATES * HISTORY_GATE_BITS + 7 ) / 8,
+    /*time(4) seq(2) sensor(1) distances(6) energies(2) retain(2) gates*/
+    HISTORY_FRAME_BYTES = 4 + 2 + 1 + 6 + 2 + 2 + HISTORY_GATE_BYTES,
+    HISTORY_MAX_FRAMES  = 0xffff, /*The sequence numbers are rebuilt from their lower 16 bits*/
+    HISTORY_MAX_SPAN    = 0x3fffffff, /*ms between the frames kept, the times are rebuilt from their lower 32 bits*/
+    HISTORY_DISORDER_MS = 1000  /*Largest time a frame of one radar is published behind a later frame of the other*/
+};
+
+/*Circular history of the last frames, stored by columns. The lower 32 bits of the capture
+time in ms are kept, and the gate energies are packed in 7 bits, so a frame takes
+HISTORY_FRAME_BYTES. The full capture times are rebuilt from the newest one, frames older
+than HISTORY_MAX_SPAN from a new frame are forgotten.
+The frames are numbered from the first one appended, frame n is in row n % cap.*/
+struct frame_history {
+    uint32_t  cap;
+    uint32_t  total;        /*Frames appended since the start*/
+    uint32_t  start;        /*Number of the oldest frame not forgotten*/
+    uint32_t  lastSeq;      /*Sequence number of the newest frame*/
+    uint64_t  lastTime;     /*Capture time of the newest frame in ms*/
+    uint32_t* time;         /*Lower bits of the capture time in ms*/
+    uint16_t* seq;          /*Lower bits of the sequence number*/
+    uint8_t*  sensor;
+    uint16_t* detectionDistance;
+    uint16_t* stationaryDistance;
+    uint16_t* movingDistance;
+    uint8_t*  stationaryEnergy;
+    uint8_t*  movingEnergy;
+    uint16_t* retain;
+    uint8_t*  gates;        /*HISTORY_GATE_BYTES per frame, moving gates first*/
+};
+
+/*Position of a reader in the history*/
+struct history_cursor {
+    uint32_t next;          /*Number of the next frame to read*/
+    uint32_t end;           /*Number of the first frame not to read*/
+    uint64_t from;          /*First capture time to read in ms*/
+    uint64_t to;            /*Last capture time to read in ms*/
+    uint8_t  format;        /*enum frame_format, CSV or BINARY*/
+    int64_t  clockoffset;
+    uint32_t device;
+    uint32_t seq;           /*Sequence number of the next binary datagram*/
+};
+
+/**
+ * @brief Initialize an empty history in a memory block.
+ * @param self, the history
+ * @param mem, memory block, aligned as a uint32_t
+ * @param size, size of the block in bytes.
+ * @return number of frames that can be stored. */
+uint32_t history_init( struct frame_history* self, void* mem, size_t size );
+
+/**
+ * @brief Store a frame, overwriting the oldest one when the history is full.
+ * @param self, the history
+ * @param data, the frame */
+void history_append( struct frame_history* self, struct dataframe const* data );
+
+/**
+ * @brief Get the number of the oldest frame stored.
+ * @param self, the history */
+uint32_t history_first( struct frame_history const* self );
+
+/**
+ * @brief Find the first frame captured at or after a time. The frames are stored in the order
+ * they were published, the search assumes their capture times grow. With two radars they
+ * may go back up to HISTORY_DISORDER_MS, frames captured after the time can then be earlier.
+ * @param self, the history
+ * @param ms, capture time in ms.
+ * @return number of the frame, self->total if there is none. */
+uint32_t history_find( struct frame_history const* self, uint64_t ms );
+
+/**
+ * @brief Get a stored frame. The capture time is rebuilt in whole ms.
+ * @param self, the history
+ * @param n, number of the frame
+ * @param data, destination of the frame.
+ * @return false if the frame has been overwritten or not appended yet. */
+bool history_get( struct frame_history const* self, uint32_t n, struct dataframe* data );
+
+/**
+ * @brief Start reading the frames captured between two times. The frames published out of
+ * capture order by up to HISTORY_DISORDER_MS are included.
+ * @param self, the history
+ * @param cursor, the reader
+ * @param from, first capture time in ms
+ * @param to, last capture time in ms
+ * @param format, FRAME_FORMAT_CSV or FRAME_FORMAT_BINARY
+ * @param clockoffset, added to the capture times, see framebatch_init()
+ * @param device, device identifier of the binary headers. */
+void history_seek( struct frame_history const* self, struct history_cursor* cursor, uint64_t from, uint64_t to,
+                   uint8_t format, int64_t clockoffset, uint32_t device );
+
+/**
+ * @brief Encode the next frames of a reader. CSV frames are lines ended by a new line, binary
+ * frames are records of a binary datagram, one datagram per call. Frames overwritten while
+ * reading are skipped.
+ * @param self, the history
+ * @param cursor, the reader
+ * @param dest, destination buffer
+ * @param len, size of the buffer.
+ * @return number of bytes written, 0 at the end of the range or if the buffer can not hold a frame. */
+size_t history_read( struct frame_history const* self, struct history_cursor* cursor, uint8_t* dest, size_t len );
+
+/**
+ * @brief Check if a reader is at the end of its range.
+ * @param self, the history
+ * @param cursor, the reader */
+bool history_done( struct frame_history const* self, struct history_cursor const* cursor );
+
+#endif //__FRAME_HISTORY__
@@ -0,0 +1,109 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#include <stddef.h>
+#include "framebus.h"
+
+enum {
+    SLOT_MASK = FRAMEBUS_SLOTS - 1
+};
+
+static_assert( ( FRAMEBUS_SLOTS & SLOT_MASK ) == 0, "FRAMEBUS_SLOTS must be a power of two" );
+
+/*Sequence stored in the slot once the frame n is ready to be read*/
+static inline uint32_t readyseq( uint32_t n ) {
+    return 2 * n + 2;
+}
+
+void framebus_init( struct framebus* self ) {
+    for( int i = 0; i < FRAMEBUS_SLOTS; ++i ) {
+        self->slots[i].seq.store( 0, std::memory_order_relaxed );
+    }
+    self->head.store( 0, std::memory_order_release );
+}
+
+void framebus_publish( struct framebus* self, struct dataframe const* frame ) {
+    uint32_t const n = self->head.fetch_add( 1, std::memory_order_relaxed );
+    struct framebus::slot* slot = &self->slots[ n & SLOT_MASK ];
+    slot->seq.store( readyseq( n ) - 1, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_release );
+    slot->frame = *frame;
+    slot->frame.seq = n;
+    slot->seq.store( readyseq( n ), std::memory_order_release );
+}
+
+void framebus_attach( struct framebus_reader* self, struct framebus* bus ) {
+    self->bus = bus;
+    self->cursor = bus->head.load( std::memory_order_acquire );
+    self->frames = 0;
+    self->drops = 0;
+}
+
+/*Get the slot under the cursor of the consumer, skipping the frames that have been overwritten.
+Return NULL if there are no frames ready.*/
+static struct framebus::slot* locate( struct framebus_reader* self ) {
+    struct framebus* bus = self->bus;
+    for(;;) {
+        uint32_t const head = bus->head.load( std::memory_order_acquire );
+        uint32_t const pending = head - self->cursor;
+        if( 0 == pending ) {
+            return NULL;
+        }
+
+        if( FRAMEBUS_SLOTS < pending ) {
+            self->drops += pending - FRAMEBUS_SLOTS;
+            self->cursor = head - FRAMEBUS_SLOTS;
+        }
+
+        struct framebus::slot* slot = &bus->slots[ self->cursor & SLOT_MASK ];
+        uint32_t const expected = readyseq( self->cursor );
+        uint32_t const seq = slot->seq.load( std::memory_order_acquire );
+        if( seq == expected ) {
+            return slot;
+        }
+
+        /*Claimed by a producer but not written yet*/
+        if( (int32_t)( seq - expected ) < 0 ) {
+            return NULL;
+        }
+
+        /*A producer has lapped the consumer*/
+        ++self->drops;
+        ++self->cursor;
+    }
+}
+
+struct dataframe const* framebus_peek( struct framebus_reader* self ) {
+    struct framebus::slot* slot = locate( self );
+    return slot ? &slot->frame : NULL;
+}
+
+bool framebus_release( struct framebus_reader* self ) {
+    struct framebus::slot* slot = &self->bus->slots[ self->cursor & SLOT_MASK ];
+    std::atomic_thread_fence( std::memory_order_acquire );
+    bool const valid = slot->seq.load( std::memory_order_relaxed ) == readyseq( self->cursor );
+    valid ? ++self->frames : ++self->drops;
+    ++self->cursor;
+    return valid;
+}
+
+bool framebus_read( struct framebus_reader* self, struct dataframe* dest ) {
+    for(;;) {
+        struct framebus::slot* slot = locate( self );
+        if( NULL == slot ) {
+            return false;
+        }
+        *dest = slot->frame;
+        if( framebus_release( self ) ) {
+            return true;
+        }
+    }
+}
+
+uint32_t framebus_pending( struct framebus_reader const* self ) {
+    return self->bus->head.load( std::memory_order_acquire ) - self->cursor;
+}
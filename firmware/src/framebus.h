@@ -0,0 +1,84 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#ifndef __FRAMEBUS__
+#define __FRAMEBUS__
+
+#include <atomic>
+#include <stdint.h>
+#include "dataframe.h"
+
+enum {
+    FRAMEBUS_SLOTS = 16  /*Must be a power of two*/
+};
+
+/*Broadcast ring of dataframes. Producers never block: when a consumer falls
+behind more than FRAMEBUS_SLOTS frames the oldest ones are overwritten and
+accounted as drops in that consumer.*/
+struct framebus {
+    struct slot {
+        std::atomic<uint32_t> seq; /*2*n+1 while frame n is written, 2*n+2 once it is ready*/
+        struct dataframe frame;
+    } slots[FRAMEBUS_SLOTS];
+    std::atomic<uint32_t> head;    /*Number of frames claimed by the producers*/
+};
+
+/*Each consumer owns its cursor, so readers never touch shared state.*/
+struct framebus_reader {
+    struct framebus* bus;
+    uint32_t cursor;
+    uint32_t frames;
+    uint32_t drops;
+};
+
+/**
+ * @brief Initialize an empty frame bus.
+ * @param self, the frame bus */
+void framebus_init( struct framebus* self );
+
+/**
+ * @brief Publish a copy of the frame for all the consumers. It never blocks.
+ * The copy gets its position in the bus as sequence number, so the frames of all
+ * the producers are numbered in the order the consumers receive them.
+ * @param self, the frame bus
+ * @param frame, frame to publish. */
+void framebus_publish( struct framebus* self, struct dataframe const* frame );
+
+/**
+ * @brief Attach a consumer to the bus. It only receives frames published from now on.
+ * @param self, the consumer
+ * @param bus, the frame bus */
+void framebus_attach( struct framebus_reader* self, struct framebus* bus );
+
+/**
+ * @brief Get the oldest frame not read yet by the consumer without copying it.
+ * The frame must be released with framebus_release() once it has been used.
+ * @param self, the consumer
+ * @return pointer to the frame, NULL if there are no new frames. */
+struct dataframe const* framebus_peek( struct framebus_reader* self );
+
+/**
+ * @brief Release the frame returned by framebus_peek() and advance the cursor.
+ * @param self, the consumer
+ * @return true if the frame was still valid, false if the producer has overwritten
+ * it meanwhile and whatever was built from it must be discarded. */
+bool framebus_release( struct framebus_reader* self );
+
+/**
+ * @brief Copy the oldest frame not read yet by the consumer and advance the cursor.
+ * @param self, the consumer
+ * @param dest, destination of the frame.
+ * @return true if a frame has been copied, false if there are no new frames. */
+bool framebus_read( struct framebus_reader* self, struct dataframe* dest );
+
+/**
+ * @brief Check if there are frames not read yet by the consumer.
+ * @param self, the consumer
+ * @return number of pending frames, including the ones that will be dropped. */
+uint32_t framebus_pending( struct framebus_reader const* self );
+
+#endif //__FRAMEBUS__
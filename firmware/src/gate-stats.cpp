@@ -0,0 +1,86 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#include "gate-stats.h"
+#include <math.h>
+#include <string.h>
+
+/*Start an empty window holding the capture time t*/
+static void openWindow( struct gatestats* self, uint64_t t, uint32_t window ) {
+    uint64_t const len = (uint64_t)window * 1000;
+    self->start  = t - t % len;
+    self->window = window;
+    self->frames = 0;
+    memset( self->min, UINT8_MAX, sizeof(self->min) );
+    memset( self->max, 0, sizeof(self->max) );
+    memset( self->sum, 0, sizeof(self->sum) );
+    memset( self->sumsq, 0, sizeof(self->sumsq) );
+}
+
+/*Write the statistics of the current window*/
+static void closeWindow( struct gatestats const* self, uint8_t sensor, struct gate_aggregate* out ) {
+    uint32_t const n = self->frames;
+    out->timestamp = self->start;
+    out->duration  = self->window;
+    out->frames    = n;
+    out->sensor    = sensor;
+    for( int i = 0; i < GATESTATS_GATES; ++i ) {
+        /*n * sumsq - sum^2 is exact in 64 bits, the variance is never negative*/
+        uint64_t const sum = self->sum[i];
+        uint64_t const var = (uint64_t)n * self->sumsq[i] - sum * sum;
+        struct gate_summary* g = &out->gate[i];
+        g->min    = self->min[i];
+        g->max    = self->max[i];
+        g->mean   = ( 100 * sum + n / 2 ) / n;
+        g->stddev = 100.0 * sqrt( (double)var ) / n + 0.5;
+    }
+}
+
+static void addGates( struct gatestats* self, int first, uint8_t const* energy ) {
+    for( int j = 0; j < LD2410_MAX_GATES; ++j ) {
+        int const i = first + j;
+        uint32_t const val = energy[j];
+        self->min[i]    = val < self->min[i] ? val : self->min[i];
+        self->max[i]    = val > self->max[i] ? val : self->max[i];
+        self->sum[i]   += val;
+        self->sumsq[i] += val * val;
+    }
+}
+
+void gatestats_init( struct gatestats* self ) {
+    memset( self, 0, sizeof(*self) );
+}
+
+bool gatestats_update( struct gatestats* self, struct dataframe const* data, uint32_t window, struct gate_aggregate* out ) {
+    if( 0 == window ) {
+        return false;
+    }
+
+    bool closed = false;
+    uint64_t const t = data->timestamp;
+    if( 0 == self->frames || t < self->start || self->start + (uint64_t)self->window * 1000 <= t ) {
+        if( self->frames ) {
+            closeWindow( self, data->sensor, out );
+            closed = true;
+        }
+        openWindow( self, t, window );
+    }
+
+    ++self->frames;
+    addGates( self, 0, data->engMovingDistanceGateEnergy );
+    addGates( self, LD2410_MAX_GATES, data->engStaticDistanceGateEnergy );
+    return closed;
+}
+
+bool gatestats_expire( struct gatestats* self, uint64_t now, uint8_t sensor, struct gate_aggregate* out ) {
+    if( 0 == self->frames || now < self->start + (uint64_t)self->window * 1000 ) {
+        return false;
+    }
+    closeWindow( self, sensor, out );
+    self->frames = 0;
+    return true;
+}
@@ -0,0 +1,74 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#ifndef __GATE_STATS__
+#define __GATE_STATS__
+
+#include <stdint.h>
+#include "dataframe.h"
+
+enum {
+    GATESTATS_GATES      = 2 * LD2410_MAX_GATES,  /*Moving gates first, then the static ones*/
+    GATESTATS_MAX_WINDOW = 10 * 3600              /*Longest window in s the sums hold*/
+};
+
+/*Statistics of a gate energy over a window. mean and stddev are in hundredths.*/
+struct gate_summary {
+    uint8_t  min;
+    uint8_t  max;
+    uint16_t mean;
+    uint16_t stddev;
+};
+
+/*Statistics of all the gates of a radar over a window*/
+struct gate_aggregate {
+    uint64_t timestamp;  /*Start of the window, capture time in us*/
+    uint32_t duration;   /*Length of the window in ms*/
+    uint32_t frames;     /*Frames in the window*/
+    uint8_t  sensor;
+    struct gate_summary gate[GATESTATS_GATES];
+};
+
+/*Running statistics of a radar over tumbling windows aligned to multiples of their length.
+Only sums are kept, so a frame costs an add, a multiply and two compares per gate.
+With energies up to 100 the sums of squares hold 2^32 / 10^4 frames, over 10 hours at
+the full rate of the radar.*/
+struct gatestats {
+    uint64_t start;      /*Start of the current window in us*/
+    uint32_t window;     /*Length of the current window in ms*/
+    uint32_t frames;
+    uint8_t  min[GATESTATS_GATES];
+    uint8_t  max[GATESTATS_GATES];
+    uint32_t sum[GATESTATS_GATES];
+    uint32_t sumsq[GATESTATS_GATES];
+};
+
+/**
+ * @brief Initialize the statistics with no window open.
+ * @param self, the statistics */
+void gatestats_init( struct gatestats* self );
+
+/**
+ * @brief Add a frame to the statistics. A frame captured after the end of the window
+ * closes it and opens the next one.
+ * @param self, the statistics
+ * @param data, the frame
+ * @param window, length of the windows in ms, a change takes effect with the next window
+ * @param out, destination of the closed window.
+ * @return true if a window has been closed and written in out. */
+bool gatestats_update( struct gatestats* self, struct dataframe const* data, uint32_t window, struct gate_aggregate* out );
+
+/**
+ * @brief Close the window if it has ended without new frames.
+ * @param self, the statistics
+ * @param now, current time in us, the clock of the capture times
+ * @param sensor, radar of the statistics
+ * @param out, destination of the closed window.
+ * @return true if a window has been closed and written in out. */
+bool gatestats_expire( struct gatestats* self, uint64_t now, uint8_t sensor, struct gate_aggregate* out );
+
+#endif //__GATE_STATS__
@@ -0,0 +1,100 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#include "history-task.h"
+#include <Arduino.h>
+#include "esp_system.h"
+#include "sensor-task.h"
+
+enum {
+    HISTORY_HEAP_RESERVE = 64 * 1024,  /*Kept free for WiFi, MQTT and the web server*/
+    HISTORY_HEAP_SHARE   = 2           /*The history takes 1/2 of the rest*/
+};
+
+static struct frame_history history;
+static SemaphoreHandle_t lock = NULL;
+static uint32_t deviceId = 0;
+static int consumer = -1;
+
+
+/*Memory for the history, taken from the heap free at boot*/
+static size_t historySize( void ) {
+    size_t const freeheap = ESP.getFreeHeap();
+    if( freeheap <= HISTORY_HEAP_RESERVE ) {
+        return 0;
+    }
+    size_t const size = ( freeheap - HISTORY_HEAP_RESERVE ) / HISTORY_HEAP_SHARE;
+    size_t const block = ESP.getMaxAllocHeap();
+    return size < block ? size : block;
+}
+
+bool hist_open( struct history_cursor* cursor, uint64_t from, uint64_t to, uint8_t format ) {
+    if( NULL == lock ) {
+        return false;
+    }
+    xSemaphoreTake( lock, portMAX_DELAY );
+    history_seek( &history, cursor, from, to, format, sensor_getClockOffset(), deviceId );
+    xSemaphoreGive( lock );
+    return true;
+}
+
+size_t hist_read( struct history_cursor* cursor, uint8_t* dest, size_t len ) {
+    xSemaphoreTake( lock, portMAX_DELAY );
+    size_t const size = history_read( &history, cursor, dest, len );
+    xSemaphoreGive( lock );
+    return size;
+}
+
+bool hist_done( struct history_cursor const* cursor ) {
+    xSemaphoreTake( lock, portMAX_DELAY );
+    bool const done = history_done( &history, cursor );
+    xSemaphoreGive( lock );
+    return done;
+}
+
+void hist_getStats( struct hist_stats* dest ) {
+    memset( dest, 0, sizeof(*dest) );
+    if( NULL == lock ) {
+        return;
+    }
+    xSemaphoreTake( lock, portMAX_DELAY );
+    uint32_t const first = history_first( &history );
+    dest->frames   = history.total - first;
+    dest->capacity = history.cap;
+    xSemaphoreGive( lock );
+    uint32_t frames;
+    if( 0 <= consumer ) {
+        sensor_getConsumerStats( consumer, &frames, &dest->drops );
+    }
+}
+
+void hist_task( void * parameter ) {
+
+    size_t const size = historySize( );
+    void* mem = size ? malloc( size ) : NULL;
+    uint32_t const cap = history_init( &history, mem, mem ? size : 0 );
+    Serial.printf("History of %u frames, %u bytes\n", cap, mem ? size : 0);
+    if( 0 == cap ) {
+        vTaskDelete( NULL );
+        return;
+    }
+
+    uint8_t mac[6];
+    esp_read_mac( mac, ESP_MAC_WIFI_STA );
+    deviceId = (uint32_t)mac[2] << 24 | (uint32_t)mac[3] << 16 | (uint32_t)mac[4] << 8 | mac[5];
+    lock = xSemaphoreCreateMutex( );
+    consumer = sensor_subscribe( );
+
+    for(;;) {
+        struct dataframe data;
+        if( waitnewData( consumer, &data ) ) {
+            xSemaphoreTake( lock, portMAX_DELAY );
+            history_append( &history, &data );
+            xSemaphoreGive( lock );
+        }
+    }
+}
@@ -0,0 +1,56 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#ifndef __HISTORY_TASK__
+#define __HISTORY_TASK__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "frame-history.h"
+
+/*Radar frames history counters*/
+struct hist_stats {
+    uint32_t frames;    /*Frames stored now*/
+    uint32_t capacity;  /*Frames that fit in the history*/
+    uint32_t drops;     /*Frames overwritten before the task could store them*/
+};
+
+/**
+ * @brief Freertos task to keep the last radar frames in RAM. The history takes part of
+ * the free heap at boot.
+ * @param parameter */
+void hist_task( void * parameter );
+
+/**
+ * @brief Start reading the frames captured in a range of time.
+ * @param cursor, the reader
+ * @param from, first capture time in ms, esp_timer time
+ * @param to, last capture time in ms, esp_timer time
+ * @param format, FRAME_FORMAT_CSV or FRAME_FORMAT_BINARY
+ * @return false if the history is not available. */
+bool hist_open( struct history_cursor* cursor, uint64_t from, uint64_t to, uint8_t format );
+
+/**
+ * @brief Encode the next frames of a reader, see history_read().
+ * It can be called from any task while the history task keeps storing frames.
+ * @param cursor, reader started with hist_open()
+ * @param dest, destination buffer
+ * @param len, size of the buffer.
+ * @return number of bytes written, 0 at the end of the range or if the buffer can not hold a frame. */
+size_t hist_read( struct history_cursor* cursor, uint8_t* dest, size_t len );
+
+/**
+ * @brief Check if a reader is at the end of its range.
+ * @param cursor, reader started with hist_open() */
+bool hist_done( struct history_cursor const* cursor );
+
+/**
+ * @brief Get a snapshot of the history counters.
+ * @param dest, destination of the counters. */
+void hist_getStats( struct hist_stats* dest );
+
+#endif //__HISTORY_TASK__
@@ -9,6 +9,9 @@
 #include "webserver.h"
 #include "mqtt_task.h"
 #include "sensor-task.h"
+#include "udp-task.h"
+#include "history-task.h"
+#include "adc-task.h"
 #include "config-mng.h"
 #include "SPIFFS.h"
 #include <ArduinoJson.h>
@@ -104,9 +107,14 @@ void setup() {
     tmswitch = xTimerCreate( "tmSwitch",   pdMS_TO_TICKS( 250 ), pdTRUE, NULL, switch_callback );
     interface_init( );
     // Now set up two Tasks to run independently.
+    xTaskCreate( adc_task,        "adc-task",        1024*2   ,NULL  ,  3,  NULL );
     xTaskCreate( webserver_task , "webserver-task",  1024*10  ,NULL  ,  2,  NULL );
     xTaskCreate( ctrl_task ,      "ctrl-task",       1024*3   ,NULL  ,  1,  NULL );
-    xTaskCreate( sensor_task,     "sensor-task",     1024*2   ,NULL  ,  1,  NULL );
+    for( int i = 0; i < sensor_count( ); ++i ) {
+        xTaskCreate( sensor_task, "sensor-task", 1024*2, (void*)(intptr_t)i, 1, NULL );
+    }
+    xTaskCreate( udp_task,        "udp-task",        1024*3   ,NULL  ,  2,  NULL );
+    xTaskCreate( hist_task,       "history-task",    1024*2   ,NULL  ,  1,  NULL );
 
 }
 
@@ -0,0 +1,62 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#include "meas-batch.h"
+#include "payload-codec.h"
+#include <string.h>
+
+static const uint8_t CBOR_ARRAY_OPEN  = 0x9f;   /*Indefinite length array*/
+static const uint8_t CBOR_ARRAY_CLOSE = 0xff;
+
+void measbatch_init( struct measbatch* self ) {
+    self->len = 0;
+    self->count = 0;
+    self->since = 0;
+    self->encoding = PAYLOAD_JSON;
+}
+
+bool measbatch_add( struct measbatch* self, uint8_t const* sample, size_t len, uint8_t encoding, uint32_t now ) {
+    if( self->count && self->encoding != encoding ) {
+        return false;
+    }
+    /*Opening bracket or separator, closing bracket and terminator*/
+    if( MEASBATCH_SIZE < self->len + len + 3 ) {
+        return false;
+    }
+    if( PAYLOAD_CBOR == encoding ) {
+        if( 0 == self->count ) {
+            self->buf[self->len++] = CBOR_ARRAY_OPEN;
+        }
+    }
+    else {
+        self->buf[self->len++] = self->count ? ',' : '[';
+    }
+    memcpy( self->buf + self->len, sample, len );
+    self->len += len;
+    if( 0 == self->count ) {
+        self->since = now;
+        self->encoding = encoding;
+    }
+    ++self->count;
+    return true;
+}
+
+bool measbatch_isDue( struct measbatch const* self, int size, uint32_t delay, uint32_t now ) {
+    return self->count && ( size <= self->count || delay <= now - self->since );
+}
+
+size_t measbatch_finish( struct measbatch* self ) {
+    if( 0 == self->count ) {
+        return 0;
+    }
+    size_t const len = self->len;
+    self->buf[len] = PAYLOAD_CBOR == self->encoding ? CBOR_ARRAY_CLOSE : (uint8_t)']';
+    self->buf[len + 1] = '\0';
+    self->len = 0;
+    self->count = 0;
+    return len + 1;
+}
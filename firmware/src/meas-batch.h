@@ -0,0 +1,61 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#ifndef __MEAS_BATCH__
+#define __MEAS_BATCH__
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    MEASBATCH_SIZE = 4096   /*Bytes of the array payload, closing bracket and terminator included*/
+};
+
+/* Measurement samples waiting to be published as one array payload. The samples are
+   documents of the payload codec, all of them with the same encoding: a JSON array, or
+   an indefinite CBOR array as the number of samples is only known when it is sent.*/
+struct measbatch {
+    uint8_t  buf[MEASBATCH_SIZE];
+    size_t   len;       /*Bytes in buf, without the closing bracket*/
+    int      count;
+    uint32_t since;     /*Time the first sample was added, ms*/
+    uint8_t  encoding;  /*enum payload_encoding of the samples*/
+};
+
+/**
+ * @brief Initialize an empty batch.
+ * @param self, the batch */
+void measbatch_init( struct measbatch* self );
+
+/**
+ * @brief Append a sample to the batch.
+ * @param self, the batch
+ * @param sample, document of the sample
+ * @param len, size of the sample
+ * @param encoding, enum payload_encoding of the sample
+ * @param now, current time in ms
+ * @return false if the sample does not fit, or the samples held have another encoding.
+ * The batch must then be finished and the sample added to the new one. */
+bool measbatch_add( struct measbatch* self, uint8_t const* sample, size_t len, uint8_t encoding, uint32_t now );
+
+/**
+ * @brief Check if the batch holds the configured number of samples or its first sample
+ * has waited the longest delay.
+ * @param self, the batch
+ * @param size, samples per payload
+ * @param delay, longest wait of a sample, ms
+ * @param now, current time in ms */
+bool measbatch_isDue( struct measbatch const* self, int size, uint32_t delay, uint32_t now );
+
+/**
+ * @brief Close the array of the samples held and empty the batch. The payload stays in
+ * buf, followed by a null terminator, until the next sample is added.
+ * @param self, the batch
+ * @return size of the payload, 0 if there were no samples. */
+size_t measbatch_finish( struct measbatch* self );
+
+#endif //__MEAS_BATCH__
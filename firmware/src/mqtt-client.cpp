@@ -0,0 +1,440 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#include "mqtt-client.h"
+#include <string.h>
+
+enum packet_type {
+    CONNECT  = 1,
+    CONNACK  = 2,
+    PUBLISH  = 3,
+    PUBACK   = 4,
+    PINGREQ  = 12,
+    PINGRESP = 13
+};
+
+enum {
+    PUBLISH_DUP = 1 << 3,
+    MAX_CONNECT = 256 + 2 * 64   /*CONNECT with the longest strings of the configuration*/
+};
+
+enum rx_state {
+    RX_HEADER,
+    RX_LENGTH,
+    RX_BODY
+};
+
+/*Header of a queued packet, followed by the packet. A padding record fills the end of
+the queue when the next record does not fit there.*/
+struct record {
+    uint16_t len;      /*Bytes of the packet*/
+    uint16_t id;       /*Packet identifier of a QoS 1 publish*/
+    uint8_t  qos;
+    uint8_t  flags;
+    uint32_t sentAt;   /*Time the packet was written, ms*/
+};
+
+enum record_flags {
+    RECORD_SENT    = 1 << 0,
+    RECORD_DONE    = 1 << 1,   /*Acknowledged, or written with QoS 0*/
+    RECORD_PADDING = 1 << 2
+};
+
+static struct record getRecord( struct mqttc const* self, size_t pos ) {
+    struct record rec;
+    memcpy( &rec, self->queue + pos, sizeof(rec) );
+    return rec;
+}
+
+static void setRecord( struct mqttc* self, size_t pos, struct record const* rec ) {
+    memcpy( self->queue + pos, rec, sizeof(*rec) );
+}
+
+/*Position of the record at pos, once the end of the queue is skipped*/
+static size_t wrap( struct mqttc const* self, size_t pos ) {
+    if( MQTTC_QUEUE_SIZE - pos < sizeof(struct record) ) {
+        return 0;
+    }
+    return getRecord( self, pos ).flags & RECORD_PADDING ? 0 : pos;
+}
+
+static size_t nextRecord( struct mqttc const* self, size_t pos ) {
+    return pos + sizeof(struct record) + getRecord( self, pos ).len;
+}
+
+static size_t used( struct mqttc const* self ) {
+    if( 0 == self->records ) {
+        return 0;
+    }
+    return self->tail < self->head ? self->head - self->tail : MQTTC_QUEUE_SIZE - self->tail + self->head;
+}
+
+/*Free the records done at the start of the queue*/
+static void reclaim( struct mqttc* self ) {
+    while( self->records ) {
+        size_t const pos = wrap( self, self->tail );
+        struct record const rec = getRecord( self, pos );
+        if( !( rec.flags & RECORD_DONE ) ) {
+            break;
+        }
+        if( self->records == self->unsent ) {
+            /*Done before being written again after a reconnection*/
+            self->send = nextRecord( self, pos );
+            --self->unsent;
+        }
+        self->tail = nextRecord( self, pos );
+        --self->records;
+    }
+    if( 0 == self->records ) {
+        self->tail = self->send = self->head = 0;
+        self->sendOffset = 0;
+    }
+    self->stats.queued = used( self );
+}
+
+/*Reserve room for a record of len bytes at the end of the queue, return its position
+or -1 if it does not fit*/
+static long reserve( struct mqttc* self, size_t len ) {
+    size_t const need = sizeof(struct record) + len;
+    if( 0 == self->records ) {
+        self->tail = self->send = self->head = 0;
+    }
+    else if( 0 == self->unsent ) {
+        self->send = self->head;
+    }
+    bool const full = self->records && self->head == self->tail;
+    if( full || MQTTC_QUEUE_SIZE < need ) {
+        return -1;
+    }
+    if( self->head < self->tail ) {
+        return need <= self->tail - self->head ? (long)self->head : -1;
+    }
+    if( need <= MQTTC_QUEUE_SIZE - self->head ) {
+        return self->head;
+    }
+    if( 0 == self->records || need <= self->tail ) {
+        if( sizeof(struct record) <= MQTTC_QUEUE_SIZE - self->head ) {
+            struct record const pad = { 0, 0, 0, RECORD_PADDING, 0 };
+            setRecord( self, self->head, &pad );
+        }
+        if( 0 == self->unsent ) {
+            self->send = 0;
+        }
+        return 0;
+    }
+    return -1;
+}
+
+static uint8_t* putU16( uint8_t* dest, uint16_t val ) {
+    dest[0] = val >> 8;
+    dest[1] = val;
+    return dest + 2;
+}
+
+static uint8_t* putString( uint8_t* dest, char const* str, size_t len ) {
+    dest = putU16( dest, len );
+    memcpy( dest, str, len );
+    return dest + len;
+}
+
+/*Fixed header with its variable length remaining length*/
+static uint8_t* putHeader( uint8_t* dest, uint8_t type, uint32_t remaining ) {
+    *dest++ = type;
+    do {
+        uint8_t byte = remaining & 0x7f;
+        remaining >>= 7;
+        *dest++ = byte | ( remaining ? 0x80 : 0 );
+    } while( remaining );
+    return dest;
+}
+
+static size_t headerSize( uint32_t remaining ) {
+    return remaining < 128 ? 2 : remaining < 16384 ? 3 : remaining < 2097152 ? 4 : 5;
+}
+
+static void closeConnection( struct mqttc* self ) {
+    self->ops->close( self->ctx );
+    mqttc_disconnected( self );
+}
+
+/*Write a control packet, only between two publishes*/
+static bool writeControl( struct mqttc* self, uint8_t const* packet, size_t len, uint32_t now ) {
+    if( self->sendOffset || len != self->ops->write( self->ctx, packet, len ) ) {
+        return false;
+    }
+    self->lastTx = now;
+    return true;
+}
+
+static void acknowledge( struct mqttc* self, uint16_t id, uint32_t now ) {
+    if( 0 == self->records ) {
+        return;
+    }
+    size_t pos = wrap( self, self->tail );
+    for( uint32_t i = self->unsent; i < self->records; ++i, pos = wrap( self, nextRecord( self, pos ) ) ) {
+        struct record rec = getRecord( self, pos );
+        if( id != rec.id || 0 == rec.qos || ( rec.flags & RECORD_DONE ) || !( rec.flags & RECORD_SENT ) ) {
+            continue;
+        }
+        rec.flags |= RECORD_DONE;
+        setRecord( self, pos, &rec );
+        --self->stats.inflight;
+        ++self->stats.acked;
+        uint32_t const latency = now - rec.sentAt;
+        self->stats.latencySum += latency;
+        self->stats.latencyMax = latency > self->stats.latencyMax ? latency : self->stats.latencyMax;
+        if( self->ops->acked ) {
+            self->ops->acked( self->ctx, id );
+        }
+        break;
+    }
+    reclaim( self );
+}
+
+static void packet( struct mqttc* self, uint32_t now ) {
+    uint8_t const* body = self->rxBody;
+    switch( self->rxType >> 4 ) {
+        case CONNACK:
+            if( MQTTC_CONNECTING != self->state ) {
+                break;
+            }
+            if( 2 <= self->rxLen && 0 == body[1] ) {
+                self->state = MQTTC_CONNECTED;
+                self->since = now;
+            }
+            else {
+                ++self->stats.refused;
+                closeConnection( self );
+            }
+            break;
+        case PUBACK:
+            if( 2 <= self->rxLen ) {
+                acknowledge( self, body[0] << 8 | body[1], now );
+            }
+            break;
+        case PINGRESP:
+            self->pingPending = false;
+            break;
+        default:
+            /*No subscriptions, anything else is ignored*/
+            break;
+    }
+}
+
+void mqttc_init( struct mqttc* self, struct mqttc_ops const* ops, void* ctx ) {
+    memset( self, 0, sizeof(*self) );
+    self->ops = ops;
+    self->ctx = ctx;
+    self->nextId = 1;
+    self->cfg.window = 1;
+}
+
+void mqttc_configure( struct mqttc* self, struct mqttc_config const* cfg ) {
+    self->cfg = *cfg;
+    uint8_t const window = cfg->window < MQTTC_MAX_WINDOW ? cfg->window : (uint8_t)MQTTC_MAX_WINDOW;
+    self->cfg.window = window < 1 ? 1 : window;
+}
+
+void mqttc_connected( struct mqttc* self, uint32_t now ) {
+    mqttc_disconnected( self );
+    char const* const id   = self->cfg.clientId ? self->cfg.clientId : "";
+    char const* const user = self->cfg.username && self->cfg.username[0] ? self->cfg.username : NULL;
+    char const* const pass = user && self->cfg.password ? self->cfg.password : NULL;
+    size_t const idLen   = strnlen( id, 64 );
+    size_t const userLen = user ? strnlen( user, 64 ) : 0;
+    size_t const passLen = pass ? strnlen( pass, 64 ) : 0;
+
+    uint32_t const remaining = 10 + 2 + idLen + ( user ? 2 + userLen : 0 ) + ( pass ? 2 + passLen : 0 );
+    uint8_t packet[MAX_CONNECT];
+    uint8_t* dest = putHeader( packet, CONNECT << 4, remaining );
+    dest = putString( dest, "MQTT", 4 );
+    *dest++ = 4;   /*Protocol level of 3.1.1*/
+    *dest++ = ( user ? 1 << 7 : 0 ) | ( pass ? 1 << 6 : 0 ) | 1 << 1;  /*Clean session*/
+    dest = putU16( dest, self->cfg.keepalive );
+    dest = putString( dest, id, idLen );
+    if( user ) {
+        dest = putString( dest, user, userLen );
+    }
+    if( pass ) {
+        dest = putString( dest, pass, passLen );
+    }
+
+    self->state = MQTTC_CONNECTING;
+    self->since = now;
+    if( !writeControl( self, packet, dest - packet, now ) ) {
+        closeConnection( self );
+        return;
+    }
+    self->ops->flush( self->ctx );
+}
+
+void mqttc_disconnected( struct mqttc* self ) {
+    self->state = MQTTC_DISCONNECTED;
+    self->rxState = RX_HEADER;
+    self->pingPending = false;
+    self->stats.inflight = 0;
+    if( self->records ) {
+        /*A publish written in part is sent again from its start*/
+        size_t pos = wrap( self, self->tail );
+        for( uint32_t i = self->unsent; i < self->records; ++i, pos = wrap( self, nextRecord( self, pos ) ) ) {
+            struct record rec = getRecord( self, pos );
+            if( !( rec.flags & RECORD_SENT ) || ( rec.flags & RECORD_DONE ) ) {
+                continue;
+            }
+            if( rec.qos ) {
+                rec.flags &= ~RECORD_SENT;
+                self->queue[pos + sizeof(rec)] |= PUBLISH_DUP;
+                ++self->stats.resent;
+            }
+            else {
+                rec.flags |= RECORD_DONE;
+            }
+            setRecord( self, pos, &rec );
+        }
+    }
+    self->send = self->tail;
+    self->unsent = self->records;
+    self->sendOffset = 0;
+    reclaim( self );
+}
+
+void mqttc_received( struct mqttc* self, uint8_t const* data, size_t len, uint32_t now ) {
+    for( size_t i = 0; i < len && MQTTC_DISCONNECTED != self->state; ++i ) {
+        uint8_t const byte = data[i];
+        switch( self->rxState ) {
+            case RX_HEADER:
+                self->rxType  = byte;
+                self->rxLen   = 0;
+                self->rxShift = 0;
+                self->rxState = RX_LENGTH;
+                break;
+            case RX_LENGTH:
+                self->rxLen |= (uint32_t)( byte & 0x7f ) << self->rxShift;
+                self->rxShift += 7;
+                if( byte & 0x80 ) {
+                    if( 21 < self->rxShift ) {
+                        /*Malformed remaining length*/
+                        closeConnection( self );
+                    }
+                    break;
+                }
+                self->rxPos = 0;
+                self->rxState = 0 == self->rxLen ? RX_HEADER : RX_BODY;
+                if( 0 == self->rxLen ) {
+                    packet( self, now );
+                }
+                break;
+            case RX_BODY:
+                if( self->rxPos < MQTTC_RX_BODY ) {
+                    self->rxBody[self->rxPos] = byte;
+                }
+                if( ++self->rxPos == self->rxLen ) {
+                    self->rxState = RX_HEADER;
+                    packet( self, now );
+                }
+                break;
+        }
+    }
+}
+
+int mqttc_publish( struct mqttc* self, char const* topic, void const* payload, size_t len, uint8_t qos ) {
+    size_t const topicLen = strlen( topic );
+    qos = qos ? 1 : 0;
+    uint32_t const remaining = 2 + topicLen + ( qos ? 2 : 0 ) + len;
+    size_t const size = headerSize( remaining ) + remaining;
+    long const pos = UINT16_MAX < size ? -1 : reserve( self, size );
+    if( pos < 0 ) {
+        ++self->stats.rejected;
+        return -1;
+    }
+
+    uint16_t id = 0;
+    if( qos ) {
+        id = self->nextId;
+        self->nextId = UINT16_MAX == self->nextId ? 1 : self->nextId + 1;
+    }
+    struct record const rec = { (uint16_t)size, id, qos, 0, 0 };
+    setRecord( self, pos, &rec );
+    uint8_t* dest = self->queue + pos + sizeof(rec);
+    dest = putHeader( dest, PUBLISH << 4 | qos << 1, remaining );
+    dest = putString( dest, topic, topicLen );
+    if( qos ) {
+        dest = putU16( dest, id );
+    }
+    memcpy( dest, payload, len );
+
+    self->head = pos + sizeof(rec) + size;
+    ++self->records;
+    ++self->unsent;
+    self->stats.queued = used( self );
+    return id;
+}
+
+void mqttc_poll( struct mqttc* self, uint32_t now ) {
+    if( MQTTC_CONNECTING == self->state && MQTTC_CONNACK_TIMEOUT <= now - self->since ) {
+        ++self->stats.timeouts;
+        closeConnection( self );
+        return;
+    }
+    if( MQTTC_CONNECTED != self->state ) {
+        return;
+    }
+
+    bool written = false;
+    while( self->unsent ) {
+        size_t const pos = wrap( self, self->send );
+        struct record rec = getRecord( self, pos );
+        if( rec.flags & RECORD_DONE ) {
+            self->send = nextRecord( self, pos );
+            --self->unsent;
+            continue;
+        }
+        if( 0 == self->sendOffset && rec.qos && self->cfg.window <= self->stats.inflight ) {
+            break;
+        }
+        uint8_t const* packet = self->queue + pos + sizeof(rec);
+        size_t const n = self->ops->write( self->ctx, packet + self->sendOffset, rec.len - self->sendOffset );
+        written = written || n;
+        self->sendOffset += n;
+        if( self->sendOffset < rec.len ) {
+            break;
+        }
+        self->sendOffset = 0;
+        self->lastTx = now;
+        rec.flags |= RECORD_SENT | ( rec.qos ? 0 : RECORD_DONE );
+        rec.sentAt = now;
+        setRecord( self, pos, &rec );
+        self->stats.inflight += rec.qos;
+        ++self->stats.published;
+        self->send = nextRecord( self, pos );
+        --self->unsent;
+    }
+    reclaim( self );
+
+    uint32_t const keepalive = (uint32_t)self->cfg.keepalive * 1000;
+    if( keepalive && self->pingPending && keepalive <= now - self->pingAt ) {
+        ++self->stats.timeouts;
+        closeConnection( self );
+        return;
+    }
+    if( keepalive && !self->pingPending && keepalive <= now - self->lastTx ) {
+        uint8_t const ping[] = { PINGREQ << 4, 0 };
+        if( writeControl( self, ping, sizeof(ping), now ) ) {
+            self->pingPending = true;
+            self->pingAt = now;
+            written = true;
+        }
+    }
+    if( written ) {
+        self->ops->flush( self->ctx );
+    }
+}
+
+char const* mqttc_stateName( uint8_t state ) {
+    static char const* const names[] = { "disconnected", "connecting", "connected" };
+    return state < sizeof(names) / sizeof(names[0]) ? names[state] : "unknown";
+}
@@ -0,0 +1,143 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#ifndef __MQTT_CLIENT__
+#define __MQTT_CLIENT__
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+    MQTTC_QUEUE_SIZE      = 8 * 1024, /*Publish packets waiting and in flight*/
+    MQTTC_MAX_WINDOW      = 16,       /*QoS 1 publishes sent without their PUBACK*/
+    MQTTC_CONNACK_TIMEOUT = 10000,    /*Wait for the broker answer to CONNECT, ms*/
+    MQTTC_RX_BODY         = 4         /*Bytes kept of a received packet, enough for the acks*/
+};
+
+enum mqttc_state {
+    MQTTC_DISCONNECTED,
+    MQTTC_CONNECTING,    /*CONNECT sent, waiting for CONNACK*/
+    MQTTC_CONNECTED
+};
+
+/*Transport of the client, a TCP connection. None of the calls may block.*/
+struct mqttc_ops {
+    size_t (*write)( void* ctx, uint8_t const* data, size_t len ); /*Copy bytes to send, return the number taken*/
+    void (*flush)( void* ctx );                    /*Send the bytes written*/
+    void (*close)( void* ctx );
+    void (*acked)( void* ctx, uint16_t id );       /*A QoS 1 publish has been acknowledged, may be NULL*/
+};
+
+struct mqttc_config {
+    char const* clientId;
+    char const* username;  /*NULL or empty for none*/
+    char const* password;
+    uint16_t keepalive;    /*Seconds, 0 disables it*/
+    uint8_t  window;       /*QoS 1 publishes in flight, 1 to MQTTC_MAX_WINDOW*/
+};
+
+struct mqttc_stats {
+    uint32_t published;   /*Publish packets written to the transport*/
+    uint32_t acked;       /*QoS 1 publishes acknowledged*/
+    uint32_t rejected;    /*Publishes refused because the queue was full*/
+    uint32_t resent;      /*QoS 1 publishes sent again after a reconnection*/
+    uint32_t refused;     /*Connections refused by the broker*/
+    uint32_t timeouts;    /*Connections closed without an answer of the broker*/
+    uint32_t latencySum;  /*Time from the publish to its PUBACK, ms*/
+    uint32_t latencyMax;
+    uint32_t queued;      /*Bytes waiting or in flight*/
+    uint8_t  inflight;
+};
+
+/* MQTT 3.1.1 client without I/O of its own. The publish packets are encoded into a
+   queue and written to the transport as it takes them, up to a window of QoS 1
+   publishes without their PUBACK. The broker acknowledges them in order. A QoS 1
+   publish is kept until acknowledged and sent again with the DUP flag after a
+   reconnection, a QoS 0 one is dropped once written. The publishes are accepted
+   while disconnected, and refused once the queue is full.*/
+struct mqttc {
+    struct mqttc_ops const* ops;
+    void*    ctx;
+    struct mqttc_config cfg;
+    uint8_t  state;         /*enum mqttc_state*/
+    uint8_t  queue[MQTTC_QUEUE_SIZE];
+    size_t   tail;          /*Oldest record*/
+    size_t   send;          /*Next record to write*/
+    size_t   head;          /*Position of the next record*/
+    size_t   sendOffset;    /*Bytes of the record at send already written*/
+    uint32_t records;
+    uint32_t unsent;        /*Records from send on, not written yet*/
+    uint16_t nextId;
+    uint32_t since;         /*Time the state was entered, ms*/
+    uint32_t lastTx;        /*Time of the last packet written, ms*/
+    bool     pingPending;
+    uint32_t pingAt;
+    /*Parser of the received packets*/
+    uint8_t  rxState;
+    uint8_t  rxType;
+    uint8_t  rxShift;
+    uint32_t rxLen;
+    uint32_t rxPos;
+    uint8_t  rxBody[MQTTC_RX_BODY];
+    struct mqttc_stats stats;
+};
+
+/**
+ * @brief Initialize a disconnected client with an empty queue.
+ * @param self, the client
+ * @param ops, transport
+ * @param ctx, argument of the transport calls */
+void mqttc_init( struct mqttc* self, struct mqttc_ops const* ops, void* ctx );
+
+/**
+ * @brief Set the session parameters, used by the next connection.
+ * @param self, the client
+ * @param cfg, the parameters, the strings must stay valid */
+void mqttc_configure( struct mqttc* self, struct mqttc_config const* cfg );
+
+/**
+ * @brief The transport has connected, send CONNECT.
+ * @param self, the client
+ * @param now, current time in ms */
+void mqttc_connected( struct mqttc* self, uint32_t now );
+
+/**
+ * @brief The transport has disconnected. The QoS 1 publishes not acknowledged are sent
+ * again on the next connection.
+ * @param self, the client */
+void mqttc_disconnected( struct mqttc* self );
+
+/**
+ * @brief Process bytes received from the transport.
+ * @param self, the client
+ * @param data, the bytes
+ * @param len, number of bytes
+ * @param now, current time in ms */
+void mqttc_received( struct mqttc* self, uint8_t const* data, size_t len, uint32_t now );
+
+/**
+ * @brief Queue a publish. It is written by the next mqttc_poll().
+ * @param self, the client
+ * @param topic, the topic
+ * @param payload, the payload
+ * @param len, size of the payload
+ * @param qos, 0 or 1
+ * @return packet identifier of a QoS 1 publish, 0 for QoS 0, -1 if the queue is full. */
+int mqttc_publish( struct mqttc* self, char const* topic, void const* payload, size_t len, uint8_t qos );
+
+/**
+ * @brief Write the queued publishes the window allows, and the keepalive pings.
+ * @param self, the client
+ * @param now, current time in ms */
+void mqttc_poll( struct mqttc* self, uint32_t now );
+
+/**
+ * @brief Get the name of a state.
+ * @param state, enum mqttc_state */
+char const* mqttc_stateName( uint8_t state );
+
+#endif //__MQTT_CLIENT__
@@ -9,39 +9,42 @@
 #include "SPIFFS.h"
 #include "ESPAsyncWebServer.h"
 #include <ArduinoJson.h>
-#include <PubSubClient.h>
+#include <AsyncTCP.h>
 #include <HTTPClient.h>
 #include "webserver.h"
 #include "config-mng.h"
 #include "mqtt_task.h"
 #include "time.h"
 #include "uinterface.h"
-#include "json-maker/json-maker.h"
+#include "payload-codec.h"
+#include "mqtt-client.h"
+#include "meas-batch.h"
 
 #include "Wire.h"
 #include "SHTSensor.h"
 #include "sensor-task.h"
-
-#include <AsyncUDP.h>
+#include "adc-task.h"
+#include "adc-filter.h"
+#include "calibration.h"
+#include "wifi-fsm.h"
 
 
 enum {
     verbose = 1
 };
 
-/*Calibration equation*/
-struct caleq {
-    double m;
-    double b;
-};
+/*The MQTT publishing of ctrl_task is left out of the build, the bridge streams the radar
+frames over UDP. Its helpers are only built with it.*/
+#define CTRL_MQTT 0
 
-WiFiClient wifiClient;
-PubSubClient client(wifiClient);
+/*The broker connection runs on the AsyncTCP task, its callbacks only pass the events
+and the received bytes to ctrl_task, which owns the MQTT client*/
+static AsyncClient tcp;
+static StreamBufferHandle_t rxStream;
+static struct mqttc mqtt;
 
 SHTSensor sht;
 
-AsyncUDP udp;
-
 
 /*Create a static freertos timer*/
 static TimerHandle_t tmPubMeasurement;
@@ -51,8 +54,11 @@ static bool isServerActive = false;
 
 /* Declare a variable to hold the created event group. */
 static EventGroupHandle_t events;
+#if CTRL_MQTT
 static struct service_config scfg;
-static struct caleq eq = { .m = 1.0, .b = 0.0 };
+#endif
+/*Calibration of the 4-20 mA channel, rebuilt when the points change*/
+static struct caltable caltable;
 
 static struct ctrl_status {
     int relay1 = LOW;
@@ -61,18 +67,27 @@ static struct ctrl_status {
 } ctrlStatus;
 
 enum {
-    JSON_TX_SIZE = 512
+    JSON_TX_SIZE    = 512,
+    MQTT_RX_SIZE    = 1024,  /*Bytes received from the broker waiting for ctrl_task*/
+    MQTT_KEEPALIVE  = 60,    /*Seconds*/
+    MQTT_RETRY      = 5000   /*Time between connection attempts, ms*/
 };
 
-static char payload_json[JSON_TX_SIZE];
+#if CTRL_MQTT
+static uint8_t payload_json[JSON_TX_SIZE];
+#endif
+static struct measbatch batch;
+
+static_assert( JSON_TX_SIZE + 3 <= MEASBATCH_SIZE, "A sample must fit an empty batch" );
 
 enum flags {
     START_AP_WIFI = 1 << 0,
-    CONNECT_WIFI  = 1 << 1,
     CONNECT_MQTT  = 1 << 2,
     PUB_INFO      = 1 << 3,
     PUB_STATUS    = 1 << 4,
-    PUB_MEASURES  = 1 << 5
+    PUB_MEASURES  = 1 << 5,
+    MQTT_TCP_UP   = 1 << 6,
+    MQTT_TCP_DOWN = 1 << 7
 };
 
 struct sensors{ 
@@ -80,42 +95,110 @@ struct sensors{
     int (*getsample)( struct sensors const*, double* ); 
     char const* unit;
     struct {
-        double min;
-        double max;
-    } const range;
+        double gain;     /*Units per mA of the 4-20 mA loop*/
+        double offset;
+    } const scale;
+    int (*getpeaks)( struct sensors const*, double* low, double* high ); /*NULL if not tracked*/
 };
 
-static double mapf(double val, double in_min, double in_max, double out_min, double out_max) {
-    
-    val = val < in_min ? in_min : val;
-    val = val > in_max ? in_max : val;
-    return (val - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
-}
+/*Physical devices behind the measurements*/
+enum device {
+    DEV_SHT3X,
+    DEV_ADC,
+    DEV_COUNT
+};
 
-static int get_sht3x_temperature( struct sensors const* self, double* value ) {
+/*Values read from a device in a sampling cycle*/
+struct devsample {
+    uint32_t cycle;
+    int err;
+    double val[3];
+};
+
+/*Each device of the configured sensors is read once per cycle, and the measurements
+of the payload take their values from here*/
+static struct samplecache {
+    uint32_t cycle;
+    uint64_t timestamp;   /*Wall clock time of the cycle, ms*/
+    struct devsample dev[DEV_COUNT];
+} cache;
 
+#if CTRL_MQTT
+static int acquire_sht3x( struct devsample* dest ) {
     int st = sht.readSample();
     if ( st == 0 )
         return -1;
 
-    *value = sht.getTemperature();
+    dest->val[0] = sht.getTemperature();
+    dest->val[1] = sht.getHumidity();
     return 0;
 }
 
-static int get_sht3x_humidity( struct sensors const* self, double* value ) {
-    int st = sht.readSample();
-    if ( st == 0 )
+/*The adc task keeps the filtered value and the peaks since the previous cycle, this
+does not wait for the bus*/
+static int acquire_adc( struct devsample* dest ) {
+    int32_t filtered;
+    int low, high;
+    if( !adc_getFiltered( &filtered ) )
+        return -1;
+
+    /*The filtered value keeps its fraction, the calibration interpolates within a code*/
+    double const raw = filtered / (double)( 1 << ADCFILTER_FRAC );
+    if( !adc_takePeaks( ADC_PEAKS_MQTT, &low, &high ) ) {
+        low = high = adcfilter_toCode( filtered );
+    }
+    dest->val[0] = raw;
+    dest->val[1] = low;
+    dest->val[2] = high;
+    return 0;
+}
+
+static int (* const acquire[DEV_COUNT])( struct devsample* ) = {
+    acquire_sht3x,
+    acquire_adc
+};
+#endif
+
+/*Get a value of a device read in the current cycle*/
+static int getCached( enum device dev, int idx, double* value ) {
+    struct devsample const* s = &cache.dev[dev];
+    if( s->cycle != cache.cycle || s->err )
         return -1;
 
-    *value = sht.getHumidity();
+    *value = s->val[idx];
     return 0;
 }
 
+static int get_sht3x_temperature( struct sensors const* self, double* value ) {
+    return getCached( DEV_SHT3X, 0, value );
+}
+
+static int get_sht3x_humidity( struct sensors const* self, double* value ) {
+    return getCached( DEV_SHT3X, 1, value );
+}
+
+static double gas_scale( struct sensors const* self, double raw ) {
+    int32_t const code = (int32_t)lround( raw * ( 1 << CAL_FRAC ) );
+    double cali = caltable_get( &caltable, code ) / (double)( 1 << CAL_FRAC );
+    cali = cali < 4.0 ? 4.0 : cali > 20.0 ? 20.0 : cali;
+    return self->scale.gain * cali + self->scale.offset;
+}
+
 static int get_gas_sensor( struct sensors const* self, double* value ){
-    double raw = board_getadcValue();
-    double cali =  eq.m * raw + eq.b;
-    *value = mapf( cali, 4.0, 20.0, self->range.min, self->range.max );
-    Serial.printf("%s: %f -> %f -> %f %s\n", self->id, raw, cali, *value, self->unit );
+    double raw;
+    if( getCached( DEV_ADC, 0, &raw ) )
+        return -1;
+    *value = gas_scale( self, raw );
+    Serial.printf("%s: %f -> %f %s\n", self->id, raw, *value, self->unit );
+    return 0;
+}
+
+static int get_gas_peaks( struct sensors const* self, double* low, double* high ){
+    double rawlow, rawhigh;
+    if( getCached( DEV_ADC, 1, &rawlow ) || getCached( DEV_ADC, 2, &rawhigh ) )
+        return -1;
+    *low = gas_scale( self, rawlow );
+    *high = gas_scale( self, rawhigh );
     return 0;
 }
 
@@ -131,22 +214,50 @@ void init_sht3x( void ) {
 
 
 
+/*Gas sensor of a 4-20 mA loop, the range from 4 mA to 20 mA is scaled at compile time*/
+static constexpr struct sensors gas( char const* id, double min, double max ) {
+    return { id, get_gas_sensor, "ppm", { ( max - min ) / 16.0, min - 4.0 * ( max - min ) / 16.0 }, get_gas_peaks };
+}
+
 struct source2sensor{ 
     char const* source; 
     void (*init)( void );
+    enum device device;
     struct sensors const sensors[2];
     int len;
-} 
-const src2sens[] = {
-    { "Temperature", init_sht3x,
+};
+
+/*Catalog of the sensors that can be configured, by their source name*/
+static constexpr struct source2sensor src2sens[] = {
+    { "Temperature", init_sht3x, DEV_SHT3X,
         {{ "temp_air", get_sht3x_temperature, "ºC" },
          { "hum_air", get_sht3x_humidity, "%" }}
         , 2 },
-    { "CH4", board_initadc, {{ "ch4", get_gas_sensor, "ppm", { 0.0, 10000.0} }}, 1 }, /*ppm = LIE*10000*/
-    { "H2S", board_initadc, {{ "h2s", get_gas_sensor, "ppm", { 0.0, 100.0} }}, 1 },
-    { "NH3", board_initadc, {{ "nh3", get_gas_sensor, "ppm", { 0.0, 100.0} }}, 1 }
+    { "CH4", NULL, DEV_ADC, { gas( "ch4", 0.0, 10000.0 ) }, 1 }, /*ppm = LIE*10000*/
+    { "H2S", NULL, DEV_ADC, { gas( "h2s", 0.0, 100.0 ) }, 1 },
+    { "NH3", NULL, DEV_ADC, { gas( "nh3", 0.0, 100.0 ) }, 1 }
 };
 
+enum {
+    SENSORS_CONFIGURED = 2,   /*cfg.cal.id_sens_1 and id_sens_2*/
+    MAX_MEASUREMENTS   = SENSORS_CONFIGURED * 2
+};
+
+/*Measurements of the configured sensors, resolved from the catalog when the
+calibration changes. The publish path does not look up the names.*/
+static struct activesensors {
+    struct sensors const* meas[MAX_MEASUREMENTS];
+    uint8_t count;
+    uint8_t devices;   /*Bit mask of enum device read each cycle*/
+} active;
+
+#if CTRL_MQTT
+/*Publishing periods of the topics, ms, resolved when the service configuration is taken*/
+static struct {
+    int measures;
+    int status;
+} periods;
+
 
 /*Print local time and date, used for debugging purposes*/
 static void printLocalTime(){
@@ -185,6 +296,7 @@ static void printLocalTime(){
         Serial.println();
     }
 }
+#endif
 
 /*Print access point configuration*/
 static void print_APcfg( struct ap_config const* ap ) {
@@ -195,66 +307,97 @@ static void print_APcfg( struct ap_config const* ap ) {
 }
 
 
-/*Calculate the equation of a straight line used to calibrate*/
-static void getCalibrationEquation( struct caleq* eq, double x0, double y0, double x1, double y1 ) {
-    double num = 0 == (x1 - x0 ) ? 1 : (x1 - x0 );
-    eq->m = (y1 - y0) / num;
-    eq->b = y0 - eq->m * x0;
+/*Fill the calibration table from the configured points*/
+static void updateCalibration( struct acq_cal const* cal ) {
+    caltable_build( &caltable, cal->val, cal->count );
     if( verbose ) {
-        Serial.printf("Calibration equation: y = %.2f * x %c%.2f\n", eq->m, eq->b > 0.0 ? '+' : ' ', eq->b);
+        Serial.printf("Calibration of %d points\n", cal->count );
+    }
+}
+
+/*Resolve the configured sensors into the active measurements, and initialize their
+devices the first time they are used*/
+static void sensors_resolve( struct acq_cal const* cal ) {
+    static uint8_t initialized = 0;
+    char const* const names[SENSORS_CONFIGURED] = { cal->id_sens_1, cal->id_sens_2 };
+    struct activesensors res;
+    memset( &res, 0, sizeof(res) );
+    for( int n = 0; n < SENSORS_CONFIGURED; ++n ) {
+        for( int i = 0; i < sizeof(src2sens)/sizeof(src2sens[0]); ++i ) {
+            struct source2sensor const* src = &src2sens[i];
+            if ( strcmp( names[n], src->source) != 0 )
+                continue;
+
+            for( int j = 0; j < src->len; ++j ) { 
+                res.meas[res.count++] = &src->sensors[j];
+            }
+            uint8_t const mask = 1 << src->device;
+            res.devices |= mask;
+            if( src->init && !( initialized & mask ) ) {
+                src->init();
+            }
+            initialized |= mask;
+        }
     }
+    active = res;
 }
 
-void sensors_init( char const* name ) {
-    for( int i = 0; i < sizeof(src2sens)/sizeof(src2sens[0]); ++i ) {
-        if ( strcmp( name, src2sens[i].source) == 0 ) {
-            src2sens[i].init();
+#if CTRL_MQTT
+/*Start a sampling cycle, reading each device of the configured sensors once. Two gas
+sensors share the ADC.*/
+static void sensors_acquire( void ) {
+    time_t now;
+    time( &now );
+    ++cache.cycle;
+    cache.timestamp = (uint64_t)now*1000;
+    for( int dev = 0; dev < DEV_COUNT; ++dev ) {
+        if( active.devices & ( 1 << dev ) ) {
+            struct devsample* s = &cache.dev[dev];
+            s->err = acquire[dev]( s );
+            s->cycle = cache.cycle;
         }
     }
 }
 
-static char* json_measurement( char* dest, struct sensors const* measurement, size_t* remlen ) {                       
+static void put_measurement( struct payload* doc, struct sensors const* measurement ) {
 
     double value = 0;
     int err = measurement->getsample( measurement, &value );
 
-    dest = json_objOpen( dest, measurement->id, remlen ); 
-    dest = json_double( dest, "value", value, remlen ); 
-    /* Add a context object property in a JSON string. */
-    dest = json_objOpen( dest, "context", remlen );
-    dest = json_str( dest, "unit",   measurement->unit , remlen  );
-    dest = json_str( dest, "status", err ? "fail":"ok" , remlen );
-    dest = json_objClose( dest, remlen );
-    
-    dest = json_objClose( dest, remlen ); 
-    
-    return dest;
+    payload_objOpen( doc, measurement->id );
+    payload_double( doc, "value", value );
+    /*Lowest and highest values since the previous measurement*/
+    double low, high;
+    if( measurement->getpeaks && 0 == measurement->getpeaks( measurement, &low, &high ) ) {
+        payload_double( doc, "min", low );
+        payload_double( doc, "max", high );
+    }
+    /* Add a context object property. */
+    payload_objOpen( doc, "context" );
+    payload_str( doc, "unit", measurement->unit );
+    payload_str( doc, "status", err ? "fail":"ok" );
+    payload_objClose( doc );
+
+    payload_objClose( doc );
 }
 
-static char* json_sensor( char* dest, char const* name, size_t* remlen ) {
-    for( int i = 0; i < sizeof(src2sens)/sizeof(src2sens[0]); ++i ) {
-        if ( strcmp( name, src2sens[i].source) == 0 ) {
-            for( int j = 0; j < src2sens[i].len; ++j ) { 
-                dest = json_measurement( dest, &src2sens[i].sensors[j], remlen );
-            }
-        }
+static void put_sensors( struct payload* doc ) {
+    for( int i = 0; i < active.count; ++i ) {
+        put_measurement( doc, active.meas[i] );
     }
-    return dest;
 }
 
-static char* json_timestampMs( char* dest, char const* name, size_t* remlen ) {
+static void put_timestampMs( struct payload* doc, char const* name ) {
     time_t now;
     time( &now );
-    dest = json_verylong( dest, name, (uint64_t)now*1000, remlen );
-    return dest;
+    payload_uint( doc, name, (uint64_t)now*1000 );
 }
 
-static char* json_location( char* dest, char const* name, size_t* remlen ) {
-    dest = json_objOpen( dest, name, remlen ); 
-    dest = json_double( dest, "lat", cfg.service.geo.lat, remlen );
-    dest = json_double( dest, "lng", cfg.service.geo.lng, remlen );
-    dest = json_objClose( dest, remlen ); 
-    return dest;
+static void put_location( struct payload* doc, char const* name ) {
+    payload_objOpen( doc, name );
+    payload_double( doc, "lat", cfg.service.geo.lat );
+    payload_double( doc, "lng", cfg.service.geo.lng );
+    payload_objClose( doc );
 }
 
 enum jsontype {
@@ -264,35 +407,62 @@ enum jsontype {
     JSON_INFO
 };
 
-static void json_frame( char* dest, enum jsontype jsontype ) {
-    size_t remlen = JSON_TX_SIZE;
-    dest = json_objOpen( dest, NULL, &remlen ); 
-    dest = json_timestampMs( dest, "timestamp", &remlen );
+/*Write a payload document in the encoding of its topic, enum payload_encoding.
+Return its size, 0 if it does not fit.*/
+static size_t json_frame( uint8_t* dest, enum jsontype jsontype, uint8_t encoding ) {
+    struct payload doc;
+    payload_init( &doc, encoding, dest, JSON_TX_SIZE );
+    payload_objOpen( &doc, NULL );
+    /*The measurements are stamped with the time they were read*/
+    if( JSON_MEASUREMENT == jsontype ) {
+        payload_uint( &doc, "timestamp", cache.timestamp );
+    }
+    else {
+        put_timestampMs( &doc, "timestamp" );
+    }
     
     switch ( jsontype ) {
         case JSON_MEASUREMENT:
-            dest = json_sensor( dest, cfg.cal.id_sens_1, &remlen );
-            dest = json_sensor( dest, cfg.cal.id_sens_2, &remlen );
+            put_sensors( &doc );
         break;
         case JSON_STATUS:
-            dest = json_double( dest, "batt", 3.7, &remlen ); 
+            payload_double( &doc, "batt", 3.7 );
         break;
         case JSON_INFO:
-            dest = json_location( dest, "location", &remlen );
+            put_location( &doc, "location" );
         break;
         default:
             Serial.print("error, undefined json type\n");
         break;
     }
     
-    dest = json_objClose( dest, &remlen ); 
-    json_end( dest, &remlen );
+    payload_objClose( &doc );
+    return payload_finish( &doc );
+}
+
+/*Queue a payload in the MQTT client, the CBOR ones are printed by size*/
+static void publish( char const* name, struct pub_topic const* tp, uint8_t const* payload, size_t len ) {
+    if( 0 == len ) {
+        Serial.printf("error, %s payload does not fit\n", name );
+        return;
+    }
+    if( mqttc_publish( &mqtt, tp->topic, payload, len, tp->qos ) < 0 ) {
+        Serial.printf("error, MQTT queue full, %s dropped\n", name );
+        return;
+    }
+    if( PAYLOAD_JSON == tp->encoding ) {
+        Serial.printf("Publishing %s %s\n", name, (char const*)payload );
+    }
+    else {
+        Serial.printf("Publishing %s, %u bytes of CBOR\n", name, (unsigned)len );
+    }
 }
 
 /*Get the publishing period of the topic from the topic configuration structure. 
 The publishing period is returned milliseconds. Return -1 is configuration is not correct*/
 static int getupdatePeriod( struct pub_topic const* tp ) {
     struct { char const* unit; int factor; } const units[] = {
+        { "Millisecond", 1 },
         { "Second", 1 * 1000 },
         { "Minute", 60 * 1000 },
         { "Hour", 60 * 60 * 1000}
@@ -305,6 +475,7 @@ static int getupdatePeriod( struct pub_topic const* tp ) {
     }
     return -1;
 }
+#endif
 
 /*Callback function used to pusblish measurement on the mqtt topic*/
 static void pubMeasurement_callback( TimerHandle_t xTimer ) {
@@ -321,30 +492,107 @@ static void pubInfo_callback( TimerHandle_t xTimer ) {
     xEventGroupSetBits( events, PUB_INFO );        
 }
 
-/*Test the status of the Wifi connection and attempt reconnection if it fails.*/
-static bool testWifi( void ) {
-    int tries = 0;
-    Serial.println("Waiting for Wifi to connect");
-    while ( tries < 30 ) {
-        interface_setMode( ON );
-        wl_status_t const status = WiFi.status();
-        vTaskDelay(pdMS_TO_TICKS(250));
-        interface_setMode( OFF );
-        if ( status == WL_CONNECTED ) {
-            return true;
-        }
-        bool const isupdate = webserver_isNetworkUpdated( );
-        if( isupdate ) {
-            return false;
+/*Transport of the MQTT client. AsyncTCP copies the bytes it takes into its buffer.*/
+static size_t tcpWrite( void*, uint8_t const* data, size_t len ) {
+    return tcp.add( (char const*)data, len );
+}
+
+static void tcpFlush( void* ) {
+    tcp.send( );
+}
+
+static void tcpClose( void* ) {
+    tcp.close( true );
+}
+
+static struct mqttc_ops const mqttOps = {
+    .write = tcpWrite,
+    .flush = tcpFlush,
+    .close = tcpClose,
+    .acked = NULL
+};
+
+/*Callbacks of the AsyncTCP task*/
+static void tcpConnected( void*, AsyncClient* ) {
+    xEventGroupSetBits( events, MQTT_TCP_UP );
+}
+
+static void tcpDisconnected( void*, AsyncClient* ) {
+    xEventGroupSetBits( events, MQTT_TCP_DOWN );
+}
+
+static void tcpError( void*, AsyncClient*, int8_t error ) {
+    Serial.printf("MQTT connection error %d\n", error );
+    xEventGroupSetBits( events, MQTT_TCP_DOWN );
+}
+
+static void tcpData( void*, AsyncClient* c, void* data, size_t len ) {
+    /*The stream is lost if ctrl_task falls behind, start again with a new session*/
+    if( len != xStreamBufferSend( rxStream, data, len, 0 ) ) {
+        c->close( true );
+    }
+}
+
+/*WiFi layer of the connection state machine*/
+static bool wifiConnected( void ) {
+    return WL_CONNECTED == WiFi.status();
+}
+
+static void wifiBegin( void ) {
+    xEventGroupClearBits( events, CONNECT_MQTT );
+    struct wifi_config* wf = &cfg.wifi;
+    if ( strcmp( wf->mode, "static") == 0 ) {
+        IPAddress addr( wf->ip.ip[0], wf->ip.ip[1], wf->ip.ip[2], wf->ip.ip[3] );
+        IPAddress gateway( wf->gateway.ip[0], wf->gateway.ip[1], wf->gateway.ip[2], wf->gateway.ip[3] );
+        IPAddress subnet( wf->netmask.ip[0], wf->netmask.ip[1], wf->netmask.ip[2], wf->netmask.ip[3] );
+        IPAddress primaryDNS( wf->primaryDNS.ip[0], wf->primaryDNS.ip[1], wf->primaryDNS.ip[2], wf->primaryDNS.ip[3] ); //optional
+        IPAddress secondaryDNS( wf->secondaryDNS.ip[0], wf->secondaryDNS.ip[1], wf->secondaryDNS.ip[2], wf->secondaryDNS.ip[3] ); //optional
+        if (!WiFi.config( addr, gateway, subnet, primaryDNS, secondaryDNS)) {
+            Serial.println("STA Failed to configure");
         }
-        vTaskDelay(pdMS_TO_TICKS(1000));
-        Serial.print( status );
-        Serial.print(".");
-        ++tries;
     }
-    return false;
+    
+    if( verbose ) {
+        print_NetworkCfg( wf );
+        Serial.printf("Mac: %s\n", cfg.service.client_id );
+    }
+    WiFi.begin( wf->ssid, wf->pass );
+}
+
+static void wifiOnline( void ) {
+    Serial.printf("Connected to %s, IP: %s\n", WiFi.SSID().c_str(), WiFi.localIP().toString().c_str() );
+    /*The wall clock is also used to timestamp the radar frames*/
+    const long  gmtOffset_sec = 3600;
+    const int   daylightOffset_sec = 3600;
+    configTime( gmtOffset_sec, daylightOffset_sec, cfg.ntp.host );
+    xEventGroupSetBits( events, CONNECT_MQTT );
+}
+
+static void wifiOffline( void ) {
+    tcp.close( true );
+    xTimerStop( tmPubInfo, 0 );
+    xTimerStop( tmPubMeasurement, 0 );
+    xTimerStop( tmPubStatus, 0 );
+}
+
+static void wifiLed( int mode ) {
+    interface_setMode( (enum modes)mode );
+}
+
+static void wifiRestart( void ) {
+    Serial.println("Restarting ESP...");  
+    ESP.restart();  
 }
 
+static struct wififsm_ops const wifiOps = {
+    .isConnected = wifiConnected,
+    .begin       = wifiBegin,
+    .online      = wifiOnline,
+    .offline     = wifiOffline,
+    .led         = wifiLed,
+    .restart     = wifiRestart
+};
+
 
 /*Enter in the configuration mode: enable wifi access point and webserver.*/
 void ctrl_enterConfigMode( void ) {
@@ -376,23 +624,30 @@ void ctrl_task( void * parameter ) {
     tmPubMeasurement = xTimerCreate( "tmMeasurement", pdMS_TO_TICKS( 20000 ), pdTRUE, NULL, pubMeasurement_callback );
     tmPubStatus = xTimerCreate( "tmStatu", pdMS_TO_TICKS( 15000 ), pdTRUE, NULL, pubStatus_callback );
     tmPubInfo = xTimerCreate( "tmInfo", pdMS_TO_TICKS( 10000 ), pdFALSE, NULL, pubInfo_callback );
-    int failCounter = 0;
-    struct acq_cal const* cal = &cfg.cal;
-    getCalibrationEquation( &eq, cal->val[0].x, cal->val[0].y, cal->val[1].x, cal->val[1].y );
+    updateCalibration( &cfg.cal );
     /* Attempt to create the event group. */
     events = xEventGroupCreate();
-    EventBits_t bitfied = xEventGroupSetBits( events, START_AP_WIFI | CONNECT_WIFI );
+    EventBits_t bitfied = xEventGroupSetBits( events, START_AP_WIFI );
+    rxStream = xStreamBufferCreate( MQTT_RX_SIZE, 1 );
+    mqttc_init( &mqtt, &mqttOps, NULL );
+    measbatch_init( &batch );
+    tcp.onConnect( tcpConnected, NULL );
+    tcp.onDisconnect( tcpDisconnected, NULL );
+    tcp.onError( tcpError, NULL );
+    tcp.onData( tcpData, NULL );
+#if CTRL_MQTT
+    uint32_t retryAt = 0;
+#endif
 
-    sensors_init( cfg.cal.id_sens_1 );
-    sensors_init( cfg.cal.id_sens_2 );
+    sensors_resolve( &cfg.cal );
+
+    struct wififsm wifi;
+    wififsm_init( &wifi, millis() );
+    wififsm_connect( &wifi, millis() );
 
     for(;;){ 
         
         bool const iscfgmode = ctrl_isConfigModeEnable();
-        if ( 10 < failCounter && !iscfgmode ) {
-            Serial.println("Restarting ESP...");  
-            ESP.restart();  
-        }
 
         bitfied = xEventGroupGetBits( events );
         /*Configura WiFi Access Point*/
@@ -412,149 +667,110 @@ void ctrl_task( void * parameter ) {
             xEventGroupClearBits( events, START_AP_WIFI );
         }
 
-        /*Connect to WiFi*/
-        bool const updatenet = webserver_isNetworkUpdated( );
-        if( (bitfied & CONNECT_WIFI) || updatenet) {
-            xEventGroupClearBits( events, CONNECT_MQTT );
-            interface_setMode( OFF );
-            struct wifi_config* wf = &cfg.wifi;
-            
-            if( (wf->ssid[0] == 0 ) || wf->mode[0] == 0 ) {
-                Serial.println("No wifi config found");
-                vTaskDelay( pdMS_TO_TICKS(10000) );
-                xEventGroupSetBits( events, CONNECT_WIFI );
-                continue;
-            }
-            
-            if ( strcmp( wf->mode, "static") == 0 ) {
-                IPAddress addr( wf->ip.ip[0], wf->ip.ip[1], wf->ip.ip[2], wf->ip.ip[3] );
-                IPAddress gateway( wf->gateway.ip[0], wf->gateway.ip[1], wf->gateway.ip[2], wf->gateway.ip[3] );
-                IPAddress subnet( wf->netmask.ip[0], wf->netmask.ip[1], wf->netmask.ip[2], wf->netmask.ip[3] );
-                IPAddress primaryDNS( wf->primaryDNS.ip[0], wf->primaryDNS.ip[1], wf->primaryDNS.ip[2], wf->primaryDNS.ip[3] ); //optional
-                IPAddress secondaryDNS( wf->secondaryDNS.ip[0], wf->secondaryDNS.ip[1], wf->secondaryDNS.ip[2], wf->secondaryDNS.ip[3] ); //optional
-                if (!WiFi.config( addr, gateway, subnet, primaryDNS, secondaryDNS)) {
-                    Serial.println("STA Failed to configure");
-                }
-            }
-            
-            if( verbose ) {
-                print_NetworkCfg( wf );
-                Serial.printf("Mac: %s\n", cfg.service.client_id );
-            }
-
-            WiFi.begin( wf->ssid, wf->pass );
-            if ( !testWifi() ) {
-                Serial.println("\nWifi connection failed");
-                vTaskDelay( pdMS_TO_TICKS(5000) );
-                continue;
-            }
-            
-            Serial.printf("Connected to %s, IP: %s\n", WiFi.SSID().c_str(), WiFi.localIP().toString().c_str() );            
-            interface_setMode( BLINK );
-            xEventGroupSetBits( events,   CONNECT_MQTT );
-            xEventGroupClearBits( events, CONNECT_WIFI );
-            failCounter = 0;
-        }
-        
-        /*Check Wifi status*/
-        if( ( WiFi.status() != WL_CONNECTED ) ) {
-            if( !testWifi() ) {
-                Serial.println("\nWifi connection failed, try again in 5 seconds\n");
-                client.disconnect();
-                xEventGroupSetBits( events, CONNECT_WIFI );
-                interface_setMode( OFF );
-                ++failCounter;
-                xTimerStop( tmPubInfo, 100 );
-                xTimerStop( tmPubMeasurement, 100 );
-                xTimerStop( tmPubStatus, 100 );
-                vTaskDelay( pdMS_TO_TICKS(5000) );
-                continue;
-            }
+        /*Connect to WiFi and watch the connection, without waiting for it*/
+        struct wififsm_input const in = {
+            .configured = 0 != cfg.wifi.ssid[0] && 0 != cfg.wifi.mode[0],
+            .updated    = webserver_isNetworkUpdated( ),
+            .configmode = iscfgmode
+        };
+        uint8_t const wifistate = wifi.state;
+        wififsm_step( &wifi, &wifiOps, &in, millis() );
+        if( verbose && wifistate != wifi.state ) {
+            Serial.printf("WiFi %s -> %s\n", wififsm_stateName( wifistate ), wififsm_stateName( wifi.state ) );
         }
 
         /*Update calibration parameters*/
         bool const updatecal = webserver_isCalibrationUpdated( );
         if( updatecal ) {
-            struct acq_cal const* cal = &cfg.cal;
-            getCalibrationEquation( &eq, cal->val[0].x, cal->val[0].y, cal->val[1].x, cal->val[1].y );
+            updateCalibration( &cfg.cal );
+            sensors_resolve( &cfg.cal );
         }
         
-        /*Send data to UDP*/
-        dataframe data;
-        bool const newframe = waitnewData( &data);
-        if( newframe ) {
-            if( 0 != cfg.udp.port ) {
-                IPAddress ip( cfg.udp.ip.ip[0], cfg.udp.ip.ip[1], cfg.udp.ip.ip[2], cfg.udp.ip.ip[3] );
-                udp.connect( ip, cfg.udp.port );
-                udp.print( dataStructureToCsv( &data ) );
-                udp.close();
-            }
-        } 
-
-#if 0
-        /*Connect to the MQTT broker and NTP server */
+#if CTRL_MQTT
+        /*Connect to the MQTT broker, without waiting for it. The publishes are queued
+        meanwhile and the QoS 1 ones not acknowledged are sent again.*/
         bool const updateserv = webserver_isServiceUpdated( );
-        if( ((bitfied & CONNECT_MQTT) || updateserv) && !iscfgmode ) {
+        if( updateserv && MQTTC_DISCONNECTED != mqtt.state ) {
+            tcp.close( true );
+        }
+        bool const idle = MQTTC_DISCONNECTED == mqtt.state && !tcp.connecting() && !tcp.connected();
+        if( ((bitfied & CONNECT_MQTT) || updateserv) && !iscfgmode && idle && (int32_t)( millis() - retryAt ) >= 0 ) {
             
             memcpy( &scfg, &cfg.service, sizeof(cfg.service) );
-            if( scfg.host_ip[0] == 0 || scfg.client_id == 0 ) {
+            periods.measures = getupdatePeriod( &scfg.measures );
+            periods.status = getupdatePeriod( &scfg.status );
+            retryAt = millis() + MQTT_RETRY;
+            if( scfg.host_ip[0] == 0 || scfg.client_id[0] == 0 ) {
                 Serial.println("No MQTT config found");
-                vTaskDelay( pdMS_TO_TICKS(10000) );
+                retryAt = millis() + 2 * MQTT_RETRY;
                 xEventGroupSetBits( events, CONNECT_MQTT );
-                continue;
             }
-            
-            Serial.println("Attempting MQTT connection...");
-            client.setServer( scfg.host_ip, scfg.port);
-            bool connected = client.connect( scfg.client_id, scfg.username, scfg.password );
-            if ( !connected ) {
-                Serial.printf("Failed broker connection, rc= %d %s\n", client.state(), "try again in 5 seconds");
-                ++failCounter;
-                vTaskDelay( pdMS_TO_TICKS(5000) ); 
-                continue;
+            else {
+                Serial.println("Attempting MQTT connection...");
+                struct mqttc_config const mc = {
+                    .clientId  = scfg.client_id,
+                    .username  = scfg.username,
+                    .password  = scfg.password,
+                    .keepalive = MQTT_KEEPALIVE,
+                    .window    = scfg.window
+                };
+                mqttc_configure( &mqtt, &mc );
+                xEventGroupClearBits( events, CONNECT_MQTT | MQTT_TCP_UP | MQTT_TCP_DOWN );
+                if( !tcp.connect( scfg.host_ip, scfg.port ) ) {
+                    Serial.println("Failed broker connection, try again in 5 seconds");
+                    xEventGroupSetBits( events, CONNECT_MQTT );
+                    ++wifi.fails;
+                }
             }
-                           
-            xTimerStart( tmPubInfo, 100 );
-            xTimerStart( tmPubMeasurement, 100 );
-            xTimerStart( tmPubStatus, 100 );
-            
-            const long  gmtOffset_sec = 3600;
-            const int   daylightOffset_sec = 3600;
-            configTime( gmtOffset_sec, daylightOffset_sec, cfg.ntp.host );
-            Serial.println("Connected to broker");
-            interface_setMode( ON );
-            xEventGroupClearBits( events, CONNECT_MQTT );
-            failCounter = 0;
         }
-        
+
+        if( bitfied & MQTT_TCP_UP ) {
+            xEventGroupClearBits( events, MQTT_TCP_UP );
+            xStreamBufferReset( rxStream );
+            mqttc_connected( &mqtt, millis() );
+        }
+
+        uint8_t const mqttstate = mqtt.state;
+        uint8_t rx[128];
+        size_t rxlen;
+        while( 0 != ( rxlen = xStreamBufferReceive( rxStream, rx, sizeof(rx), 0 ) ) ) {
+            mqttc_received( &mqtt, rx, rxlen, millis() );
+        }
+
         /*Check MQTT conection status*/
-        bool mqttconneted = client.loop();
-        if( !mqttconneted ) {
+        if( bitfied & MQTT_TCP_DOWN ) {
+            xEventGroupClearBits( events, MQTT_TCP_DOWN );
+            mqttc_disconnected( &mqtt );
             Serial.println("\nMQTT connection failed, try again in 5 seconds\n");
-            client.disconnect();
             xEventGroupSetBits( events, CONNECT_MQTT );
             interface_setMode( BLINK );
-            ++failCounter;
+            ++wifi.fails;
+            retryAt = millis() + MQTT_RETRY;
             xTimerStop( tmPubInfo, 100 );
             xTimerStop( tmPubMeasurement, 100 );
             xTimerStop( tmPubStatus, 100 );
-            vTaskDelay( pdMS_TO_TICKS(5000) );
-            continue;
+        }
+        else if( MQTTC_CONNECTED == mqtt.state && MQTTC_CONNECTED != mqttstate ) {
+            xTimerStart( tmPubInfo, 100 );
+            xTimerStart( tmPubMeasurement, 100 );
+            xTimerStart( tmPubStatus, 100 );
+            
+            Serial.println("Connected to broker");
+            interface_setMode( ON );
+            wifi.fails = 0;
         }
 
         if( bitfied & PUB_INFO ) {
             xEventGroupClearBits( events, PUB_INFO );
-            json_frame( payload_json, JSON_INFO );
-            client.publish( scfg.info.topic, payload_json);
-            Serial.printf("Publishing info %s\n", payload_json);
+            size_t const len = json_frame( payload_json, JSON_INFO, scfg.info.encoding );
+            publish( "info", &scfg.info, payload_json, len );
         }
 
         if( bitfied & PUB_STATUS ) {
             xEventGroupClearBits( events, PUB_STATUS );
-            json_frame( payload_json, JSON_STATUS );
-            client.publish( scfg.status.topic, payload_json );
-            Serial.printf("Publishing status %s\n", payload_json);
-            xTimerChangePeriod( tmPubStatus, pdMS_TO_TICKS( getupdatePeriod( &scfg.status )), 100 );
+            size_t const len = json_frame( payload_json, JSON_STATUS, scfg.status.encoding );
+            publish( "status", &scfg.status, payload_json, len );
+            xTimerChangePeriod( tmPubStatus, pdMS_TO_TICKS( periods.status ), 100 );
             if( verbose ) {
                 printLocalTime();
             }           
@@ -562,11 +778,27 @@ void ctrl_task( void * parameter ) {
 
         if( bitfied & PUB_MEASURES ) {
             xEventGroupClearBits( events, PUB_MEASURES );
-            json_frame( payload_json, JSON_MEASUREMENT );
-            client.publish( scfg.measures.topic, payload_json);
-            Serial.printf("Publishing measurements %s\n", payload_json);
-            xTimerChangePeriod( tmPubMeasurement, pdMS_TO_TICKS( getupdatePeriod( &scfg.measures )), 100 ); 
+            uint8_t const encoding = scfg.measures.encoding;
+            sensors_acquire( );
+            size_t const len = json_frame( payload_json, JSON_MEASUREMENT, encoding );
+            if( scfg.batchsize <= 1 || 0 == len ) {
+                publish( "measurements", &scfg.measures, payload_json, len );
+            }
+            /*The samples held with another encoding go in their own payload*/
+            else if( !measbatch_add( &batch, payload_json, len, encoding, millis() ) ) {
+                publish( "measurements", &scfg.measures, batch.buf, measbatch_finish( &batch ) );
+                measbatch_add( &batch, payload_json, len, encoding, millis() );
+            }
+            xTimerChangePeriod( tmPubMeasurement, pdMS_TO_TICKS( periods.measures ), 100 ); 
         }
+
+        /*The samples are kept in the batch while the broker is not connected*/
+        if( measbatch_isDue( &batch, scfg.batchsize, (uint32_t)scfg.batchdelay * 1000, millis() ) ) {
+            publish( "measurements", &scfg.measures, batch.buf, measbatch_finish( &batch ) );
+        }
+
+        /*Write what the window and the TCP buffer take, and the keepalive pings*/
+        mqttc_poll( &mqtt, millis() );
 #endif
         vTaskDelay( pdMS_TO_TICKS(20) );
     }
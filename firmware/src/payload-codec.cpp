@@ -0,0 +1,234 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#include "payload-codec.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/*CBOR major types, already shifted*/
+enum {
+    CBOR_UINT   = 0 << 5,
+    CBOR_NEGINT = 1 << 5,
+    CBOR_TEXT   = 3 << 5,
+    CBOR_ARRAY  = 4 << 5,
+    CBOR_MAP    = 5 << 5,
+    CBOR_FLOAT32 = 0xfa,
+    CBOR_FLOAT64 = 0xfb,
+    CBOR_INDEFINITE = 31,
+    CBOR_BREAK  = 0xff
+};
+
+static void put( struct payload* self, void const* data, size_t len ) {
+    if( self->overflow || self->cap < self->len + len ) {
+        self->overflow = true;
+        return;
+    }
+    memcpy( self->buf + self->len, data, len );
+    self->len += len;
+}
+
+static void putByte( struct payload* self, uint8_t val ) {
+    put( self, &val, 1 );
+}
+
+/*Write a value in big endian*/
+static void putBE( struct payload* self, uint64_t val, int bytes ) {
+    uint8_t be[8];
+    for( int i = bytes - 1; 0 <= i; --i ) {
+        be[i] = val;
+        val >>= 8;
+    }
+    put( self, be, bytes );
+}
+
+/*CBOR head: major type and its argument in the shortest form*/
+static void cborHead( struct payload* self, uint8_t major, uint64_t val ) {
+    if( val < 24 ) {
+        putByte( self, major | val );
+    }
+    else if( val <= UINT8_MAX ) {
+        putByte( self, major | 24 );
+        putBE( self, val, 1 );
+    }
+    else if( val <= UINT16_MAX ) {
+        putByte( self, major | 25 );
+        putBE( self, val, 2 );
+    }
+    else if( val <= UINT32_MAX ) {
+        putByte( self, major | 26 );
+        putBE( self, val, 4 );
+    }
+    else {
+        putByte( self, major | 27 );
+        putBE( self, val, 8 );
+    }
+}
+
+static void cborText( struct payload* self, char const* text ) {
+    size_t const len = strlen( text );
+    cborHead( self, CBOR_TEXT, len );
+    put( self, text, len );
+}
+
+static void jsonText( struct payload* self, char const* text ) {
+    putByte( self, '"' );
+    for( char const* c = text; *c; ++c ) {
+        if( '"' == *c || '\\' == *c ) {
+            putByte( self, '\\' );
+            putByte( self, *c );
+        }
+        else if( (uint8_t)*c < ' ' ) {
+            char esc[8];
+            int const len = snprintf( esc, sizeof(esc), "\\u%04x", (unsigned)*c );
+            put( self, esc, len );
+        }
+        else {
+            putByte( self, *c );
+        }
+    }
+    putByte( self, '"' );
+}
+
+/*Start a member of the current container: separator and name*/
+static void member( struct payload* self, char const* name ) {
+    bool const first = 0 == self->depth || 0 == self->stack[self->depth - 1].count;
+    if( self->depth ) {
+        ++self->stack[self->depth - 1].count;
+    }
+    if( PAYLOAD_CBOR == self->encoding ) {
+        if( name ) {
+            cborText( self, name );
+        }
+        return;
+    }
+    if( !first ) {
+        putByte( self, ',' );
+    }
+    if( name ) {
+        jsonText( self, name );
+        putByte( self, ':' );
+    }
+}
+
+static void openContainer( struct payload* self, char const* name, uint8_t major, char json ) {
+    member( self, name );
+    if( PAYLOAD_MAX_DEPTH <= self->depth ) {
+        self->overflow = true;
+        return;
+    }
+    self->stack[self->depth].head  = self->len;
+    self->stack[self->depth].count = 0;
+    ++self->depth;
+    putByte( self, PAYLOAD_CBOR == self->encoding ? major | CBOR_INDEFINITE : json );
+}
+
+/*A CBOR container with less than 24 members gets its count in the header written
+at its opening, the others stay indefinite and end with a break*/
+static void closeContainer( struct payload* self, uint8_t major, char json ) {
+    if( 0 == self->depth ) {
+        self->overflow = true;
+        return;
+    }
+    --self->depth;
+    if( PAYLOAD_JSON == self->encoding ) {
+        putByte( self, json );
+        return;
+    }
+    uint32_t const count = self->stack[self->depth].count;
+    if( count < 24 && !self->overflow ) {
+        self->buf[self->stack[self->depth].head] = major | count;
+    }
+    else {
+        putByte( self, CBOR_BREAK );
+    }
+}
+
+void payload_init( struct payload* self, uint8_t encoding, uint8_t* dest, size_t len ) {
+    memset( self, 0, sizeof(*self) );
+    self->encoding = encoding;
+    self->buf = dest;
+    self->cap = len;
+}
+
+void payload_objOpen( struct payload* self, char const* name ) {
+    openContainer( self, name, CBOR_MAP, '{' );
+}
+
+void payload_objClose( struct payload* self ) {
+    closeContainer( self, CBOR_MAP, '}' );
+}
+
+void payload_arrOpen( struct payload* self, char const* name ) {
+    openContainer( self, name, CBOR_ARRAY, '[' );
+}
+
+void payload_arrClose( struct payload* self ) {
+    closeContainer( self, CBOR_ARRAY, ']' );
+}
+
+void payload_str( struct payload* self, char const* name, char const* value ) {
+    member( self, name );
+    if( PAYLOAD_CBOR == self->encoding ) {
+        cborText( self, value );
+    }
+    else {
+        jsonText( self, value );
+    }
+}
+
+void payload_double( struct payload* self, char const* name, double value ) {
+    member( self, name );
+    if( PAYLOAD_JSON == self->encoding ) {
+        char txt[32];
+        int const len = snprintf( txt, sizeof(txt), "%g", value );
+        put( self, txt, len );
+        return;
+    }
+
+    double const limit = 9007199254740992.0; /*2^53, integers are exact below it*/
+    if( -limit < value && value < limit && value == trunc( value ) ) {
+        if( 0 <= value ) {
+            cborHead( self, CBOR_UINT, (uint64_t)value );
+        }
+        else {
+            cborHead( self, CBOR_NEGINT, (uint64_t)( -value - 1 ) );
+        }
+        return;
+    }
+    float const single = (float)value;
+    if( fabs( (double)single - value ) <= fabs( value ) * 5e-7 ) {
+        uint32_t bits;
+        memcpy( &bits, &single, sizeof(bits) );
+        putByte( self, CBOR_FLOAT32 );
+        putBE( self, bits, 4 );
+        return;
+    }
+    uint64_t bits;
+    memcpy( &bits, &value, sizeof(bits) );
+    putByte( self, CBOR_FLOAT64 );
+    putBE( self, bits, 8 );
+}
+
+void payload_uint( struct payload* self, char const* name, uint64_t value ) {
+    member( self, name );
+    if( PAYLOAD_CBOR == self->encoding ) {
+        cborHead( self, CBOR_UINT, value );
+        return;
+    }
+    char txt[24];
+    int const len = snprintf( txt, sizeof(txt), "%llu", (unsigned long long)value );
+    put( self, txt, len );
+}
+
+size_t payload_finish( struct payload* self ) {
+    if( PAYLOAD_JSON == self->encoding ) {
+        putByte( self, '\0' );
+        self->len -= self->overflow ? 0 : 1;
+    }
+    return self->overflow || self->depth ? 0 : self->len;
+}
@@ -0,0 +1,99 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#ifndef __PAYLOAD_CODEC__
+#define __PAYLOAD_CODEC__
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum payload_encoding {
+    PAYLOAD_JSON = 0,   /*Compact JSON text, as written by json-maker*/
+    PAYLOAD_CBOR = 1    /*RFC 8949, same maps and keys as the JSON text*/
+};
+
+enum {
+    PAYLOAD_MAX_DEPTH = 8
+};
+
+/* Writer of a MQTT payload document. The document is described once, with nested
+   objects and arrays of named values, and written either as JSON text or as CBOR.
+   In CBOR the numbers are binary: a double without fractional part is written as an
+   integer, and as a float32 when that keeps the 6 significant digits of the JSON text.
+   The map and array headers are patched when they are closed, so no count is needed
+   up front.*/
+struct payload {
+    uint8_t  encoding;  /*enum payload_encoding*/
+    uint8_t* buf;
+    size_t   cap;
+    size_t   len;
+    bool     overflow;
+    uint8_t  depth;
+    struct {
+        size_t   head;   /*Position of the CBOR header of the container*/
+        uint32_t count;  /*Members written*/
+    } stack[PAYLOAD_MAX_DEPTH];
+};
+
+/**
+ * @brief Start a document.
+ * @param self, the document
+ * @param encoding, enum payload_encoding
+ * @param dest, destination buffer
+ * @param len, size of the destination buffer */
+void payload_init( struct payload* self, uint8_t encoding, uint8_t* dest, size_t len );
+
+/**
+ * @brief Open an object.
+ * @param self, the document
+ * @param name, name of the member, NULL at the top level or inside an array */
+void payload_objOpen( struct payload* self, char const* name );
+
+/**
+ * @brief Close the last object opened.
+ * @param self, the document */
+void payload_objClose( struct payload* self );
+
+/**
+ * @brief Open an array.
+ * @param self, the document
+ * @param name, name of the member, NULL at the top level or inside an array */
+void payload_arrOpen( struct payload* self, char const* name );
+
+/**
+ * @brief Close the last array opened.
+ * @param self, the document */
+void payload_arrClose( struct payload* self );
+
+/**
+ * @brief Write a text member.
+ * @param self, the document
+ * @param name, name of the member, NULL inside an array
+ * @param value, the text */
+void payload_str( struct payload* self, char const* name, char const* value );
+
+/**
+ * @brief Write a number member.
+ * @param self, the document
+ * @param name, name of the member, NULL inside an array
+ * @param value, the number */
+void payload_double( struct payload* self, char const* name, double value );
+
+/**
+ * @brief Write an unsigned integer member.
+ * @param self, the document
+ * @param name, name of the member, NULL inside an array
+ * @param value, the integer */
+void payload_uint( struct payload* self, char const* name, uint64_t value );
+
+/**
+ * @brief End the document. The JSON text is terminated with a null character.
+ * @param self, the document
+ * @return size of the document without the terminator, 0 if it does not fit or is unbalanced. */
+size_t payload_finish( struct payload* self );
+
+#endif //__PAYLOAD_CODEC__
@@ -0,0 +1,115 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#include "presence.h"
+#include <string.h>
+
+enum {
+    GATES = 2 * LD2410_MAX_GATES
+};
+
+void presence_init( struct presence* self ) {
+    memset( self, 0, sizeof(*self) );
+    self->state = PRESENCE_VACANT;
+}
+
+char const* presence_stateName( uint8_t state ) {
+    switch( state ) {
+        case PRESENCE_VACANT:   return "vacant";
+        case PRESENCE_OCCUPIED: return "occupied";
+        case PRESENCE_MOVING:   return "moving";
+        default:                return "unknown";
+    }
+}
+
+int presence_update( struct presence* self, struct presence_params const* params,
+                     struct dataframe const* data, uint32_t now, struct presence_event* ev ) {
+
+    uint8_t const window = 0 < params->window && params->window <= PRESENCE_MAX_WINDOW ? params->window : 1;
+    if( window != self->window ) {
+        /*The sums of the old window are not valid anymore*/
+        uint8_t const state = self->state;
+        uint32_t const lastSeen = self->lastSeen;
+        uint32_t const lastEvent = self->lastEvent;
+        presence_init( self );
+        self->window = window;
+        self->state = state;
+        self->lastSeen = lastSeen;
+        self->lastEvent = lastEvent;
+    }
+
+    /*Replace the oldest frame of the window. The sums are compared with the thresholds scaled
+    by the number of frames, so no division is needed per gate.*/
+    uint8_t* oldest = self->hist[self->pos];
+    uint8_t const* moving = data->engMovingDistanceGateEnergy;
+    uint8_t const* stationary = data->engStaticDistanceGateEnergy;
+    uint16_t movmax = 0, statmax = 0;
+    int movgate = 0, statgate = 0;
+    for( int i = 0; i < LD2410_MAX_GATES; ++i ) {
+        uint16_t const sum = self->sum[i] + moving[i] - oldest[i];
+        self->sum[i] = sum;
+        oldest[i] = moving[i];
+        if( movmax < sum ) {
+            movmax = sum;
+            movgate = i;
+        }
+    }
+    for( int i = 0; i < LD2410_MAX_GATES; ++i ) {
+        uint16_t const sum = self->sum[LD2410_MAX_GATES + i] + stationary[i] - oldest[LD2410_MAX_GATES + i];
+        self->sum[LD2410_MAX_GATES + i] = sum;
+        oldest[LD2410_MAX_GATES + i] = stationary[i];
+        if( statmax < sum ) {
+            statmax = sum;
+            statgate = i;
+        }
+    }
+    self->pos = self->pos + 1 < window ? self->pos + 1 : 0;
+    self->fill += self->fill < window;
+
+    uint16_t const enter = params->enter * self->fill;
+    uint16_t const exit  = params->exit * self->fill;
+    uint8_t const previous = self->state;
+    bool const wasmoving = PRESENCE_MOVING == previous;
+    bool const waspresent = PRESENCE_VACANT != previous;
+    bool const ismoving = enter <= movmax || ( wasmoving && exit <= movmax );
+    bool const ispresent = ismoving || enter <= statmax || ( waspresent && ( exit <= statmax || exit <= movmax ) );
+
+    if( ismoving ) {
+        self->state = PRESENCE_MOVING;
+        self->lastSeen = now;
+    }
+    else if( ispresent ) {
+        self->state = PRESENCE_OCCUPIED;
+        self->lastSeen = now;
+    }
+    else if( waspresent ) {
+        /*Keep the target during the hold time, it may be hidden for a while*/
+        self->state = params->holdms <= now - self->lastSeen ? PRESENCE_VACANT : PRESENCE_OCCUPIED;
+    }
+
+    int kind = PRESENCE_NONE;
+    if( self->state != previous ) {
+        kind = PRESENCE_CHANGE;
+    }
+    else if( params->summaryms && params->summaryms <= now - self->lastEvent ) {
+        kind = PRESENCE_SUMMARY;
+    }
+    if( PRESENCE_NONE == kind ) {
+        return kind;
+    }
+
+    self->lastEvent = now;
+    ev->timestamp  = data->timestamp;
+    ev->sensor     = data->sensor;
+    ev->kind       = kind;
+    ev->state      = self->state;
+    ev->previous   = previous;
+    ev->moving     = movmax / self->fill;
+    ev->stationary = statmax / self->fill;
+    ev->gate       = movmax >= statmax ? movgate : statgate;
+    return kind;
+}
@@ -0,0 +1,85 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#ifndef __PRESENCE__
+#define __PRESENCE__
+
+#include <stdint.h>
+#include "dataframe.h"
+
+enum {
+    PRESENCE_MAX_WINDOW = 16    /*Frames of the moving average of the gate energies*/
+};
+
+enum presence_state {
+    PRESENCE_VACANT   = 0,
+    PRESENCE_OCCUPIED = 1,      /*Stationary target*/
+    PRESENCE_MOVING   = 2
+};
+
+enum presence_kind {
+    PRESENCE_NONE    = 0,
+    PRESENCE_CHANGE  = 1,
+    PRESENCE_SUMMARY = 2
+};
+
+/*Settings of the detector, the energies are compared with the averaged gates*/
+struct presence_params {
+    uint8_t  window;     /*Frames averaged per gate, up to PRESENCE_MAX_WINDOW*/
+    uint8_t  enter;      /*Energy to detect a target*/
+    uint8_t  exit;       /*Energy to keep detecting it, below enter*/
+    uint16_t holdms;     /*Time without targets before going vacant*/
+    uint32_t summaryms;  /*Period of the summary events, 0 disables them*/
+};
+
+/*State change or periodic summary of a radar*/
+struct presence_event {
+    uint64_t timestamp;  /*Capture time of the frame that raised it*/
+    uint8_t  sensor;
+    uint8_t  kind;       /*enum presence_kind*/
+    uint8_t  state;      /*enum presence_state*/
+    uint8_t  previous;   /*State before a change*/
+    uint8_t  moving;     /*Highest averaged moving gate energy*/
+    uint8_t  stationary; /*Highest averaged static gate energy*/
+    uint8_t  gate;       /*Gate of the highest averaged energy*/
+};
+
+/*Detector of a radar. The gate energies are averaged over a window kept as
+running sums, so every frame only adds the new energies and removes the oldest.*/
+struct presence {
+    uint8_t  hist[PRESENCE_MAX_WINDOW][2 * LD2410_MAX_GATES];
+    uint16_t sum[2 * LD2410_MAX_GATES];
+    uint8_t  window;     /*Size of the window the sums were built with*/
+    uint8_t  pos;
+    uint8_t  fill;
+    uint8_t  state;
+    uint32_t lastSeen;   /*Last time a target was above the exit level*/
+    uint32_t lastEvent;
+};
+
+/**
+ * @brief Initialize a detector in vacant state.
+ * @param self, the detector */
+void presence_init( struct presence* self );
+
+/**
+ * @brief Feed a frame to the detector.
+ * @param self, the detector
+ * @param params, settings of the detector
+ * @param data, the frame
+ * @param now, current time in ms
+ * @param ev, destination of the event.
+ * @return kind of the event written in ev, PRESENCE_NONE if there is no event. */
+int presence_update( struct presence* self, struct presence_params const* params,
+                     struct dataframe const* data, uint32_t now, struct presence_event* ev );
+
+/**
+ * @brief Get the name of a state.
+ * @param state, enum presence_state */
+char const* presence_stateName( uint8_t state );
+
+#endif //__PRESENCE__
@@ -0,0 +1,117 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#include "radar-capture.h"
+
+static uint8_t* put16( uint8_t* dest, uint16_t val ) {
+    dest[0] = val;
+    dest[1] = val >> 8;
+    return dest + 2;
+}
+
+static uint8_t* put32( uint8_t* dest, uint32_t val ) {
+    dest = put16( dest, val );
+    return put16( dest, val >> 16 );
+}
+
+static uint16_t get16( uint8_t const* src ) {
+    return src[0] | ( src[1] << 8 );
+}
+
+static uint32_t get32( uint8_t const* src ) {
+    return get16( src ) | ( (uint32_t)get16( src + 2 ) << 16 );
+}
+
+void capture_init( struct capture* self, uint8_t* buf, size_t cap, uint8_t sensor, uint64_t now ) {
+    self->buf   = buf;
+    self->cap   = cap;
+    self->chunk = 0;
+    self->start = now;
+    self->full  = false;
+
+    uint8_t* dest = put32( buf, CAPTURE_MAGIC );
+    *dest++ = CAPTURE_VERSION;
+    *dest++ = sensor;
+    dest = put16( dest, 0 );
+    dest = put32( dest, now );
+    put32( dest, now >> 32 );
+    self->len = CAPTURE_HEADER;
+}
+
+bool capture_chunk( struct capture* self, uint64_t now ) {
+    uint64_t const elapsed = now - self->start;
+    uint32_t const dt = elapsed < UINT32_MAX ? elapsed : UINT32_MAX;
+    if( self->chunk && self->chunk + CAPTURE_CHUNK == self->len ) {
+        /*Nothing was read since the last chunk was opened*/
+        put32( self->buf + self->chunk, dt );
+        return true;
+    }
+    if( self->cap < self->len + CAPTURE_CHUNK + 1 ) {
+        self->chunk = 0;
+        self->full = true;
+        return false;
+    }
+    self->chunk = self->len;
+    uint8_t* dest = put32( self->buf + self->len, dt );
+    put16( dest, 0 );
+    self->len += CAPTURE_CHUNK;
+    return true;
+}
+
+bool capture_put( struct capture* self, uint8_t c ) {
+    if( 0 == self->chunk ) {
+        return false;
+    }
+    uint8_t* hdr = self->buf + self->chunk;
+    uint16_t const count = get16( hdr + 4 );
+    if( CAPTURE_MAX_CHUNK == count ) {
+        uint32_t const dt = get32( hdr );
+        if( !capture_chunk( self, self->start + dt ) ) {
+            return false;
+        }
+        return capture_put( self, c );
+    }
+    if( self->cap <= self->len ) {
+        self->full = true;
+        return false;
+    }
+    self->buf[self->len++] = c;
+    put16( hdr + 4, count + 1 );
+    return true;
+}
+
+size_t capture_finish( struct capture* self ) {
+    if( self->chunk && self->chunk + CAPTURE_CHUNK == self->len ) {
+        /*Drop the last chunk if it is empty*/
+        self->len = self->chunk;
+    }
+    self->chunk = 0;
+    return self->len;
+}
+
+size_t capture_parseHeader( uint8_t const* src, size_t len, uint8_t* sensor, uint64_t* start ) {
+    if( len < CAPTURE_HEADER || CAPTURE_MAGIC != get32( src ) || CAPTURE_VERSION != src[4] ) {
+        return 0;
+    }
+    *sensor = src[5];
+    *start = get32( src + 8 ) | (uint64_t)get32( src + 12 ) << 32;
+    return CAPTURE_HEADER;
+}
+
+size_t capture_parseChunk( uint8_t const* src, size_t len, uint32_t* dt, uint8_t const** data, uint16_t* count ) {
+    if( len < CAPTURE_CHUNK ) {
+        return 0;
+    }
+    uint16_t const n = get16( src + 4 );
+    if( len < (size_t)CAPTURE_CHUNK + n ) {
+        return 0;
+    }
+    *dt = get32( src );
+    *data = src + CAPTURE_CHUNK;
+    *count = n;
+    return CAPTURE_CHUNK + n;
+}
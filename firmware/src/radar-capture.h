@@ -0,0 +1,84 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#ifndef __RADAR_CAPTURE__
+#define __RADAR_CAPTURE__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Recording of the raw bytes received from a radar UART, to replay them later on the host.
+   All the fields are little endian.
+    header: magic(4) version(1) sensor(1) reserved(2) start(8, capture time in us)
+    chunk:  dt(4, us since start) len(2) bytes(len)
+   A chunk holds the bytes read in a burst, they arrived at about the same time. */
+enum {
+    CAPTURE_MAGIC     = 0x5043444c, /*"LDCP"*/
+    CAPTURE_VERSION   = 1,
+    CAPTURE_HEADER    = 16,
+    CAPTURE_CHUNK     = 6,
+    CAPTURE_MAX_CHUNK = 0xffff
+};
+
+struct capture {
+    uint8_t* buf;
+    size_t   cap;
+    size_t   len;
+    size_t   chunk;   /*Offset of the header of the open chunk, 0 if there is none*/
+    uint64_t start;
+    bool     full;    /*Bytes were lost because the buffer is full*/
+};
+
+/**
+ * @brief Start a recording in a buffer.
+ * @param self, the recording
+ * @param buf, destination buffer
+ * @param cap, size of the buffer, at least CAPTURE_HEADER
+ * @param sensor, radar recorded
+ * @param now, capture time of the start in us. */
+void capture_init( struct capture* self, uint8_t* buf, size_t cap, uint8_t sensor, uint64_t now );
+
+/**
+ * @brief Open a new chunk for the next bytes, an empty open chunk is reused.
+ * @param self, the recording
+ * @param now, capture time of the bytes in us.
+ * @return false if the buffer is full. */
+bool capture_chunk( struct capture* self, uint64_t now );
+
+/**
+ * @brief Append a received byte to the open chunk.
+ * @param self, the recording
+ * @param c, the byte.
+ * @return false if the buffer is full or there is no open chunk. */
+bool capture_put( struct capture* self, uint8_t c );
+
+/**
+ * @brief Close the recording.
+ * @param self, the recording
+ * @return size of the recording in bytes. */
+size_t capture_finish( struct capture* self );
+
+/**
+ * @brief Decode the header of a recording.
+ * @param src, the recording
+ * @param len, size of the recording
+ * @param sensor, destination of the radar recorded
+ * @param start, destination of the capture time of the start.
+ * @return number of bytes read, 0 if it is not a recording. */
+size_t capture_parseHeader( uint8_t const* src, size_t len, uint8_t* sensor, uint64_t* start );
+
+/**
+ * @brief Decode a chunk of a recording.
+ * @param src, first byte of the chunk
+ * @param len, bytes left in the recording
+ * @param dt, destination of the time since the start in us
+ * @param data, destination of the bytes of the chunk
+ * @param count, destination of the number of bytes.
+ * @return number of bytes read, 0 if the chunk is truncated. */
+size_t capture_parseChunk( uint8_t const* src, size_t len, uint32_t* dt, uint8_t const** data, uint16_t* count );
+
+#endif //__RADAR_CAPTURE__
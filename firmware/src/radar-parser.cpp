@@ -0,0 +1,215 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#include "radar-parser.h"
+#include <string.h>
+
+enum {
+    REPORT_ENGINEERING = 0x01,
+    REPORT_BASIC       = 0x02,
+    REPORT_HEAD        = 0xaa,
+    REPORT_TAIL        = 0x55,
+    REPORT_CHECK       = 0x00,
+    REPORT_BASIC_LEN   = 13,    /*Payload of a basic report*/
+    PREFIX             = RADARFRAME_HEADER + RADARFRAME_LEN
+};
+
+enum status {
+    FRAME_INCOMPLETE,
+    FRAME_REPORT,
+    FRAME_ACK,
+    FRAME_BAD_HEADER,
+    FRAME_BAD_LENGTH,
+    FRAME_BAD_FOOTER
+};
+
+static uint8_t const reportHeader[RADARFRAME_HEADER] = { 0xf4, 0xf3, 0xf2, 0xf1 };
+static uint8_t const reportFooter[RADARFRAME_FOOTER] = { 0xf8, 0xf7, 0xf6, 0xf5 };
+static uint8_t const ackHeader[RADARFRAME_HEADER]    = { 0xfd, 0xfc, 0xfb, 0xfa };
+static uint8_t const ackFooter[RADARFRAME_FOOTER]    = { 0x04, 0x03, 0x02, 0x01 };
+
+static uint16_t get16( uint8_t const* src ) {
+    return src[0] | ( src[1] << 8 );
+}
+
+/*Offset of the first byte that may start a frame, including a header cut at the end.*/
+static size_t findHeader( uint8_t const* src, size_t len ) {
+    for( size_t i = 0; i < len; ++i ) {
+        uint8_t const* header;
+        if( reportHeader[0] == src[i] ) {
+            header = reportHeader;
+        }
+        else if( ackHeader[0] == src[i] ) {
+            header = ackHeader;
+        }
+        else {
+            continue;
+        }
+        size_t const n = len - i < (size_t)RADARFRAME_HEADER ? len - i : (size_t)RADARFRAME_HEADER;
+        if( 0 == memcmp( src + i, header, n ) ) {
+            return i;
+        }
+    }
+    return len;
+}
+
+/*Check the frame starting at src with the bytes received so far, and get its full size.*/
+static enum status frameStatus( uint8_t const* src, size_t len, size_t* total ) {
+    size_t const n = len < (size_t)RADARFRAME_HEADER ? len : (size_t)RADARFRAME_HEADER;
+    bool const isreport = 0 == memcmp( src, reportHeader, n );
+    if( !isreport && 0 != memcmp( src, ackHeader, n ) ) {
+        return FRAME_BAD_HEADER;
+    }
+    if( len < PREFIX ) {
+        *total = PREFIX;
+        return FRAME_INCOMPLETE;
+    }
+    uint16_t const plen = get16( src + RADARFRAME_HEADER );
+    if( RADARFRAME_MAX_PAYLOAD < plen ) {
+        return FRAME_BAD_LENGTH;
+    }
+    *total = PREFIX + plen + RADARFRAME_FOOTER;
+    if( len < *total ) {
+        return FRAME_INCOMPLETE;
+    }
+    uint8_t const* footer = isreport ? reportFooter : ackFooter;
+    if( 0 != memcmp( src + PREFIX + plen, footer, RADARFRAME_FOOTER ) ) {
+        return FRAME_BAD_FOOTER;
+    }
+    return isreport ? FRAME_REPORT : FRAME_ACK;
+}
+
+/*Decode the payload of a report, the gates not reported by the radar are set to 0.*/
+static bool decodeReport( uint8_t const* p, size_t len, struct dataframe* data ) {
+    if( len < REPORT_BASIC_LEN || REPORT_HEAD != p[1] || REPORT_TAIL != p[len - 2] || REPORT_CHECK != p[len - 1] ) {
+        return false;
+    }
+
+    size_t moving = 0, stationary = 0;
+    if( REPORT_ENGINEERING == p[0] ) {
+        moving = p[11] + 1;
+        stationary = p[12] + 1;
+        if( LD2410_MAX_GATES < moving || LD2410_MAX_GATES < stationary || len < 13 + moving + stationary + 2 ) {
+            return false;
+        }
+    }
+    else if( REPORT_BASIC != p[0] ) {
+        return false;
+    }
+
+    data->movingTargetDistance     = get16( p + 3 );
+    data->movingTargetEnergy       = p[5];
+    data->stationaryTargetDistance = get16( p + 6 );
+    data->stationaryTargetEnergy   = p[8];
+    data->detectionDistance        = get16( p + 9 );
+
+    uint8_t const* gates = p + 13;
+    memcpy( data->engMovingDistanceGateEnergy, gates, moving );
+    memset( data->engMovingDistanceGateEnergy + moving, 0, LD2410_MAX_GATES - moving );
+    memcpy( data->engStaticDistanceGateEnergy, gates + moving, stationary );
+    memset( data->engStaticDistanceGateEnergy + stationary, 0, LD2410_MAX_GATES - stationary );
+
+    /*Retain data, between the gates and the tail*/
+    uint8_t const* retain = gates + moving + stationary;
+    size_t const rlen = p + len - 2 - retain;
+    data->engRataingData = REPORT_ENGINEERING != p[0] ? 0 : 2 <= rlen ? get16( retain ) : 1 == rlen ? retain[0] : 0;
+    return true;
+}
+
+/*Handle a complete frame, return true if a report has been decoded*/
+static bool handleFrame( struct radarparser* self, enum status st, uint8_t const* src, struct dataframe* data ) {
+    if( FRAME_ACK == st ) {
+        ++self->stats.acks;
+        return false;
+    }
+    if( !decodeReport( src + PREFIX, get16( src + RADARFRAME_HEADER ), data ) ) {
+        ++self->stats.badPayload;
+        return false;
+    }
+    ++self->stats.reports;
+    return true;
+}
+
+static void countError( struct radarparser* self, enum status st ) {
+    if( FRAME_BAD_LENGTH == st ) {
+        ++self->stats.badLength;
+    }
+    else if( FRAME_BAD_FOOTER == st ) {
+        ++self->stats.badFooter;
+    }
+}
+
+void radarparser_init( struct radarparser* self ) {
+    memset( self, 0, sizeof(*self) );
+}
+
+size_t radarparser_parse( struct radarparser* self, uint8_t const* src, size_t len,
+                          struct dataframe* data, bool* decoded ) {
+    *decoded = false;
+    size_t pos = 0;
+
+    /*Complete the frame split by the previous read*/
+    while( self->len ) {
+        size_t total = PREFIX;
+        enum status const st = frameStatus( self->pending, self->len, &total );
+        if( FRAME_INCOMPLETE == st ) {
+            size_t const want = total - self->len;
+            size_t const n = want < len - pos ? want : len - pos;
+            memcpy( self->pending + self->len, src + pos, n );
+            self->len += n;
+            pos += n;
+            if( n < want ) {
+                return pos;
+            }
+            continue;
+        }
+        if( FRAME_REPORT == st || FRAME_ACK == st ) {
+            self->len = 0;
+            if( handleFrame( self, st, self->pending, data ) ) {
+                *decoded = true;
+                return pos;
+            }
+            continue;
+        }
+        /*Not a valid frame, look for a header in the bytes already taken*/
+        countError( self, st );
+        size_t const skip = 1 + findHeader( self->pending + 1, self->len - 1 );
+        self->stats.skipped += skip;
+        self->len -= skip;
+        memmove( self->pending, self->pending + skip, self->len );
+    }
+
+    /*The frames are decoded in place*/
+    while( pos < len ) {
+        size_t const skip = findHeader( src + pos, len - pos );
+        self->stats.skipped += skip;
+        pos += skip;
+        if( pos == len ) {
+            break;
+        }
+
+        size_t total = PREFIX;
+        enum status const st = frameStatus( src + pos, len - pos, &total );
+        if( FRAME_INCOMPLETE == st ) {
+            self->len = len - pos;
+            memcpy( self->pending, src + pos, self->len );
+            return len;
+        }
+        if( FRAME_REPORT == st || FRAME_ACK == st ) {
+            pos += total;
+            if( handleFrame( self, st, src + pos - total, data ) ) {
+                *decoded = true;
+                return pos;
+            }
+            continue;
+        }
+        countError( self, st );
+        ++self->stats.skipped;
+        ++pos;
+    }
+    return pos;
+}
@@ -0,0 +1,66 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#ifndef __RADAR_PARSER__
+#define __RADAR_PARSER__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "dataframe.h"
+
+/* Frames sent by the LD2410, all the fields are little endian.
+    report:  F4 F3 F2 F1  len(2)  payload(len)  F8 F7 F6 F5
+    ack:     FD FC FB FA  len(2)  payload(len)  04 03 02 01
+   Report payload:
+    type(1, 1 engineering 2 basic) AA  state(1) moving distance(2) moving energy(1)
+    static distance(2) static energy(1) detection distance(2)
+    engineering only: max moving gate N(1) max static gate M(1) moving energies(N+1)
+                      static energies(M+1) retain data(2)
+    55 00 */
+enum {
+    RADARFRAME_HEADER      = 4,
+    RADARFRAME_LEN         = 2,
+    RADARFRAME_FOOTER      = 4,
+    RADARFRAME_MAX_PAYLOAD = 64,
+    RADARFRAME_MAX         = RADARFRAME_HEADER + RADARFRAME_LEN + RADARFRAME_MAX_PAYLOAD + RADARFRAME_FOOTER
+};
+
+struct radarparser_stats {
+    uint32_t reports;     /*Reports decoded*/
+    uint32_t acks;        /*Command acknowledges, not decoded*/
+    uint32_t badLength;
+    uint32_t badFooter;
+    uint32_t badPayload;
+    uint32_t skipped;     /*Bytes dropped while searching a header*/
+};
+
+/*The reports are decoded straight from the received bytes. Only a frame split between
+two reads is copied, to complete it with the next bytes.*/
+struct radarparser {
+    uint8_t pending[RADARFRAME_MAX];
+    uint16_t len;
+    struct radarparser_stats stats;
+};
+
+/**
+ * @brief Initialize a parser.
+ * @param self, the parser */
+void radarparser_init( struct radarparser* self );
+
+/**
+ * @brief Parse received bytes until a report is decoded or all of them are used.
+ * Call it again with the rest of the bytes after a report.
+ * @param self, the parser
+ * @param src, received bytes
+ * @param len, number of received bytes
+ * @param data, destination of the report. Capture time, sequence number and sensor are not touched.
+ * @param decoded, set to true if a report has been written in data.
+ * @return number of bytes used. */
+size_t radarparser_parse( struct radarparser* self, uint8_t const* src, size_t len,
+                          struct dataframe* data, bool* decoded );
+
+#endif //__RADAR_PARSER__
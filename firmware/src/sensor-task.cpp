@@ -1,105 +1,434 @@
 #include "sensor-task.h"
 #include <ld2410.h>
-#include "freertos/queue.h"
+#include "framebus.h"
+#include "presence.h"
+#include "gate-stats.h"
+#include "radar-parser.h"
+#include "radar-capture.h"
+#include "config-mng.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+#include <sys/time.h>
 
+enum {
+    RADAR_BAUDRATE  = 256000,
+    RADAR_RX_BUFFER = 4096, /*~160 ms of continuous data at 256000 baud*/
+    RADAR_RX_TOUT   = 10,   /*Symbols without data to flag the end of a frame*/
+    UART_HW_FIFO    = 128,
+    PRESENCE_EVENTS = 16,   /*Presence events waiting to be sent*/
+    AGGREGATES      = 2 * SENSOR_MAX_RADARS, /*Gate statistics waiting to be sent*/
+    RADAR_READ      = 256   /*Bytes taken from the UART driver per read*/
+};
 
-#define RXD2 16 // 8 
-#define TXD2 17 // 9
+/*Unix time of 2020-01-01, the clock is not synchronized by SNTP while it is earlier*/
+static time_t const CLOCK_SYNCED = 1577836800;
 
-ld2410 radar;
+/*UART and pins of each radar*/
+static struct {
+    HardwareSerial* serial;
+    int rx;
+    int tx;
+} const wiring[SENSOR_MAX_RADARS] = {
+    { &Serial2, 16, 17 },
+    { &Serial1, 32, 33 }
+};
 
-uint32_t lastReading = 0;
+enum capture_state {
+    CAPTURE_IDLE,
+    CAPTURE_RUNNING,
+    CAPTURE_STOPPING,  /*Requested, the radar task closes the recording*/
+    CAPTURE_DONE
+};
 
+/*Ingestion pipeline of a radar. Each one is driven by its own task and nothing
+in it is shared with the other radars.*/
+struct sensor_instance {
+    uint8_t id;
+    HardwareSerial* serial;
+    ld2410 radar;             /*Only used to configure the radar, the reports are decoded by parser*/
+    struct radarparser parser;
+    uint8_t rxbuf[RADAR_READ];
+    TaskHandle_t task;
+    struct sensor_stats stats;
+    struct dataframe dataf;   /*Frame being filled*/
+    /*State of the adaptive reporting rate*/
+    struct {
+        bool active;
+        uint32_t lastActive;  /*Last time the energy was above the exit level*/
+        uint32_t lastReport;
+    } rate;
+    struct presence presence;
+    struct gatestats aggregate;
+    /*Raw UART recording, the buffer is allocated on the first capture and kept.
+    Only the radar task touches the recording while it runs.*/
+    struct {
+        std::atomic<int> state;
+        struct capture rec;
+        struct capture* active;  /*Recording being written by the radar task*/
+        uint8_t* buf;
+    } capture;
+};
 
-uint32_t pos = 0;
-char buffer1[128];
-char serialBuffer[256];
+static struct sensor_instance instances[SENSOR_MAX_RADARS];
 
-void filldataFrame( struct dataframe* data ) {
+static void stampdataFrame( struct sensor_instance* self, int64_t timestamp ) {
+    struct dataframe* data = &self->dataf;
+    data->timestamp = timestamp;
+    data->sensor    = self->id;
+}
+
+
+static struct framebus bus;
+static struct framebus_reader readers[SENSOR_MAX_CONSUMERS];
+static std::atomic<int> consumers( 0 );
+static EventGroupHandle_t frameEvents;
+static QueueHandle_t presenceEvents;
+static QueueHandle_t aggregates;
+
+/*Event bits of all the registered consumers*/
+static EventBits_t consumerBits( void ) {
+    return ( 1u << consumers.load() ) - 1;
+}
+
+int sensor_subscribe( void ) {
+    int const id = consumers.fetch_add( 1 );
+    if ( SENSOR_MAX_CONSUMERS <= id ) {
+        consumers.fetch_sub( 1 );
+        Serial.println("No free frame consumers");
+        return -1;
+    }
+    framebus_attach( &readers[id], &bus );
+    return id;
+}
+
+struct dataframe const* sensor_peekFrame( int consumer, uint32_t timeout ) {
+    struct framebus_reader* reader = &readers[consumer];
+    struct dataframe const* frame = framebus_peek( reader );
+    if( NULL == frame && timeout ) {
+        xEventGroupWaitBits( frameEvents, 1u << consumer, pdTRUE, pdFALSE, pdMS_TO_TICKS(timeout) );
+        frame = framebus_peek( reader );
+    }
+    return frame;
+}
+
+bool sensor_releaseFrame( int consumer ) {
+    return framebus_release( &readers[consumer] );
+}
+
+bool waitnewData( int consumer, struct dataframe *data ) {
+    struct framebus_reader* reader = &readers[consumer];
+    if( framebus_read( reader, data ) ) {
+        return true;
+    }
+    xEventGroupWaitBits( frameEvents, 1u << consumer, pdTRUE, pdFALSE, pdMS_TO_TICKS(250) );
+    return framebus_read( reader, data );
+}
+
+void sensor_getConsumerStats( int consumer, uint32_t* frames, uint32_t* drops ) {
+    *frames = readers[consumer].frames;
+    *drops  = readers[consumer].drops;
+}
+
+void sensor_init( void ) {
+    framebus_init( &bus );
+    frameEvents = xEventGroupCreate();
+    if ( frameEvents == NULL ) {
+        Serial.println("Failed to create frame event group");
+    }
+    presenceEvents = xQueueCreate( PRESENCE_EVENTS, sizeof(struct presence_event) );
+    if ( presenceEvents == NULL ) {
+        Serial.println("Failed to create presence event queue");
+    }
+    aggregates = xQueueCreate( AGGREGATES, sizeof(struct gate_aggregate) );
+    if ( aggregates == NULL ) {
+        Serial.println("Failed to create gate statistics queue");
+    }
+}
+
+bool sensor_getEvent( struct presence_event* ev ) {
+    return pdTRUE == xQueueReceive( presenceEvents, ev, 0 );
+}
+
+bool sensor_getAggregate( struct gate_aggregate* agg ) {
+    return pdTRUE == xQueueReceive( aggregates, agg, 0 );
+}
+
+int sensor_getPresence( int sensor ) {
+    if( sensor < 0 || sensor_count() <= sensor || !cfg.presence.enabled ) {
+        return -1;
+    }
+    return instances[sensor].presence.state;
+}
+
+int64_t sensor_getClockOffset( void ) {
+    struct timeval now;
+    gettimeofday( &now, NULL );
+    int64_t const boot = esp_timer_get_time();
+    if( now.tv_sec < CLOCK_SYNCED ) {
+        return 0;
+    }
+    return (int64_t)now.tv_sec * 1000000 + now.tv_usec - boot;
+}
+
+bool sensor_getStats( int sensor, struct sensor_stats* dest ) {
+    if( sensor < 0 || sensor_count() <= sensor ) {
+        return false;
+    }
+    struct sensor_instance const* self = &instances[sensor];
+    struct radarparser_stats const* ps = &self->parser.stats;
+    *dest = self->stats;
+    dest->badFrames = ps->badLength + ps->badFooter + ps->badPayload;
+    dest->skippedBytes = ps->skipped;
+    return true;
+}
+
+int sensor_count( void ) {
+    return cfg.radar.count < SENSOR_MAX_RADARS ? cfg.radar.count : SENSOR_MAX_RADARS;
+}
 
-    data->detectionDistance        = radar.detectionDistance();
-    data->stationaryTargetDistance = radar.stationaryTargetDistance();
-    data->stationaryTargetEnergy   = radar.stationaryTargetEnergy();
-    data->movingTargetDistance     = radar.movingTargetDistance();
-    data->movingTargetEnergy       = radar.movingTargetEnergy();
-    data->engRataingData           = radar.engRetainDataValue();
-  
-    for (int x = 0; x < LD2410_MAX_GATES; ++x) {
-        data->engMovingDistanceGateEnergy[x] = radar.engMovingDistanceGateEnergy(x);
-        data->engStaticDistanceGateEnergy[x] = radar.engStaticDistanceGateEnergy(x);
+bool sensor_startCapture( int sensor ) {
+    if( sensor < 0 || sensor_count() <= sensor ) {
+        return false;
     }
+    struct sensor_instance* self = &instances[sensor];
+    int const state = self->capture.state.load();
+    if( CAPTURE_RUNNING == state || CAPTURE_STOPPING == state ) {
+        return false;
+    }
+    if( NULL == self->capture.buf ) {
+        self->capture.buf = (uint8_t*)malloc( SENSOR_CAPTURE_SIZE );
+        if( NULL == self->capture.buf ) {
+            Serial.println("Failed to allocate the capture buffer");
+            return false;
+        }
+    }
+    capture_init( &self->capture.rec, self->capture.buf, SENSOR_CAPTURE_SIZE, sensor, esp_timer_get_time() );
+    self->capture.state.store( CAPTURE_RUNNING );
+    xTaskNotifyGive( self->task );
+    return true;
 }
 
+void sensor_stopCapture( int sensor ) {
+    if( sensor < 0 || sensor_count() <= sensor ) {
+        return;
+    }
+    struct sensor_instance* self = &instances[sensor];
+    int expected = CAPTURE_RUNNING;
+    if( self->capture.state.compare_exchange_strong( expected, CAPTURE_STOPPING ) ) {
+        xTaskNotifyGive( self->task );
+    }
+}
 
-String dataStructureToCsv( struct dataframe const* data) {
-    pos = snprintf(serialBuffer, sizeof(serialBuffer),
-                    "%d,%d,%d,%d,%d,%d",
-                    data->stationaryTargetDistance, data->stationaryTargetEnergy,
-                    data->movingTargetDistance, data->movingTargetEnergy,
-                    data->detectionDistance, data->engRataingData );
+size_t sensor_getCapture( int sensor, uint8_t const** data ) {
+    if( sensor < 0 || sensor_count() <= sensor ) {
+        return 0;
+    }
+    struct sensor_instance* self = &instances[sensor];
+    if( CAPTURE_DONE != self->capture.state.load() ) {
+        return 0;
+    }
+    *data = self->capture.buf;
+    return self->capture.rec.len;
+}
 
-    for (int x = 0; x < LD2410_MAX_GATES; ++x) {
-        int len = snprintf(buffer1, sizeof(buffer1), ",%d", data->engMovingDistanceGateEnergy[x]);
-        strcat(serialBuffer, buffer1);
-        pos += len;
+/*Apply the capture requests of the web server, from the radar task*/
+static void updateCapture( struct sensor_instance* self ) {
+    int const state = self->capture.state.load();
+    if( CAPTURE_RUNNING == state && NULL == self->capture.active ) {
+        self->capture.active = &self->capture.rec;
     }
-    for (int x = 0; x < LD2410_MAX_GATES; ++x) {
-        int len = snprintf(buffer1, sizeof(buffer1), ",%d",data->engStaticDistanceGateEnergy[x]);
-        strcat(serialBuffer, buffer1);
-        pos += len;
+    else if( CAPTURE_STOPPING == state || ( self->capture.active && self->capture.rec.full ) ) {
+        self->capture.active = NULL;
+        capture_finish( &self->capture.rec );
+        self->capture.state.store( CAPTURE_DONE );
     }
+}
 
-    return String(serialBuffer);
+/*Called from the UART event task on reception errors. The driver flushes the 
+input on overflows, so the lost data is estimated from the buffer size.*/
+static void onRadarError( struct sensor_instance* self, hardwareSerial_error_t err ) {
+    struct sensor_stats& stats = self->stats;
+    switch( err ) {
+        case UART_BUFFER_FULL_ERROR:
+            ++stats.overruns;
+            stats.droppedBytes += RADAR_RX_BUFFER;
+            break;
+        case UART_FIFO_OVF_ERROR:
+            ++stats.overruns;
+            stats.droppedBytes += UART_HW_FIFO;
+            break;
+        case UART_FRAME_ERROR:
+        case UART_PARITY_ERROR:
+            ++stats.framingErrors;
+            break;
+        default:
+            break;
+    }
+    xTaskNotifyGive( self->task );
 }
 
-static QueueHandle_t queue;
-bool newdata = false;
-static struct dataframe dataf;
+/*Decide if a frame is reported. With the adaptive rate enabled, frames are reported at the
+active rate while a target is detected and at the heartbeat rate while the scene is idle.*/
+static bool reportFrame( struct sensor_instance* self, uint32_t now ) {
+    struct radar_config const* rc = &cfg.radar;
+    struct dataframe const* data = &self->dataf;
+    if( !rc->adaptive ) {
+        return true;
+    }
 
-bool waitnewData( struct dataframe *data) {
+    uint8_t const energy = max( data->movingTargetEnergy, data->stationaryTargetEnergy );
+    uint8_t const exitlevel = rc->threshold > rc->hysteresis ? rc->threshold - rc->hysteresis : 0;
+    bool const wasactive = self->rate.active;
+    if( rc->threshold <= energy || ( self->rate.active && exitlevel <= energy ) ) {
+        self->rate.active = true;
+        self->rate.lastActive = now;
+    }
+    else if( self->rate.active && rc->holdms <= now - self->rate.lastActive ) {
+        self->rate.active = false;
+    }
 
-    if( xQueueReceive(queue, data, (TickType_t)pdMS_TO_TICKS(250)) ) {
+    uint32_t const period = self->rate.active ? rc->activeperiod : rc->idleperiod;
+    if( ( self->rate.active && !wasactive ) || period <= now - self->rate.lastReport ) {
+        self->rate.lastReport = now;
         return true;
     }
     return false;
 }
 
-void sensor_init( void ) {
-    int sizeitem = sizeof( struct dataframe );
-    queue = xQueueCreate( 5, sizeitem );
-    if (queue == 0) {
-        Serial.printf("Failed to create queue= %p\n", queue);
+/*Run the presence detector over a frame. The events are queued for the consumers
+and the consumers are woken up as if a frame were published.*/
+static void detectPresence( struct sensor_instance* self, uint32_t now ) {
+    struct presence_config const* pc = &cfg.presence;
+    if( !pc->enabled ) {
+        return;
+    }
+
+    struct presence_params const params = {
+        .window    = pc->window,
+        .enter     = pc->enter,
+        .exit      = pc->exit,
+        .holdms    = pc->holdms,
+        .summaryms = (uint32_t)pc->summary * 1000
+    };
+    struct presence_event ev;
+    if( PRESENCE_NONE == presence_update( &self->presence, &params, &self->dataf, now, &ev ) ) {
+        return;
+    }
+    if( pdTRUE != xQueueSend( presenceEvents, &ev, 0 ) ) {
+        ++self->stats.lostEvents;
+        return;
+    }
+    xEventGroupSetBits( frameEvents, consumerBits() );
+}
+
+/*Queue the statistics of a closed window and wake up the consumers*/
+static void queueAggregate( struct sensor_instance* self, struct gate_aggregate const* agg ) {
+    if( pdTRUE != xQueueSend( aggregates, agg, 0 ) ) {
+        ++self->stats.lostEvents;
+        return;
+    }
+    xEventGroupSetBits( frameEvents, consumerBits() );
+}
+
+/*Add a frame to the gate statistics of the current window*/
+static void aggregateFrame( struct sensor_instance* self ) {
+    if( !cfg.aggregate.enabled ) {
+        /*Drop the window, it would be sent with old frames once enabled again*/
+        if( self->aggregate.frames ) {
+            gatestats_init( &self->aggregate );
+        }
+        return;
+    }
+    struct gate_aggregate agg;
+    if( gatestats_update( &self->aggregate, &self->dataf, (uint32_t)cfg.aggregate.window * 1000, &agg ) ) {
+        queueAggregate( self, &agg );
+    }
+}
+
+/*Send the window of a radar that stopped reporting once it has ended*/
+static void expireAggregate( struct sensor_instance* self ) {
+    struct gate_aggregate agg;
+    if( cfg.aggregate.enabled && gatestats_expire( &self->aggregate, esp_timer_get_time(), self->id, &agg ) ) {
+        queueAggregate( self, &agg );
     }
+}
+
+/*Record the bytes of a read while a capture runs*/
+static void captureRead( struct sensor_instance* self, int64_t now, size_t len ) {
+    struct capture* rec = self->capture.active;
+    if( NULL == rec || !capture_chunk( rec, now ) ) {
+        return;
+    }
+    for( size_t i = 0; i < len && capture_put( rec, self->rxbuf[i] ); ++i ) {
+    }
+}
 
+/*Feed the parser with all the received bytes, publishing each decoded report once.
+The reports are decoded in the read buffer, the frame is filled in the same pass.*/
+static void drainRadar( struct sensor_instance* self ) {
+    struct sensor_stats& stats = self->stats;
+    int avail;
+    while( 0 < ( avail = self->serial->available() ) ) {
+        size_t const len = self->serial->readBytes( self->rxbuf, avail < RADAR_READ ? avail : RADAR_READ );
+        int64_t const rxtime = esp_timer_get_time();
+        stats.rxBytes += len;
+        captureRead( self, rxtime, len );
+        for( size_t pos = 0; pos < len; ) {
+            bool decoded;
+            pos += radarparser_parse( &self->parser, self->rxbuf + pos, len - pos, &self->dataf, &decoded );
+            if( !decoded ) {
+                continue;
+            }
+            stampdataFrame( self, rxtime );
+            ++stats.frames;
+            uint32_t const now = millis();
+            detectPresence( self, now );
+            aggregateFrame( self );
+            if( !reportFrame( self, now ) ) {
+                ++stats.suppressed;
+                continue;
+            }
+            framebus_publish( &bus, &self->dataf );
+            xEventGroupSetBits( frameEvents, consumerBits() );
+        }
+    }
 }
 
 void sensor_task( void * parameter ) {
 
+    int const id = (int)(intptr_t)parameter;
+    struct sensor_instance* self = &instances[id];
+    self->id = id;
+    self->serial = wiring[id].serial;
+    self->task = xTaskGetCurrentTaskHandle();
+    presence_init( &self->presence );
+    gatestats_init( &self->aggregate );
+    radarparser_init( &self->parser );
+    HardwareSerial* serial = self->serial;
 
     // start path to LD2410
-    // radar.debug(Serial);  // enable debug output to console
-    Serial2.begin(256000, SERIAL_8N1, RXD2, TXD2); // UART for monitoring the radar rx, tx
+    // self->radar.debug(Serial);  // enable debug output to console
+    serial->setRxBufferSize( RADAR_RX_BUFFER );
+    serial->begin(RADAR_BAUDRATE, SERIAL_8N1, wiring[id].rx, wiring[id].tx); // UART for monitoring the radar rx, tx
     // Start LD2410 Sensor
-    if (radar.begin(Serial2)) {
-        Serial.println(F("Sensor Initialized..."));
+    if (self->radar.begin(*serial)) {
+        Serial.printf("Sensor %d Initialized...\n", id);
         delay(5000);
-        radar.requestStartEngineeringMode();
+        self->radar.requestStartEngineeringMode();
     } else {
-        Serial.println(F(" Sensor was not connected"));
+        Serial.printf(" Sensor %d was not connected\n", id);
     }
+
+    serial->setRxTimeout( RADAR_RX_TOUT );
+    serial->onReceiveError( [self]( hardwareSerial_error_t err ) { onRadarError( self, err ); } );
+    serial->onReceive( [self]() { xTaskNotifyGive( self->task ); } );
     
     for(;;){
-        radar.ld2410_loop();
-        if(radar.isConnected() && millis() - lastReading > 100) {  //Report every 1000ms
-            filldataFrame( &dataf ); 
-            newdata = true;
-            int status = xQueueSend( queue, &dataf, pdMS_TO_TICKS(250) );
-            if ( !status ) 
-                Serial.println( "Failing queue");
-            
-            lastReading = millis();
-        }
-        vTaskDelay(pdMS_TO_TICKS(1));
+        /*The timeout only guards against a missed notification*/
+        ulTaskNotifyTake( pdTRUE, pdMS_TO_TICKS(1000) );
+        updateCapture( self );
+        drainRadar( self );
+        expireAggregate( self );
     }
 
-}
+}
\ No newline at end of file
@@ -3,27 +3,123 @@
 #define __SENSOR_TASK__
 
 #include "ld2410.h"
+#include "dataframe.h"
+#include "presence.h"
+#include "gate-stats.h"
 
-struct dataframe {
-    uint16_t detectionDistance;
-    uint16_t stationaryTargetDistance;
-    uint8_t  stationaryTargetEnergy;
-    uint16_t movingTargetDistance;
-    uint8_t  movingTargetEnergy;
-    uint16_t engRataingData;
-    uint8_t  engMovingDistanceGateEnergy[LD2410_MAX_GATES];
-    uint8_t  engStaticDistanceGateEnergy[LD2410_MAX_GATES];
+enum {
+    SENSOR_MAX_CONSUMERS = 8,
+    SENSOR_MAX_RADARS    = DATAFRAME_MAX_SENSORS,
+    SENSOR_CAPTURE_SIZE  = 32 * 1024  /*Over a minute of engineering frames*/
+};
+
+/*Radar UART ingestion counters, one set per radar*/
+struct sensor_stats {
+    uint32_t rxBytes;
+    uint32_t frames;
+    uint32_t overruns;
+    uint32_t framingErrors;
+    uint32_t droppedBytes;
+    uint32_t suppressed;   /*Frames not reported by the adaptive rate*/
+    uint32_t lostEvents;   /*Presence events and gate statistics dropped because the queue was full*/
+    uint32_t badFrames;    /*Frames with a wrong length, footer or payload*/
+    uint32_t skippedBytes; /*Bytes dropped by the parser to find the next frame*/
 };
 
 
 /**
- * @brief Freertos task to manage the WIFI and MQTT connections.
- * @param parameter */
+ * @brief Freertos task to read the frames of a radar. There is one task per radar.
+ * @param parameter, index of the radar, from 0 to sensor_count() - 1. */
 void sensor_task( void * parameter );
 
-bool waitnewData( struct dataframe *data);
+/**
+ * @brief Get the number of radars enabled in the configuration. */
+int sensor_count( void );
+
+/**
+ * @brief Register a new consumer of the radar frames. Every consumer receives 
+ * all the frames published from now on, of all the radars.
+ * @return consumer identifier, -1 if there are no free consumers. */
+int sensor_subscribe( void );
+
+/**
+ * @brief Wait up to 250 ms for a new frame and copy it.
+ * @param consumer, identifier returned by sensor_subscribe().
+ * @param data, destination of the frame.
+ * @return true if a new frame has been copied, false otherwise. */
+bool waitnewData( int consumer, struct dataframe *data );
+
+/**
+ * @brief Wait for a new frame without copying it. 
+ * The frame must be released with sensor_releaseFrame() once it has been used.
+ * @param consumer, identifier returned by sensor_subscribe().
+ * @param timeout, maximum waiting time in ms.
+ * @return pointer to the frame, NULL if there are no new frames. */
+struct dataframe const* sensor_peekFrame( int consumer, uint32_t timeout );
+
+/**
+ * @brief Release the frame returned by sensor_peekFrame().
+ * @param consumer, identifier returned by sensor_subscribe().
+ * @return true if the frame was still valid while it was used, false if it was overwritten. */
+bool sensor_releaseFrame( int consumer );
+
+/**
+ * @brief Get the frame counters of a consumer.
+ * @param consumer, identifier returned by sensor_subscribe().
+ * @param frames, number of frames read.
+ * @param drops, number of frames lost because the consumer was too slow. */
+void sensor_getConsumerStats( int consumer, uint32_t* frames, uint32_t* drops );
+
+/**
+ * @brief Get a snapshot of the UART ingestion counters of a radar.
+ * @param sensor, index of the radar.
+ * @param dest, destination of the counters.
+ * @return false if the radar is not enabled. */
+bool sensor_getStats( int sensor, struct sensor_stats* dest );
+
+/**
+ * @brief Get the offset between the capture times of the frames and the wall clock.
+ * @return microseconds to add to a capture time to get unix time, 0 while SNTP has not set the clock. */
+int64_t sensor_getClockOffset( void );
+
+/**
+ * @brief Get the next presence event of any radar, without waiting. 
+ * The consumers are woken up by new events as by new frames.
+ * @param ev, destination of the event.
+ * @return true if an event has been copied. */
+bool sensor_getEvent( struct presence_event* ev );
+
+/**
+ * @brief Get the next gate statistics of any radar, without waiting. 
+ * The consumers are woken up by new statistics as by new frames.
+ * @param agg, destination of the statistics.
+ * @return true if statistics have been copied. */
+bool sensor_getAggregate( struct gate_aggregate* agg );
 
-String dataStructureToCsv( struct dataframe const* data);
+/**
+ * @brief Get the current presence state of a radar.
+ * @param sensor, index of the radar.
+ * @return enum presence_state, -1 if the radar or the detector are not enabled. */
+int sensor_getPresence( int sensor );
+
+/**
+ * @brief Start recording the raw bytes received from a radar, see radar-capture.h.
+ * The recording stops by itself when the buffer is full.
+ * @param sensor, index of the radar.
+ * @return false if the radar is not enabled, a recording is running or there is no memory. */
+bool sensor_startCapture( int sensor );
+
+/**
+ * @brief Request the end of the recording, it is closed by the radar task shortly after.
+ * @param sensor, index of the radar. */
+void sensor_stopCapture( int sensor );
+
+/**
+ * @brief Get the finished recording of a radar.
+ * @param sensor, index of the radar.
+ * @param data, destination of the recording.
+ * @return size of the recording, 0 if there is no finished recording. */
+size_t sensor_getCapture( int sensor, uint8_t const** data );
 
 void sensor_init( void );
 
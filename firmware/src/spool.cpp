@@ -0,0 +1,322 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#include "spool.h"
+#include <dirent.h>
+#include <string.h>
+#include <sys/stat.h>
+
+enum {
+    RECORD_HEADER = 2,
+    PATH_MAX_LEN  = SPOOL_PATH + 24
+};
+
+static void segmentPath( struct spool const* self, uint32_t n, char* dest ) {
+    snprintf( dest, PATH_MAX_LEN, "%s/spool-%u.bin", self->dir, (unsigned)n );
+}
+
+static uint32_t segmentSize( struct spool const* self, uint32_t n ) {
+    char path[PATH_MAX_LEN];
+    segmentPath( self, n, path );
+    struct stat st;
+    return 0 == stat( path, &st ) ? st.st_size : 0;
+}
+
+/*Number of complete records of a segment, following the record headers*/
+static uint32_t segmentRecords( struct spool const* self, uint32_t n ) {
+    char path[PATH_MAX_LEN];
+    segmentPath( self, n, path );
+    uint32_t const size = segmentSize( self, n );
+    FILE* f = fopen( path, "rb" );
+    if( NULL == f ) {
+        return 0;
+    }
+    uint32_t records = 0;
+    uint32_t pos = 0;
+    uint8_t hdr[RECORD_HEADER];
+    while( RECORD_HEADER == fread( hdr, 1, RECORD_HEADER, f ) ) {
+        pos += RECORD_HEADER + ( hdr[0] | hdr[1] << 8 );
+        if( size < pos || 0 != fseek( f, pos, SEEK_SET ) ) {
+            break;
+        }
+        ++records;
+    }
+    fclose( f );
+    return records;
+}
+
+static void closeReader( struct spool* self ) {
+    if( self->reader ) {
+        fclose( self->reader );
+        self->reader = NULL;
+    }
+}
+
+/*Size of the oldest segment, the newest one may still be in use*/
+static uint32_t firstSize( struct spool const* self ) {
+    return self->first == self->last ? self->lastSize : segmentSize( self, self->first );
+}
+
+/*Delete the oldest segment, its records not read yet are counted as evicted*/
+static void dropFirst( struct spool* self ) {
+    uint32_t const fsize = firstSize( self );
+    char path[PATH_MAX_LEN];
+    closeReader( self );
+    segmentPath( self, self->first, path );
+    remove( path );
+
+    self->stats.evicted += self->firstRecords;
+    self->stats.records -= self->firstRecords;
+    self->stats.bytes   -= fsize - self->offset;
+    self->size          -= fsize;
+    self->offset = 0;
+    if( self->first == self->last ) {
+        self->lastSize = 0;
+        self->firstRecords = 0;
+        return;
+    }
+    ++self->first;
+    self->firstRecords = segmentRecords( self, self->first );
+}
+
+/*Delete the oldest segments while the spool is over its limit*/
+static void evict( struct spool* self ) {
+    while( self->limit < self->size && self->first != self->last ) {
+        dropFirst( self );
+    }
+}
+
+bool spool_open( struct spool* self, char const* dir, uint32_t limit ) {
+    memset( self, 0, sizeof(*self) );
+    strncpy( self->dir, dir, sizeof(self->dir) - 1 );
+    DIR* d = opendir( dir );
+    if( NULL == d ) {
+        return false;
+    }
+
+    bool found = false;
+    struct dirent* entry;
+    while( NULL != ( entry = readdir( d ) ) ) {
+        unsigned n;
+        char end;
+        if( 2 != sscanf( entry->d_name, "spool-%u.bi%c", &n, &end ) || 'n' != end ) {
+            continue;
+        }
+        self->first = !found || n < self->first ? n : self->first;
+        self->last  = !found || self->last < n ? n : self->last;
+        found = true;
+    }
+    closedir( d );
+
+    /*The segments are numbered without gaps, a missing one is empty*/
+    if( found ) {
+        for( uint32_t n = self->first; n != self->last + 1; ++n ) {
+            uint32_t const records = segmentRecords( self, n );
+            uint32_t const size = segmentSize( self, n );
+            self->stats.records += records;
+            self->stats.bytes   += size;
+            self->size          += size;
+            if( n == self->first ) {
+                self->firstRecords = records;
+            }
+            if( n == self->last ) {
+                self->lastSize = size;
+            }
+        }
+    }
+    spool_setLimit( self, limit );
+    return true;
+}
+
+void spool_setLimit( struct spool* self, uint32_t limit ) {
+    self->limit = limit < 2 * SPOOL_SEGMENT ? 2 * SPOOL_SEGMENT : limit;
+    evict( self );
+}
+
+void spool_flush( struct spool* self ) {
+    uint32_t const unread = self->len - self->pos;
+    uint32_t const records = self->bufRecords;
+    uint8_t const* data = self->buf + self->pos;
+    self->len = self->pos = self->bufRecords = 0;
+    if( 0 == unread ) {
+        return;
+    }
+
+    if( self->lastSize && SPOOL_SEGMENT < self->lastSize + unread ) {
+        ++self->last;
+        self->lastSize = 0;
+    }
+    /*A reader of the segment being appended would not see the new records*/
+    if( self->first == self->last ) {
+        closeReader( self );
+    }
+
+    char path[PATH_MAX_LEN];
+    segmentPath( self, self->last, path );
+    FILE* f = fopen( path, "ab" );
+    size_t const written = f ? fwrite( data, 1, unread, f ) : 0;
+    bool const ok = NULL != f && 0 == fclose( f ) && written == unread;
+    ++self->stats.writes;
+    if( !ok ) {
+        /*The segment may hold a part of the batch, the records written completely are
+        kept. It is not appended anymore and the reader drops it at the partial record.*/
+        uint32_t kept = 0;
+        size_t pos = 0;
+        while( pos + RECORD_HEADER <= written ) {
+            pos += RECORD_HEADER + ( data[pos] | data[pos + 1] << 8 );
+            if( written < pos ) {
+                break;
+            }
+            ++kept;
+        }
+        self->stats.errors  += records - kept;
+        self->stats.records -= records - kept;
+        self->stats.bytes   -= unread - written;
+        self->stats.written += written;
+        self->size          += written;
+        if( self->first == self->last ) {
+            self->firstRecords += kept;
+        }
+        ++self->last;
+        self->lastSize = 0;
+        evict( self );
+        return;
+    }
+
+    self->stats.written += unread;
+    self->size          += unread;
+    self->lastSize      += unread;
+    if( self->first == self->last ) {
+        self->firstRecords += records;
+    }
+    evict( self );
+}
+
+bool spool_put( struct spool* self, void const* data, size_t len, uint32_t now ) {
+    if( 0 == len || SPOOL_MAX_RECORD < len ) {
+        return false;
+    }
+    if( SPOOL_BUFFER < self->len + RECORD_HEADER + len ) {
+        spool_flush( self );
+    }
+    if( 0 == self->bufRecords ) {
+        self->since = now;
+    }
+    uint8_t* pos = self->buf + self->len;
+    pos[0] = len;
+    pos[1] = len >> 8;
+    memcpy( pos + RECORD_HEADER, data, len );
+    self->len += RECORD_HEADER + len;
+    ++self->bufRecords;
+    ++self->stats.records;
+    ++self->stats.spooled;
+    self->stats.bytes += RECORD_HEADER + len;
+    return true;
+}
+
+void spool_sync( struct spool* self, uint32_t now ) {
+    if( self->bufRecords && SPOOL_FLUSH_MS <= now - self->since ) {
+        spool_flush( self );
+    }
+}
+
+/*Read the next record of the oldest segment*/
+static size_t readSegment( struct spool* self, void* dest, size_t len ) {
+    if( NULL == self->reader ) {
+        char path[PATH_MAX_LEN];
+        segmentPath( self, self->first, path );
+        self->reader = fopen( path, "rb" );
+        if( NULL == self->reader || 0 != fseek( self->reader, self->offset, SEEK_SET ) ) {
+            closeReader( self );
+            return 0;
+        }
+    }
+    uint8_t hdr[RECORD_HEADER];
+    if( RECORD_HEADER != fread( hdr, 1, RECORD_HEADER, self->reader ) ) {
+        return 0;
+    }
+    size_t const size = hdr[0] | hdr[1] << 8;
+    if( len < size || size != fread( dest, 1, size, self->reader ) ) {
+        return 0;
+    }
+    /*The position is only moved by spool_pop()*/
+    fseek( self->reader, self->offset, SEEK_SET );
+    return size;
+}
+
+size_t spool_peek( struct spool* self, void* dest, size_t len ) {
+    for(;;) {
+        if( self->offset < firstSize( self ) ) {
+            size_t const size = readSegment( self, dest, len );
+            if( size ) {
+                return size;
+            }
+        /*Unreadable segment, its records are lost*/
+            uint32_t const lost = self->firstRecords;
+            dropFirst( self );
+            self->stats.evicted -= lost;
+            self->stats.errors  += lost;
+        }
+        else if( self->first != self->last ) {
+            /*Empty or missing segment left by a failed write*/
+            dropFirst( self );
+        }
+        else {
+            break;
+        }
+    }
+
+    if( self->pos < self->len ) {
+        uint8_t const* pos = self->buf + self->pos;
+        size_t const size = pos[0] | pos[1] << 8;
+        if( len < size ) {
+            return 0;
+        }
+        memcpy( dest, pos + RECORD_HEADER, size );
+        return size;
+    }
+    return 0;
+}
+
+void spool_pop( struct spool* self ) {
+    uint32_t const fsize = firstSize( self );
+    if( self->offset < fsize ) {
+        uint8_t hdr[RECORD_HEADER];
+        if( NULL == self->reader || RECORD_HEADER != fread( hdr, 1, RECORD_HEADER, self->reader ) ) {
+            return;
+        }
+        uint32_t const size = RECORD_HEADER + ( hdr[0] | hdr[1] << 8 );
+        self->offset += size;
+        fseek( self->reader, self->offset, SEEK_SET );
+        --self->firstRecords;
+        --self->stats.records;
+        ++self->stats.drained;
+        self->stats.bytes -= size;
+        if( fsize <= self->offset ) {
+            /*All the records of the segment have been read*/
+            dropFirst( self );
+        }
+        return;
+    }
+
+    if( self->pos < self->len ) {
+        uint8_t const* pos = self->buf + self->pos;
+        uint32_t const size = RECORD_HEADER + ( pos[0] | pos[1] << 8 );
+        self->pos += size;
+        --self->bufRecords;
+        --self->stats.records;
+        ++self->stats.drained;
+        self->stats.bytes -= size;
+        if( self->pos == self->len ) {
+            self->pos = self->len = 0;
+        }
+    }
+}
+
+bool spool_empty( struct spool const* self ) {
+    return 0 == self->stats.records;
+}
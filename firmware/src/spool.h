@@ -0,0 +1,110 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#ifndef __SPOOL__
+#define __SPOOL__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum {
+    SPOOL_SEGMENT   = 16 * 1024,  /*A segment file is closed once it reaches this size*/
+    SPOOL_BUFFER    = 2 * 1024,   /*Records kept in RAM before a flash write*/
+    SPOOL_FLUSH_MS  = 30000,      /*Longest time a record waits in RAM*/
+    SPOOL_MAX_RECORD = 1472,
+    SPOOL_PATH      = 32
+};
+
+/*Spool counters*/
+struct spool_stats {
+    uint32_t records;    /*Records waiting, on flash and in RAM*/
+    uint32_t bytes;      /*Bytes waiting, on flash and in RAM*/
+    uint32_t spooled;    /*Records stored since boot*/
+    uint32_t drained;    /*Records sent since boot*/
+    uint32_t evicted;    /*Records dropped to make room for newer ones*/
+    uint32_t errors;     /*Records lost by flash errors*/
+    uint32_t writes;     /*Flash writes*/
+    uint32_t written;    /*Bytes written to flash*/
+};
+
+/* Append only store of records, kept in segment files <dir>/spool-<n>.bin:
+    record: len(2, little endian) data(len)
+   The records are batched in RAM and appended to the newest segment. The oldest segment
+   is deleted when the total size goes over the limit, and once all its records are read.
+   A segment partially read before a restart is read again from its start.*/
+struct spool {
+    char     dir[SPOOL_PATH];
+    uint32_t limit;      /*Largest size on flash in bytes*/
+    uint32_t first;      /*Oldest segment*/
+    uint32_t last;       /*Segment being appended*/
+    uint32_t size;       /*Bytes on flash, all the segments*/
+    uint32_t lastSize;   /*Bytes in the segment being appended*/
+    uint32_t firstRecords; /*Records in the oldest segment not read yet*/
+    uint32_t offset;     /*Read position in the oldest segment*/
+    FILE*    reader;     /*Open on the oldest segment while it is read*/
+    uint8_t  buf[SPOOL_BUFFER];
+    uint16_t len;        /*Bytes in buf*/
+    uint16_t pos;        /*Read position in buf, once the segments are read*/
+    uint16_t bufRecords;
+    uint32_t since;      /*Time the oldest record of buf was added, ms*/
+    struct spool_stats stats;
+};
+
+/**
+ * @brief Open the spool of a directory, with the records left by the previous run.
+ * @param self, the spool
+ * @param dir, directory of the segment files, "/spiffs" on the device
+ * @param limit, largest size on flash in bytes, at least 2 segments.
+ * @return false if the directory can not be read. */
+bool spool_open( struct spool* self, char const* dir, uint32_t limit );
+
+/**
+ * @brief Change the largest size on flash, the oldest segments are deleted if it is smaller.
+ * @param self, the spool
+ * @param limit, largest size on flash in bytes. */
+void spool_setLimit( struct spool* self, uint32_t limit );
+
+/**
+ * @brief Store a record. It is kept in RAM until the buffer is full or spool_sync() writes it.
+ * @param self, the spool
+ * @param data, the record
+ * @param len, size of the record, up to SPOOL_MAX_RECORD
+ * @param now, current time in ms.
+ * @return false if the record is too large or has been lost by a flash error. */
+bool spool_put( struct spool* self, void const* data, size_t len, uint32_t now );
+
+/**
+ * @brief Write the records of the RAM buffer once the oldest one has waited SPOOL_FLUSH_MS.
+ * @param self, the spool
+ * @param now, current time in ms. */
+void spool_sync( struct spool* self, uint32_t now );
+
+/**
+ * @brief Write the records of the RAM buffer to flash.
+ * @param self, the spool */
+void spool_flush( struct spool* self );
+
+/**
+ * @brief Get the oldest record without removing it.
+ * @param self, the spool
+ * @param dest, destination of the record
+ * @param len, size of the destination, SPOOL_MAX_RECORD is always enough.
+ * @return size of the record, 0 if the spool is empty. */
+size_t spool_peek( struct spool* self, void* dest, size_t len );
+
+/**
+ * @brief Remove the record returned by spool_peek().
+ * @param self, the spool */
+void spool_pop( struct spool* self );
+
+/**
+ * @brief Check if there are records waiting.
+ * @param self, the spool */
+bool spool_empty( struct spool const* self );
+
+#endif //__SPOOL__
@@ -0,0 +1,387 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#include "udp-task.h"
+#include <WiFi.h>
+#include "lwip/pbuf.h"
+#include "lwip/udp.h"
+#include "lwip/priv/tcpip_priv.h"
+#include "config-mng.h"
+#include "sensor-task.h"
+#include "frame-codec.h"
+#include "webserver.h"
+
+enum {
+    FRAME_WAIT_MS     = 250,
+    RATE_PERIOD_MS    = 1000
+};
+
+#define SPOOL_DIR "/spiffs"  /*Mount point of SPIFFS.begin()*/
+
+/*Arguments of the lwip calls that must run in the tcpip thread*/
+struct udp_apicall {
+    struct tcpip_api_call_data call;
+    struct udp_pcb* pcb;
+    struct pbuf* p;
+    ip_addr_t const* addr;
+    uint16_t port;
+    err_t err;
+};
+
+static struct udp_pcb* pcb; /*Created once WiFi is up, NULL until then*/
+static struct pbuf* pb;     /*Datagram being built, the frames are encoded straight into it*/
+static struct frame_batch batch;
+static struct frame_delta delta[DATAFRAME_MAX_SENSORS]; /*Gate energies known by the collector*/
+static uint32_t datagramSeq = 0;
+static uint32_t eventSeq = 0;
+static uint32_t deviceId = 0;
+static int consumer = -1;
+static struct udp_stats stats;
+static struct spool spool;  /*Events and gate statistics not sent while offline*/
+static bool spoolReady = false;
+static uint32_t drainTokens = 0; /*Spooled datagrams that may be sent, in thousandths*/
+static uint32_t drainAt = 0;
+static uint32_t rateAt = 0;
+static uint32_t drainedAt = 0;
+
+
+static err_t sendto_api( struct tcpip_api_call_data* call ) {
+    struct udp_apicall* msg = (struct udp_apicall*)call;
+    msg->err = udp_sendto( msg->pcb, msg->p, msg->addr, msg->port );
+    return msg->err;
+}
+
+static err_t new_api( struct tcpip_api_call_data* call ) {
+    struct udp_apicall* msg = (struct udp_apicall*)call;
+    msg->pcb = udp_new( );
+    msg->err = msg->pcb ? ERR_OK : ERR_MEM;
+    return msg->err;
+}
+
+/*Create the pcb in the tcpip thread the first time it is needed with WiFi connected,
+lwip is not up before. It is tried again on the next call if it fails.*/
+static bool openPcb( void ) {
+    static bool failed = false;
+    if( NULL == pcb && WiFi.isConnected() ) {
+        struct udp_apicall msg;
+        msg.pcb = NULL;
+        tcpip_api_call( new_api, &msg.call );
+        pcb = msg.pcb;
+        if( NULL == pcb && !failed ) {
+            Serial.println("Failed to create the UDP pcb");
+        }
+        failed = NULL == pcb;
+    }
+    return NULL != pcb;
+}
+
+/*Identifier of the device sent in the binary datagrams, lower bytes of the MAC*/
+static uint32_t getdeviceId( void ) {
+    uint8_t mac[6];
+    esp_read_mac( mac, ESP_MAC_WIFI_STA );
+    return (uint32_t)mac[2] << 24 | (uint32_t)mac[3] << 16 | (uint32_t)mac[4] << 8 | mac[5];
+}
+
+/*Force a keyframe of every radar as the next delta record, with the current settings if
+the configuration has changed*/
+static void resetDelta( bool reconfigure ) {
+    for( int i = 0; i < DATAFRAME_MAX_SENSORS; ++i ) {
+        if( reconfigure ) {
+            framedelta_init( &delta[i], cfg.udp.deadband, cfg.udp.keyinterval );
+        }
+        else {
+            framedelta_reset( &delta[i] );
+        }
+    }
+}
+
+/*Start an empty batch with the current configuration of the UDP target. The buffer of the
+next datagram is allocated here, before any frame arrives.*/
+static bool startBatch( void ) {
+    if( NULL == pb ) {
+        pb = pbuf_alloc( PBUF_TRANSPORT, UDP_DATAGRAM_SIZE, PBUF_RAM );
+        if( NULL == pb ) {
+            return false;
+        }
+    }
+    size_t const cap = cfg.udp.mtu && cfg.udp.mtu < UDP_DATAGRAM_SIZE ? cfg.udp.mtu : UDP_DATAGRAM_SIZE;
+    framebatch_init( &batch, (uint8_t*)pb->payload, cap, cfg.udp.format, cfg.udp.maxframes,
+                     delta, sensor_getClockOffset() );
+    return true;
+}
+
+/*Send a datagram of len bytes to the UDP collector from the tcpip thread*/
+static bool sendDatagram( struct pbuf* p, size_t len ) {
+    if( !openPcb( ) ) {
+        ++stats.sendErrors;
+        return false;
+    }
+    ip_addr_t addr;
+    IP_ADDR4( &addr, cfg.udp.ip.ip[0], cfg.udp.ip.ip[1], cfg.udp.ip.ip[2], cfg.udp.ip.ip[3] );
+    pbuf_realloc( p, len );
+    struct udp_apicall msg;
+    msg.pcb  = pcb;
+    msg.p    = p;
+    msg.addr = &addr;
+    msg.port = cfg.udp.port;
+    tcpip_api_call( sendto_api, &msg.call );
+    if( ERR_OK != msg.err ) {
+        ++stats.sendErrors;
+        return false;
+    }
+    ++stats.datagrams;
+    return true;
+}
+
+/*Send an event or gate statistics datagram. It is kept in the spool if it can not be sent,
+they are few and the collector needs all of them.*/
+static bool sendOrSpool( struct pbuf* p, size_t len ) {
+    bool const online = WiFi.isConnected();
+    if( online && sendDatagram( p, len ) ) {
+        return true;
+    }
+    if( !online ) {
+        ++stats.offline;
+    }
+    if( spoolReady && cfg.udp.spoolkb ) {
+        spool_put( &spool, p->payload, len, millis() );
+    }
+    return false;
+}
+
+/*Send the spooled datagrams at the configured rate, between the live ones. The budget
+builds up with the time since the previous call and is capped to one second of sending.*/
+static void drainSpool( void ) {
+    uint32_t const now = millis();
+    uint32_t const elapsed = now - drainAt;
+    drainAt = now;
+    if( !spoolReady || 0 == cfg.udp.port || !WiFi.isConnected() || spool_empty( &spool ) ) {
+        drainTokens = 0;
+        return;
+    }
+
+    uint32_t const cap = 1000 * cfg.udp.drainrate;
+    drainTokens = elapsed < RATE_PERIOD_MS ? drainTokens + elapsed * cfg.udp.drainrate : cap;
+    drainTokens = drainTokens < cap ? drainTokens : cap;
+    while( 1000 <= drainTokens ) {
+        struct pbuf* p = pbuf_alloc( PBUF_TRANSPORT, SPOOL_MAX_RECORD, PBUF_RAM );
+        if( NULL == p ) {
+            return;
+        }
+        size_t const len = spool_peek( &spool, p->payload, SPOOL_MAX_RECORD );
+        bool const sent = len && sendDatagram( p, len );
+        pbuf_free( p );
+        if( !sent ) {
+            /*Tried again on the next call*/
+            return;
+        }
+        spool_pop( &spool );
+        drainTokens -= 1000;
+    }
+}
+
+/*Send the frames held in the batch as a single datagram. The buffer is kept for the next
+batch if the datagram can not be sent. The collector can not decode further delta records
+once a datagram is lost, so a keyframe is forced.*/
+static void flush( void ) {
+    size_t const len = framebatch_finish( &batch );
+    if( len && 0 != cfg.udp.port ) {
+        if( !WiFi.isConnected() ) {
+            ++stats.offline;
+            resetDelta( false );
+        }
+        else {
+            if( !sendDatagram( pb, len ) ) {
+                resetDelta( false );
+            }
+            ++datagramSeq;
+            pbuf_free( pb );
+            pb = NULL;
+        }
+    }
+    startBatch( );
+}
+
+/*Send a presence event right away in its own datagram, it is not held in the batch.*/
+static void sendEvent( struct presence_event const* ev ) {
+    if( 0 == cfg.udp.port ) {
+        return;
+    }
+    struct pbuf* p = pbuf_alloc( PBUF_TRANSPORT, FRAME_EVENT_CSV_MAX, PBUF_RAM );
+    if( NULL == p ) {
+        ++stats.sendErrors;
+        return;
+    }
+
+    int64_t const clockoffset = sensor_getClockOffset();
+    size_t len;
+    if( FRAME_FORMAT_CSV == cfg.udp.format ) {
+        len = frame_eventToCsv( ev, clockoffset, (char*)p->payload, FRAME_EVENT_CSV_MAX );
+    }
+    else {
+        struct frame_header const hdr = {
+            .version   = FRAME_BIN_VERSION,
+            .count     = 1,
+            .flags     = FRAME_FLAG_EVENT,
+            .device    = deviceId,
+            .seq       = eventSeq,
+            .frameseq  = 0,
+            .timestamp = 0
+        };
+        len = frame_binEvent( &hdr, ev, clockoffset, (uint8_t*)p->payload, FRAME_EVENT_CSV_MAX );
+    }
+    ++eventSeq;
+    if( len && sendOrSpool( p, len ) ) {
+        ++stats.events;
+    }
+    pbuf_free( p );
+}
+
+/*Send the gate statistics of a window in their own datagram, with the sequence numbers
+of the events.*/
+static void sendAggregate( struct gate_aggregate const* agg ) {
+    if( 0 == cfg.udp.port ) {
+        return;
+    }
+    struct pbuf* p = pbuf_alloc( PBUF_TRANSPORT, FRAME_AGGREGATE_CSV_MAX, PBUF_RAM );
+    if( NULL == p ) {
+        ++stats.sendErrors;
+        return;
+    }
+
+    int64_t const clockoffset = sensor_getClockOffset();
+    size_t len;
+    if( FRAME_FORMAT_CSV == cfg.udp.format ) {
+        len = frame_aggregateToCsv( agg, clockoffset, (char*)p->payload, FRAME_AGGREGATE_CSV_MAX );
+    }
+    else {
+        struct frame_header const hdr = {
+            .version   = FRAME_BIN_VERSION,
+            .count     = 1,
+            .flags     = FRAME_FLAG_AGGREGATE,
+            .device    = deviceId,
+            .seq       = eventSeq,
+            .frameseq  = 0,
+            .timestamp = 0
+        };
+        len = frame_binAggregate( &hdr, agg, clockoffset, (uint8_t*)p->payload, FRAME_AGGREGATE_CSV_MAX );
+    }
+    ++eventSeq;
+    if( len && sendOrSpool( p, len ) ) {
+        ++stats.aggregates;
+    }
+    pbuf_free( p );
+}
+
+/*Add a radar frame to the batch, return false if it must go in the next one*/
+static bool batchFrame( struct dataframe const* frame ) {
+    struct frame_header const hdr = {
+        .version   = FRAME_BIN_VERSION,
+        .count     = 0,
+        .flags     = 0,
+        .device    = deviceId,
+        .seq       = datagramSeq,
+        .frameseq  = 0,
+        .timestamp = 0
+    };
+    return framebatch_add( &batch, &hdr, frame, millis() );
+}
+
+void udp_getStats( struct udp_stats* dest ) {
+    *dest = stats;
+    dest->spool = spool.stats;
+    uint32_t frames;
+    if( 0 <= consumer ) {
+        sensor_getConsumerStats( consumer, &frames, &dest->drops );
+    }
+}
+
+void udp_task( void * parameter ) {
+
+    consumer = sensor_subscribe( );
+    deviceId = getdeviceId( );
+    resetDelta( true );
+    startBatch( );
+    spoolReady = spool_open( &spool, SPOOL_DIR, (uint32_t)cfg.udp.spoolkb * 1024 );
+    if( !spoolReady ) {
+        Serial.println("Failed to open the UDP spool");
+    }
+
+    for(;;) {
+        if( webserver_isUdpUpdated( ) ) {
+            flush( );
+            resetDelta( true );
+            spool_setLimit( &spool, (uint32_t)cfg.udp.spoolkb * 1024 );
+        }
+        else if( NULL == pb ) {
+            flush( );
+        }
+
+        int32_t const remaining = framebatch_remaining( &batch, millis(), cfg.udp.holdms );
+        if( 0 == remaining ) {
+            flush( );
+        }
+
+        struct presence_event ev;
+        while( sensor_getEvent( &ev ) ) {
+            sendEvent( &ev );
+        }
+
+        struct gate_aggregate agg;
+        while( sensor_getAggregate( &agg ) ) {
+            sendAggregate( &agg );
+        }
+
+        drainSpool( );
+        uint32_t const now = millis();
+        if( spoolReady ) {
+            spool_sync( &spool, now );
+        }
+        if( RATE_PERIOD_MS <= now - rateAt ) {
+            stats.drainRate = spool.stats.drained - drainedAt;
+            drainedAt = spool.stats.drained;
+            rateAt = now;
+        }
+
+        uint32_t const timeout = 0 < remaining && remaining < FRAME_WAIT_MS ? remaining : FRAME_WAIT_MS;
+        struct dataframe const* frame = sensor_peekFrame( consumer, timeout );
+        bool const rawframes = ( !cfg.presence.enabled || cfg.presence.raw ) && ( !cfg.aggregate.enabled || cfg.aggregate.raw );
+        if( NULL == frame || NULL == pb || !rawframes ) {
+            if( frame ) {
+                sensor_releaseFrame( consumer );
+            }
+            continue;
+        }
+
+        struct frame_batch const saved = batch;
+        struct frame_delta savedDelta[DATAFRAME_MAX_SENSORS];
+        memcpy( savedDelta, delta, sizeof(delta) );
+        if( !batchFrame( frame ) ) {
+            if( 0 == batch.count ) {
+                /*It does not fit even in an empty batch*/
+                ++stats.oversize;
+                sensor_releaseFrame( consumer );
+                continue;
+            }
+            /*Too far from the first frame of the batch, it is peeked again for the next one*/
+            flush( );
+            continue;
+        }
+        bool const valid = sensor_releaseFrame( consumer );
+        if( !valid ) {
+            /*The frame was overwritten while it was encoded*/
+            batch = saved;
+            memcpy( delta, savedDelta, sizeof(delta) );
+            continue;
+        }
+
+        ++stats.frames;
+        if( framebatch_isFull( &batch ) ) {
+            flush( );
+        }
+    }
+}
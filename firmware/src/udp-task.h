@@ -0,0 +1,43 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#ifndef __UDP_TASK__
+#define __UDP_TASK__
+
+#include <stdint.h>
+#include "spool.h"
+
+enum {
+    UDP_DATAGRAM_SIZE = 1472 /*Largest payload without IP fragmentation on a 1500 bytes MTU*/
+};
+
+/*UDP streaming counters*/
+struct udp_stats {
+    uint32_t datagrams;
+    uint32_t frames;
+    uint32_t events;    /*Presence events sent*/
+    uint32_t aggregates; /*Gate statistics sent*/
+    uint32_t sendErrors;
+    uint32_t offline;   /*Datagrams discarded while the WiFi station was down*/
+    uint32_t drops;     /*Frames overwritten before the task could send them*/
+    uint32_t oversize;  /*Frames larger than an empty datagram*/
+    uint32_t drainRate; /*Spooled datagrams sent in the last second*/
+    struct spool_stats spool;
+};
+
+/**
+ * @brief Freertos task to stream the radar frames to the UDP collector.
+ * It runs independently of the WIFI and MQTT management done in ctrl_task.
+ * @param parameter */
+void udp_task( void * parameter );
+
+/**
+ * @brief Get a snapshot of the UDP streaming counters.
+ * @param dest, destination of the counters. */
+void udp_getStats( struct udp_stats* dest );
+
+#endif //__UDP_TASK__
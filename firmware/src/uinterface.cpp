@@ -8,7 +8,6 @@
 #include "uinterface.h"
 #include "Arduino.h"
 #include "config-mng.h"
-#include "adc121.h"
 
 /*Create a static freertos timer*/
 static TimerHandle_t tmledMode;
@@ -110,31 +109,6 @@ void interface_setState( enum modes mode ) {
 }
 
 
-int board_getadcValue( void ) {
-    uint32_t adc_reading = 0;
-    enum {
-        NO_OF_SAMPLES = 32
-    };
-
-    for (int i = 0; i < NO_OF_SAMPLES; i++) {
-        int16_t raw = 0;
-        int err = adc121_getval( &raw );
-        if ( err ) {
-            Serial.printf("Error reading adc121\n");
-            return 0;
-        }
-        adc_reading += raw;
-    }
-    
-    return adc_reading / NO_OF_SAMPLES;
-}
-
-void board_initadc( void ) {
-    adc121_init( );
-    Serial.println("Init adc...");
-}
-
-
 void factoryreset( void ) {
     Serial.print("Config default mode...");
     config_setdefault(  );
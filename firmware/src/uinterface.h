@@ -43,12 +43,6 @@ void interface_setMode( enum modes mode );
  * @param mode, the state of the led: OFF, BLINK, ON */
 void interface_setState( enum modes mode );
 
-/**
- * @brief This function reads some ADC acquisitions and return the filtered value. */
-int board_getadcValue( void );
-
-void board_initadc( void );
-
 /**
  * @brief This function does a factory reset of the device. */
 void factoryreset( void );
@@ -7,14 +7,23 @@
 
 #include "ESPAsyncWebServer.h"
 #include <ArduinoJson.h>
-#include <PubSubClient.h>
 #include <HTTPClient.h>
 #include "config-mng.h"
 #include "SPIFFS.h"
 #include "uinterface.h"
+#include "sensor-task.h"
+#include "udp-task.h"
+#include "history-task.h"
+#include "adc-task.h"
+#include "frame-codec.h"
+#include "presence.h"
+#include "gate-stats.h"
+#include "esp_timer.h"
+#include "webserver.h"
 
 enum {
-    verbose = 1
+    verbose = 1,
+    MAX_ENERGY = 100    /*Gate energies and thresholds of the LD2410, in percent*/
 };
 
 
@@ -26,9 +35,14 @@ enum {
     UPDATE_SERVICE        = 1u << 4,
     UPDATE_CALIBRATION    = 1u << 5,
     UPDATE_NETWORK        = 1u << 6,
-    OVERWRITE_CALIBRATION = 1u << 7
+    OVERWRITE_CALIBRATION = 1u << 7,
+    UPDATE_UDP            = 1u << 8
 };
 
+/*The model of webserver.h, that tools/cal-check checks the page payload against*/
+static_assert( JSON_OBJECT_SIZE(APPLYCAL_KEYS) + 2 * JSON_ARRAY_SIZE(CAL_MAX_POINTS) + APPLYCAL_TEXT == APPLYCAL_CAPACITY,
+               "JSON_SLOT_SIZE differs from the slots of ArduinoJson" );
+
 static EventGroupHandle_t eventGroup;
 static bool isServerActive = false;
 static String jsonwifis;
@@ -71,6 +85,35 @@ static void ipToString(String* dest, struct ip src) {
     *dest = buf;
 }
 
+/** Get the radar of the sensor parameter, the request is answered with 400 if it is missing */
+static bool getSensorParam( AsyncWebServerRequest* request, int* sensor ) {
+    if( !request->hasParam("sensor") ) {
+        request->send(400, "text/plain", "missing sensor");
+        return false;
+    }
+    *sensor = request->getParam("sensor")->value().toInt();
+    return true;
+}
+
+/** Get the JSON document of an apply request, the request is answered with 400 if it is missing */
+static bool getParameters( AsyncWebServerRequest* request, String* parameters ) {
+    if( !request->hasParam("parameters") ) {
+        request->send(400, "text/plain", "missing parameters");
+        return false;
+    }
+    *parameters = request->getParam("parameters")->value();
+    return true;
+}
+
+/** Check that a member of a request document, when present, is an integer from min to max */
+static bool inRange( JsonObject root, char const* key, long min, long max ) {
+    if( !root.containsKey(key) ) {
+        return true;
+    }
+    JsonVariant const value = root[key];
+    return value.is<long>() && min <= value.as<long>() && value.as<long>() <= max;
+}
+
 bool webserver_isNetworkUpdated( void ) {
     EventBits_t bits = xEventGroupGetBits( eventGroup );
     if ( bits & UPDATE_NETWORK ) {
@@ -89,6 +132,15 @@ bool webserver_isServiceUpdated( void ) {
     return 0;
 }
 
+bool webserver_isUdpUpdated( void ) {
+    EventBits_t bits = xEventGroupGetBits( eventGroup );
+    if ( bits & UPDATE_UDP ) {
+        xEventGroupClearBits( eventGroup, UPDATE_UDP );
+        return 1;
+    }
+    return 0;
+}
+
 bool webserver_isCalibrationUpdated( void ) {
     EventBits_t bits = xEventGroupGetBits( eventGroup );
     if ( bits & UPDATE_CALIBRATION ) {
@@ -239,11 +291,66 @@ void webserver_task( void * parameter ) {
 
         /*Send json with NTP configuration*/
     server.on("/udpData", HTTP_GET, [](AsyncWebServerRequest * request) {
-        DynamicJsonDocument json( 128 );
+        DynamicJsonDocument json( 256 );
         String temporal;
         ipToString( &temporal, cfg.udp.ip );
         json["ip"]     = temporal;
         json["port"]   = cfg.udp.port;
+        json["fmt"]    = cfg.udp.format;
+        json["frames"] = cfg.udp.maxframes;
+        json["mtu"]    = cfg.udp.mtu;
+        json["hold"]   = cfg.udp.holdms;
+        json["dband"]  = cfg.udp.deadband;
+        json["key"]    = cfg.udp.keyinterval;
+        json["spool"]  = cfg.udp.spoolkb;
+        json["drain"]  = cfg.udp.drainrate;
+
+        String content;
+        serializeJson(json, content);
+        request->send(200, "application/json", content);
+        if( verbose ) Serial.println(content);
+    });
+
+    /*Send json with radar reporting configuration*/
+    server.on("/radarData", HTTP_GET, [](AsyncWebServerRequest * request) {
+        DynamicJsonDocument json( 256 );
+        json["count"] = cfg.radar.count;
+        json["adapt"] = cfg.radar.adaptive;
+        json["thr"]   = cfg.radar.threshold;
+        json["hyst"]  = cfg.radar.hysteresis;
+        json["actp"]  = cfg.radar.activeperiod;
+        json["idlep"] = cfg.radar.idleperiod;
+        json["hold"]  = cfg.radar.holdms;
+
+        String content;
+        serializeJson(json, content);
+        request->send(200, "application/json", content);
+        if( verbose ) Serial.println(content);
+    });
+
+    /*Send json with presence detector configuration*/
+    server.on("/presenceData", HTTP_GET, [](AsyncWebServerRequest * request) {
+        DynamicJsonDocument json( 256 );
+        json["en"]    = cfg.presence.enabled;
+        json["raw"]   = cfg.presence.raw;
+        json["win"]   = cfg.presence.window;
+        json["enter"] = cfg.presence.enter;
+        json["exit"]  = cfg.presence.exit;
+        json["hold"]  = cfg.presence.holdms;
+        json["sum"]   = cfg.presence.summary;
+
+        String content;
+        serializeJson(json, content);
+        request->send(200, "application/json", content);
+        if( verbose ) Serial.println(content);
+    });
+
+    /*Send json with gate statistics configuration*/
+    server.on("/aggregateData", HTTP_GET, [](AsyncWebServerRequest * request) {
+        DynamicJsonDocument json( 128 );
+        json["en"]  = cfg.aggregate.enabled;
+        json["raw"] = cfg.aggregate.raw;
+        json["win"] = cfg.aggregate.window;
 
         String content;
         serializeJson(json, content);
@@ -262,9 +369,17 @@ void webserver_task( void * parameter ) {
         json["meas_tp"] = std::string(cfg.service.measures.topic, strlen(cfg.service.measures.topic));
         json["meas_tm"] = cfg.service.measures.period;
         json["meas_un"] = std::string(cfg.service.measures.unit, strlen(cfg.service.measures.unit));
+        json["meas_bn"] = cfg.service.batchsize;
+        json["meas_bd"] = cfg.service.batchdelay;
+        json["meas_en"] = cfg.service.measures.encoding;
+        json["meas_qs"] = cfg.service.measures.qos;
+        json["win"]     = cfg.service.window;
         json["stat_tp"] = std::string(cfg.service.status.topic, strlen(cfg.service.status.topic));
         json["stat_tm"] = cfg.service.status.period;
         json["stat_un"] = std::string(cfg.service.status.unit, strlen(cfg.service.status.unit));
+        json["stat_en"] = cfg.service.status.encoding;
+        json["stat_qs"] = cfg.service.status.qos;
+        json["info_en"] = cfg.service.info.encoding;
         json["loc_lat"] = cfg.service.geo.lat;
         json["loc_lon"] = cfg.service.geo.lng;
 
@@ -276,13 +391,22 @@ void webserver_task( void * parameter ) {
 
     /*Send json sensor calibration*/
     server.on("/calibrationData", HTTP_GET, [](AsyncWebServerRequest * request) {
-        DynamicJsonDocument json( 254 );
-        json["x0"]    = cfg.cal.val[0].x;
-        json["y0"]    = cfg.cal.val[0].y;
-        json["x1"]    = cfg.cal.val[1].x;
-        json["y1"]    = cfg.cal.val[1].y;
+        DynamicJsonDocument json( 640 );
+        JsonArray xs = json.createNestedArray("xs");
+        JsonArray ys = json.createNestedArray("ys");
+        for( int i = 0; i < cfg.cal.count && i < CAL_MAX_POINTS; ++i ) {
+            xs.add( cfg.cal.val[i].x );
+            ys.add( cfg.cal.val[i].y );
+        }
         json["sen1"] = std::string(cfg.cal.id_sens_1, strlen(cfg.cal.id_sens_1));
         json["sen2"] = std::string(cfg.cal.id_sens_2, strlen(cfg.cal.id_sens_2));
+        json["rate"] = cfg.adc.rate;
+        json["avg"]  = cfg.adc.window;
+        json["cyc"]  = cfg.adc.cycle;
+        json["med"]  = cfg.adc.median;
+        json["iir"]  = cfg.adc.iir;
+        json["kq"]   = cfg.adc.kalmanq;
+        json["kr"]   = cfg.adc.kalmanr;
 
         String content;
         serializeJson(json, content);
@@ -290,10 +414,85 @@ void webserver_task( void * parameter ) {
         if( verbose ) Serial.println(content);
     });
 
-    /*Send json with sensor sample*/
+    /*Send json with sensor sample, and the lowest and highest conversions since the
+    previous request*/
     server.on("/sample", HTTP_GET, [](AsyncWebServerRequest * request) {
-        DynamicJsonDocument json( 32 );
-        json["adcval"]    = board_getadcValue( );
+        DynamicJsonDocument json( 96 );
+        int adcval = 0;
+        adc_getValue( &adcval );
+        json["adcval"]    = adcval;
+        int low, high;
+        if( adc_takePeaks( ADC_PEAKS_WEB, &low, &high ) ) {
+            json["min"]   = low;
+            json["max"]   = high;
+        }
+
+        String content;
+        serializeJson(json, content);
+        request->send(200, "application/json", content);
+        if( verbose ) Serial.println(content);
+    });
+
+    /*Send json with the radar ingestion counters*/
+    server.on("/statsData", HTTP_GET, [](AsyncWebServerRequest * request) {
+        DynamicJsonDocument json( 1536 );
+        JsonArray radars = json.createNestedArray("radar");
+        struct sensor_stats st;
+        for( int i = 0; sensor_getStats( i, &st ); ++i ) {
+            JsonObject radar = radars.createNestedObject();
+            radar["id"]       = i;
+            radar["rxbytes"]  = st.rxBytes;
+            radar["frames"]   = st.frames;
+            radar["overruns"] = st.overruns;
+            radar["framerr"]  = st.framingErrors;
+            radar["dropped"]  = st.droppedBytes;
+            radar["suppressed"] = st.suppressed;
+            radar["lostevents"] = st.lostEvents;
+            radar["badframes"]  = st.badFrames;
+            radar["skipped"]    = st.skippedBytes;
+            int const state = sensor_getPresence( i );
+            if( 0 <= state ) {
+                radar["presence"] = presence_stateName( state );
+            }
+        }
+
+        struct udp_stats ust;
+        udp_getStats( &ust );
+        JsonObject udp = json.createNestedObject("udp");
+        udp["datagrams"] = ust.datagrams;
+        udp["frames"]    = ust.frames;
+        udp["events"]    = ust.events;
+        udp["aggregates"] = ust.aggregates;
+        udp["errors"]    = ust.sendErrors;
+        udp["offline"]   = ust.offline;
+        udp["drops"]     = ust.drops;
+        udp["oversize"]  = ust.oversize;
+        JsonObject spool = udp.createNestedObject("spool");
+        spool["records"] = ust.spool.records;
+        spool["bytes"]   = ust.spool.bytes;
+        spool["spooled"] = ust.spool.spooled;
+        spool["drained"] = ust.spool.drained;
+        spool["rate"]    = ust.drainRate;
+        spool["evicted"] = ust.spool.evicted;
+        spool["errors"]  = ust.spool.errors;
+        spool["writes"]  = ust.spool.writes;
+        spool["written"] = ust.spool.written;
+
+        struct hist_stats hst;
+        hist_getStats( &hst );
+        JsonObject history = json.createNestedObject("history");
+        history["frames"]   = hst.frames;
+        history["capacity"] = hst.capacity;
+        history["drops"]    = hst.drops;
+
+        struct adc_stats ast;
+        adc_getStats( &ast );
+        JsonObject adc = json.createNestedObject("adc");
+        adc["samples"]  = ast.samples;
+        adc["errors"]   = ast.errors;
+        adc["overruns"] = ast.overruns;
+        adc["jitter"]   = ast.jitter;
+        adc["i2c"]      = ast.transactions;
 
         String content;
         serializeJson(json, content);
@@ -350,7 +549,7 @@ void webserver_task( void * parameter ) {
         if ( verbose )
             Serial.println(parameters);
         
-        const size_t capacity = JSON_OBJECT_SIZE(15) + 128;
+        const size_t capacity = JSON_OBJECT_SIZE(22) + 128;
         DynamicJsonDocument doc(capacity);
         auto error = deserializeJson(doc, parameters);
         if (error) {
@@ -391,14 +590,162 @@ void webserver_task( void * parameter ) {
         JsonObject root = doc.as<JsonObject>();
         if (root.containsKey("ip"))   stringToIp(&cfg.udp.ip, root["ip"]);
         if (root.containsKey("port"))  cfg.udp.port = root["port"];
+        if (root.containsKey("fmt"))   cfg.udp.format = root["fmt"];
+        if (root.containsKey("frames")) {
+            int const frames = root["frames"];
+            cfg.udp.maxframes = frames < 1 ? 1 : UINT8_MAX < frames ? UINT8_MAX : frames;
+        }
+        if (root.containsKey("hold"))  cfg.udp.holdms = root["hold"];
+        if (root.containsKey("dband")) cfg.udp.deadband = root["dband"];
+        if (root.containsKey("key"))   cfg.udp.keyinterval = root["key"];
+        if (root.containsKey("spool")) cfg.udp.spoolkb = root["spool"];
+        if (root.containsKey("drain")) cfg.udp.drainrate = root["drain"];
+        /*A datagram holds at least one frame of the format, also when only the format changes*/
+        int const minmtu = framebatch_minSize( cfg.udp.format );
+        int const mtu = root.containsKey("mtu") ? root["mtu"].as<int>() : cfg.udp.mtu;
+        cfg.udp.mtu = mtu < minmtu ? minmtu : UDP_DATAGRAM_SIZE < mtu ? UDP_DATAGRAM_SIZE : mtu;
         
-        xEventGroupSetBits( eventGroup, SAVE_CFG );
+        xEventGroupSetBits( eventGroup, SAVE_CFG | UPDATE_UDP );
         request->send(200, "text/plain", "ok");
         
         if( verbose )
             print_udpCfg( &cfg.udp );
     });
 
+    /*Receive json with radar reporting configuration*/
+    server.on("/applyRadar", HTTP_GET, [] (AsyncWebServerRequest * request) {
+        
+        String parameters;
+        if( !getParameters( request, &parameters ) ) {
+            return;
+        }
+        if ( verbose )
+            Serial.println(parameters);
+        
+        const size_t capacity = JSON_OBJECT_SIZE(15) + 128;
+        DynamicJsonDocument doc(capacity);
+        auto error = deserializeJson(doc, parameters);
+        if (error) {
+            Serial.println("parseObject() failed:");
+            request->send(200, "text/plain", "error");
+            return;
+        }
+
+        JsonObject root = doc.as<JsonObject>();
+        /*The values are checked as a whole before any is applied*/
+        bool const valid = inRange( root, "count", 1, SENSOR_MAX_RADARS )
+                        && inRange( root, "adapt", 0, 1 )
+                        && inRange( root, "thr",   0, MAX_ENERGY )
+                        && inRange( root, "hyst",  0, MAX_ENERGY )
+                        && inRange( root, "actp",  0, UINT16_MAX )
+                        && inRange( root, "idlep", 0, UINT16_MAX )
+                        && inRange( root, "hold",  0, UINT16_MAX );
+        if ( !valid ) {
+            Serial.println("Invalid radar settings");
+            request->send(200, "text/plain", "error");
+            return;
+        }
+        if (root.containsKey("count"))  cfg.radar.count = root["count"];
+        if (root.containsKey("adapt"))  cfg.radar.adaptive = root["adapt"];
+        if (root.containsKey("thr"))    cfg.radar.threshold = root["thr"];
+        if (root.containsKey("hyst"))   cfg.radar.hysteresis = root["hyst"];
+        if (root.containsKey("actp"))   cfg.radar.activeperiod = root["actp"];
+        if (root.containsKey("idlep"))  cfg.radar.idleperiod = root["idlep"];
+        if (root.containsKey("hold"))   cfg.radar.holdms = root["hold"];
+        
+        xEventGroupSetBits( eventGroup, SAVE_CFG );
+        request->send(200, "text/plain", "ok");
+        
+        if( verbose )
+            print_radarCfg( &cfg.radar );
+    });
+
+    /*Receive json with presence detector configuration*/
+    server.on("/applyPresence", HTTP_GET, [] (AsyncWebServerRequest * request) {
+        
+        String parameters;
+        if( !getParameters( request, &parameters ) ) {
+            return;
+        }
+        if ( verbose )
+            Serial.println(parameters);
+        
+        const size_t capacity = JSON_OBJECT_SIZE(15) + 128;
+        DynamicJsonDocument doc(capacity);
+        auto error = deserializeJson(doc, parameters);
+        if (error) {
+            Serial.println("parseObject() failed:");
+            request->send(200, "text/plain", "error");
+            return;
+        }
+
+        JsonObject root = doc.as<JsonObject>();
+        bool const valid = inRange( root, "en",    0, 1 )
+                        && inRange( root, "raw",   0, 1 )
+                        && inRange( root, "win",   1, PRESENCE_MAX_WINDOW )
+                        && inRange( root, "enter", 0, MAX_ENERGY )
+                        && inRange( root, "exit",  0, MAX_ENERGY )
+                        && inRange( root, "hold",  0, UINT16_MAX )
+                        && inRange( root, "sum",   0, UINT16_MAX );
+        if ( !valid ) {
+            Serial.println("Invalid presence settings");
+            request->send(200, "text/plain", "error");
+            return;
+        }
+        if (root.containsKey("en"))     cfg.presence.enabled = root["en"];
+        if (root.containsKey("raw"))    cfg.presence.raw = root["raw"];
+        if (root.containsKey("win"))    cfg.presence.window = root["win"];
+        if (root.containsKey("enter"))  cfg.presence.enter = root["enter"];
+        if (root.containsKey("exit"))   cfg.presence.exit = root["exit"];
+        if (root.containsKey("hold"))   cfg.presence.holdms = root["hold"];
+        if (root.containsKey("sum"))    cfg.presence.summary = root["sum"];
+        
+        xEventGroupSetBits( eventGroup, SAVE_CFG );
+        request->send(200, "text/plain", "ok");
+        
+        if( verbose )
+            print_presenceCfg( &cfg.presence );
+    });
+
+    /*Receive json with gate statistics configuration*/
+    server.on("/applyAggregate", HTTP_GET, [] (AsyncWebServerRequest * request) {
+        
+        String parameters;
+        if( !getParameters( request, &parameters ) ) {
+            return;
+        }
+        if ( verbose )
+            Serial.println(parameters);
+        
+        const size_t capacity = JSON_OBJECT_SIZE(5) + 64;
+        DynamicJsonDocument doc(capacity);
+        auto error = deserializeJson(doc, parameters);
+        if (error) {
+            Serial.println("parseObject() failed:");
+            request->send(200, "text/plain", "error");
+            return;
+        }
+
+        JsonObject root = doc.as<JsonObject>();
+        bool const valid = inRange( root, "en",  0, 1 )
+                        && inRange( root, "raw", 0, 1 )
+                        && inRange( root, "win", 1, GATESTATS_MAX_WINDOW );
+        if ( !valid ) {
+            Serial.println("Invalid aggregate settings");
+            request->send(200, "text/plain", "error");
+            return;
+        }
+        if (root.containsKey("en"))     cfg.aggregate.enabled = root["en"];
+        if (root.containsKey("raw"))    cfg.aggregate.raw = root["raw"];
+        if (root.containsKey("win"))    cfg.aggregate.window = root["win"];
+        
+        xEventGroupSetBits( eventGroup, SAVE_CFG );
+        request->send(200, "text/plain", "ok");
+        
+        if( verbose )
+            print_aggregateCfg( &cfg.aggregate );
+    });
+
     /*Receive WIFI credential and network configuration from web page*/
     server.on("/applyNetwork", HTTP_GET, [] (AsyncWebServerRequest * request) {
 
@@ -406,7 +753,7 @@ void webserver_task( void * parameter ) {
         if ( verbose )
             Serial.println(parameters);
         
-        const size_t capacity = JSON_OBJECT_SIZE(15) + 512;
+        const size_t capacity = JSON_OBJECT_SIZE(24) + 512;
         DynamicJsonDocument doc(capacity);
         auto error = deserializeJson(doc, parameters);
         JsonObject root = doc.as<JsonObject>();
@@ -468,9 +815,17 @@ void webserver_task( void * parameter ) {
         if (root.containsKey("meas_tp"))  strcpy(cfg.service.measures.topic, root["meas_tp"]);
         if (root.containsKey("meas_tm"))  cfg.service.measures.period = root["meas_tm"];
         if (root.containsKey("meas_un"))  strcpy(cfg.service.measures.unit, root["meas_un"]);
+        if (root.containsKey("meas_bn"))  cfg.service.batchsize = root["meas_bn"];
+        if (root.containsKey("meas_bd"))  cfg.service.batchdelay = root["meas_bd"];
+        if (root.containsKey("meas_en"))  cfg.service.measures.encoding = root["meas_en"];
+        if (root.containsKey("meas_qs"))  cfg.service.measures.qos = root["meas_qs"];
+        if (root.containsKey("win"))      cfg.service.window = root["win"];
         if (root.containsKey("stat_tp"))  strcpy(cfg.service.status.topic, root["stat_tp"]); 
         if (root.containsKey("stat_tm"))  cfg.service.status.period = root["stat_tm"];
         if (root.containsKey("stat_un"))  strcpy(cfg.service.status.unit, root["stat_un"]);
+        if (root.containsKey("stat_en"))  cfg.service.status.encoding = root["stat_en"];
+        if (root.containsKey("stat_qs"))  cfg.service.status.qos = root["stat_qs"];
+        if (root.containsKey("info_en"))  cfg.service.info.encoding = root["info_en"];
         if (root.containsKey("loc_lat"))  cfg.service.geo.lat = root["loc_lat"];
         if (root.containsKey("loc_lon"))  cfg.service.geo.lng = root["loc_lon"];
 
@@ -488,8 +843,7 @@ void webserver_task( void * parameter ) {
         if ( verbose )
             Serial.println(parameters);
         
-        const size_t capacity = JSON_OBJECT_SIZE(15) + 128;
-        DynamicJsonDocument doc(capacity);
+        DynamicJsonDocument doc(APPLYCAL_CAPACITY);
         auto error = deserializeJson(doc, parameters);
         JsonObject root = doc.as<JsonObject>();
         if (error) {
@@ -497,20 +851,119 @@ void webserver_task( void * parameter ) {
             request->send(200, "text/plain", "error");
             return;
         }
+        /*The points are sorted by code and replace the previous ones as a whole*/
+        if (root.containsKey("xs") && root.containsKey("ys")) {
+            JsonArray xs = root["xs"];
+            JsonArray ys = root["ys"];
+            struct calpoint points[CAL_MAX_POINTS];
+            int count = xs.size();
+            if ( count != ys.size() || CAL_MAX_POINTS < count ) {
+                request->send(200, "text/plain", "error");
+                return;
+            }
+            for ( int i = 0; i < count; ++i ) {
+                /*Out of range codes are kept out of range, for cal_isValid to refuse them*/
+                int const x = xs[i];
+                points[i].x = x < 0 ? -1 : CAL_MAX_CODE < x ? CAL_MAX_CODE + 1 : x;
+                points[i].y = ys[i];
+            }
+            count = cal_sort( points, count );
+            if ( !cal_isValid( points, count ) ) {
+                Serial.println("Invalid calibration points");
+                request->send(200, "text/plain", "error");
+                return;
+            }
+            memcpy( cfg.cal.val, points, count * sizeof( points[0] ) );
+            cfg.cal.count = count;
+        }
         bool overwrite = false;
-        if (root.containsKey("x0"))     cfg.cal.val[0].x =  root["x0"];
-        if (root.containsKey("y0"))     cfg.cal.val[0].y =  root["y0"];
-        if (root.containsKey("x1"))     cfg.cal.val[1].x =  root["x1"];
-        if (root.containsKey("y1"))     cfg.cal.val[1].y =  root["y1"];
         if (root.containsKey("sen1"))   strcpy(cfg.cal.id_sens_1, root["sen1"]);
         if (root.containsKey("sen2"))   strcpy(cfg.cal.id_sens_2, root["sen2"]);
+        if (root.containsKey("rate"))   cfg.adc.rate = root["rate"];
+        if (root.containsKey("avg"))    cfg.adc.window = root["avg"];
+        if (root.containsKey("cyc"))    cfg.adc.cycle = root["cyc"];
+        if (root.containsKey("med"))    cfg.adc.median = root["med"];
+        if (root.containsKey("iir"))    cfg.adc.iir = root["iir"];
+        if (root.containsKey("kq"))     cfg.adc.kalmanq = root["kq"];
+        if (root.containsKey("kr"))     cfg.adc.kalmanr = root["kr"];
         if (root.containsKey("owrite")) overwrite = root["owrite"];
 
         xEventGroupSetBits( eventGroup, SAVE_CFG | UPDATE_CALIBRATION | ( overwrite ? OVERWRITE_CALIBRATION : 0) );
         request->send(200, "text/plain", "ok");
         
-        if ( verbose )
+        if ( verbose ) {
             print_Calibration( &cfg.cal );
+            print_adcCfg( &cfg.adc );
+        }
+    });
+
+    /*Record the raw UART bytes of a radar, to replay them with tools/radar-replay*/
+    server.on("/captureStart", HTTP_GET, [](AsyncWebServerRequest * request) {
+        int sensor;
+        if( !getSensorParam( request, &sensor ) ) {
+            return;
+        }
+        request->send(200, "text/plain", sensor_startCapture( sensor ) ? "ok" : "error");
+    });
+
+    server.on("/captureStop", HTTP_GET, [](AsyncWebServerRequest * request) {
+        int sensor;
+        if( !getSensorParam( request, &sensor ) ) {
+            return;
+        }
+        sensor_stopCapture( sensor );
+        request->send(200, "text/plain", "ok");
+    });
+
+    /*Send the finished recording of a radar*/
+    server.on("/capture.bin", HTTP_GET, [](AsyncWebServerRequest * request) {
+        int sensor;
+        if( !getSensorParam( request, &sensor ) ) {
+            return;
+        }
+        uint8_t const* data;
+        size_t const len = sensor_getCapture( sensor, &data );
+        if( 0 == len ) {
+            request->send(404, "text/plain", "no capture");
+            return;
+        }
+        AsyncWebServerResponse* response = request->beginResponse_P(200, "application/octet-stream", data, len);
+        response->addHeader("Content-Disposition", "attachment; filename=capture.bin");
+        request->send(response);
+    });
+
+    /*Send the radar frames kept in RAM, of the last seconds or between two times in ms, with
+    the clock of the frames. The frames are encoded while they are sent, a datagram per chunk
+    in binary format.*/
+    server.on("/history", HTTP_GET, [](AsyncWebServerRequest * request) {
+        bool const bin = request->hasParam("format") && request->getParam("format")->value() == "bin";
+        int64_t const offset = sensor_getClockOffset() / 1000;
+        int64_t const now = esp_timer_get_time() / 1000;
+        int64_t from = 0, to = now;
+        if( request->hasParam("last") ) {
+            from = now - 1000 * request->getParam("last")->value().toInt();
+        }
+        if( request->hasParam("from") ) {
+            from = atoll( request->getParam("from")->value().c_str() ) - offset;
+        }
+        if( request->hasParam("to") ) {
+            to = atoll( request->getParam("to")->value().c_str() ) - offset;
+        }
+
+        struct history_cursor cursor;
+        if( to < from || to < 0 || !hist_open( &cursor, from < 0 ? 0 : from, to < now ? to : now,
+                                               bin ? FRAME_FORMAT_BINARY : FRAME_FORMAT_CSV ) ) {
+            request->send(404, "text/plain", "no history");
+            return;
+        }
+        AsyncWebServerResponse* response = request->beginChunkedResponse( bin ? "application/octet-stream" : "text/csv",
+            [cursor]( uint8_t* buffer, size_t maxLen, size_t index ) mutable -> size_t {
+                size_t const len = hist_read( &cursor, buffer, maxLen );
+                /*The chunk has no room for a frame, wait for a larger one*/
+                return 0 == len && !hist_done( &cursor ) ? RESPONSE_TRY_AGAIN : len;
+            });
+        response->addHeader("Content-Disposition", bin ? "attachment; filename=history.bin" : "attachment; filename=history.csv");
+        request->send(response);
     });
 
     /*Receive restarting device*/
@@ -9,6 +9,16 @@
 #define __WEB_SERVER__
 
 #include "stdbool.h"
+#include "calibration.h"
+
+/* Memory of the JSON document of /applyCalibration. ArduinoJson 6 takes a slot per member
+   and per array element, and copies the keys and the string values of a String input.*/
+enum {
+    JSON_SLOT_SIZE    = 16,   /*Bytes of a slot on the ESP32*/
+    APPLYCAL_KEYS     = 12,   /*xs, ys, sen1, sen2, owrite and the seven ADC settings*/
+    APPLYCAL_TEXT     = 50 + 2 * 16,  /*The keys and two sensor names of up to 15 characters*/
+    APPLYCAL_CAPACITY = ( APPLYCAL_KEYS + 2 * CAL_MAX_POINTS ) * JSON_SLOT_SIZE + APPLYCAL_TEXT
+};
 
 /**
  * @brief Freertos task to handle the web server
@@ -35,6 +45,12 @@ bool webserver_isServiceUpdated( void );
  * @return true calibration data has been updated, false otherwise. */
 bool webserver_isCalibrationUpdated( void );
 
+/**
+ * @brief Check if UDP target configuration has been updated from webserver.
+ * It's clean the status flag if it has been updated.
+ * @return true UDP configuration has been updated, false otherwise. */
+bool webserver_isUdpUpdated( void );
+
 /**
  * @brief Check if network configuration has been updated from webserver.
  * It's clean the status flag if it has been updated.
@@ -0,0 +1,112 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#include "wifi-fsm.h"
+
+static void enter( struct wififsm* self, uint8_t state, uint32_t now ) {
+    self->state = state;
+    self->since = now;
+}
+
+/*Start the station, or wait for a configuration*/
+static void startConnection( struct wififsm* self, struct wififsm_ops const* ops, struct wififsm_input const* in, uint32_t now ) {
+    ops->led( WIFIFSM_LED_OFF );
+    self->led = false;
+    if( !in->configured ) {
+        enter( self, WIFIFSM_NO_CONFIG, now );
+        return;
+    }
+    ops->begin( );
+    enter( self, WIFIFSM_CONNECTING, now );
+}
+
+/*Wait for the station to connect, with a short pulse of the led every period*/
+static void waitConnection( struct wififsm* self, struct wififsm_ops const* ops, uint32_t now ) {
+    uint32_t const elapsed = now - self->since;
+    if( ops->isConnected( ) ) {
+        if( WIFIFSM_CONNECTING == self->state ) {
+            ops->online( );
+            self->fails = 0;
+        }
+        ops->led( WIFIFSM_LED_BLINK );
+        enter( self, WIFIFSM_CONNECTED, now );
+        return;
+    }
+
+    if( WIFIFSM_CONNECT_TIMEOUT <= elapsed ) {
+        ops->led( WIFIFSM_LED_OFF );
+        if( WIFIFSM_LOST == self->state ) {
+            ops->offline( );
+            ++self->fails;
+        }
+        enter( self, WIFIFSM_RETRY, now );
+        return;
+    }
+
+    bool const on = elapsed % WIFIFSM_PULSE_PERIOD < WIFIFSM_PULSE;
+    if( on != self->led ) {
+        ops->led( on ? WIFIFSM_LED_ON : WIFIFSM_LED_OFF );
+        self->led = on;
+    }
+}
+
+void wififsm_init( struct wififsm* self, uint32_t now ) {
+    self->state = WIFIFSM_IDLE;
+    self->since = now;
+    self->fails = 0;
+    self->led   = false;
+}
+
+void wififsm_connect( struct wififsm* self, uint32_t now ) {
+    enter( self, WIFIFSM_START, now );
+}
+
+void wififsm_step( struct wififsm* self, struct wififsm_ops const* ops, struct wififsm_input const* in, uint32_t now ) {
+    if( WIFIFSM_MAX_FAILS < self->fails && !in->configmode ) {
+        ops->restart( );
+        return;
+    }
+
+    if( in->updated ) {
+        startConnection( self, ops, in, now );
+        return;
+    }
+
+    uint32_t const elapsed = now - self->since;
+    switch( self->state ) {
+        case WIFIFSM_START:
+            startConnection( self, ops, in, now );
+            break;
+        case WIFIFSM_NO_CONFIG:
+            if( WIFIFSM_CONFIG_DELAY <= elapsed ) {
+                startConnection( self, ops, in, now );
+            }
+            break;
+        case WIFIFSM_CONNECTING:
+        case WIFIFSM_LOST:
+            waitConnection( self, ops, now );
+            break;
+        case WIFIFSM_CONNECTED:
+            if( !ops->isConnected( ) ) {
+                self->led = false;
+                enter( self, WIFIFSM_LOST, now );
+            }
+            break;
+        case WIFIFSM_RETRY:
+            if( WIFIFSM_RETRY_DELAY <= elapsed ) {
+                startConnection( self, ops, in, now );
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+char const* wififsm_stateName( uint8_t state ) {
+    static char const* const names[] = { "idle", "start", "no config", "connecting", "connected", "lost", "retry" };
+    return state < sizeof(names) / sizeof(names[0]) ? names[state] : "unknown";
+}
@@ -0,0 +1,90 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+*/
+
+#ifndef __WIFI_FSM__
+#define __WIFI_FSM__
+
+#include <stdint.h>
+
+enum {
+    WIFIFSM_CONNECT_TIMEOUT = 30 * 1250, /*Time for the station to connect, ms*/
+    WIFIFSM_RETRY_DELAY     = 5000,      /*Wait after a failed connection, ms*/
+    WIFIFSM_CONFIG_DELAY    = 10000,     /*Wait while there is no WiFi configuration, ms*/
+    WIFIFSM_PULSE_PERIOD    = 1250,      /*The led is on for WIFIFSM_PULSE ms of each period while connecting*/
+    WIFIFSM_PULSE           = 250,
+    WIFIFSM_MAX_FAILS       = 10         /*Connections lost in a row before restarting*/
+};
+
+enum wififsm_state {
+    WIFIFSM_IDLE,        /*No connection requested yet*/
+    WIFIFSM_START,       /*Connection requested, started by the next step*/
+    WIFIFSM_NO_CONFIG,   /*Waiting for a WiFi configuration*/
+    WIFIFSM_CONNECTING,  /*Station started, waiting for it to connect*/
+    WIFIFSM_CONNECTED,
+    WIFIFSM_LOST,        /*Connection lost, waiting for the station to reconnect by itself*/
+    WIFIFSM_RETRY        /*Waiting before connecting again*/
+};
+
+/*Same values as enum modes of uinterface.h*/
+enum wififsm_led {
+    WIFIFSM_LED_OFF   = 0,
+    WIFIFSM_LED_BLINK = 1,
+    WIFIFSM_LED_ON    = 2
+};
+
+/*WiFi layer driven by the state machine. None of the calls may block.*/
+struct wififsm_ops {
+    bool (*isConnected)( void );
+    void (*begin)( void );      /*Apply the configuration and start the station*/
+    void (*online)( void );     /*The station has connected*/
+    void (*offline)( void );    /*The connection is given up, stop its users*/
+    void (*led)( int mode );    /*enum wififsm_led*/
+    void (*restart)( void );
+};
+
+/*Inputs read by the control task before each step*/
+struct wififsm_input {
+    bool configured;   /*There is a WiFi configuration*/
+    bool updated;      /*The configuration has changed, connect again*/
+    bool configmode;   /*The configuration access point is enabled, never restart*/
+};
+
+/*Management of the WiFi station as timed transitions. A step only checks the
+state of the station and the time, so the control task never waits on WiFi.*/
+struct wififsm {
+    uint8_t  state;     /*enum wififsm_state*/
+    uint32_t since;     /*Time the current state was entered, ms*/
+    int      fails;     /*Failed connections in a row*/
+    bool     led;       /*Led on while connecting*/
+};
+
+/**
+ * @brief Initialize the state machine in idle state.
+ * @param self, the state machine
+ * @param now, current time in ms */
+void wififsm_init( struct wififsm* self, uint32_t now );
+
+/**
+ * @brief Request a connection, as done at boot.
+ * @param self, the state machine
+ * @param now, current time in ms */
+void wififsm_connect( struct wififsm* self, uint32_t now );
+
+/**
+ * @brief Run the transitions due at a time.
+ * @param self, the state machine
+ * @param ops, WiFi layer
+ * @param in, inputs of the step
+ * @param now, current time in ms */
+void wififsm_step( struct wififsm* self, struct wififsm_ops const* ops, struct wififsm_input const* in, uint32_t now );
+
+/**
+ * @brief Get the name of a state.
+ * @param state, enum wififsm_state */
+char const* wififsm_stateName( uint8_t state );
+
+#endif //__WIFI_FSM__
@@ -0,0 +1,231 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+
+    Host check of the measurement batches of ctrl_task. The samples are written with the
+    payload codec and go through the batch as ctrl_task does: a sample that does not fit
+    or has another encoding publishes the batch first, and the batch is published once it
+    holds the configured number of samples or its first sample has waited the delay.
+    Every payload must be the JSON or CBOR array of the samples since the previous one, in
+    order, and fit the 4 KB buffer. The cases are:
+        - size trigger,
+        - delay trigger,
+        - overflow of the 4 KB buffer, with samples that fill it to the last byte,
+        - change of encoding in the middle of a batch.
+
+    Build:
+        g++ -O2 -I../src batch-check.cpp ../src/meas-batch.cpp ../src/payload-codec.cpp -o batch-check
+    Usage:
+        batch-check [-v]   -v prints the payloads. Returns 1 if a check fails.
+*/
+
+#include "meas-batch.h"
+#include "payload-codec.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static bool verbose = false;
+
+/*Sample of ctrl_task, with a padding text to set its size*/
+static std::string makeSample( uint8_t encoding, uint32_t n, size_t pad ) {
+    static uint8_t buf[MEASBATCH_SIZE];
+    std::string const text( pad, 'x' );
+    struct payload doc;
+    payload_init( &doc, encoding, buf, sizeof(buf) );
+    payload_objOpen( &doc, NULL );
+    payload_uint( &doc, "timestamp", 1657824699590ull + n );
+    payload_objOpen( &doc, "ch4" );
+    payload_double( &doc, "value", n );
+    payload_str( &doc, "pad", text.c_str() );
+    payload_objClose( &doc );
+    payload_objClose( &doc );
+    size_t const len = payload_finish( &doc );
+    return std::string( (char const*)buf, len );
+}
+
+/*Sample of len bytes, the text header of CBOR grows with the padding*/
+static std::string sampleOfSize( uint8_t encoding, size_t len ) {
+    size_t pad = len - makeSample( encoding, 1, 0 ).size();
+    std::string s = makeSample( encoding, 1, pad );
+    while( len < s.size() && 0 < pad ) {
+        s = makeSample( encoding, 1, --pad );
+    }
+    return s;
+}
+
+/*Array payload expected for the samples*/
+static std::string wrap( std::vector<std::string> const& samples, uint8_t encoding ) {
+    bool const cbor = PAYLOAD_CBOR == encoding;
+    std::string out( 1, cbor ? (char)0x9f : '[' );
+    for( size_t i = 0; i < samples.size(); ++i ) {
+        if( !cbor && i ) {
+            out += ',';
+        }
+        out += samples[i];
+    }
+    out += cbor ? (char)0xff : ']';
+    return out;
+}
+
+/*ctrl_task measurement path and the samples not published yet*/
+struct sim {
+    struct measbatch batch;
+    int size;
+    uint32_t delay;
+    std::vector<std::string> pending;
+    std::vector<uint8_t> pendingEnc;
+    std::vector<int> counts;       /*Samples of each payload*/
+    std::vector<uint32_t> times;   /*Time of each payload*/
+    bool ok;
+};
+
+static void simInit( struct sim* s, int size, uint32_t delay ) {
+    measbatch_init( &s->batch );
+    s->size = size;
+    s->delay = delay;
+    s->ok = true;
+}
+
+/*Check a published payload against the oldest pending samples*/
+static void published( struct sim* s, uint8_t const* payload, size_t len, uint32_t now ) {
+    std::string const p( (char const*)payload, len );
+    if( 0 == len || MEASBATCH_SIZE < len + 1 || '\0' != payload[len] ) {
+        printf( "payload of %zu bytes out of the buffer or not terminated, FAILED\n", len );
+        s->ok = false;
+        return;
+    }
+    for( size_t k = 1; k <= s->pending.size(); ++k ) {
+        if( s->pendingEnc[k - 1] != s->pendingEnc[0] ) {
+            break;
+        }
+        std::vector<std::string> const held( s->pending.begin(), s->pending.begin() + k );
+        if( wrap( held, s->pendingEnc[0] ) == p ) {
+            if( verbose ) {
+                printf( "  %6u ms, %2zu samples, %4zu bytes %s\n", now, k, len,
+                        PAYLOAD_CBOR == s->pendingEnc[0] ? "CBOR" : p.c_str() );
+            }
+            s->pending.erase( s->pending.begin(), s->pending.begin() + k );
+            s->pendingEnc.erase( s->pendingEnc.begin(), s->pendingEnc.begin() + k );
+            s->counts.push_back( (int)k );
+            s->times.push_back( now );
+            return;
+        }
+    }
+    printf( "payload of %zu bytes is not the array of the pending samples, FAILED\n", len );
+    s->ok = false;
+}
+
+/*PUB_MEASURES of ctrl_task*/
+static void measure( struct sim* s, std::string const& sample, uint8_t encoding, uint32_t now ) {
+    s->pending.push_back( sample );
+    s->pendingEnc.push_back( encoding );
+    uint8_t const* data = (uint8_t const*)sample.data();
+    if( !measbatch_add( &s->batch, data, sample.size(), encoding, now ) ) {
+        published( s, s->batch.buf, measbatch_finish( &s->batch ), now );
+        if( !measbatch_add( &s->batch, data, sample.size(), encoding, now ) ) {
+            printf( "sample of %zu bytes does not fit an empty batch, FAILED\n", sample.size() );
+            s->ok = false;
+        }
+    }
+}
+
+/*End of the loop of ctrl_task*/
+static void poll( struct sim* s, uint32_t now ) {
+    if( measbatch_isDue( &s->batch, s->size, s->delay, now ) ) {
+        published( s, s->batch.buf, measbatch_finish( &s->batch ), now );
+    }
+}
+
+static bool report( char const* name, bool ok ) {
+    printf( "%-28s %s\n", name, ok ? "ok" : "FAILED" );
+    return ok;
+}
+
+/*Batches of 5 samples, one per second, the delay never expires*/
+static bool sizeTrigger( void ) {
+    static struct sim s;
+    simInit( &s, 5, 60000 );
+    for( uint32_t n = 0; n < 23; ++n ) {
+        measure( &s, makeSample( PAYLOAD_JSON, n, 0 ), PAYLOAD_JSON, n * 1000 );
+        poll( &s, n * 1000 );
+    }
+    bool ok = s.ok && 4 == s.counts.size() && 3 == s.pending.size() && 3 == s.batch.count;
+    for( size_t i = 0; ok && i < s.counts.size(); ++i ) {
+        ok = 5 == s.counts[i] && ( 5 * i + 4 ) * 1000 == s.times[i];
+    }
+    return report( "size trigger", ok );
+}
+
+/*Batches of up to 100 samples, one per second, published 3 s after the first one*/
+static bool delayTrigger( void ) {
+    static struct sim s;
+    simInit( &s, 100, 3000 );
+    for( uint32_t n = 0; n < 10; ++n ) {
+        measure( &s, makeSample( PAYLOAD_CBOR, n, 0 ), PAYLOAD_CBOR, n * 1000 );
+        poll( &s, n * 1000 );
+        /*Polls between the samples*/
+        poll( &s, n * 1000 + 999 );
+    }
+    /*Samples at 0 to 3 s published at 3 s, 4 to 7 s at 7 s, 8 and 9 s still held*/
+    bool const ok = s.ok && 2 == s.counts.size() && 4 == s.counts[0] && 4 == s.counts[1]
+                 && 3000 == s.times[0] && 7000 == s.times[1] && 2 == s.batch.count;
+    return report( "delay trigger", ok );
+}
+
+/*Samples that do not fit the 4 KB buffer publish the batch first, in both encodings*/
+static bool overflow( uint8_t encoding ) {
+    static struct sim s;
+    simInit( &s, 1000, 600000 );
+    for( uint32_t n = 0; n < 60; ++n ) {
+        measure( &s, makeSample( encoding, n, 300 + n % 7 ), encoding, n * 100 );
+        poll( &s, n * 100 );
+    }
+    bool ok = s.ok && 3 <= s.counts.size();
+
+    /*A sample that fills an empty batch to the last byte fits, one byte more does not*/
+    measbatch_finish( &s.batch );
+    s.pending.clear();
+    s.pendingEnc.clear();
+    std::string const full = sampleOfSize( encoding, MEASBATCH_SIZE - 3 );
+    std::string const over = sampleOfSize( encoding, MEASBATCH_SIZE - 2 );
+    ok = ok && MEASBATCH_SIZE - 3 == full.size() && MEASBATCH_SIZE - 2 == over.size();
+    ok = ok && measbatch_add( &s.batch, (uint8_t const*)full.data(), full.size(), encoding, 0 );
+    size_t const len = measbatch_finish( &s.batch );
+    ok = ok && MEASBATCH_SIZE - 1 == len && wrap( { full }, encoding ) == std::string( (char const*)s.batch.buf, len );
+    ok = ok && !measbatch_add( &s.batch, (uint8_t const*)over.data(), over.size(), encoding, 0 );
+    ok = ok && 0 == s.batch.count && 0 == measbatch_finish( &s.batch );
+    return report( PAYLOAD_CBOR == encoding ? "overflow of 4 KB, cbor" : "overflow of 4 KB, json", ok );
+}
+
+/*The encoding of the topic changes while samples are held*/
+static bool encodingSwitch( void ) {
+    static struct sim s;
+    simInit( &s, 10, 600000 );
+    uint8_t const encodings[] = { PAYLOAD_JSON, PAYLOAD_JSON, PAYLOAD_CBOR, PAYLOAD_CBOR, PAYLOAD_CBOR, PAYLOAD_JSON };
+    for( uint32_t n = 0; n < sizeof(encodings); ++n ) {
+        measure( &s, makeSample( encodings[n], n, 0 ), encodings[n], n * 1000 );
+        poll( &s, n * 1000 );
+    }
+    /*The last JSON sample is published by the size trigger*/
+    struct measbatch const held = s.batch;
+    s.size = 1;
+    poll( &s, 6000 );
+    bool const ok = s.ok && 3 == s.counts.size() && 2 == s.counts[0] && 3 == s.counts[1] && 1 == s.counts[2]
+                 && 2000 == s.times[0] && 5000 == s.times[1] && PAYLOAD_JSON == held.encoding && s.pending.empty();
+    return report( "encoding switch", ok );
+}
+
+int main( int argc, char* argv[] ) {
+    verbose = 2 <= argc && 0 == strcmp( argv[1], "-v" );
+    int failed = 0;
+    failed += !sizeTrigger( );
+    failed += !delayTrigger( );
+    failed += !overflow( PAYLOAD_JSON );
+    failed += !overflow( PAYLOAD_CBOR );
+    failed += !encodingSwitch( );
+    return failed ? 1 : 0;
+}
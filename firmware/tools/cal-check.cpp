@@ -0,0 +1,351 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+
+    Host check of the multi point calibration of the 4-20 mA channel. The points are
+    sorted and validated as the web server does, the table is built as ctrl_task does,
+    and every code, in steps of 1/16, is converted with the table and with the exact
+    piecewise line in double precision. The conversions must be monotonic and within
+    the accuracy limit, and the cost of a conversion is measured.
+    The largest payload the page sends to /applyCalibration must fit the JSON document of
+    the handler, counted as ArduinoJson 6 does.
+    The default calibration is then loaded from byte images of the EEPROM of older
+    versions, as config_load() does, and the two points written by them must be kept.
+
+    Build:
+        g++ -O2 -I../src cal-check.cpp ../src/calibration.cpp -o cal-check
+    Usage:
+        cal-check [-v]   -v prints the table. Returns 1 if a check fails.
+*/
+
+#include "calibration.h"
+#include "config-mng.h"
+#include "webserver.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <string>
+
+enum {
+    SUBSTEPS = 16,      /*Fractions of a code checked*/
+    LOOPS    = 20
+};
+
+/*Largest error allowed, mA. A code is about 5 uA over the 4-20 mA range.*/
+static double const maxError = 0.0001;
+
+struct curve {
+    char const* name;
+    struct calpoint points[CAL_MAX_POINTS];
+    int count;
+};
+
+static struct curve const curves[] = {
+    /*Two points, as the calibration before the table*/
+    { "two points",        {{ 4.0f, 655 }, { 20.0f, 3276 }}, 2 },
+    /*Transmitter that compresses at both ends of the range*/
+    { "non linear ends",   {{ 4.0f, 700 }, { 4.6f, 790 }, { 6.0f, 1020 }, { 10.0f, 1660 },
+                            { 14.0f, 2300 }, { 18.0f, 2950 }, { 19.4f, 3200 }, { 20.0f, 3330 }}, 8 },
+    /*Points given out of order and a repeated code, the last of those is kept*/
+    { "unsorted",          {{ 12.0f, 1966 }, { 4.0f, 655 }, { 20.0f, 3276 }, { 11.0f, 1966 }}, 4 },
+    /*Values falling with the code*/
+    { "falling",           {{ 20.0f, 600 }, { 12.0f, 1900 }, { 4.0f, 3300 }}, 3 }
+};
+
+static double exact( struct calpoint const* p, int count, double x ) {
+    int seg = 0;
+    while( seg < count - 2 && p[seg + 1].x <= x ) {
+        ++seg;
+    }
+    return p[seg].y + (double)( p[seg + 1].y - p[seg].y ) * ( x - p[seg].x ) / ( p[seg + 1].x - p[seg].x );
+}
+
+static bool checkCurve( struct curve const* c, bool verbose ) {
+    struct calpoint points[CAL_MAX_POINTS];
+    memcpy( points, c->points, sizeof(points) );
+    int const count = cal_sort( points, c->count );
+    if( !cal_isValid( points, count ) ) {
+        printf( "%-18s rejected\n", c->name );
+        return false;
+    }
+    static struct caltable table;
+    caltable_build( &table, points, count );
+    if( verbose ) {
+        for( int i = 0; i < CALTABLE_SIZE; ++i ) {
+            printf( "%5d %10.5f\n", i << CALTABLE_SHIFT, table.y[i] / (double)( 1 << CAL_FRAC ) );
+        }
+    }
+
+    bool const rising = points[0].y < points[count - 1].y;
+    double worst = 0;
+    double worstAt = 0;
+    bool monotonic = true;
+    int32_t prev = table.y[0];
+    for( int32_t code = 0; code <= ( CAL_MAX_CODE << CAL_FRAC ); code += ( 1 << CAL_FRAC ) / SUBSTEPS ) {
+        int32_t const y = caltable_get( &table, code );
+        double const x = code / (double)( 1 << CAL_FRAC );
+        double const err = std::fabs( y / (double)( 1 << CAL_FRAC ) - exact( points, count, x ) );
+        if( worst < err ) {
+            worst = err;
+            worstAt = x;
+        }
+        monotonic = monotonic && ( rising ? prev <= y : y <= prev );
+        prev = y;
+    }
+
+    /*Cost of a conversion over the codes, against the exact line*/
+    int32_t sum = 0;
+    auto const start = std::chrono::steady_clock::now();
+    for( int l = 0; l < LOOPS; ++l ) {
+        for( int32_t code = 0; code <= ( CAL_MAX_CODE << CAL_FRAC ); code += 1 << ( CAL_FRAC - 4 ) ) {
+            sum += caltable_get( &table, code );
+        }
+    }
+    auto const mid = std::chrono::steady_clock::now();
+    double dsum = 0;
+    for( int l = 0; l < LOOPS; ++l ) {
+        for( int32_t code = 0; code <= ( CAL_MAX_CODE << CAL_FRAC ); code += 1 << ( CAL_FRAC - 4 ) ) {
+            dsum += exact( points, count, code / (double)( 1 << CAL_FRAC ) );
+        }
+    }
+    auto const end = std::chrono::steady_clock::now();
+    double const conversions = LOOPS * ( CAL_MAX_CODE * 16.0 + 1 );
+    double const tableNs = std::chrono::duration<double, std::nano>( mid - start ).count() / conversions;
+    double const exactNs = std::chrono::duration<double, std::nano>( end - mid ).count() / conversions;
+    /*Keep the compiler from dropping the loops*/
+    if( 1 == sum && 1 == dsum ) {
+        printf( " " );
+    }
+
+    bool const ok = monotonic && worst <= maxError;
+    printf( "%-18s %6d %12.6f %10.3f %10s %9.1f %9.1f %s\n", c->name, count, worst, worstAt,
+            monotonic ? "yes" : "no", tableNs, exactNs, ok ? "" : "FAILED" );
+    return ok;
+}
+
+/*Point sets the web server must refuse*/
+static bool checkRejected( void ) {
+    struct {
+        char const* name;
+        struct calpoint points[CAL_MAX_POINTS];
+        int count;
+    } const bad[] = {
+        { "one point",      {{ 4.0f, 655 }}, 1 },
+        { "same code",      {{ 4.0f, 655 }, { 20.0f, 655 }}, 2 },
+        { "not monotonic",  {{ 4.0f, 655 }, { 12.0f, 1966 }, { 11.0f, 2500 }, { 20.0f, 3276 }}, 4 },
+        { "flat",           {{ 4.0f, 655 }, { 4.0f, 1966 }}, 2 },
+        { "code too large", {{ 4.0f, 655 }, { 20.0f, 4096 }}, 2 },
+        { "negative code",  {{ 4.0f, -1 }, { 20.0f, 3276 }}, 2 }
+    };
+    bool ok = true;
+    for( auto const& b : bad ) {
+        struct calpoint points[CAL_MAX_POINTS];
+        memcpy( points, b.points, sizeof(points) );
+        int const count = cal_sort( points, b.count );
+        if( cal_isValid( points, count ) ) {
+            printf( "%-18s accepted, FAILED\n", b.name );
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+/*Memory of a JSON document in ArduinoJson 6: a slot per member and per array element, and
+the keys and string values copied once each*/
+struct jsonUsage {
+    int slots;
+    std::set<std::string> strings;
+};
+
+static char const* jsonString( char const* p, std::string* s ) {
+    for( ++p; '"' != *p; ++p ) {
+        *s += *p;
+    }
+    return p + 1;
+}
+
+static char const* jsonValue( char const* p, struct jsonUsage* u ) {
+    if( '{' == *p || '[' == *p ) {
+        bool const object = '{' == *p;
+        char const close = object ? '}' : ']';
+        ++p;
+        while( close != *p ) {
+            if( object ) {
+                std::string key;
+                p = jsonString( p, &key ) + 1;
+                u->strings.insert( key );
+            }
+            ++u->slots;
+            p = jsonValue( p, u );
+            p += ',' == *p;
+        }
+        return p + 1;
+    }
+    if( '"' == *p ) {
+        std::string s;
+        p = jsonString( p, &s );
+        u->strings.insert( s );
+        return p;
+    }
+    while( *p && ',' != *p && '}' != *p && ']' != *p ) {
+        ++p;
+    }
+    return p;
+}
+
+/*getCalibration() of main.html with the longest values*/
+static std::string calibrationPayload( int count ) {
+    std::string xs, ys;
+    for( int i = 0; i < count; ++i ) {
+        xs += ( i ? "," : "" ) + std::to_string( CAL_MAX_CODE - i );
+        ys += ( i ? "," : "" ) + std::string( "-19.987654321" );
+    }
+    /*Two different names of 15 characters, the longest id_sens_1 holds*/
+    std::string const name( sizeof(((struct acq_cal*)0)->id_sens_1) - 2, 'N' );
+    return "{\"xs\":[" + xs + "],\"ys\":[" + ys + "],\"sen1\":\"" + name + "A\",\"sen2\":\"" + name + "B\","
+           "\"rate\":1000,\"avg\":64,\"cyc\":7,\"med\":5,\"iir\":8,\"kq\":0.0001,\"kr\":0.25,\"owrite\":true}";
+}
+
+static bool checkApplyPayload( void ) {
+    bool ok = true;
+    printf( "\n%-22s %8s %8s %8s\n", "applyCalibration", "bytes", "memory", "capacity" );
+    for( int count = 2; count <= CAL_MAX_POINTS; ++count ) {
+        std::string const payload = calibrationPayload( count );
+        struct jsonUsage u = { 0, {} };
+        jsonValue( payload.c_str(), &u );
+        size_t memory = u.slots * JSON_SLOT_SIZE;
+        for( auto const& s : u.strings ) {
+            memory += s.size() + 1;
+        }
+        bool const good = memory <= APPLYCAL_CAPACITY;
+        printf( "%-14s%2d points %8zu %8zu %8d %s\n", "", count, payload.size(), memory, APPLYCAL_CAPACITY, good ? "" : "FAILED" );
+        ok = ok && good;
+    }
+    return ok;
+}
+
+/*Layout of the EEPROM of config-mng.cpp*/
+enum {
+    EEPROM_SIZE = 2048,
+    CAL_ADDR    = 1024,
+    LEGACY_ADDR = 900,
+    V15_CONFIG  = 880     /*sizeof(struct config) of CFG_VER 15*/
+};
+
+/*EEPROM written by CFG_VER 15 with a two point calibration. The padding of the structure
+holds whatever was in RAM, and the flash past the old 1024 bytes is erased.*/
+static void makeV15Image( uint8_t* image, double y0, int16_t x0, double y1, int16_t x1, uint8_t padding ) {
+    memset( image, 0xff, EEPROM_SIZE );
+    for( int i = 0; i < V15_CONFIG; ++i ) {
+        image[i] = (uint8_t)( i * 13 );
+    }
+    int const version = 15;
+    memcpy( image + V15_CONFIG, &version, sizeof(version) );
+    struct cal_legacy legacy;
+    memset( &legacy, padding, sizeof(legacy) );
+    legacy.val[0].y = y0;
+    legacy.val[0].x = x0;
+    legacy.val[1].y = y1;
+    legacy.val[1].x = x1;
+    strcpy( legacy.id_sens_1, "CH4" );
+    strcpy( legacy.id_sens_2, "Temperature" );
+    memcpy( image + LEGACY_ADDR, &legacy, sizeof(legacy) );
+}
+
+/*Default calibration of config_load(), return the config version it reads*/
+static int loadImage( uint8_t const* image, struct acq_cal* cal ) {
+    int version;
+    memcpy( &version, image + sizeof(struct config), sizeof(version) );
+    memcpy( cal, image + CAL_ADDR, sizeof(*cal) );
+    if( cal_isValid( cal->val, cal->count ) ) {
+        return version;
+    }
+    struct cal_legacy legacy;
+    memcpy( &legacy, image + LEGACY_ADDR, sizeof(legacy) );
+    memset( cal, 0, sizeof(*cal) );
+    cal->count = cal_fromLegacy( cal->val, &legacy );
+    if( cal->count ) {
+        memcpy( cal->id_sens_1, legacy.id_sens_1, sizeof(cal->id_sens_1) );
+        memcpy( cal->id_sens_2, legacy.id_sens_2, sizeof(cal->id_sens_2) );
+    }
+    else {
+        cal->count = cal_setNominal( cal->val );
+    }
+    return version;
+}
+
+static bool checkMigration( void ) {
+    static uint8_t image[EEPROM_SIZE];
+    struct {
+        char const* name;
+        double y0, y1;
+        int16_t x0, x1;
+        uint8_t padding;
+        bool migrated;   /*The points are kept, else the nominal line is expected*/
+    } const cases[] = {
+        { "v15 round values",     4.0,   20.0,   655, 3276, 0x00, true },
+        { "v15 calibrated",       4.013, 19.987, 661, 3281, 0x5a, true },
+        { "v15 calibrated, 0xff", 3.998, 20.004, 649, 3270, 0xff, true },
+        { "v15 reversed points",  19.96, 4.021,  3279, 652, 0x5a, true },
+        { "v15 not calibrated",   0.0,   0.0,    0,   0,    0x00, false }
+    };
+    bool ok = true;
+    printf( "\n%-22s %12s %8s %s\n", "eeprom image", "version at", "points", "migrated" );
+    for( auto const& c : cases ) {
+        makeV15Image( image, c.y0, c.x0, c.y1, c.x1, c.padding );
+        struct acq_cal cal;
+        int const version = loadImage( image, &cal );
+        bool good;
+        if( c.migrated ) {
+            bool const swap = c.x1 < c.x0;
+            good = 2 == cal.count && ( swap ? c.x1 : c.x0 ) == cal.val[0].x && ( swap ? c.x0 : c.x1 ) == cal.val[1].x
+                && (float)( swap ? c.y1 : c.y0 ) == cal.val[0].y && (float)( swap ? c.y0 : c.y1 ) == cal.val[1].y
+                && 0 == strcmp( cal.id_sens_1, "CH4" ) && 0 == strcmp( cal.id_sens_2, "Temperature" );
+        }
+        else {
+            struct calpoint nominal[2];
+            cal_setNominal( nominal );
+            good = 2 == cal.count && 0 == memcmp( nominal, cal.val, sizeof(nominal) );
+        }
+        /*The version read in the old layout comes from the legacy calibration*/
+        printf( "%-22s %12d %8d %s %s\n", c.name, version, cal.count, c.migrated ? "yes" : "no", good ? "" : "FAILED" );
+        ok = ok && good;
+
+        /*Once written at the new address the calibration is used as it is*/
+        struct acq_cal written = cal;
+        memcpy( image + CAL_ADDR, &written, sizeof(written) );
+        memset( image + LEGACY_ADDR, 0xff, sizeof(struct cal_legacy) );
+        loadImage( image, &cal );
+        if( 0 != memcmp( &written, &cal, sizeof(cal) ) ) {
+            printf( "%-22s reloaded, FAILED\n", c.name );
+            ok = false;
+        }
+    }
+
+    /*An erased EEPROM gets the nominal line*/
+    memset( image, 0xff, EEPROM_SIZE );
+    struct acq_cal cal;
+    loadImage( image, &cal );
+    if( 2 != cal.count || 655 != cal.val[0].x || 3276 != cal.val[1].x ) {
+        printf( "erased eeprom, FAILED\n" );
+        ok = false;
+    }
+    return ok;
+}
+
+int main( int argc, char* argv[] ) {
+    bool const verbose = 2 <= argc && 0 == strcmp( argv[1], "-v" );
+    int failed = 0;
+    printf( "%-18s %6s %12s %10s %10s %9s %9s\n", "curve", "points", "worst mA", "at code", "monotonic", "table ns", "exact ns" );
+    for( auto const& c : curves ) {
+        failed += !checkCurve( &c, verbose );
+    }
+    failed += !checkRejected( );
+    failed += !checkApplyPayload( );
+    failed += !checkMigration( );
+    return failed ? 1 : 0;
+}
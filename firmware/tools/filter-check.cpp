@@ -0,0 +1,285 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+
+    Host check of the filter chain of the 4-20 mA channel. Each chain runs over noisy
+    signals of the ADC121 codes: white noise, relay and pump spikes, and level steps.
+    The output is compared with the clean signal and with the same chain computed in
+    double precision, and the cost per sample is measured.
+
+    Build:
+        g++ -O2 -I../src filter-check.cpp ../src/adc-filter.cpp -o filter-check
+    Usage:
+        filter-check [-v] [file]
+        file, ADC codes one per line, as recorded from /sample. It is filtered by each
+        chain and only the noise and spikes left are reported, there is no clean
+        signal to compare with. -v prints every output sample.
+        Returns 1 if a check fails.
+*/
+
+#include "adc-filter.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+enum {
+    SAMPLES     = 6000,
+    LOOPS       = 200,
+    SPIKE_EVERY = 150,    /*Samples between relay spikes*/
+    STEP_AT     = 3000,   /*Sample of the level step*/
+    SPIKE_SPAN  = 60      /*Samples after a spike counted as its trail*/
+};
+
+/*Levels of 8 mA and 16 mA with the 4-20 mA input over the whole 12 bits*/
+static double const levelLow  = 4095.0 * 8 / 20;
+static double const levelHigh = 4095.0 * 16 / 20;
+static double const noise     = 6.0;   /*Standard deviation of the white noise, codes*/
+
+struct signal {
+    std::vector<double> clean;
+    std::vector<int16_t> noisy;
+    std::vector<bool> spike;
+};
+
+/*Steady level with a step, white noise and spikes of one or two samples. There are
+no spikes around the step, to measure the settling time alone.*/
+static struct signal makeSignal( unsigned seed ) {
+    struct signal s;
+    std::mt19937 gen( seed );
+    std::normal_distribution<double> white( 0.0, noise );
+    std::uniform_int_distribution<int> spikeSize( 300, 1500 );
+    for( int i = 0; i < SAMPLES; ++i ) {
+        double const clean = i < STEP_AT ? levelLow : levelHigh;
+        bool const nearStep = STEP_AT - SPIKE_SPAN <= i && i < STEP_AT + 300;
+        bool const spike = 0 < i && !nearStep && ( 0 == i % SPIKE_EVERY || 1 == i % ( 2 * SPIKE_EVERY ) );
+        double val = clean + white( gen ) + ( spike ? ( i % 4 ? 1 : -1 ) * spikeSize( gen ) : 0 );
+        val = std::min( 4095.0, std::max( 0.0, std::round( val ) ) );
+        s.clean.push_back( clean );
+        s.noisy.push_back( (int16_t)val );
+        s.spike.push_back( spike );
+    }
+    return s;
+}
+
+/*The chain in double precision*/
+struct reference {
+    struct adcfilter_params p;
+    std::vector<int16_t> med;
+    std::vector<int16_t> mean;
+    bool started = false;
+    double iir = 0;
+    double kx = 0;
+    double kp = 0;
+};
+
+static double refPut( struct reference* r, int16_t sample ) {
+    int const nmed = std::min<int>( std::max<int>( r->p.median, 1 ), ADCFILTER_MAX_MEDIAN ) | 1;
+    int const nmean = std::min<int>( std::max<int>( r->p.mean, 1 ), ADCFILTER_MAX_MEAN );
+    if( 1 < nmed ) {
+        r->med.push_back( sample );
+        if( (int)r->med.size() > nmed ) {
+            r->med.erase( r->med.begin() );
+        }
+        std::vector<int16_t> sorted = r->med;
+        std::sort( sorted.begin(), sorted.end() );
+        sample = sorted[sorted.size() / 2];
+    }
+    double value = sample;
+    if( 1 < nmean ) {
+        r->mean.push_back( sample );
+        if( (int)r->mean.size() > nmean ) {
+            r->mean.erase( r->mean.begin() );
+        }
+        double sum = 0;
+        for( int16_t v : r->mean ) {
+            sum += v;
+        }
+        value = sum / r->mean.size();
+    }
+    if( !r->started ) {
+        r->started = true;
+        r->iir = r->kx = value;
+        r->kp = r->p.r;
+        return value;
+    }
+    if( r->p.iir ) {
+        r->iir += ( value - r->iir ) * r->p.iir / 256.0;
+        value = r->iir;
+    }
+    if( r->p.r ) {
+        double const p = r->kp + r->p.q;
+        double const k = p / ( p + r->p.r );
+        r->kx += k * ( value - r->kx );
+        r->kp = p * ( 1 - k );
+        value = r->kx;
+    }
+    return value;
+}
+
+struct result {
+    double rmsIn;      /*Error of the input in the steady parts, spikes excluded*/
+    double rmsOut;     /*Error of the output in the steady parts*/
+    double spikeOut;   /*Largest error of the output in the trail of the spikes*/
+    int    settle;     /*Samples after the step to stay within 2% of it, spikes excluded*/
+    double refError;   /*Largest difference with the double precision chain, codes*/
+};
+
+static struct result run( struct adcfilter_params const* p, struct signal const& s, bool verbose ) {
+    struct adcfilter f;
+    adcfilter_init( &f, p );
+    struct reference ref;
+    ref.p = *p;
+    struct result res = { 0, 0, 0, 0, 0 };
+    double sumIn = 0, sumOut = 0;
+    int n = 0;
+    int lastOut = STEP_AT;
+    double const step = levelHigh - levelLow;
+    for( int i = 0; i < SAMPLES; ++i ) {
+        double const out = adcfilter_put( &f, s.noisy[i] ) / (double)( 1 << ADCFILTER_FRAC );
+        double const exact = refPut( &ref, s.noisy[i] );
+        res.refError = std::max( res.refError, std::fabs( out - exact ) );
+        double const err = out - s.clean[i];
+        if( verbose ) {
+            printf( "%d %d %.3f %.3f\n", i, s.noisy[i], out, exact );
+        }
+        bool nearSpike = false;
+        for( int j = std::max( 0, i - SPIKE_SPAN ); j <= i; ++j ) {
+            nearSpike = nearSpike || s.spike[j];
+        }
+        if( STEP_AT <= i && !nearSpike && 0.02 * step < std::fabs( err ) ) {
+            lastOut = i;
+        }
+        /*The steady parts skip the start and the step*/
+        bool const steady = ( 200 <= i && i < STEP_AT ) || STEP_AT + 200 <= i;
+        if( !steady ) {
+            continue;
+        }
+        if( nearSpike ) {
+            res.spikeOut = std::max( res.spikeOut, std::fabs( err ) );
+        }
+        else {
+            double const in = s.noisy[i] - s.clean[i];
+            sumIn += in * in;
+            sumOut += err * err;
+            ++n;
+        }
+    }
+    res.rmsIn = std::sqrt( sumIn / n );
+    res.rmsOut = std::sqrt( sumOut / n );
+    res.settle = lastOut + 1 - STEP_AT;
+    return res;
+}
+
+static double costNs( struct adcfilter_params const* p, struct signal const& s ) {
+    struct adcfilter f;
+    adcfilter_init( &f, p );
+    int32_t sum = 0;
+    auto const start = std::chrono::steady_clock::now();
+    for( int l = 0; l < LOOPS; ++l ) {
+        for( int16_t v : s.noisy ) {
+            sum += adcfilter_put( &f, v );
+        }
+    }
+    auto const end = std::chrono::steady_clock::now();
+    /*Keep the compiler from dropping the loop*/
+    if( 1 == sum ) {
+        printf( " " );
+    }
+    return std::chrono::duration<double, std::nano>( end - start ).count() / LOOPS / s.noisy.size();
+}
+
+/*A chain, and the limits it must meet on the generated signal*/
+struct chain {
+    char const* name;
+    struct adcfilter_params p;
+    double maxSpike;     /*Largest error left by the spikes, codes*/
+    double maxRatio;     /*Output noise over input noise*/
+    int    maxSettle;    /*Samples to settle after the step*/
+};
+
+static struct chain const chains[] = {
+    { "none",                 { 1, 1,  0,  0,   0 }, 1e9,  1.01, 1   },
+    { "median 5",             { 5, 1,  0,  0,   0 }, 25,   0.90, 4   },
+    { "mean 16",              { 1, 16, 0,  0,   0 }, 120,  0.30, 16  },
+    { "median 5, mean 16",    { 5, 16, 0,  0,   0 }, 10,   0.35, 20  },
+    { "iir 32/256",           { 1, 1,  32, 0,   0 }, 200,  0.40, 40  },
+    { "median 5, iir 32/256", { 5, 1,  32, 0,   0 }, 10,   0.40, 40  },
+    { "kalman q 1 r 36",      { 1, 1,  0,  1,   36 }, 300, 0.40, 200 },
+    { "median 5, kalman",     { 5, 1,  0,  1,   36 }, 10,  0.40, 200 },
+    { "median 9, mean 8, iir 64, kalman", { 9, 8, 64, 4, 36 }, 10, 0.40, 120 }
+};
+
+/*Noise and spikes left in a recorded signal, measured against its own median of 31*/
+static int checkFile( char const* path, bool verbose ) {
+    FILE* f = fopen( path, "r" );
+    if( NULL == f ) {
+        fprintf( stderr, "can not open %s\n", path );
+        return 1;
+    }
+    std::vector<int16_t> codes;
+    int code;
+    while( 1 == fscanf( f, "%d", &code ) ) {
+        codes.push_back( (int16_t)std::min( 4095, std::max( 0, code ) ) );
+    }
+    fclose( f );
+    printf( "%s, %zu samples\n%-34s %10s %10s\n", path, codes.size(), "chain", "noise", "worst" );
+    for( auto const& c : chains ) {
+        struct adcfilter flt;
+        adcfilter_init( &flt, &c.p );
+        std::vector<double> out;
+        for( int16_t v : codes ) {
+            out.push_back( adcfilter_put( &flt, v ) / (double)( 1 << ADCFILTER_FRAC ) );
+        }
+        double sum = 0, worst = 0;
+        int n = 0;
+        for( int i = 15; i + 15 < (int)out.size(); ++i ) {
+            std::vector<double> win( out.begin() + i - 15, out.begin() + i + 16 );
+            std::nth_element( win.begin(), win.begin() + 15, win.end() );
+            double const dev = out[i] - win[15];
+            sum += dev * dev;
+            worst = std::max( worst, std::fabs( dev ) );
+            ++n;
+            if( verbose ) {
+                printf( "%d %d %.3f\n", i, codes[i], out[i] );
+            }
+        }
+        printf( "%-34s %10.2f %10.2f\n", c.name, n ? std::sqrt( sum / n ) : 0.0, worst );
+    }
+    return 0;
+}
+
+int main( int argc, char* argv[] ) {
+    bool verbose = false;
+    char const* path = NULL;
+    for( int i = 1; i < argc; ++i ) {
+        if( 0 == strcmp( argv[i], "-v" ) ) {
+            verbose = true;
+        }
+        else {
+            path = argv[i];
+        }
+    }
+    if( path ) {
+        return checkFile( path, verbose );
+    }
+
+    struct signal const s = makeSignal( 20220714 );
+    int failed = 0;
+    printf( "%-34s %8s %8s %8s %7s %9s %8s\n", "chain", "rms in", "rms out", "spike", "settle", "ref err", "ns" );
+    for( auto const& c : chains ) {
+        struct result const r = run( &c.p, s, verbose );
+        double const ns = costNs( &c.p, s );
+        bool const ok = r.spikeOut <= c.maxSpike && r.rmsOut <= c.maxRatio * r.rmsIn
+                     && r.settle <= c.maxSettle && r.refError < 0.05;
+        printf( "%-34s %8.2f %8.2f %8.1f %7d %9.4f %8.1f %s\n", c.name, r.rmsIn, r.rmsOut, r.spikeOut,
+                r.settle, r.refError, ns, ok ? "" : "FAILED" );
+        failed += !ok;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,569 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+
+    Host side decoder of the radar UDP stream.
+
+    Build:
+        g++ -O2 -I../src frame-decoder.cpp ../src/frame-codec.cpp ../src/presence.cpp ../src/gate-stats.cpp -o frame-decoder
+    Usage:
+        frame-decoder <udp port>   print every received frame as a csv line:
+                                   device,datagram seq,<sensor>,<frame seq>,<capture time in us>,<frame fields>
+                                   The capture time is unix time once the device clock is synchronized.
+                                   Gaps in the frame sequence numbers are reported on stderr.
+                                   Presence events are printed as:
+                                   device,event seq,event,<sensor>,<time>,<kind>,<state>,<previous>,<energies>,<gate>
+                                   and gate statistics as:
+                                   device,event seq,aggregate,<sensor>,<start>,<ms>,<frames>,<min,max,mean,stddev per gate>
+        frame-decoder --verify <file> [deadband] [keyinterval]
+                                   replay the frames of a file, one csv frame per line as
+                                   printed by this tool or sent in csv format, through the
+                                   delta encoder and decoder and check the reconstruction.
+        frame-decoder --history <file>
+                                   print the frames of a binary download of /history, as
+                                   frames received by UDP.
+        frame-decoder --bench [n]  compare the cost and size of the frame encodings.
+        frame-decoder --interleave [n]
+                                   batch n frames of two radars, published out of capture
+                                   order, in binary and delta datagrams as the device does,
+                                   and check that the batches are only cut when full and that
+                                   every frame is decoded exactly.
+*/
+
+#include "frame-codec.h"
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+enum {
+    MAX_DEVICES = 16
+};
+
+/*Delta decoding state of each device sending to the collector*/
+static struct device {
+    uint32_t id;
+    uint32_t seq;   /*Sequence number expected in the next datagram*/
+    uint32_t frameseq; /*Sequence number expected in the next frame*/
+    uint32_t lost;
+    struct frame_delta delta[DATAFRAME_MAX_SENSORS];
+} devices[MAX_DEVICES];
+static int ndevices = 0;
+
+static struct device* getdevice( uint32_t id ) {
+    for( int i = 0; i < ndevices; ++i ) {
+        if( devices[i].id == id ) {
+            return &devices[i];
+        }
+    }
+    struct device* dev = &devices[ndevices < MAX_DEVICES ? ndevices++ : MAX_DEVICES - 1];
+    dev->id = id;
+    dev->seq = 0;
+    dev->frameseq = 0;
+    dev->lost = 0;
+    for( int i = 0; i < DATAFRAME_MAX_SENSORS; ++i ) {
+        framedelta_init( &dev->delta[i], 0, 0 );
+    }
+    return dev;
+}
+
+/*Print a binary datagram, one line per record. Return the number of records.*/
+static int printBinary( uint8_t const* src, size_t len ) {
+    struct frame_header hdr;
+    size_t pos = frame_binParseHeader( src, len, &hdr );
+    if( 0 == pos ) {
+        return 0;
+    }
+
+    if( hdr.flags & FRAME_FLAG_EVENT ) {
+        /*Events have their own sequence numbers and do not touch the delta state*/
+        struct presence_event ev;
+        if( 0 == frame_binParseEvent( &hdr, src + pos, len - pos, &ev ) ) {
+            fprintf( stderr, "truncated event, seq %u\n", hdr.seq );
+            return 0;
+        }
+        char csv[FRAME_EVENT_CSV_MAX];
+        frame_eventToCsv( &ev, 0, csv, sizeof(csv) );
+        printf( "%08x,%u,%s\n", hdr.device, hdr.seq, csv );
+        return 1;
+    }
+
+    if( hdr.flags & FRAME_FLAG_AGGREGATE ) {
+        struct gate_aggregate agg;
+        if( 0 == frame_binParseAggregate( &hdr, src + pos, len - pos, &agg ) ) {
+            fprintf( stderr, "truncated aggregate, seq %u\n", hdr.seq );
+            return 0;
+        }
+        char csv[FRAME_AGGREGATE_CSV_MAX];
+        frame_aggregateToCsv( &agg, 0, csv, sizeof(csv) );
+        printf( "%08x,%u,%s\n", hdr.device, hdr.seq, csv );
+        return 1;
+    }
+
+    struct device* dev = getdevice( hdr.device );
+    if( hdr.seq != dev->seq ) {
+        /*A lost datagram may hold changes of the gates, wait for the next keyframes*/
+        for( int i = 0; i < DATAFRAME_MAX_SENSORS; ++i ) {
+            framedelta_reset( &dev->delta[i] );
+        }
+    }
+    dev->seq = hdr.seq + 1;
+
+    int records = 0;
+    for( ; records < hdr.count; ++records ) {
+        struct dataframe frame;
+        size_t const rlen = FRAME_BIN_VERSION_DELTA == hdr.version
+                          ? frame_deltaParseRecord( dev->delta, &hdr, src + pos, len - pos, &frame )
+                          : frame_binParseRecord( &hdr, src + pos, len - pos, &frame );
+        if( 0 == rlen ) {
+            fprintf( stderr, "truncated datagram, seq %u\n", hdr.seq );
+            break;
+        }
+        pos += rlen;
+        if( frame.seq != dev->frameseq && dev->frameseq ) {
+            uint32_t const gap = frame.seq - dev->frameseq;
+            dev->lost += gap;
+            fprintf( stderr, "device %08x: %u frames lost before %u, %u in total\n", hdr.device, gap, frame.seq, dev->lost );
+        }
+        dev->frameseq = frame.seq + 1;
+        if( FRAME_BIN_VERSION_DELTA == hdr.version && !dev->delta[frame.sensor].valid ) {
+            continue;
+        }
+
+        char csv[FRAME_CSV_MAX];
+        frame_toCsv( &frame, 0, csv, sizeof(csv) );
+        printf( "%08x,%u,%s\n", hdr.device, hdr.seq, csv );
+    }
+    return records;
+}
+
+/*Print the datagrams of a binary history download, they are stored one after the other*/
+static int history( char const* path ) {
+    FILE* f = fopen( path, "rb" );
+    if( NULL == f ) {
+        perror( path );
+        return 1;
+    }
+    static uint8_t buf[FRAME_BIN_HEADER + UINT8_MAX * FRAME_BIN_RECORD];
+    int frames = 0;
+    while( FRAME_BIN_HEADER == fread( buf, 1, FRAME_BIN_HEADER, f ) ) {
+        struct frame_header hdr;
+        if( 0 == frame_binParseHeader( buf, FRAME_BIN_HEADER, &hdr ) || FRAME_BIN_VERSION != hdr.version ) {
+            fprintf( stderr, "%s: not a binary history\n", path );
+            break;
+        }
+        size_t const len = FRAME_BIN_HEADER + fread( buf + FRAME_BIN_HEADER, 1, hdr.count * FRAME_BIN_RECORD, f );
+        frames += printBinary( buf, len );
+    }
+    fclose( f );
+    fprintf( stderr, "%d frames\n", frames );
+    return 0;
+}
+
+static int listen( int port ) {
+    int const sock = socket( AF_INET, SOCK_DGRAM, 0 );
+    struct sockaddr_in addr;
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_ANY );
+    addr.sin_port = htons( port );
+    if( sock < 0 || bind( sock, (struct sockaddr*)&addr, sizeof(addr) ) < 0 ) {
+        perror( "bind" );
+        return 1;
+    }
+
+    for(;;) {
+        uint8_t buf[2048];
+        ssize_t const len = recv( sock, buf, sizeof(buf) - 1, 0 );
+        if( len <= 0 ) {
+            continue;
+        }
+
+        if( buf[0] == FRAME_BIN_MAGIC ) {
+            printBinary( buf, len );
+        }
+        else {
+            buf[len] = '\0';
+            printf( "%s\n", (char*)buf );
+        }
+        fflush( stdout );
+    }
+    return 0;
+}
+
+/*Parse a line of comma separated values as printed by frame_toCsv, skipping the
+device,datagram seq prefix printed by this tool when it is present.*/
+static bool parseCsv( char const* line, struct dataframe* frame ) {
+    enum { FIELDS = 9 + 2 * LD2410_MAX_GATES, PREFIX = 2 };
+    unsigned long long val[FIELDS + PREFIX];
+    int n = 0;
+    char const* pos = line;
+    while( n < FIELDS + PREFIX ) {
+        char* end;
+        val[n] = strtoull( pos, &end, n ? 10 : 16 );
+        ++n;
+        if( end == pos ) {
+            return false;
+        }
+        if( ',' != *end ) {
+            break;
+        }
+        pos = end + 1;
+    }
+
+    unsigned long long const* f;
+    if( FIELDS == n ) {
+        /*Without prefix the first field is decimal*/
+        val[0] = strtoull( line, NULL, 10 );
+        f = val;
+    }
+    else if( FIELDS + PREFIX == n ) {
+        f = val + PREFIX;
+    }
+    else {
+        return false;
+    }
+
+    if( DATAFRAME_MAX_SENSORS <= f[0] ) {
+        return false;
+    }
+    frame->sensor                   = f[0];
+    frame->seq                      = f[1];
+    frame->timestamp                = f[2];
+    frame->stationaryTargetDistance = f[3];
+    frame->stationaryTargetEnergy   = f[4];
+    frame->movingTargetDistance     = f[5];
+    frame->movingTargetEnergy       = f[6];
+    frame->detectionDistance        = f[7];
+    frame->engRataingData           = f[8];
+    for( int x = 0; x < LD2410_MAX_GATES; ++x ) {
+        frame->engMovingDistanceGateEnergy[x] = f[9 + x];
+        frame->engStaticDistanceGateEnergy[x] = f[9 + LD2410_MAX_GATES + x];
+    }
+    return true;
+}
+
+/*Replay recorded frames through the delta encoder and decoder. Every decoded gate must be
+within the deadband of the recorded one and every other field must be exact.*/
+static int verify( char const* path, int deadband, int keyinterval ) {
+    FILE* file = fopen( path, "r" );
+    if( NULL == file ) {
+        perror( path );
+        return 1;
+    }
+
+    struct frame_delta encoder[DATAFRAME_MAX_SENSORS], decoder[DATAFRAME_MAX_SENSORS];
+    for( int i = 0; i < DATAFRAME_MAX_SENSORS; ++i ) {
+        framedelta_init( &encoder[i], deadband, keyinterval );
+        framedelta_init( &decoder[i], 0, 0 );
+    }
+
+    long frames = 0, errors = 0, bytes = 0, maxerr = 0;
+    char line[512];
+    while( fgets( line, sizeof(line), file ) ) {
+        struct dataframe frame, decoded;
+        if( !parseCsv( line, &frame ) ) {
+            continue;
+        }
+
+        /*Each record is the first of its datagram*/
+        struct frame_header hdr = { FRAME_BIN_VERSION_DELTA, 1, 0, 0, 0, frame.seq, frame.timestamp };
+        uint8_t record[FRAME_DELTA_RECORD];
+        size_t const len = frame_deltaRecord( encoder, &frame, 0, 0, record, sizeof(record) );
+        if( len != frame_deltaParseRecord( decoder, &hdr, record, len, &decoded ) || !decoder[frame.sensor].valid ) {
+            fprintf( stderr, "frame %ld: record not decoded\n", frames );
+            ++errors;
+            continue;
+        }
+        ++frames;
+        bytes += len;
+
+        bool ok = frame.sensor                   == decoded.sensor
+               && frame.seq                      == decoded.seq
+               && frame.timestamp                == decoded.timestamp
+               && frame.detectionDistance        == decoded.detectionDistance
+               && frame.stationaryTargetDistance == decoded.stationaryTargetDistance
+               && frame.stationaryTargetEnergy   == decoded.stationaryTargetEnergy
+               && frame.movingTargetDistance     == decoded.movingTargetDistance
+               && frame.movingTargetEnergy       == decoded.movingTargetEnergy
+               && frame.engRataingData           == decoded.engRataingData;
+        for( int x = 0; x < LD2410_MAX_GATES; ++x ) {
+            long const em = labs( (long)frame.engMovingDistanceGateEnergy[x] - decoded.engMovingDistanceGateEnergy[x] );
+            long const es = labs( (long)frame.engStaticDistanceGateEnergy[x] - decoded.engStaticDistanceGateEnergy[x] );
+            maxerr = em > maxerr ? em : maxerr;
+            maxerr = es > maxerr ? es : maxerr;
+            ok = ok && em <= deadband && es <= deadband;
+        }
+        if( !ok ) {
+            fprintf( stderr, "frame %ld: reconstruction out of the deadband\n", frames );
+            ++errors;
+        }
+    }
+    fclose( file );
+
+    printf( "%ld frames, %.1f bytes/record (%d full), max gate error %ld, %ld errors\n",
+            frames, frames ? (double)bytes / frames : 0.0, FRAME_BIN_RECORD, maxerr, errors );
+    return errors || 0 == frames ? 1 : 0;
+}
+
+/*Encoder used before the binary format existed, kept as reference for the benchmark*/
+static size_t legacyCsv( struct dataframe const* data, char* serialBuffer, size_t len ) {
+    char buffer1[128];
+    size_t pos = snprintf( serialBuffer, len, "%d,%d,%d,%d,%d,%d",
+                    data->stationaryTargetDistance, data->stationaryTargetEnergy,
+                    data->movingTargetDistance, data->movingTargetEnergy,
+                    data->detectionDistance, data->engRataingData );
+
+    for( int x = 0; x < LD2410_MAX_GATES; ++x ) {
+        pos += snprintf( buffer1, sizeof(buffer1), ",%d", data->engMovingDistanceGateEnergy[x] );
+        strcat( serialBuffer, buffer1 );
+    }
+    for( int x = 0; x < LD2410_MAX_GATES; ++x ) {
+        pos += snprintf( buffer1, sizeof(buffer1), ",%d", data->engStaticDistanceGateEnergy[x] );
+        strcat( serialBuffer, buffer1 );
+    }
+    return pos;
+}
+
+/*Next gate energy of a slowly changing scene*/
+static uint8_t drift( uint8_t prev ) {
+    int const val = prev + rand() % 7 - 3;
+    return val < 0 ? 0 : val > 100 ? 100 : val;
+}
+
+static void randomFrame( struct dataframe* frame, struct dataframe const* prev ) {
+    frame->seq                      = prev ? prev->seq + 1 : 0;
+    frame->timestamp                = prev ? prev->timestamp + 50000 : 0;
+    frame->detectionDistance        = rand() % 600;
+    frame->stationaryTargetDistance = rand() % 600;
+    frame->stationaryTargetEnergy   = rand() % 101;
+    frame->movingTargetDistance     = rand() % 600;
+    frame->movingTargetEnergy       = rand() % 101;
+    frame->engRataingData           = rand() % 256;
+    for( int x = 0; x < LD2410_MAX_GATES; ++x ) {
+        frame->engMovingDistanceGateEnergy[x] = prev ? drift( prev->engMovingDistanceGateEnergy[x] ) : rand() % 101;
+        frame->engStaticDistanceGateEnergy[x] = prev ? drift( prev->engStaticDistanceGateEnergy[x] ) : rand() % 101;
+    }
+}
+
+enum encoder {
+    ENC_LEGACY_CSV,
+    ENC_CSV,
+    ENC_BINARY,
+    ENC_BINARY_BATCH,
+    ENC_DELTA_BATCH,
+    ENC_PRESENCE,
+    ENC_AGGREGATE
+};
+
+enum {
+    BENCH_BATCH = 10,
+    BENCH_DEADBAND = 2,
+    BENCH_KEYINTERVAL = 50,
+    BENCH_WINDOW = 5000     /*ms, the 1000 frames of the bench are 10 windows*/
+};
+
+static size_t encode( enum encoder enc, struct dataframe const* frame, uint8_t* dest, size_t len ) {
+    switch( enc ) {
+        case ENC_LEGACY_CSV:
+            return legacyCsv( frame, (char*)dest, len );
+        case ENC_CSV:
+            return frame_toCsv( frame, 0, (char*)dest, len );
+        case ENC_BINARY: {
+            struct frame_header const hdr = { FRAME_BIN_VERSION, 1, 0, 0x12345678, 0, frame->seq, frame->timestamp };
+            size_t const hlen = frame_binHeader( &hdr, dest, len );
+            return hlen + frame_binRecord( frame, 0, 0, dest + hlen, len - hlen );
+        }
+        case ENC_BINARY_BATCH:
+        case ENC_DELTA_BATCH: {
+            /*Cost of a frame when BENCH_BATCH frames share one datagram*/
+            static struct frame_batch batch;
+            static struct frame_delta delta[DATAFRAME_MAX_SENSORS] = { { BENCH_DEADBAND, BENCH_KEYINTERVAL, 0, false, { 0 } } };
+            struct frame_header const hdr = { FRAME_BIN_VERSION, 0, 0, 0x12345678, 0, 0, 0 };
+            if( 0 == batch.count ) {
+                uint8_t const format = ENC_DELTA_BATCH == enc ? FRAME_FORMAT_DELTA : FRAME_FORMAT_BINARY;
+                framebatch_init( &batch, dest, len, format, BENCH_BATCH, delta, 0 );
+            }
+            size_t const before = batch.len;
+            framebatch_add( &batch, &hdr, frame, 0 );
+            size_t const added = batch.len - before;
+            if( framebatch_isFull( &batch ) ) {
+                framebatch_finish( &batch );
+            }
+            return added;
+        }
+        case ENC_PRESENCE: {
+            /*Only the events of the detector are sent, in their own datagrams*/
+            static struct presence detector;
+            struct presence_params const params = { 8, 30, 20, 5000, 60000 };
+            struct presence_event ev;
+            if( PRESENCE_NONE == presence_update( &detector, &params, frame, frame->timestamp / 1000, &ev ) ) {
+                return 0;
+            }
+            struct frame_header const hdr = { FRAME_BIN_VERSION, 1, FRAME_FLAG_EVENT, 0x12345678, 0, 0, 0 };
+            return frame_binEvent( &hdr, &ev, 0, dest, len );
+        }
+        case ENC_AGGREGATE: {
+            /*Only the statistics of each window are sent*/
+            static struct gatestats stats;
+            struct gate_aggregate agg;
+            if( !gatestats_update( &stats, frame, BENCH_WINDOW, &agg ) ) {
+                return 0;
+            }
+            struct frame_header const hdr = { FRAME_BIN_VERSION, 1, FRAME_FLAG_AGGREGATE, 0x12345678, 0, 0, 0 };
+            return frame_binAggregate( &hdr, &agg, 0, dest, len );
+        }
+    }
+    return 0;
+}
+
+static int bench( int n ) {
+    enum { FRAMES = 100 * BENCH_BATCH }; /*The sequence numbers must not go back within a batch*/
+    static struct dataframe frames[FRAMES];
+    for( int i = 0; i < FRAMES; ++i ) {
+        randomFrame( &frames[i], i ? &frames[i - 1] : NULL );
+    }
+
+    struct { char const* name; enum encoder enc; } const encoders[] = {
+        { "csv (snprintf+strcat)",   ENC_LEGACY_CSV },
+        { "csv",                     ENC_CSV },
+        { "binary",                  ENC_BINARY },
+        { "binary, 10 per datagram", ENC_BINARY_BATCH },
+        { "delta, 10 per datagram",  ENC_DELTA_BATCH },
+        { "presence events",         ENC_PRESENCE },
+        { "gate stats, 5 s windows", ENC_AGGREGATE }
+    };
+
+    printf( "%-24s %12s %12s\n", "encoder", "ns/frame", "bytes/frame" );
+    for( auto const& e : encoders ) {
+        static uint8_t buf[1472];
+        size_t bytes = 0;
+        auto const start = std::chrono::steady_clock::now();
+        for( int i = 0; i < n; ++i ) {
+            bytes += encode( e.enc, &frames[i % FRAMES], buf, sizeof(buf) );
+            __asm__ volatile( "" : : "r"( buf ) : "memory" );
+        }
+        auto const end = std::chrono::steady_clock::now();
+        double const ns = std::chrono::duration<double, std::nano>( end - start ).count();
+        printf( "%-24s %12.1f %12.1f\n", e.name, ns / n, (double)bytes / n );
+    }
+    return 0;
+}
+
+/*All the fields of two frames are equal*/
+static bool sameFrame( struct dataframe const* a, struct dataframe const* b ) {
+    return a->sensor                   == b->sensor
+        && a->seq                      == b->seq
+        && a->timestamp                == b->timestamp
+        && a->detectionDistance        == b->detectionDistance
+        && a->stationaryTargetDistance == b->stationaryTargetDistance
+        && a->stationaryTargetEnergy   == b->stationaryTargetEnergy
+        && a->movingTargetDistance     == b->movingTargetDistance
+        && a->movingTargetEnergy       == b->movingTargetEnergy
+        && a->engRataingData           == b->engRataingData
+        && 0 == memcmp( a->engMovingDistanceGateEnergy, b->engMovingDistanceGateEnergy, LD2410_MAX_GATES )
+        && 0 == memcmp( a->engStaticDistanceGateEnergy, b->engStaticDistanceGateEnergy, LD2410_MAX_GATES );
+}
+
+/*Decode a datagram of the interleave check and compare it with the frames batched*/
+static long checkDatagram( uint8_t const* src, size_t len, struct frame_delta* decoder,
+                           struct dataframe const* frames, int first, int count ) {
+    struct frame_header hdr;
+    size_t pos = frame_binParseHeader( src, len, &hdr );
+    long errors = 0 == pos || hdr.count != count;
+    for( int i = 0; pos && i < hdr.count && i < count; ++i ) {
+        struct dataframe frame;
+        size_t const rlen = FRAME_BIN_VERSION_DELTA == hdr.version
+                          ? frame_deltaParseRecord( decoder, &hdr, src + pos, len - pos, &frame )
+                          : frame_binParseRecord( &hdr, src + pos, len - pos, &frame );
+        pos = rlen ? pos + rlen : 0;
+        if( 0 == rlen || !sameFrame( &frame, &frames[first + i] ) ) {
+            fprintf( stderr, "frame %d not decoded exactly\n", first + i );
+            ++errors;
+        }
+    }
+    return errors;
+}
+
+/*Each radar task stamps its frames when they are received, the frames of radar 1 are
+published up to 180 ms after a later frame of radar 0, and may be older than the first
+frame of the batch*/
+static int interleave( int n ) {
+    std::vector<struct dataframe> frames( n );
+    for( int i = 0; i < n; ++i ) {
+        randomFrame( &frames[i], i ? &frames[i - 1] : NULL );
+        frames[i].sensor = i % 2;
+        frames[i].timestamp = 1000000 + (uint64_t)i * 25000 - ( i % 2 ? ( 10 - i % 10 ) * 20000 : 0 );
+    }
+
+    int failed = 0;
+    uint8_t const formats[] = { FRAME_FORMAT_BINARY, FRAME_FORMAT_DELTA };
+    for( uint8_t const format : formats ) {
+        struct frame_delta encoder[DATAFRAME_MAX_SENSORS], decoder[DATAFRAME_MAX_SENSORS];
+        for( int i = 0; i < DATAFRAME_MAX_SENSORS; ++i ) {
+            framedelta_init( &encoder[i], 0, BENCH_KEYINTERVAL );
+            framedelta_init( &decoder[i], 0, 0 );
+        }
+        static uint8_t buf[1472];
+        struct frame_batch batch;
+        struct frame_header const hdr = { FRAME_BIN_VERSION, 0, 0, 0x12345678, 0, 0, 0 };
+        framebatch_init( &batch, buf, sizeof(buf), format, BENCH_BATCH, encoder, 0 );
+        long datagrams = 0, cut = 0, errors = 0;
+        int first = 0;
+        for( int i = 0; i < n; ++i ) {
+            if( !framebatch_add( &batch, &hdr, &frames[i], 0 ) ) {
+                /*udp_task sends the batch and adds the frame to the next one*/
+                ++cut;
+                int const count = batch.count;
+                size_t const len = framebatch_finish( &batch );
+                errors += checkDatagram( buf, len, decoder, frames.data(), first, count );
+                ++datagrams;
+                first = i;
+                framebatch_add( &batch, &hdr, &frames[i], 0 );
+            }
+            if( framebatch_isFull( &batch ) || i == n - 1 ) {
+                int const count = batch.count;
+                size_t const len = framebatch_finish( &batch );
+                errors += checkDatagram( buf, len, decoder, frames.data(), first, count );
+                ++datagrams;
+                first = i + 1;
+            }
+        }
+        bool const ok = 0 == errors && 0 == cut && ( n + BENCH_BATCH - 1 ) / BENCH_BATCH == datagrams;
+        printf( "%-8s %d frames of 2 radars, %ld datagrams, %ld cut before full, %ld errors %s\n",
+                FRAME_FORMAT_DELTA == format ? "delta" : "binary", n, datagrams, cut, errors, ok ? "ok" : "FAILED" );
+        failed += !ok;
+    }
+    return failed ? 1 : 0;
+}
+
+int main( int argc, char* argv[] ) {
+    if( 2 <= argc && 0 == strcmp( argv[1], "--bench" ) ) {
+        return bench( 3 <= argc ? atoi( argv[2] ) : 1000000 );
+    }
+
+    if( 3 <= argc && 0 == strcmp( argv[1], "--verify" ) ) {
+        return verify( argv[2], 4 <= argc ? atoi( argv[3] ) : 2, 5 <= argc ? atoi( argv[4] ) : 50 );
+    }
+
+    if( 2 <= argc && 0 == strcmp( argv[1], "--interleave" ) ) {
+        return interleave( 3 <= argc ? atoi( argv[2] ) : 10000 );
+    }
+
+    if( 3 == argc && 0 == strcmp( argv[1], "--history" ) ) {
+        return history( argv[2] );
+    }
+
+    if( 2 == argc ) {
+        return listen( atoi( argv[1] ) );
+    }
+
+    fprintf( stderr, "usage: %s <udp port> | --verify <file> [deadband] [keyinterval] | --history <file> | --bench [n] | --interleave [n]\n", argv[0] );
+    return 1;
+}
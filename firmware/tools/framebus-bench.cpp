@@ -0,0 +1,350 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+
+    Host stress test and throughput of the frame bus of sensor_task. One publisher
+    thread writes frames whose content is derived from their number, and several
+    reader threads take them, half of them copying with framebus_read() and half of
+    them in place with framebus_peek() and framebus_release(). Each reader checks:
+        - the sequence numbers always grow,
+        - no frame accepted by the bus is torn, mixing the content of two frames,
+        - the frames read plus the drops are all the published frames,
+        - the gaps in the sequence numbers are the drops.
+    The bus runs twice:
+        - a stress run where the publisher yields every few frames, so the readers
+          interleave with it even on a single core, and reader 0 is slow, so it is
+          lapped and drops frames,
+        - a throughput run without the slow reader, where the publisher waits while a
+          reader is half the ring behind, so every reader keeps up and none drops.
+    The throughput run is compared with the queue the bus replaced, given the same
+    work: every reader gets every frame from its own mutex and condition variable
+    queue of 5 dataframes, copied in and out, and the publisher waits while a queue is
+    full as xQueueSend() did. Both report the frames delivered per reader per second,
+    from the first publish until the last reader is done, and the drops.
+
+    Build:
+        g++ -O2 -pthread -I../src framebus-bench.cpp ../src/framebus.cpp -o framebus-bench
+    Usage:
+        framebus-bench [-r readers] [-n frames]   Returns 1 if a check fails.
+*/
+
+#include "framebus.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum {
+    QUEUE_DEPTH = 5,      /*Depth of the xQueue of sensor_task before the bus*/
+    BURST       = 4,      /*Frames between yields of the publisher in the stress run*/
+    SLOW_WORK   = 20      /*Sleep of the slow reader per frame, us*/
+};
+
+/*Every byte of the frame is derived from its number, a torn frame mixes two numbers*/
+static void fillFrame( struct dataframe* f, uint32_t n ) {
+    uint8_t const b = (uint8_t)( n * 7 + 1 );
+    memset( f, 0, sizeof(*f) );
+    f->timestamp = n;
+    f->detectionDistance = (uint16_t)n;
+    f->stationaryTargetDistance = (uint16_t)( n >> 16 );
+    f->stationaryTargetEnergy = b;
+    f->movingTargetDistance = (uint16_t)~n;
+    f->movingTargetEnergy = b;
+    f->engRataingData = (uint16_t)( n ^ 0x5a5a );
+    memset( f->engMovingDistanceGateEnergy, b, sizeof(f->engMovingDistanceGateEnergy) );
+    memset( f->engStaticDistanceGateEnergy, b, sizeof(f->engStaticDistanceGateEnergy) );
+}
+
+/*Check the content against the number of the frame, the timestamp*/
+static bool isConsistent( struct dataframe const* f ) {
+    struct dataframe expected;
+    fillFrame( &expected, (uint32_t)f->timestamp );
+    expected.seq = f->seq;
+    return 0 == memcmp( &expected, f, sizeof(expected) );
+}
+
+struct readerResult {
+    uint32_t received;
+    uint32_t frames;      /*Counters of the reader of the bus*/
+    uint32_t drops;
+    uint32_t gaps;        /*Frames missing in the sequence numbers received*/
+    uint32_t disorders;   /*Sequence numbers not greater than the previous one*/
+    uint32_t torn;        /*Frames accepted with mixed content*/
+};
+
+static void slowWork( void ) {
+    std::this_thread::sleep_for( std::chrono::microseconds( SLOW_WORK ) );
+}
+
+static void account( struct readerResult* r, struct dataframe const* f, int64_t* last ) {
+    if( !isConsistent( f ) || f->seq != (uint32_t)f->timestamp ) {
+        ++r->torn;
+    }
+    if( (int64_t)f->seq <= *last ) {
+        ++r->disorders;
+    }
+    else {
+        r->gaps += (uint32_t)( f->seq - *last - 1 );
+    }
+    *last = f->seq;
+    ++r->received;
+}
+
+static void busReader( struct framebus_reader* reader, bool inPlace, bool slow, std::atomic<int>* ready,
+                       std::atomic<bool> const* done, uint32_t total, struct readerResult* r,
+                       std::atomic<uint32_t>* progress ) {
+    int64_t last = -1;
+    ready->fetch_add( 1 );
+    for(;;) {
+        struct dataframe frame;
+        bool got = false;
+        if( inPlace ) {
+            struct dataframe const* f = framebus_peek( reader );
+            if( f ) {
+                /*The copy stands for the work done on the frame in place*/
+                frame = *f;
+                if( slow ) {
+                    slowWork();
+                }
+                got = framebus_release( reader );
+            }
+        }
+        else {
+            got = framebus_read( reader, &frame );
+            if( got && slow ) {
+                slowWork();
+            }
+        }
+
+        if( got ) {
+            account( r, &frame, &last );
+            progress->store( (uint32_t)( last + 1 ), std::memory_order_release );
+        }
+        else if( done->load( std::memory_order_acquire ) && 0 == framebus_pending( reader ) ) {
+            break;
+        }
+        else if( !inPlace || NULL == framebus_peek( reader ) ) {
+            std::this_thread::yield();
+        }
+    }
+    /*Frames after the last one received*/
+    r->gaps += (uint32_t)( total - 1 - last );
+    r->frames = reader->frames;
+    r->drops = reader->drops;
+}
+
+/*Lowest number of frames a reader has got to*/
+static uint32_t slowest( std::vector<std::atomic<uint32_t>> const& progress ) {
+    uint32_t low = UINT32_MAX;
+    for( auto const& p : progress ) {
+        uint32_t const n = p.load( std::memory_order_acquire );
+        low = n < low ? n : low;
+    }
+    return low;
+}
+
+/*Print the results of the readers, and the frames delivered to each per second*/
+static void printReaders( char const* title, std::vector<struct readerResult> const& results, double seconds ) {
+    printf( "\n%s\n%-8s %-8s %10s %10s %10s %10s %10s %8s %12s\n", title, "reader", "mode", "received", "frames",
+            "drops", "gaps", "disorder", "torn", "frames/s" );
+    for( size_t i = 0; i < results.size(); ++i ) {
+        struct readerResult const* r = &results[i];
+        printf( "%-8zu %-8s %10u %10u %10u %10u %10u %8u %12.0f\n", i, 1 == i % 2 ? "in place" : "copy",
+                r->received, r->frames, r->drops, r->gaps, r->disorders, r->torn, r->received / seconds );
+    }
+}
+
+/*Delivery of a run, the slowest reader*/
+struct delivery {
+    double rate;       /*Frames delivered per second to the slowest reader*/
+    uint32_t drops;    /*Frames dropped by all the readers*/
+};
+
+/*Run the bus. In the stress run the publisher never waits and reader 0 is slow, in the
+throughput run the publisher waits for the readers.*/
+static struct delivery runBus( int nreaders, uint32_t total, bool stress, bool* ok ) {
+    static struct framebus bus;
+    framebus_init( &bus );
+    std::vector<struct framebus_reader> readers( nreaders );
+    std::vector<struct readerResult> results( nreaders );
+    for( int i = 0; i < nreaders; ++i ) {
+        framebus_attach( &readers[i], &bus );
+        memset( &results[i], 0, sizeof(results[i]) );
+    }
+
+    std::atomic<bool> done( false );
+    std::atomic<int> ready( 0 );
+    std::vector<std::atomic<uint32_t>> progress( nreaders );
+    std::vector<std::thread> threads;
+    for( int i = 0; i < nreaders; ++i ) {
+        progress[i].store( 0 );
+        threads.emplace_back( busReader, &readers[i], 1 == i % 2, stress && 0 == i, &ready, &done, total,
+                              &results[i], &progress[i] );
+    }
+    while( ready.load() < nreaders ) {
+        std::this_thread::yield();
+    }
+
+    auto const start = std::chrono::steady_clock::now();
+    struct dataframe frame;
+    for( uint32_t n = 0; n < total; ++n ) {
+        /*Half the ring ahead of the slowest reader at most, it is never lapped*/
+        while( !stress && FRAMEBUS_SLOTS / 2 <= n - slowest( progress ) ) {
+            std::this_thread::yield();
+        }
+        fillFrame( &frame, n );
+        framebus_publish( &bus, &frame );
+        if( stress && 0 == n % BURST ) {
+            std::this_thread::yield();
+        }
+    }
+    done.store( true, std::memory_order_release );
+    for( auto& t : threads ) {
+        t.join();
+    }
+    double const seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+    printReaders( stress ? "bus, stress run" : "bus, throughput run", results, seconds );
+    struct delivery d = { 0, 0 };
+    d.rate = total / seconds;
+    for( int i = 0; i < nreaders; ++i ) {
+        struct readerResult const* r = &results[i];
+        bool const good = 0 == r->torn && 0 == r->disorders && r->received == r->frames
+                       && r->frames + r->drops == total && r->gaps == r->drops;
+        if( !good ) {
+            printf( "reader %d lost count of its frames, FAILED\n", i );
+        }
+        *ok = *ok && good;
+        d.rate = r->received / seconds < d.rate ? r->received / seconds : d.rate;
+        d.drops += r->drops;
+    }
+    /*In the throughput run every reader keeps up*/
+    if( !stress && 0 != d.drops ) {
+        printf( "frames dropped while the publisher waits for the readers, FAILED\n" );
+        *ok = false;
+    }
+    /*In the stress run the fast readers must keep up with most frames, and the slow
+    one must be lapped, or the drops were not exercised*/
+    if( stress ) {
+        for( int i = 1; i < nreaders; ++i ) {
+            if( results[i].frames < total / 2 ) {
+                printf( "reader %d got few frames, FAILED\n", i );
+                *ok = false;
+            }
+        }
+        if( 0 == results[0].drops ) {
+            printf( "the slow reader did not drop frames, FAILED\n" );
+            *ok = false;
+        }
+    }
+    return d;
+}
+
+/*Queue of sensor_task before the bus*/
+struct frameQueue {
+    std::mutex lock;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::deque<struct dataframe> frames;
+    bool closed = false;
+};
+
+static void queueReader( struct frameQueue* q, struct readerResult* r ) {
+    int64_t last = -1;
+    for(;;) {
+        struct dataframe frame;
+        {
+            std::unique_lock<std::mutex> guard( q->lock );
+            q->notEmpty.wait( guard, [q] { return !q->frames.empty() || q->closed; } );
+            if( q->frames.empty() ) {
+                break;
+            }
+            frame = q->frames.front();
+            q->frames.pop_front();
+        }
+        q->notFull.notify_one();
+        account( r, &frame, &last );
+    }
+    r->frames = r->received;
+}
+
+/*Run a queue per reader, every reader gets every frame*/
+static struct delivery runQueue( int nreaders, uint32_t total, bool* ok ) {
+    std::vector<struct frameQueue> queues( nreaders );
+    std::vector<struct readerResult> results( nreaders );
+    std::vector<std::thread> threads;
+    for( int i = 0; i < nreaders; ++i ) {
+        memset( &results[i], 0, sizeof(results[i]) );
+        threads.emplace_back( queueReader, &queues[i], &results[i] );
+    }
+
+    auto const start = std::chrono::steady_clock::now();
+    struct dataframe frame;
+    for( uint32_t n = 0; n < total; ++n ) {
+        fillFrame( &frame, n );
+        frame.seq = n;
+        for( auto& q : queues ) {
+            {
+                std::unique_lock<std::mutex> guard( q.lock );
+                q.notFull.wait( guard, [&q] { return q.frames.size() < QUEUE_DEPTH; } );
+                q.frames.push_back( frame );
+            }
+            q.notEmpty.notify_one();
+        }
+    }
+    for( auto& q : queues ) {
+        {
+            std::lock_guard<std::mutex> guard( q.lock );
+            q.closed = true;
+        }
+        q.notEmpty.notify_all();
+    }
+    for( auto& t : threads ) {
+        t.join();
+    }
+    double const seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+    printReaders( "queue of 5 per reader", results, seconds );
+    struct delivery d = { total / seconds, 0 };
+    for( int i = 0; i < nreaders; ++i ) {
+        struct readerResult const* r = &results[i];
+        if( 0 != r->torn || 0 != r->disorders || 0 != r->gaps || total != r->received ) {
+            printf( "queue delivered %u of %u frames to reader %d, FAILED\n", r->received, total, i );
+            *ok = false;
+        }
+        d.rate = r->received / seconds < d.rate ? r->received / seconds : d.rate;
+    }
+    return d;
+}
+
+int main( int argc, char* argv[] ) {
+    int nreaders = 4;
+    uint32_t total = 1000000;
+    for( int i = 1; i + 1 < argc; i += 2 ) {
+        if( 0 == strcmp( argv[i], "-r" ) ) {
+            nreaders = atoi( argv[i + 1] );
+        }
+        else if( 0 == strcmp( argv[i], "-n" ) ) {
+            total = (uint32_t)atol( argv[i + 1] );
+        }
+    }
+    nreaders = nreaders < 2 ? 2 : nreaders;
+
+    bool ok = true;
+    printf( "%d readers, %u frames of %zu bytes, reader 0 is slow in the stress run\n", nreaders, total, sizeof(struct dataframe) );
+    runBus( nreaders, total, true, &ok );
+    struct delivery const bus = runBus( nreaders, total, false, &ok );
+    struct delivery const queue = runQueue( nreaders, total, &ok );
+    printf( "\n%-44s %20s %8s\n", "every reader gets every frame", "frames/s per reader", "drops" );
+    printf( "%-44s %20.0f %8u\n", "frame bus, publisher waits for the readers", bus.rate, bus.drops );
+    printf( "%-44s %20.0f %8u\n", "queue of 5 per reader, mutex and condvar", queue.rate, queue.drops );
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,204 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+
+    Host check of the frame history of hist_task. 4000 synthetic frames, one every 100 ms,
+    are appended to a history of 1000 frames, and ranges of capture times are read in
+    binary datagrams as /history does. Each range must give the stored frames captured
+    in it, in order, with their full capture time and sequence number, and history_find()
+    must agree with a linear search. The cases are:
+        - frames after boot,
+        - frames across the wrap of the 32 bit ms time, 49.7 days after boot,
+        - frames after a gap longer than HISTORY_MAX_SPAN, the older ones are forgotten,
+        - frames of two radars published out of capture order.
+
+    Build:
+        g++ -O2 -I../src history-check.cpp ../src/frame-history.cpp ../src/frame-codec.cpp ../src/presence.cpp ../src/gate-stats.cpp -o history-check
+    Usage:
+        history-check   Returns 1 if a check fails.
+*/
+
+#include "frame-history.h"
+#include "frame-codec.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+enum {
+    CAPACITY = 1000,
+    FRAMES   = 4000,
+    PERIOD   = 100,     /*ms between frames*/
+    DATAGRAM = 1400
+};
+
+static uint64_t const wrap32 = 1ull << 32;
+
+static void makeFrame( struct dataframe* f, uint32_t seq, uint64_t ms ) {
+    memset( f, 0, sizeof(*f) );
+    f->timestamp = ms * 1000;
+    f->seq = seq;
+    f->sensor = seq % 2;
+    f->detectionDistance = (uint16_t)( seq * 3 );
+    f->movingTargetEnergy = (uint8_t)( seq % 100 );
+    for( int g = 0; g < LD2410_MAX_GATES; ++g ) {
+        f->engMovingDistanceGateEnergy[g] = (uint8_t)( ( seq + g ) % 101 );
+        f->engStaticDistanceGateEnergy[g] = (uint8_t)( ( seq * 7 + g ) % 101 );
+    }
+}
+
+/*The history and the frames appended to it*/
+struct sim {
+    struct frame_history hist;
+    std::vector<uint8_t> mem;
+    std::vector<struct dataframe> frames;
+    bool sorted;    /*The capture times grow*/
+};
+
+static void simInit( struct sim* s ) {
+    s->mem.assign( CAPACITY * HISTORY_FRAME_BYTES + 8, 0 );
+    history_init( &s->hist, s->mem.data(), CAPACITY * HISTORY_FRAME_BYTES );
+    s->frames.clear();
+    s->sorted = true;
+}
+
+static void append( struct sim* s, uint64_t ms ) {
+    struct dataframe f;
+    makeFrame( &f, (uint32_t)s->frames.size(), ms );
+    history_append( &s->hist, &f );
+    s->frames.push_back( f );
+}
+
+/*Read a range as /history does and compare it with the frames appended*/
+static bool checkRange( struct sim* s, uint64_t from, uint64_t to, uint32_t first ) {
+    std::vector<struct dataframe> expected;
+    for( uint32_t n = first; n < s->frames.size(); ++n ) {
+        uint64_t const ms = s->frames[n].timestamp / 1000;
+        if( from <= ms && ms <= to ) {
+            expected.push_back( s->frames[n] );
+        }
+    }
+
+    uint32_t linear = first;
+    while( linear < s->frames.size() && s->frames[linear].timestamp / 1000 < from ) {
+        ++linear;
+    }
+    if( s->sorted && history_find( &s->hist, from ) != linear ) {
+        printf( "find %llu gives %u instead of %u, ", (unsigned long long)from, history_find( &s->hist, from ), linear );
+        return false;
+    }
+
+    struct history_cursor cursor;
+    history_seek( &s->hist, &cursor, from, to, FRAME_FORMAT_BINARY, 0, 0x1234 );
+    std::vector<struct dataframe> got;
+    uint8_t buf[DATAGRAM];
+    for( int guard = 0; !history_done( &s->hist, &cursor ) && guard < FRAMES; ++guard ) {
+        size_t const len = history_read( &s->hist, &cursor, buf, sizeof(buf) );
+        struct frame_header hdr;
+        size_t pos = frame_binParseHeader( buf, len, &hdr );
+        for( int i = 0; pos && i < hdr.count; ++i ) {
+            /*Zeroed as makeFrame() does, the frames are compared with their padding*/
+            struct dataframe f;
+            memset( &f, 0, sizeof(f) );
+            size_t const n = frame_binParseRecord( &hdr, buf + pos, len - pos, &f );
+            pos = n ? pos + n : 0;
+            got.push_back( f );
+        }
+    }
+    if( got.size() != expected.size() ) {
+        printf( "range %llu to %llu gives %zu frames instead of %zu, ", (unsigned long long)from,
+                (unsigned long long)to, got.size(), expected.size() );
+        return false;
+    }
+    for( size_t i = 0; i < got.size(); ++i ) {
+        if( 0 != memcmp( &got[i], &expected[i], sizeof(got[i]) ) ) {
+            printf( "frame %u of range %llu to %llu differs, ", expected[i].seq, (unsigned long long)from, (unsigned long long)to );
+            return false;
+        }
+    }
+    return true;
+}
+
+/*Ranges at the ends, in the middle and across the whole history*/
+static bool checkRanges( struct sim* s, uint32_t first ) {
+    uint64_t const t0 = s->frames[first].timestamp / 1000;
+    uint64_t const t1 = s->frames.back().timestamp / 1000;
+    uint64_t const ranges[][2] = {
+        { 0, UINT64_MAX },
+        { t0, t1 },
+        { t0 - 1, t0 },
+        { t1, t1 + 1000 },
+        { t0 + 12345, t0 + 23456 },
+        { t0 + 5050, t0 + 5050 },
+        { t1 - 500, t1 - 1 },
+        { t1 + 1, UINT64_MAX }
+    };
+    for( auto const& r : ranges ) {
+        if( !checkRange( s, r[0], r[1], first ) ) {
+            return false;
+        }
+    }
+    for( uint64_t ms = t0; ms <= t1; ms += 4321 ) {
+        if( !checkRange( s, ms, ms + 9876, first ) ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool report( char const* name, struct sim const* s, bool ok ) {
+    printf( "%-26s %6u frames kept, %10llu to %10llu ms %s\n", name, s->hist.total - history_first( &s->hist ),
+            (unsigned long long)( s->frames[history_first( &s->hist )].timestamp / 1000 ),
+            (unsigned long long)( s->frames.back().timestamp / 1000 ), ok ? "ok" : "FAILED" );
+    return ok;
+}
+
+static bool fromTime( char const* name, uint64_t start ) {
+    static struct sim s;
+    simInit( &s );
+    for( uint32_t n = 0; n < FRAMES; ++n ) {
+        append( &s, start + n * PERIOD );
+    }
+    bool const ok = FRAMES - CAPACITY == history_first( &s.hist ) && checkRanges( &s, FRAMES - CAPACITY );
+    return report( name, &s, ok );
+}
+
+/*The radar stops for longer than the span the stored times can cover*/
+static bool longGap( void ) {
+    static struct sim s;
+    simInit( &s );
+    uint64_t const start = wrap32 - 50000;
+    for( uint32_t n = 0; n < FRAMES / 8; ++n ) {
+        append( &s, start + n * PERIOD );
+    }
+    uint64_t const resume = s.frames.back().timestamp / 1000 + HISTORY_MAX_SPAN + 1;
+    uint32_t const kept = (uint32_t)s.frames.size();
+    for( uint32_t n = 0; n < FRAMES / 8; ++n ) {
+        append( &s, resume + n * PERIOD );
+    }
+    bool const ok = kept == history_first( &s.hist ) && checkRanges( &s, kept );
+    return report( "after a gap of 12 days", &s, ok );
+}
+
+/*Each radar task stamps its frames, the frames of radar 1 are published up to 360 ms late*/
+static bool twoRadars( void ) {
+    static struct sim s;
+    simInit( &s );
+    s.sorted = false;
+    for( uint32_t n = 0; n < FRAMES; ++n ) {
+        uint32_t const late = n % 2 ? ( n % 10 ) * 40 : 0;
+        append( &s, wrap32 - 100000 + n * PERIOD / 2 - late );
+    }
+    bool const ok = FRAMES - CAPACITY == history_first( &s.hist ) && checkRanges( &s, FRAMES - CAPACITY );
+    return report( "two radars out of order", &s, ok );
+}
+
+int main( void ) {
+    int failed = 0;
+    failed += !fromTime( "after boot", 1000 );
+    failed += !fromTime( "across the 32 bit wrap", wrap32 - FRAMES / 2 * PERIOD );
+    failed += !longGap( );
+    failed += !twoRadars( );
+    return failed ? 1 : 0;
+}
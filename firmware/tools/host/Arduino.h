@@ -0,0 +1,84 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+
+    Minimal Arduino API to build the radar driver on the host. Only what the
+    ld2410 driver uses is provided, the time functions are defined by the tool.
+*/
+
+#ifndef __HOST_ARDUINO__
+#define __HOST_ARDUINO__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef uint8_t byte;
+
+#define DEC 10
+#define HEX 16
+#define F(s) (s)
+
+unsigned long millis( void );
+unsigned long micros( void );
+void delay( unsigned long ms );
+
+class Print {
+    public:
+        virtual ~Print( ) { }
+        virtual size_t write( uint8_t c ) = 0;
+        virtual size_t write( uint8_t const* buf, size_t len ) {
+            size_t n = 0;
+            while( len-- ) {
+                n += write( *buf++ );
+            }
+            return n;
+        }
+        size_t write( char const* str ) { return write( (uint8_t const*)str, strlen( str ) ); }
+        virtual void flush( ) { }
+
+        size_t print( char const* str ) { return write( str ); }
+        size_t print( char c ) { return write( (uint8_t)c ); }
+        size_t print( int val, int base = DEC ) { return print( (long long)val, base ); }
+        size_t print( unsigned val, int base = DEC ) { return print( (unsigned long long)val, base ); }
+        size_t print( long val, int base = DEC ) { return print( (long long)val, base ); }
+        size_t print( unsigned long val, int base = DEC ) { return print( (unsigned long long)val, base ); }
+        size_t print( long long val, int base = DEC ) {
+            char str[24];
+            snprintf( str, sizeof(str), HEX == base ? "%llX" : "%lld", val );
+            return write( str );
+        }
+        size_t print( unsigned long long val, int base = DEC ) {
+            char str[24];
+            snprintf( str, sizeof(str), HEX == base ? "%llX" : "%llu", val );
+            return write( str );
+        }
+        size_t print( double val, int digits = 2 ) {
+            char str[32];
+            snprintf( str, sizeof(str), "%.*f", digits, val );
+            return write( str );
+        }
+
+        size_t println( void ) { return write( "\r\n" ); }
+        template<typename T> size_t println( T val ) { return print( val ) + println(); }
+        template<typename T> size_t println( T val, int base ) { return print( val, base ) + println(); }
+};
+
+class Stream : public Print {
+    public:
+        virtual int available( ) = 0;
+        virtual int read( ) = 0;
+        virtual int peek( ) = 0;
+        size_t readBytes( uint8_t* buf, size_t len ) {
+            size_t n = 0;
+            for( int c; n < len && 0 <= ( c = read() ); ++n ) {
+                buf[n] = c;
+            }
+            return n;
+        }
+};
+
+#endif //__HOST_ARDUINO__
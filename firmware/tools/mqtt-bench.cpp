@@ -0,0 +1,215 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+
+    Publish throughput and latency of the MQTT client of ctrl_task against a broker
+    on the host, a local mosquitto for instance. The client runs on a non-blocking
+    socket as it does on AsyncTCP: the publishes are queued as long as the queue
+    takes them, and written as the socket and the QoS 1 window allow.
+
+    Build:
+        g++ -O2 -I../src mqtt-bench.cpp ../src/mqtt-client.cpp -o mqtt-bench
+    Usage:
+        mqtt-bench [-h host] [-p port] [-n publishes] [-s payload bytes] [-q qos] [-w window]
+        Without -q and -w it runs QoS 0 and QoS 1 with windows of 1, 2, 4, 8 and 16.
+        The latency is the time from the publish to its PUBACK, queueing included.
+        A QoS 0 run ends once the last publish is written to the socket.
+*/
+
+#include "mqtt-client.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+enum {
+    RUN_TIMEOUT_MS = 30000
+};
+
+static char const* host = "127.0.0.1";
+static char const* port = "1883";
+
+/*Socket transport and the publish times by packet identifier*/
+struct bench {
+    int fd;
+    bool closed;
+    std::vector<uint64_t> publishedAt;
+    std::vector<uint32_t> latencies;
+};
+
+static uint64_t nowUs( void ) {
+    using namespace std::chrono;
+    return duration_cast<microseconds>( steady_clock::now().time_since_epoch() ).count();
+}
+
+static size_t sockWrite( void* ctx, uint8_t const* data, size_t len ) {
+    struct bench* b = (struct bench*)ctx;
+    ssize_t const n = send( b->fd, data, len, MSG_NOSIGNAL );
+    return n < 0 ? 0 : n;
+}
+
+static void sockFlush( void* ) {
+}
+
+static void sockClose( void* ctx ) {
+    struct bench* b = (struct bench*)ctx;
+    b->closed = true;
+}
+
+static void sockAcked( void* ctx, uint16_t id ) {
+    struct bench* b = (struct bench*)ctx;
+    b->latencies.push_back( nowUs() - b->publishedAt[id] );
+}
+
+static struct mqttc_ops const ops = {
+    .write = sockWrite,
+    .flush = sockFlush,
+    .close = sockClose,
+    .acked = sockAcked
+};
+
+static int connectBroker( void ) {
+    struct addrinfo hints;
+    memset( &hints, 0, sizeof(hints) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res;
+    if( 0 != getaddrinfo( host, port, &hints, &res ) ) {
+        return -1;
+    }
+    int fd = socket( res->ai_family, res->ai_socktype, res->ai_protocol );
+    if( 0 <= fd && 0 != connect( fd, res->ai_addr, res->ai_addrlen ) ) {
+        close( fd );
+        fd = -1;
+    }
+    freeaddrinfo( res );
+    if( 0 <= fd ) {
+        int const one = 1;
+        setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one) );
+        fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+    }
+    return fd;
+}
+
+static bool run( int count, int size, int qos, int window ) {
+    static struct mqttc client;
+    struct bench b;
+    b.fd = connectBroker( );
+    b.closed = false;
+    b.publishedAt.assign( UINT16_MAX + 1, 0 );
+    if( b.fd < 0 ) {
+        fprintf( stderr, "can not connect to %s:%s\n", host, port );
+        return false;
+    }
+
+    char id[32];
+    snprintf( id, sizeof(id), "mqtt-bench-%d", (int)getpid() );
+    struct mqttc_config const cfg = {
+        .clientId  = id,
+        .username  = NULL,
+        .password  = NULL,
+        .keepalive = 30,
+        .window    = (uint8_t)window
+    };
+    mqttc_init( &client, &ops, &b );
+    mqttc_configure( &client, &cfg );
+
+    std::vector<uint8_t> payload( size, 'x' );
+    uint64_t const start = nowUs();
+    mqttc_connected( &client, 0 );
+    int queued = 0;
+    uint64_t firstAt = 0;
+    for(;;) {
+        uint32_t const ms = ( nowUs() - start ) / 1000;
+        uint32_t const done = qos ? client.stats.acked : client.stats.published;
+        if( b.closed || (int)done == count || RUN_TIMEOUT_MS <= ms ) {
+            break;
+        }
+        while( MQTTC_CONNECTED == client.state && queued < count ) {
+            int const pid = mqttc_publish( &client, "bench/publish", payload.data(), payload.size(), qos );
+            if( pid < 0 ) {
+                break;
+            }
+            b.publishedAt[pid] = nowUs();
+            firstAt = firstAt ? firstAt : b.publishedAt[pid];
+            ++queued;
+        }
+        mqttc_poll( &client, ms );
+
+        struct pollfd pfd = { b.fd, (short)( POLLIN | ( client.unsent ? POLLOUT : 0 ) ), 0 };
+        poll( &pfd, 1, 1 );
+        if( pfd.revents & ( POLLERR | POLLHUP ) ) {
+            b.closed = true;
+        }
+        if( pfd.revents & POLLIN ) {
+            uint8_t buf[4096];
+            ssize_t const n = recv( b.fd, buf, sizeof(buf), 0 );
+            if( 0 == n ) {
+                b.closed = true;
+            }
+            else if( 0 < n ) {
+                mqttc_received( &client, buf, n, ( nowUs() - start ) / 1000 );
+            }
+        }
+    }
+    double const secs = ( nowUs() - firstAt ) / 1e6;
+    uint32_t const done = qos ? client.stats.acked : client.stats.published;
+    close( b.fd );
+
+    std::sort( b.latencies.begin(), b.latencies.end() );
+    auto pct = [&b]( double p ) {
+        return b.latencies.empty() ? 0u : b.latencies[ std::min( b.latencies.size() - 1, (size_t)( p * b.latencies.size() ) ) ];
+    };
+    printf( "qos %d  window %2d  %6u/%d  %9.0f msg/s  %7.2f MB/s", qos, qos ? client.cfg.window : 0,
+            done, count, done / secs, done * (double)size / secs / 1e6 );
+    if( qos ) {
+        printf( "  latency p50 %6u us  p99 %6u us  max %6u us", pct( 0.5 ), pct( 0.99 ), pct( 1.0 ) );
+    }
+    printf( "%s\n", (int)done == count ? "" : b.closed ? "  connection closed" : "  timeout" );
+    return (int)done == count;
+}
+
+int main( int argc, char* argv[] ) {
+    int count = 10000;
+    int size = 200;
+    int qos = -1;
+    int window = 0;
+    int opt;
+    while( -1 != ( opt = getopt( argc, argv, "h:p:n:s:q:w:" ) ) ) {
+        switch( opt ) {
+            case 'h': host = optarg; break;
+            case 'p': port = optarg; break;
+            case 'n': count = atoi( optarg ); break;
+            case 's': size = atoi( optarg ); break;
+            case 'q': qos = atoi( optarg ); break;
+            case 'w': window = atoi( optarg ); break;
+            default:
+                fprintf( stderr, "usage: %s [-h host] [-p port] [-n publishes] [-s payload bytes] [-q qos] [-w window]\n", argv[0] );
+                return 1;
+        }
+    }
+
+    bool ok = true;
+    if( 0 <= qos ) {
+        ok = run( count, size, qos, window ? window : 1 );
+    }
+    else {
+        ok = run( count, size, 0, 1 );
+        for( int w : { 1, 2, 4, 8, 16 } ) {
+            ok = run( count, size, 1, w ) && ok;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,532 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+
+    Host check of the MQTT client of ctrl_task against a scripted broker. The transport
+    keeps the bytes written, takes a limited number of them per poll as the AsyncTCP
+    buffer does, and the broker parses the packets and answers as each case sets. Every
+    publish taken by the queue must reach the broker once, in order, with its topic,
+    payload, QoS and identifier, and only the QoS 1 ones written before a disconnection
+    may be sent again, with the DUP flag. The cases are:
+        - framing of CONNECT, PUBLISH and PINGREQ, and parsing of the broker packets
+          received a byte at a time, keepalive and CONNACK timeouts, refused connection,
+        - the window of QoS 1 publishes without their PUBACK, and its limits,
+        - wrap of the queue with a padding record, partial writes, full queue,
+        - reconnection, with the QoS 1 publishes not acknowledged sent again with DUP.
+
+    Build:
+        g++ -O2 -I../src mqtt-check.cpp ../src/mqtt-client.cpp -o mqtt-check
+    Usage:
+        mqtt-check [-v]   -v prints the packets the broker receives. Returns 1 if a check fails.
+*/
+
+#include "mqtt-client.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+enum {
+    CONNECT  = 1,
+    CONNACK  = 2,
+    PUBLISH  = 3,
+    PUBACK   = 4,
+    PINGREQ  = 12,
+    PINGRESP = 13
+};
+
+static bool verbose = false;
+
+/*A packet parsed by the broker*/
+struct packet {
+    uint8_t type;
+    uint8_t flags;
+    std::vector<uint8_t> raw;
+    std::string topic;
+    std::string payload;
+    uint16_t id;
+};
+
+/*A publish taken by the queue*/
+struct message {
+    std::string topic;
+    std::string payload;
+    uint8_t qos;
+    uint16_t id;
+};
+
+/*Client, transport and broker of a case*/
+struct sim {
+    struct mqttc c;
+    std::vector<uint8_t> wire;      /*Bytes written and not parsed by the broker*/
+    size_t room;                    /*Bytes the transport takes until the next poll*/
+    size_t chunk;                   /*Bytes taken per poll, 0 for all*/
+    int closes;
+    int flushes;
+    std::vector<uint16_t> acked;    /*Identifiers passed to the acked callback*/
+    std::vector<struct packet> rx;  /*Packets received by the broker*/
+    std::vector<struct message> expected;
+    size_t delivered;               /*Expected publishes received*/
+    std::vector<uint16_t> unacked;  /*QoS 1 publishes received without PUBACK, in order*/
+    uint32_t dups;                  /*Publishes received again with DUP*/
+    uint32_t now;
+    bool ok;
+};
+
+static size_t netWrite( void* ctx, uint8_t const* data, size_t len ) {
+    struct sim* s = (struct sim*)ctx;
+    size_t const n = s->chunk && s->room < len ? s->room : len;
+    s->room -= s->chunk ? n : 0;
+    s->wire.insert( s->wire.end(), data, data + n );
+    return n;
+}
+
+static void netFlush( void* ctx ) {
+    ++( (struct sim*)ctx )->flushes;
+}
+
+static void netClose( void* ctx ) {
+    ++( (struct sim*)ctx )->closes;
+}
+
+static void netAcked( void* ctx, uint16_t id ) {
+    ( (struct sim*)ctx )->acked.push_back( id );
+}
+
+static struct mqttc_ops const ops = {
+    .write = netWrite,
+    .flush = netFlush,
+    .close = netClose,
+    .acked = netAcked
+};
+
+static void fail( struct sim* s, char const* what ) {
+    if( s->ok ) {
+        printf( "  %s\n", what );
+    }
+    s->ok = false;
+}
+
+static void simInit( struct sim* s, uint8_t window, size_t chunk ) {
+    mqttc_init( &s->c, &ops, s );
+    struct mqttc_config const cfg = {
+        .clientId  = "bridge",
+        .username  = NULL,
+        .password  = NULL,
+        .keepalive = 0,
+        .window    = window
+    };
+    mqttc_configure( &s->c, &cfg );
+    s->wire.clear();
+    s->chunk = s->room = chunk;
+    s->closes = s->flushes = 0;
+    s->acked.clear();
+    s->rx.clear();
+    s->expected.clear();
+    s->unacked.clear();
+    s->delivered = 0;
+    s->dups = 0;
+    s->now = 0;
+    s->ok = true;
+}
+
+/*Parse the complete packets written, the bytes of a packet written in part are kept*/
+static void brokerParse( struct sim* s ) {
+    size_t pos = 0;
+    for( ;; ) {
+        size_t p = pos + 1;
+        uint32_t remaining = 0;
+        int shift = 0;
+        bool more = true;
+        while( more && p < s->wire.size() && shift <= 21 ) {
+            remaining |= (uint32_t)( s->wire[p] & 0x7f ) << shift;
+            more = s->wire[p++] & 0x80;
+            shift += 7;
+        }
+        if( more || s->wire.size() - p < remaining ) {
+            break;
+        }
+        struct packet pk;
+        pk.type = s->wire[pos] >> 4;
+        pk.flags = s->wire[pos] & 0x0f;
+        pk.raw.assign( s->wire.begin() + pos, s->wire.begin() + p + remaining );
+        pk.id = 0;
+        uint8_t const* b = s->wire.data() + p;
+        size_t const topicLen = 2 <= remaining ? b[0] << 8 | b[1] : 0;
+        size_t const idLen = pk.flags & 0x06 ? 2 : 0;
+        if( PUBLISH == pk.type && remaining < 2 + topicLen + idLen ) {
+            /*Malformed, kept as an unknown packet and the publish is missing*/
+            pk.type = 0;
+        }
+        if( PUBLISH == pk.type ) {
+            pk.topic.assign( (char const*)b + 2, topicLen );
+            pk.id = idLen ? b[2 + topicLen] << 8 | b[3 + topicLen] : 0;
+            pk.payload.assign( (char const*)b + 2 + topicLen + idLen, remaining - 2 - topicLen - idLen );
+        }
+        if( verbose ) {
+            printf( "    %5u ms type %2u flags %x, %zu bytes, id %u\n", s->now, pk.type, pk.flags, pk.raw.size(), pk.id );
+        }
+        s->rx.push_back( pk );
+        pos = p + remaining;
+    }
+    s->wire.erase( s->wire.begin(), s->wire.begin() + pos );
+}
+
+/*Check the publishes received against the ones queued*/
+static void brokerDeliver( struct sim* s, size_t from ) {
+    for( size_t i = from; i < s->rx.size(); ++i ) {
+        struct packet const& pk = s->rx[i];
+        if( PUBLISH != pk.type ) {
+            continue;
+        }
+        uint8_t const qos = pk.flags >> 1 & 3;
+        bool const dup = pk.flags & 0x08;
+        bool const again = qos && s->unacked.end() != std::find( s->unacked.begin(), s->unacked.end(), pk.id );
+        if( again ) {
+            /*Sent again after a reconnection, with the content it had the first time*/
+            size_t k = 0;
+            while( k < s->delivered && !( s->expected[k].qos && s->expected[k].id == pk.id ) ) {
+                ++k;
+            }
+            if( !dup || k == s->delivered || s->expected[k].topic != pk.topic || s->expected[k].payload != pk.payload ) {
+                fail( s, "publish sent again without DUP or with another content" );
+            }
+            ++s->dups;
+            continue;
+        }
+        if( s->delivered == s->expected.size() ) {
+            fail( s, "publish received that was not queued" );
+            continue;
+        }
+        struct message const& m = s->expected[s->delivered++];
+        if( dup || m.qos != qos || m.id != pk.id || m.topic != pk.topic || m.payload != pk.payload ) {
+            fail( s, "publish received out of order or not as queued" );
+        }
+        if( qos ) {
+            s->unacked.push_back( pk.id );
+        }
+    }
+}
+
+/*The broker answers with the given bytes, count at a time*/
+static void answer( struct sim* s, std::vector<uint8_t> const& bytes, size_t count ) {
+    for( size_t i = 0; i < bytes.size(); i += count ) {
+        size_t const n = bytes.size() - i < count ? bytes.size() - i : count;
+        mqttc_received( &s->c, bytes.data() + i, n, s->now );
+    }
+}
+
+static void puback( struct sim* s ) {
+    if( s->unacked.empty() ) {
+        fail( s, "no publish to acknowledge" );
+        return;
+    }
+    uint16_t const id = s->unacked.front();
+    s->unacked.erase( s->unacked.begin() );
+    answer( s, { PUBACK << 4, 2, (uint8_t)( id >> 8 ), (uint8_t)id }, 4 );
+}
+
+/*TCP connection and CONNACK accepted*/
+static void connect( struct sim* s ) {
+    s->wire.clear();
+    mqttc_connected( &s->c, s->now );
+    size_t const from = s->rx.size();
+    brokerParse( s );
+    if( s->rx.size() != from + 1 || CONNECT != s->rx.back().type ) {
+        fail( s, "no CONNECT" );
+    }
+    answer( s, { CONNACK << 4, 2, 0, 0 }, 4 );
+    if( MQTTC_CONNECTED != s->c.state ) {
+        fail( s, "CONNACK not taken" );
+    }
+}
+
+/*Payload of a publish, its bytes derived from its number*/
+static std::string makePayload( uint32_t k, size_t len ) {
+    std::string p( len, '\0' );
+    for( size_t i = 0; i < len; ++i ) {
+        p[i] = (char)( k * 31 + i );
+    }
+    return p;
+}
+
+static int publish( struct sim* s, uint32_t k, size_t len, uint8_t qos ) {
+    std::string const topic = "bridge/" + std::to_string( k % 5 );
+    std::string const payload = makePayload( k, len );
+    int const id = mqttc_publish( &s->c, topic.c_str(), payload.data(), payload.size(), qos );
+    if( 0 <= id ) {
+        s->expected.push_back( { topic, payload, qos, (uint16_t)id } );
+    }
+    return id;
+}
+
+/*A loop of ctrl_task: poll the client, the broker reads what was sent*/
+static void tick( struct sim* s, uint32_t ms ) {
+    s->now += ms;
+    s->room = s->chunk;
+    mqttc_poll( &s->c, s->now );
+    size_t const from = s->rx.size();
+    brokerParse( s );
+    brokerDeliver( s, from );
+}
+
+/*Every publish was received and acknowledged, the queue is empty*/
+static bool drained( struct sim const* s ) {
+    return s->ok && s->delivered == s->expected.size() && s->unacked.empty() && 0 == s->c.records
+        && 0 == s->c.stats.queued && 0 == s->c.stats.inflight;
+}
+
+static bool report( char const* name, bool ok ) {
+    printf( "%-36s %s\n", name, ok ? "ok" : "FAILED" );
+    return ok;
+}
+
+static std::vector<uint8_t> bytes( char const* str, size_t len ) {
+    return std::vector<uint8_t>( (uint8_t const*)str, (uint8_t const*)str + len );
+}
+
+static bool framing( void ) {
+    static struct sim s;
+    simInit( &s, 2, 0 );
+
+    /*CONNECT with the user name and password, clean session and a keepalive of 5 s*/
+    struct mqttc_config const cfg = { "bridge-01", "user", "pass", 5, 2 };
+    mqttc_configure( &s.c, &cfg );
+    mqttc_connected( &s.c, s.now );
+    brokerParse( &s );
+    char const connect1[] = "\x10\x21\0\x04MQTT\x04\xc2\0\x05\0\x09" "bridge-01\0\x04user\0\x04pass";
+    bool ok = 1 == s.rx.size() && bytes( connect1, sizeof(connect1) - 1 ) == s.rx[0].raw && 1 == s.flushes;
+
+    /*CONNACK a byte at a time*/
+    answer( &s, { CONNACK << 4, 2, 0, 0 }, 1 );
+    ok = ok && MQTTC_CONNECTED == s.c.state;
+
+    /*QoS 0, QoS 1 with a two byte remaining length, and the 127 and 128 lengths*/
+    mqttc_publish( &s.c, "a/b", "xyz", 3, 0 );
+    std::string const p200 = makePayload( 1, 200 );
+    ok = ok && 1 == mqttc_publish( &s.c, "a/b", p200.data(), p200.size(), 1 );
+    std::string const p122 = makePayload( 2, 122 ), p123 = makePayload( 3, 123 );
+    mqttc_publish( &s.c, "a/b", p122.data(), p122.size(), 0 );
+    mqttc_publish( &s.c, "a/b", p123.data(), p123.size(), 0 );
+    mqttc_poll( &s.c, s.now );
+    brokerParse( &s );
+    char const pub0[] = "\x30\x08\0\x03" "a/bxyz";
+    char const pub1[] = "\x32\xcf\x01\0\x03" "a/b\0\x01";
+    ok = ok && 5 == s.rx.size() && bytes( pub0, sizeof(pub0) - 1 ) == s.rx[1].raw
+         && bytes( pub1, sizeof(pub1) - 1 ) == std::vector<uint8_t>( s.rx[2].raw.begin(), s.rx[2].raw.begin() + 10 )
+         && 210 == s.rx[2].raw.size() && p200 == s.rx[2].payload
+         && 0x7f == s.rx[3].raw[1] && 0x80 == s.rx[4].raw[1] && 0x01 == s.rx[4].raw[2] && p123 == s.rx[4].payload;
+
+    /*PUBACK split in two reads, then an unknown packet is skipped*/
+    answer( &s, { PUBACK << 4, 2, 0, 1, 0x90, 3, 0, 1, 0 }, 3 );
+    ok = ok && 1 == s.c.stats.acked && 1 == s.acked.size() && 1 == s.acked[0] && 0 == s.c.records;
+
+    /*PINGREQ after 5 s without writing, PINGRESP, then no PINGRESP closes*/
+    s.now += 5000;
+    mqttc_poll( &s.c, s.now );
+    brokerParse( &s );
+    ok = ok && 6 == s.rx.size() && bytes( "\xc0\0", 2 ) == s.rx[5].raw && s.c.pingPending;
+    answer( &s, { PINGRESP << 4, 0 }, 1 );
+    ok = ok && !s.c.pingPending;
+    s.now += 5000;
+    mqttc_poll( &s.c, s.now );
+    s.now += 4999;
+    mqttc_poll( &s.c, s.now );
+    ok = ok && MQTTC_CONNECTED == s.c.state && 0 == s.closes;
+    s.now += 1;
+    mqttc_poll( &s.c, s.now );
+    ok = ok && MQTTC_DISCONNECTED == s.c.state && 1 == s.closes && 1 == s.c.stats.timeouts;
+
+    /*Without a user name the password is not sent*/
+    struct mqttc_config const anon = { "bridge-01", "", "pass", 0, 1 };
+    mqttc_configure( &s.c, &anon );
+    s.rx.clear();
+    s.wire.clear();
+    mqttc_connected( &s.c, s.now );
+    brokerParse( &s );
+    char const connect2[] = "\x10\x15\0\x04MQTT\x04\x02\0\0\0\x09" "bridge-01";
+    ok = ok && 1 == s.rx.size() && bytes( connect2, sizeof(connect2) - 1 ) == s.rx[0].raw;
+
+    /*Refused by the broker, and no CONNACK*/
+    answer( &s, { CONNACK << 4, 2, 0, 5 }, 4 );
+    ok = ok && MQTTC_DISCONNECTED == s.c.state && 1 == s.c.stats.refused && 2 == s.closes;
+    mqttc_connected( &s.c, s.now );
+    s.now += MQTTC_CONNACK_TIMEOUT - 1;
+    mqttc_poll( &s.c, s.now );
+    ok = ok && MQTTC_CONNECTING == s.c.state;
+    s.now += 1;
+    mqttc_poll( &s.c, s.now );
+    ok = ok && MQTTC_DISCONNECTED == s.c.state && 2 == s.c.stats.timeouts && 3 == s.closes;
+    return report( "framing and keepalive", ok );
+}
+
+/*40 QoS 1 publishes, the broker acknowledges one per loop. The window must be full
+while publishes wait, and never exceeded.*/
+static bool window( uint8_t configured, uint8_t limit ) {
+    static struct sim s;
+    simInit( &s, configured, 0 );
+    connect( &s );
+    for( uint32_t k = 0; k < 40; ++k ) {
+        publish( &s, k, 50, 1 );
+    }
+    for( int i = 0; i < 100 && s.delivered < s.expected.size(); ++i ) {
+        tick( &s, 20 );
+        size_t const waiting = s.expected.size() - s.delivered;
+        if( s.unacked.size() != limit && 0 != waiting ) {
+            fail( &s, "window not full while publishes wait" );
+        }
+        if( limit < s.unacked.size() || limit < s.c.stats.inflight ) {
+            fail( &s, "window exceeded" );
+        }
+        puback( &s );
+    }
+    while( !s.unacked.empty() ) {
+        puback( &s );
+    }
+    bool ok = drained( &s ) && 40 == s.c.stats.acked && 40 == s.acked.size();
+    for( size_t i = 0; ok && i < s.acked.size(); ++i ) {
+        ok = s.expected[i].id == s.acked[i];
+    }
+    char name[64];
+    snprintf( name, sizeof(name), "window of %u, configured %u", limit, configured );
+    return report( name, ok );
+}
+
+/*Two large publishes, the first acknowledged, a third only fits at the start of the
+queue: a padding record fills the end and the records are sent in order*/
+static bool padding( void ) {
+    static struct sim s;
+    simInit( &s, 4, 0 );
+    publish( &s, 0, 3000, 1 );
+    publish( &s, 1, 3000, 1 );
+    connect( &s );
+    tick( &s, 20 );
+    puback( &s );
+    size_t const tail = s.c.tail;
+    size_t const head = s.c.head;
+    bool ok = 0 < tail && MQTTC_QUEUE_SIZE - head < 2500 + 32;
+    ok = ok && 0 <= publish( &s, 2, 2500, 1 ) && s.c.head < s.c.tail;
+    /*A small one still fits between head and tail, a large one does not*/
+    ok = ok && 0 <= publish( &s, 3, 100, 0 ) && s.c.head < s.c.tail;
+    ok = ok && 0 > publish( &s, 4, 2500, 0 ) && 1 == s.c.stats.rejected;
+    tick( &s, 20 );
+    while( !s.unacked.empty() ) {
+        puback( &s );
+    }
+    ok = ok && drained( &s ) && 0 == s.c.head && 0 == s.c.tail;
+
+    /*An empty queue takes a publish as large as the queue allows*/
+    ok = ok && 0 <= publish( &s, 5, MQTTC_QUEUE_SIZE - 40, 1 ) && 0 > publish( &s, 6, 1, 0 );
+    tick( &s, 20 );
+    puback( &s );
+    ok = ok && drained( &s ) && 0 > publish( &s, 7, MQTTC_QUEUE_SIZE, 0 );
+    return report( "queue wrap with padding", ok );
+}
+
+/*Publishes of varied sizes and QoS while the transport takes 700 bytes per loop and the
+broker acknowledges late: the queue wraps at every offset, fills and empties*/
+static bool wrapAround( void ) {
+    static struct sim s;
+    simInit( &s, 8, 700 );
+    connect( &s );
+    uint32_t seed = 12345, k = 0, wraps = 0, rejected = 0;
+    for( int i = 0; i < 20000; ++i ) {
+        for( int n = 0; n < 3; ++n ) {
+            seed = seed * 1103515245 + 12345;
+            size_t const len = ( seed >> 8 ) % 1500;
+            size_t const head = s.c.head;
+            uint32_t const records = s.c.records;
+            if( publish( &s, k++, len, seed >> 30 & 1 ) < 0 ) {
+                ++rejected;
+            }
+            else if( records && s.c.head < head ) {
+                ++wraps;
+            }
+        }
+        tick( &s, 20 );
+        /*The last 4 are acknowledged late, all of them every 50 loops*/
+        while( 4 < s.unacked.size() || ( 0 == i % 50 && !s.unacked.empty() ) ) {
+            puback( &s );
+        }
+        if( MQTTC_QUEUE_SIZE < s.c.stats.queued ) {
+            fail( &s, "queue over its size" );
+        }
+    }
+    for( int i = 0; i < 1000 && !drained( &s ); ++i ) {
+        tick( &s, 20 );
+        while( !s.unacked.empty() ) {
+            puback( &s );
+        }
+    }
+    bool const ok = drained( &s ) && 100 < wraps && 0 < rejected && rejected == s.c.stats.rejected;
+    printf( "  %u publishes, %zu queued, %u rejected, %u wraps of the queue\n", k, s.expected.size(), rejected, wraps );
+    return report( "queue wrap, partial writes", ok );
+}
+
+/*The connection drops with QoS 1 publishes in flight and one written in part*/
+static bool reconnect( void ) {
+    static struct sim s;
+    simInit( &s, 4, 0 );
+    connect( &s );
+    uint8_t const qos[] = { 1, 0, 1, 1, 0, 1, 1, 1 };
+    for( uint32_t k = 0; k < sizeof(qos); ++k ) {
+        publish( &s, k, 100, qos[k] );
+    }
+    tick( &s, 20 );
+    /*Ids 1 to 4 in flight, 1 and 2 acknowledged, 5 written and 6 written in part*/
+    bool ok = 6 == s.delivered && 4 == s.unacked.size();
+    puback( &s );
+    puback( &s );
+    s.chunk = 150;
+    tick( &s, 20 );
+    ok = ok && 7 == s.delivered && 3 == s.unacked.size() && !s.wire.empty();
+
+    /*The bytes of the packet written in part are lost with the connection. A publish
+    queued while disconnected waits for the next one.*/
+    mqttc_disconnected( &s.c );
+    s.wire.clear();
+    s.chunk = 0;
+    ok = ok && 3 == s.c.stats.resent && 0 == s.c.stats.inflight;
+    publish( &s, 8, 100, 1 );
+    tick( &s, 20 );
+    ok = ok && 7 == s.delivered && 0 == s.dups;
+    connect( &s );
+    tick( &s, 20 );
+    /*3 to 5 again with DUP, 6 from its start, 7 waits for the window*/
+    ok = ok && 3 == s.dups && 8 == s.delivered;
+    for( int i = 0; i < 10 && !s.unacked.empty(); ++i ) {
+        puback( &s );
+        tick( &s, 20 );
+    }
+    ok = ok && drained( &s ) && 3 == s.dups && 7 == s.c.stats.acked;
+
+    /*QoS 0 publishes written before the drop are not sent again*/
+    simInit( &s, 1, 0 );
+    connect( &s );
+    publish( &s, 0, 10, 0 );
+    publish( &s, 1, 10, 1 );
+    tick( &s, 20 );
+    mqttc_disconnected( &s.c );
+    connect( &s );
+    tick( &s, 20 );
+    puback( &s );
+    ok = ok && drained( &s ) && 1 == s.dups && 1 == s.c.stats.resent;
+    return report( "reconnection and DUP", ok );
+}
+
+int main( int argc, char* argv[] ) {
+    verbose = 2 <= argc && 0 == strcmp( argv[1], "-v" );
+    int failed = 0;
+    failed += !framing( );
+    failed += !window( 1, 1 );
+    failed += !window( 4, 4 );
+    failed += !window( 0, 1 );
+    failed += !window( 200, MQTTC_MAX_WINDOW );
+    failed += !padding( );
+    failed += !wrapAround( );
+    failed += !reconnect( );
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,304 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+
+    Host check of the MQTT payload encodings. Each document of ctrl_task and of the
+    test/example.json v1 layout is written as JSON and as CBOR. The CBOR is decoded back
+    to JSON text, which must be equal to the JSON encoding, and the size and encode time
+    of both encodings are compared.
+
+    Build:
+        g++ -O2 -I../src payload-bench.cpp ../src/payload-codec.cpp -o payload-bench
+    Usage:
+        payload-bench [-v]   -v prints the documents. Returns 1 if a round trip fails.
+*/
+
+#include "payload-codec.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+enum {
+    BUF_SIZE = 4096,
+    LOOPS    = 100000,
+    BATCH    = 10
+};
+
+/*Measurements of the two sensors of a board, as read by ctrl_task*/
+struct sample {
+    char const* id;
+    double value;
+    char const* unit;
+    bool ok;
+};
+
+static struct sample const samples[] = {
+    { "ch4",      1234.5678, "ppm", true },
+    { "temp_air", 23.456,    "ºC",  true },
+    { "hum_air",  45.6,      "%",   false }
+};
+
+static uint64_t const timestamp = 1657824699590ull;
+
+/*Same schema as json_frame() of ctrl_task*/
+static void measurement( struct payload* doc ) {
+    payload_objOpen( doc, NULL );
+    payload_uint( doc, "timestamp", timestamp );
+    for( auto const& s : samples ) {
+        payload_objOpen( doc, s.id );
+        payload_double( doc, "value", s.value );
+        payload_objOpen( doc, "context" );
+        payload_str( doc, "unit", s.unit );
+        payload_str( doc, "status", s.ok ? "ok" : "fail" );
+        payload_objClose( doc );
+        payload_objClose( doc );
+    }
+    payload_objClose( doc );
+}
+
+static void status( struct payload* doc ) {
+    payload_objOpen( doc, NULL );
+    payload_uint( doc, "timestamp", timestamp );
+    payload_double( doc, "batt", 3.7 );
+    payload_objClose( doc );
+}
+
+static void info( struct payload* doc ) {
+    payload_objOpen( doc, NULL );
+    payload_uint( doc, "timestamp", timestamp );
+    payload_objOpen( doc, "location" );
+    payload_double( doc, "lat", 36.72826292956254 );
+    payload_double( doc, "lng", -4.398295360622022 );
+    payload_objClose( doc );
+    payload_objClose( doc );
+}
+
+static void batch( struct payload* doc ) {
+    payload_arrOpen( doc, NULL );
+    for( int i = 0; i < BATCH; ++i ) {
+        measurement( doc );
+    }
+    payload_arrClose( doc );
+}
+
+/*Measures topic of the v1 layout, with numbers for the raw and calibrated values*/
+static void v1measures( struct payload* doc ) {
+    payload_objOpen( doc, NULL );
+    payload_str( doc, "ts", "2022-07-14T18:51:39.590605310Z" );
+    payload_objOpen( doc, "identifiers" );
+    payload_str( doc, "device_id", "name-of-device" );
+    payload_str( doc, "application_id", "farm" );
+    payload_str( doc, "dev_uuid", "0062FB17B8CEB5F7" );
+    payload_objClose( doc );
+    payload_objOpen( doc, "rx_info" );
+    payload_str( doc, "ssid", "wifi-name" );
+    payload_double( doc, "rssi", -60 );
+    payload_objClose( doc );
+    payload_objOpen( doc, "measures" );
+    payload_objOpen( doc, "nh3" );
+    payload_double( doc, "raw", 4.021 );
+    payload_double( doc, "value", 0.13125 );
+    payload_str( doc, "unit", "ppm" );
+    payload_objClose( doc );
+    payload_objOpen( doc, "co" );
+    payload_double( doc, "raw", 12.5 );
+    payload_double( doc, "value", 531.25 );
+    payload_str( doc, "unit", "ppb" );
+    payload_objClose( doc );
+    payload_objClose( doc );
+    payload_objClose( doc );
+}
+
+/*Decoder of the CBOR subset written by payload-codec, to JSON text in the same form
+as the JSON encoding*/
+struct reader {
+    uint8_t const* p;
+    uint8_t const* end;
+    bool error;
+};
+
+static uint64_t readBE( struct reader* r, int bytes ) {
+    uint64_t val = 0;
+    for( int i = 0; i < bytes; ++i ) {
+        if( r->end <= r->p ) {
+            r->error = true;
+            return 0;
+        }
+        val = val << 8 | *r->p++;
+    }
+    return val;
+}
+
+static void jsonText( std::string* out, std::string const& text ) {
+    *out += '"';
+    for( char c : text ) {
+        if( '"' == c || '\\' == c ) {
+            *out += '\\';
+            *out += c;
+        }
+        else if( (uint8_t)c < ' ' ) {
+            char esc[8];
+            snprintf( esc, sizeof(esc), "\\u%04x", (unsigned)c );
+            *out += esc;
+        }
+        else {
+            *out += c;
+        }
+    }
+    *out += '"';
+}
+
+static void number( std::string* out, double val ) {
+    char txt[32];
+    snprintf( txt, sizeof(txt), "%g", val );
+    *out += txt;
+}
+
+/*Decode one item, return false on a break code*/
+static bool item( struct reader* r, std::string* out ) {
+    if( r->error || r->end <= r->p ) {
+        r->error = true;
+        return true;
+    }
+    uint8_t const ib = *r->p++;
+    if( 0xff == ib ) {
+        return false;
+    }
+    uint8_t const major = ib >> 5;
+    uint8_t const info = ib & 31;
+    if( 7 == major ) {
+        if( 0xfa == ib ) {
+            uint32_t const bits = readBE( r, 4 );
+            float f;
+            memcpy( &f, &bits, sizeof(f) );
+            number( out, f );
+        }
+        else if( 0xfb == ib ) {
+            uint64_t const bits = readBE( r, 8 );
+            double d;
+            memcpy( &d, &bits, sizeof(d) );
+            number( out, d );
+        }
+        else {
+            r->error = true;
+        }
+        return true;
+    }
+
+    bool const indefinite = 31 == info;
+    uint64_t arg = info;
+    if( 24 <= info && info <= 27 ) {
+        arg = readBE( r, 1 << ( info - 24 ) );
+    }
+    else if( 24 <= info && !indefinite ) {
+        r->error = true;
+        return true;
+    }
+
+    char txt[32];
+    switch( major ) {
+        case 0:
+            snprintf( txt, sizeof(txt), "%llu", (unsigned long long)arg );
+            *out += txt;
+            break;
+        case 1:
+            snprintf( txt, sizeof(txt), "%lld", -1 - (long long)arg );
+            *out += txt;
+            break;
+        case 3:
+            if( (uint64_t)( r->end - r->p ) < arg ) {
+                r->error = true;
+                break;
+            }
+            jsonText( out, std::string( (char const*)r->p, arg ) );
+            r->p += arg;
+            break;
+        case 4:
+        case 5: {
+            bool const map = 5 == major;
+            *out += map ? '{' : '[';
+            for( uint64_t i = 0; !r->error && ( indefinite || i < arg ); ++i ) {
+                std::string key;
+                if( !item( r, &key ) ) {
+                    break;
+                }
+                *out += i ? "," : "";
+                *out += key;
+                if( map ) {
+                    *out += ':';
+                    if( !item( r, out ) ) {
+                        r->error = true;
+                    }
+                }
+            }
+            *out += map ? '}' : ']';
+            break;
+        }
+        default:
+            r->error = true;
+            break;
+    }
+    return true;
+}
+
+static bool cborToJson( uint8_t const* src, size_t len, std::string* out ) {
+    struct reader r = { src, src + len, false };
+    bool const ok = item( &r, out );
+    return ok && !r.error && r.p == r.end;
+}
+
+static size_t encode( void (*build)( struct payload* ), uint8_t encoding, uint8_t* buf ) {
+    struct payload doc;
+    payload_init( &doc, encoding, buf, BUF_SIZE );
+    build( &doc );
+    return payload_finish( &doc );
+}
+
+static double encodeTime( void (*build)( struct payload* ), uint8_t encoding, uint8_t* buf ) {
+    auto const start = std::chrono::steady_clock::now();
+    size_t sum = 0;
+    for( int i = 0; i < LOOPS; ++i ) {
+        sum += encode( build, encoding, buf );
+        /*Keep the compiler from dropping the loop*/
+        buf[0] ^= sum & 1;
+    }
+    auto const end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>( end - start ).count() / LOOPS;
+}
+
+int main( int argc, char* argv[] ) {
+    bool const verbose = 2 <= argc && 0 == strcmp( argv[1], "-v" );
+    struct {
+        char const* name;
+        void (*build)( struct payload* );
+    } const docs[] = {
+        { "measures",            measurement },
+        { "status",              status },
+        { "info",                info },
+        { "measures, batch of 10", batch },
+        { "v1 measures",         v1measures }
+    };
+
+    static uint8_t json[BUF_SIZE];
+    static uint8_t cbor[BUF_SIZE];
+    int failed = 0;
+    printf( "%-24s %10s %10s %6s %10s %10s\n", "document", "json B", "cbor B", "ratio", "json ns", "cbor ns" );
+    for( auto const& d : docs ) {
+        size_t const jlen = encode( d.build, PAYLOAD_JSON, json );
+        size_t const clen = encode( d.build, PAYLOAD_CBOR, cbor );
+        std::string decoded;
+        bool const ok = jlen && clen && cborToJson( cbor, clen, &decoded ) && decoded == (char const*)json;
+        if( !ok || verbose ) {
+            printf( "%s\n  json: %s\n  cbor: %s\n", d.name, (char const*)json, decoded.c_str() );
+        }
+        double const jns = encodeTime( d.build, PAYLOAD_JSON, json );
+        double const cns = encodeTime( d.build, PAYLOAD_CBOR, cbor );
+        printf( "%-24s %10zu %10zu %5.0f%% %10.0f %10.0f %s\n", d.name, jlen, clen,
+                jlen ? 100.0 * clen / jlen : 0.0, jns, cns, ok ? "" : "ROUND TRIP FAILED" );
+        failed += !ok;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,419 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+
+    Host replay of the radar UART recordings made with /captureStart, /captureStop
+    and /capture.bin. The recorded bytes are decoded by the same parser and frame
+    code as the firmware, in the reads made by the radar task. The ld2410 driver,
+    which the firmware only uses to configure the radar, is replayed through a
+    Stream for comparison.
+
+    Build (the ld2410 driver is the one fetched by PlatformIO):
+        LD2410=../.pio/libdeps/esp32dev/ld2410/src
+        g++ -O2 -Ihost -I../src -I$LD2410 radar-replay.cpp ../src/radar-parser.cpp ../src/radar-capture.cpp \
+            ../src/frame-codec.cpp ../src/presence.cpp $LD2410/ld2410.cpp -o radar-replay
+    Usage:
+        radar-replay <capture> [--realtime] [--library]
+                                              print the frames as csv lines, as sent by the firmware.
+                                              The bytes are played back as fast as possible, or
+                                              at the recorded pace with --realtime. With --library
+                                              they are decoded by the ld2410 driver.
+        radar-replay --check <capture> <csv>  compare the frames with the lines of a previous run,
+                                              exits with 1 on any difference.
+        radar-replay --bench <capture> [n]    replay n times and report frames/s and ns/frame of
+                                              the driver and of the parser, with the frames
+                                              filled and encoded as csv.
+        radar-replay --synth <capture> [n]    write a recording of n random engineering frames,
+                                              split in chunks as the UART delivers them.
+*/
+
+#include "radar-capture.h"
+#include "radar-parser.h"
+#include <ld2410.h>
+#include "frame-codec.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+/*Time seen by the driver, the capture time of the bytes being played back*/
+static uint64_t clockus;
+static bool realtime;
+static std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+unsigned long micros( void ) {
+    if( realtime ) {
+        return std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - epoch ).count();
+    }
+    return clockus;
+}
+
+unsigned long millis( void ) {
+    return micros() / 1000;
+}
+
+void delay( unsigned long ms ) {
+    if( realtime ) {
+        std::this_thread::sleep_for( std::chrono::milliseconds( ms ) );
+    }
+    else {
+        clockus += (uint64_t)ms * 1000;
+    }
+}
+
+/*Stream that delivers the chunks of a recording once their capture time is reached*/
+class replay_stream : public Stream {
+    public:
+        replay_stream( uint8_t const* src, size_t len ) : src( src ), len( len ) {
+            pos = capture_parseHeader( src, len, &sensor, &start );
+        }
+
+        /*Move to the next chunk, waiting for its time. Return false at the end of the recording.*/
+        bool next( void ) {
+            uint32_t dt;
+            size_t const rlen = pos ? capture_parseChunk( src + pos, len - pos, &dt, &data, &left ) : 0;
+            if( 0 == rlen ) {
+                left = 0;
+                return false;
+            }
+            pos += rlen;
+            if( realtime ) {
+                std::this_thread::sleep_until( epoch + std::chrono::microseconds( dt ) );
+            }
+            else if( clockus < dt ) {
+                clockus = dt;
+            }
+            chunktime = start + dt;
+            return true;
+        }
+
+        int available( ) override { return left; }
+        int peek( ) override { return left ? *data : -1; }
+        int read( ) override {
+            if( 0 == left ) {
+                return -1;
+            }
+            --left;
+            return *data++;
+        }
+        /*Copy the rest of the chunk at once, as a read of the UART driver*/
+        size_t readChunk( uint8_t* dest ) {
+            size_t const n = left;
+            memcpy( dest, data, n );
+            data += n;
+            left = 0;
+            return n;
+        }
+
+        /*Commands sent to the radar are discarded*/
+        size_t write( uint8_t ) override { return 1; }
+
+        uint8_t sensor = 0;
+        uint64_t start = 0;
+        uint64_t chunktime = 0;  /*Capture time of the chunk being read*/
+        size_t pos;
+
+    private:
+        uint8_t const* src;
+        size_t len;
+        uint8_t const* data = NULL;
+        uint16_t left = 0;
+};
+
+static uint8_t* readFile( char const* name, size_t* len ) {
+    FILE* f = fopen( name, "rb" );
+    if( NULL == f ) {
+        perror( name );
+        return NULL;
+    }
+    fseek( f, 0, SEEK_END );
+    *len = ftell( f );
+    fseek( f, 0, SEEK_SET );
+    uint8_t* buf = (uint8_t*)malloc( *len );
+    if( buf && *len != fread( buf, 1, *len, f ) ) {
+        free( buf );
+        buf = NULL;
+    }
+    fclose( f );
+    return buf;
+}
+
+/*Copy the last report of the driver, as the radar task did before it had its own parser*/
+static void libraryFill( ld2410& radar, struct dataframe* data ) {
+    data->detectionDistance        = radar.detectionDistance();
+    data->stationaryTargetDistance = radar.stationaryTargetDistance();
+    data->stationaryTargetEnergy   = radar.stationaryTargetEnergy();
+    data->movingTargetDistance     = radar.movingTargetDistance();
+    data->movingTargetEnergy       = radar.movingTargetEnergy();
+    data->engRataingData           = radar.engRetainDataValue();
+    for( int x = 0; x < LD2410_MAX_GATES; ++x ) {
+        data->engMovingDistanceGateEnergy[x] = radar.engMovingDistanceGateEnergy(x);
+        data->engStaticDistanceGateEnergy[x] = radar.engStaticDistanceGateEnergy(x);
+    }
+}
+
+enum decoder {
+    DECODE_PARSER,   /*As the firmware does*/
+    DECODE_LIBRARY
+};
+
+/*Decode a recording chunk by chunk, as drainRadar does with the UART reads. Each report
+is filled in a frame and passed to the handler if notify is set.*/
+template<typename handler>
+static int replay( uint8_t const* src, size_t len, enum decoder dec, bool notify, handler onframe ) {
+    replay_stream stream( src, len );
+    if( 0 == stream.pos ) {
+        fprintf( stderr, "not a radar capture\n" );
+        return -1;
+    }
+    ld2410 radar;
+    struct radarparser parser;
+    if( DECODE_LIBRARY == dec ) {
+        radar.begin( stream, false );
+    }
+    radarparser_init( &parser );
+
+    int frames = 0;
+    struct dataframe data;
+    memset( &data, 0, sizeof(data) );
+    data.sensor = stream.sensor;
+    while( stream.next() ) {
+        if( DECODE_LIBRARY == dec ) {
+            for( int avail = stream.available(); avail--; ) {
+                if( radar.ld2410_loop() ) {
+                    data.timestamp = stream.chunktime;
+                    data.seq = frames++;
+                    libraryFill( radar, &data );
+                    if( notify ) {
+                        onframe( &data );
+                    }
+                }
+            }
+            continue;
+        }
+
+        uint8_t buf[CAPTURE_MAX_CHUNK];
+        size_t const n = stream.readChunk( buf );
+        for( size_t pos = 0; pos < n; ) {
+            bool decoded;
+            pos += radarparser_parse( &parser, buf + pos, n - pos, &data, &decoded );
+            if( decoded ) {
+                data.timestamp = stream.chunktime;
+                data.seq = frames++;
+                if( notify ) {
+                    onframe( &data );
+                }
+            }
+        }
+    }
+    if( DECODE_PARSER == dec && ( parser.stats.badLength || parser.stats.badFooter || parser.stats.badPayload ) ) {
+        fprintf( stderr, "parser: %u bad length, %u bad footer, %u bad payload, %u bytes skipped\n",
+                 parser.stats.badLength, parser.stats.badFooter, parser.stats.badPayload, parser.stats.skipped );
+    }
+    return frames;
+}
+
+static int print( char const* name, enum decoder dec ) {
+    size_t len;
+    uint8_t* buf = readFile( name, &len );
+    if( NULL == buf ) {
+        return 1;
+    }
+    int const frames = replay( buf, len, dec, true, []( struct dataframe const* data ) {
+        char csv[FRAME_CSV_MAX];
+        frame_toCsv( data, 0, csv, sizeof(csv) );
+        printf( "%s\n", csv );
+        fflush( stdout );
+    } );
+    free( buf );
+    return frames < 0;
+}
+
+static int check( char const* name, char const* expected ) {
+    size_t len;
+    uint8_t* buf = readFile( name, &len );
+    FILE* f = fopen( expected, "r" );
+    if( NULL == buf || NULL == f ) {
+        if( NULL == f ) {
+            perror( expected );
+        }
+        free( buf );
+        return 1;
+    }
+
+    int line = 0, errors = 0;
+    int const frames = replay( buf, len, DECODE_PARSER, true, [&]( struct dataframe const* data ) {
+        char csv[FRAME_CSV_MAX];
+        char ref[FRAME_CSV_MAX + 2];
+        frame_toCsv( data, 0, csv, sizeof(csv) );
+        ++line;
+        if( NULL == fgets( ref, sizeof(ref), f ) ) {
+            ref[0] = '\0';
+        }
+        ref[strcspn( ref, "\r\n" )] = '\0';
+        if( strcmp( csv, ref ) ) {
+            if( ++errors <= 10 ) {
+                fprintf( stderr, "line %d:\n  expected %s\n  decoded  %s\n", line, ref, csv );
+            }
+        }
+    } );
+    char extra[8];
+    bool const longer = NULL != fgets( extra, sizeof(extra), f );
+    fclose( f );
+    free( buf );
+    if( frames < 0 ) {
+        return 1;
+    }
+    if( longer ) {
+        fprintf( stderr, "expected more than %d frames\n", frames );
+        ++errors;
+    }
+    printf( "%d frames, %d errors\n", frames, errors );
+    return 0 != errors;
+}
+
+static int bench( char const* name, int n ) {
+    size_t len;
+    uint8_t* buf = readFile( name, &len );
+    if( NULL == buf ) {
+        return 1;
+    }
+
+    struct { char const* name; enum decoder dec; } const decoders[] = {
+        { "ld2410 driver", DECODE_LIBRARY },
+        { "radar-parser",  DECODE_PARSER }
+    };
+
+    /*Decoding and filling the frame, then also the csv encoding done for every frame*/
+    int frames = 0;
+    printf( "%-16s %16s %16s %16s\n", "decoder", "decode+fill ns", "+csv ns/frame", "+csv frames/s" );
+    for( auto const& d : decoders ) {
+        double ns[2] = { 0, 0 };
+        for( int pass = 0; pass < 2; ++pass ) {
+            size_t bytes = 0;
+            auto const start = std::chrono::steady_clock::now();
+            for( int i = 0; i < n; ++i ) {
+                clockus = 0;
+                frames = replay( buf, len, d.dec, 1 == pass, [&]( struct dataframe const* data ) {
+                    char csv[FRAME_CSV_MAX];
+                    bytes += frame_toCsv( data, 0, csv, sizeof(csv) );
+                } );
+                if( frames <= 0 ) {
+                    fprintf( stderr, "no frames in the capture\n" );
+                    free( buf );
+                    return 1;
+                }
+            }
+            auto const end = std::chrono::steady_clock::now();
+            ns[pass] = std::chrono::duration<double, std::nano>( end - start ).count() / ( (double)frames * n );
+            __asm__ volatile( "" : : "r"( bytes ) : "memory" );
+        }
+        printf( "%-16s %16.1f %16.1f %16.0f\n", d.name, ns[0], ns[1], 1e9 / ns[1] );
+    }
+    free( buf );
+    printf( "%d frames, %zu bytes per replay\n", frames, len );
+    return 0;
+}
+
+static uint8_t* put16( uint8_t* dest, uint16_t val ) {
+    dest[0] = val;
+    dest[1] = val >> 8;
+    return dest + 2;
+}
+
+/*Engineering mode report of the LD2410 with random energies*/
+static size_t synthFrame( uint8_t* dest ) {
+    static uint8_t const head[] = { 0xf4, 0xf3, 0xf2, 0xf1 };
+    static uint8_t const tail[] = { 0xf8, 0xf7, 0xf6, 0xf5 };
+    enum { DATA_LEN = 11 + 2 + 2 * LD2410_MAX_GATES + 2 + 2 };
+    uint8_t* pos = dest;
+    memcpy( pos, head, sizeof(head) );
+    pos = put16( pos + sizeof(head), DATA_LEN );
+    *pos++ = 0x01;                          /*Engineering mode*/
+    *pos++ = 0xaa;
+    *pos++ = rand() % 4;                    /*Target state*/
+    pos = put16( pos, rand() % 600 );       /*Moving target distance*/
+    *pos++ = rand() % 101;
+    pos = put16( pos, rand() % 600 );       /*Stationary target distance*/
+    *pos++ = rand() % 101;
+    pos = put16( pos, rand() % 600 );       /*Detection distance*/
+    *pos++ = LD2410_MAX_GATES - 1;
+    *pos++ = LD2410_MAX_GATES - 1;
+    for( int i = 0; i < 2 * LD2410_MAX_GATES; ++i ) {
+        *pos++ = rand() % 101;
+    }
+    *pos++ = rand() % 256;                  /*Retain data*/
+    *pos++ = rand() % 2;
+    *pos++ = 0x55;
+    *pos++ = 0x00;
+    memcpy( pos, tail, sizeof(tail) );
+    return pos + sizeof(tail) - dest;
+}
+
+static int synth( char const* name, int n ) {
+    enum { PERIOD_US = 100000 };  /*Engineering reports come at about 10 Hz*/
+    size_t const cap = CAPTURE_HEADER + (size_t)n * 2 * ( CAPTURE_CHUNK + 64 );
+    uint8_t* buf = (uint8_t*)malloc( cap );
+    if( NULL == buf ) {
+        return 1;
+    }
+    struct capture rec;
+    capture_init( &rec, buf, cap, 0, 0 );
+    for( int i = 0; i < n; ++i ) {
+        uint8_t frame[64];
+        size_t const flen = synthFrame( frame );
+        /*The UART receive timeout may split a report in two reads*/
+        size_t const split = rand() % 4 ? flen : 1 + rand() % ( flen - 1 );
+        uint64_t const t = (uint64_t)i * PERIOD_US;
+        capture_chunk( &rec, t );
+        for( size_t j = 0; j < flen; ++j ) {
+            if( j == split ) {
+                capture_chunk( &rec, t + 1000 );
+            }
+            capture_put( &rec, frame[j] );
+        }
+    }
+    size_t const len = capture_finish( &rec );
+
+    FILE* f = fopen( name, "wb" );
+    bool const ok = f && len == fwrite( buf, 1, len, f );
+    if( f ) {
+        fclose( f );
+    }
+    free( buf );
+    if( !ok ) {
+        perror( name );
+        return 1;
+    }
+    printf( "%d frames, %zu bytes\n", n, len );
+    return 0;
+}
+
+int main( int argc, char* argv[] ) {
+    if( 3 <= argc && 0 == strcmp( argv[1], "--bench" ) ) {
+        return bench( argv[2], 4 <= argc ? atoi( argv[3] ) : 100 );
+    }
+
+    if( 4 <= argc && 0 == strcmp( argv[1], "--check" ) ) {
+        return check( argv[2], argv[3] );
+    }
+
+    if( 3 <= argc && 0 == strcmp( argv[1], "--synth" ) ) {
+        return synth( argv[2], 4 <= argc ? atoi( argv[3] ) : 1000 );
+    }
+
+    if( 2 <= argc && '-' != argv[1][0] ) {
+        enum decoder dec = DECODE_PARSER;
+        for( int i = 2; i < argc; ++i ) {
+            realtime |= 0 == strcmp( argv[i], "--realtime" );
+            dec = 0 == strcmp( argv[i], "--library" ) ? DECODE_LIBRARY : dec;
+        }
+        return print( argv[1], dec );
+    }
+
+    fprintf( stderr, "usage: %s <capture> [--realtime] [--library] | --check <capture> <csv> | --bench <capture> [n] | --synth <capture> [n]\n", argv[0] );
+    return 1;
+}
@@ -0,0 +1,251 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+
+    Host check of the spool of udp_task, on segment files in a temporary directory. The
+    records are numbered, and each case drains the spool as drainSpool() does, until it is
+    empty. The records read must be whole, in order, and every record stored must be read,
+    evicted or counted as an error. The cases are:
+        - records left by the previous run, and a segment read in part before a restart,
+        - eviction of the oldest segments over the limit,
+        - reading while the records are written,
+        - a failed open of a new segment, as with SPIFFS full,
+        - short writes that leave a partial record, in the oldest segment and in a newer one.
+    The failures are injected by wrapping fopen() and fwrite().
+
+    Build:
+        g++ -O2 -I../src spool-check.cpp ../src/spool.cpp -Wl,--wrap=fopen,--wrap=fwrite -o spool-check
+    Usage:
+        spool-check   Returns 1 if a check fails.
+*/
+
+#include "spool.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*Failures injected in the next segment writes*/
+static int failOpens = 0;       /*Appends that fail to open*/
+static size_t shortWrite = 0;   /*Bytes written by the next fwrite, 0 for all*/
+
+extern "C" FILE* __real_fopen( char const* path, char const* mode );
+extern "C" size_t __real_fwrite( void const* ptr, size_t size, size_t n, FILE* f );
+
+extern "C" FILE* __wrap_fopen( char const* path, char const* mode ) {
+    if( 'a' == mode[0] && failOpens ) {
+        --failOpens;
+        errno = ENOSPC;
+        return NULL;
+    }
+    return __real_fopen( path, mode );
+}
+
+extern "C" size_t __wrap_fwrite( void const* ptr, size_t size, size_t n, FILE* f ) {
+    if( shortWrite ) {
+        size_t const part = shortWrite < size * n ? shortWrite : size * n;
+        shortWrite = 0;
+        errno = ENOSPC;
+        return __real_fwrite( ptr, 1, part, f );
+    }
+    return __real_fwrite( ptr, size, n, f );
+}
+
+/*The path of a segment must fit SPOOL_PATH*/
+static char root[] = "/tmp/spool-XXXXXX";
+
+/*Record k starts with its number, its size and content derived from it*/
+static size_t makeRecord( uint32_t k, uint8_t* dest ) {
+    size_t const len = 8 + ( k * 37 ) % 300;
+    memcpy( dest, &k, sizeof(k) );
+    for( size_t i = sizeof(k); i < len; ++i ) {
+        dest[i] = (uint8_t)( k * 7 + i );
+    }
+    return len;
+}
+
+/*The spool of a case, and the records read from it*/
+struct sim {
+    struct spool sp;
+    std::string dir;
+    uint32_t opened;    /*Records found by spool_open()*/
+    uint32_t next;      /*Number of the next record to store*/
+    int64_t last;       /*Number of the last record read*/
+    uint32_t read;
+    uint32_t skipped;   /*Records jumped over between two records read*/
+    uint32_t reread;    /*Records read again after a restart*/
+    bool ok;
+};
+
+static void simOpen( struct sim* s, char const* name, uint32_t limit ) {
+    s->dir = std::string( root ) + "/" + name;
+    mkdir( s->dir.c_str(), 0700 );
+    s->next = 0;
+    s->last = -1;
+    s->read = s->skipped = s->reread = 0;
+    s->ok = spool_open( &s->sp, s->dir.c_str(), limit );
+    s->opened = s->sp.stats.records;
+}
+
+static void put( struct sim* s, uint32_t count, uint32_t now ) {
+    for( uint32_t i = 0; i < count; ++i ) {
+        uint8_t rec[SPOOL_MAX_RECORD];
+        size_t const len = makeRecord( s->next++, rec );
+        spool_put( &s->sp, rec, len, now );
+    }
+}
+
+/*drainSpool() of udp_task, up to max records*/
+static void drain( struct sim* s, uint32_t max ) {
+    for( uint32_t i = 0; i < max && !spool_empty( &s->sp ); ++i ) {
+        uint8_t rec[SPOOL_MAX_RECORD];
+        uint8_t expected[SPOOL_MAX_RECORD];
+        size_t const len = spool_peek( &s->sp, rec, sizeof(rec) );
+        if( 0 == len ) {
+            printf( "no record while %u are waiting, ", s->sp.stats.records );
+            s->ok = false;
+            return;
+        }
+        uint32_t k;
+        memcpy( &k, rec, sizeof(k) );
+        if( k >= s->next || len != makeRecord( k, expected ) || 0 != memcmp( rec, expected, len ) ) {
+            printf( "record %u is not whole, ", k );
+            s->ok = false;
+            return;
+        }
+        if( (int64_t)k <= s->last ) {
+            s->reread += (uint32_t)( s->last - k + 1 );
+        }
+        else {
+            s->skipped += (uint32_t)( k - s->last - 1 );
+        }
+        s->last = k;
+        ++s->read;
+        spool_pop( &s->sp );
+    }
+}
+
+static int segmentFiles( struct sim const* s ) {
+    int files = 0;
+    DIR* d = opendir( s->dir.c_str() );
+    for( struct dirent* e; d && NULL != ( e = readdir( d ) ); ) {
+        files += 0 == strncmp( e->d_name, "spool-", 6 );
+    }
+    if( d ) {
+        closedir( d );
+    }
+    return files;
+}
+
+/*Drain what is left and check that every record is accounted for*/
+static bool finish( struct sim* s, char const* name ) {
+    drain( s, UINT32_MAX );
+    struct spool_stats const* st = &s->sp.stats;
+    bool const ok = s->ok && spool_empty( &s->sp ) && 0 == st->bytes && 0 == s->sp.size && 0 == segmentFiles( s )
+                 && s->opened + st->spooled == st->drained + st->evicted + st->errors + st->records
+                 && s->skipped == st->evicted + st->errors;
+    printf( "%-24s %6u %8u %8u %8u %8u %8u %s\n", name, st->spooled, st->drained, st->evicted, st->errors,
+            s->reread, st->writes, ok ? "ok" : "FAILED" );
+    return ok;
+}
+
+/*Records left by the previous run, one segment read in part before the restart*/
+static bool restart( void ) {
+    static struct sim s;
+    simOpen( &s, "restart", 256 * 1024 );
+    put( &s, 1000, 0 );
+    spool_flush( &s.sp );
+    drain( &s, 300 );
+
+    /*The new run finds the records not read yet and those of the segment read in part,
+    its counters start again*/
+    uint32_t const waiting = s.sp.stats.records;
+    int64_t const last = s.last;
+    bool ok = spool_open( &s.sp, s.dir.c_str(), 256 * 1024 ) && waiting < s.sp.stats.records;
+    s.opened = s.sp.stats.records;
+    drain( &s, 1 );
+    ok = ok && s.last <= last && 0 < s.reread;
+    s.ok = s.ok && ok;
+    return finish( &s, "restart" );
+}
+
+static bool eviction( void ) {
+    static struct sim s;
+    simOpen( &s, "evict", 2 * SPOOL_SEGMENT );
+    for( int i = 0; i < 20; ++i ) {
+        put( &s, 100, 0 );
+        spool_flush( &s.sp );
+        s.ok = s.ok && s.sp.size <= 2 * SPOOL_SEGMENT;
+    }
+    s.ok = s.ok && 0 < s.sp.stats.evicted;
+    return finish( &s, "eviction" );
+}
+
+/*Records sent while others are stored, the RAM buffer is written by spool_sync()*/
+static bool readWhileWriting( void ) {
+    static struct sim s;
+    simOpen( &s, "rw", 64 * 1024 );
+    for( uint32_t now = 0; now < 2000 * 1000; now += 1000 ) {
+        put( &s, 9, now );
+        spool_sync( &s.sp, now );
+        drain( &s, 0 == now % 7000 ? 60 : 2 );
+    }
+    return finish( &s, "read while writing" );
+}
+
+/*SPIFFS full: the open of the next segment fails, the records of that batch are lost*/
+static bool failedOpen( void ) {
+    static struct sim s;
+    simOpen( &s, "open", 128 * 1024 );
+    put( &s, 10, 0 );
+    failOpens = 1;
+    spool_flush( &s.sp );
+    put( &s, 400, 0 );
+    spool_flush( &s.sp );
+    s.ok = s.ok && 10 == s.sp.stats.errors && 0 < s.sp.stats.records;
+    return finish( &s, "failed open" );
+}
+
+/*A write that stops in the middle of a record, in the segment read and in a newer one*/
+static bool shortWrites( void ) {
+    static struct sim s;
+    simOpen( &s, "short", 256 * 1024 );
+    put( &s, 30, 0 );
+    shortWrite = 1000;
+    spool_flush( &s.sp );
+    put( &s, 300, 0 );
+    spool_flush( &s.sp );
+    drain( &s, 5 );
+    put( &s, 30, 0 );
+    shortWrite = 777;
+    spool_flush( &s.sp );
+    put( &s, 100, 0 );
+    spool_flush( &s.sp );
+    s.ok = s.ok && 0 < s.sp.stats.errors && s.sp.stats.errors < 60;
+    return finish( &s, "short writes" );
+}
+
+int main( void ) {
+    if( NULL == mkdtemp( root ) ) {
+        perror( "mkdtemp" );
+        return 1;
+    }
+    printf( "%-24s %6s %8s %8s %8s %8s %8s\n", "case", "stored", "drained", "evicted", "errors", "reread", "writes" );
+    int failed = 0;
+    failed += !restart( );
+    failed += !eviction( );
+    failed += !readWhileWriting( );
+    failed += !failedOpen( );
+    failed += !shortWrites( );
+    std::string const cmd = std::string( "rm -rf " ) + root;
+    if( 0 != system( cmd.c_str() ) ) {
+        printf( "%s not removed\n", root );
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,146 @@
+/*
+    Project: <https://github.com/AngelJMC/4-20ma-wifi-bridge>
+    Copyright (c) 2022 Angel Maldonado <angelgesus@gmail.com>.
+    Licensed under the MIT License: <http://opensource.org/licenses/MIT>.
+    SPDX-License-Identifier: MIT
+
+    Host simulation of the WiFi state machine of ctrl_task against a simulated
+    WiFi station, stepped every 20 ms as the control task does.
+
+    Build:
+        g++ -O2 -I../src wifi-sim.cpp ../src/wifi-fsm.cpp -o wifi-sim
+    Usage:
+        wifi-sim [-v]   run all the scenarios, -v prints the transitions.
+                        Returns 1 if a scenario fails.
+*/
+
+#include "wifi-fsm.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+enum {
+    TICK_MS = 20,    /*Period of the control task loop*/
+    NEVER   = -1
+};
+
+/*Simulated station. It connects connectAfter ms after begin(), the link drops
+at dropAt and comes back by itself at backAt, times in ms.*/
+static struct station {
+    long connectAfter;
+    long dropAt;
+    long backAt;
+    long begunAt;
+    long now;
+    /*Calls seen from the state machine*/
+    int begins;
+    int onlines;
+    int offlines;
+    int restarts;
+} sta;
+
+static bool staConnected( void ) {
+    if( NEVER != sta.dropAt && sta.dropAt <= sta.now && ( NEVER == sta.backAt || sta.now < sta.backAt ) ) {
+        return false;
+    }
+    return NEVER != sta.begunAt && NEVER != sta.connectAfter && sta.begunAt + sta.connectAfter <= sta.now;
+}
+
+static void staBegin( void )      { sta.begunAt = sta.now; ++sta.begins; }
+static void staOnline( void )     { ++sta.onlines; }
+static void staOffline( void )    { ++sta.offlines; }
+static void staLed( int )         { }
+static void staRestart( void )    { ++sta.restarts; }
+
+static struct wififsm_ops const ops = {
+    .isConnected = staConnected,
+    .begin       = staBegin,
+    .online      = staOnline,
+    .offline     = staOffline,
+    .led         = staLed,
+    .restart     = staRestart
+};
+
+struct scenario {
+    char const* name;
+    long connectAfter;
+    long dropAt;
+    long backAt;
+    long configuredAt;   /*Time the WiFi configuration is entered*/
+    long updateAt;       /*Time the configuration is changed from the web page*/
+    long duration;
+    /*Expected state at the end and calls*/
+    uint8_t state;
+    int begins;
+    int onlines;
+    int offlines;
+};
+
+static bool verbose = false;
+static double worstStep = 0;
+
+static bool run( struct scenario const* sc ) {
+    memset( &sta, 0, sizeof(sta) );
+    sta.connectAfter = sc->connectAfter;
+    sta.dropAt = sc->dropAt;
+    sta.backAt = sc->backAt;
+    sta.begunAt = NEVER;
+
+    struct wififsm fsm;
+    wififsm_init( &fsm, 0 );
+    wififsm_connect( &fsm, 0 );
+    for( sta.now = 0; sta.now <= sc->duration; sta.now += TICK_MS ) {
+        struct wififsm_input const in = {
+            .configured = sc->configuredAt <= sta.now,
+            .updated    = sc->updateAt == sta.now,
+            .configmode = false
+        };
+        uint8_t const before = fsm.state;
+        auto const start = std::chrono::steady_clock::now();
+        wififsm_step( &fsm, &ops, &in, sta.now );
+        auto const end = std::chrono::steady_clock::now();
+        double const us = std::chrono::duration<double, std::micro>( end - start ).count();
+        worstStep = us > worstStep ? us : worstStep;
+        if( verbose && before != fsm.state ) {
+            printf( "  %8ld ms  %s -> %s\n", sta.now, wififsm_stateName( before ), wififsm_stateName( fsm.state ) );
+        }
+    }
+
+    bool const ok = sc->state == fsm.state && sc->begins == sta.begins && sc->onlines == sta.onlines
+                 && sc->offlines == sta.offlines && 0 == sta.restarts;
+    printf( "%-40s %s  state %s, begin %d, online %d, offline %d\n", sc->name, ok ? "ok  " : "FAIL",
+            wififsm_stateName( fsm.state ), sta.begins, sta.onlines, sta.offlines );
+    return ok;
+}
+
+int main( int argc, char* argv[] ) {
+    verbose = 2 <= argc && 0 == strcmp( argv[1], "-v" );
+
+    /*Retries: a failed connection waits WIFIFSM_CONNECT_TIMEOUT and then WIFIFSM_RETRY_DELAY*/
+    long const cycle = WIFIFSM_CONNECT_TIMEOUT + WIFIFSM_RETRY_DELAY;
+    struct scenario const scenarios[] = {
+        { "connects in 3 s",                      3000, NEVER, NEVER, 0, NEVER, 60000,
+          WIFIFSM_CONNECTED, 1, 1, 0 },
+        { "never connects",                       NEVER, NEVER, NEVER, 0, NEVER, 2 * cycle + 10000,
+          WIFIFSM_CONNECTING, 3, 0, 0 },
+        { "drops and reconnects by itself",       1000, 20000, 22000, 0, NEVER, 60000,
+          WIFIFSM_CONNECTED, 1, 1, 0 },
+        { "drops for good",                       1000, 20000, NEVER, 0, NEVER, 20000 + WIFIFSM_CONNECT_TIMEOUT + 1000,
+          WIFIFSM_RETRY, 1, 1, 1 },
+        { "drops and is back after a new begin",  1000, 20000, 70000, 0, NEVER, 80000,
+          WIFIFSM_CONNECTED, 2, 2, 1 },
+        { "no configuration for 25 s",            1000, NEVER, NEVER, 25000, NEVER, 40000,
+          WIFIFSM_CONNECTED, 1, 1, 0 },
+        { "configuration changed while waiting",  NEVER, NEVER, NEVER, 0, 10000, 20000,
+          WIFIFSM_CONNECTING, 2, 0, 0 },
+        { "configuration changed while connected", 1000, NEVER, NEVER, 0, 10000, 20000,
+          WIFIFSM_CONNECTED, 2, 2, 0 }
+    };
+
+    int failed = 0;
+    for( auto const& sc : scenarios ) {
+        failed += !run( &sc );
+    }
+    printf( "longest step %.2f us, the control task sleeps %d ms between steps\n", worstStep, TICK_MS );
+    return failed ? 1 : 0;
+}